@@ -0,0 +1,197 @@
+#include "capturedialog.h"
+#include "micontbuspacket.h"
+
+#include <QLabel>
+#include <QLineEdit>
+#include <QSpinBox>
+#include <QComboBox>
+#include <QPushButton>
+#include <QProgressBar>
+#include <QTableView>
+#include <QHeaderView>
+#include <QGridLayout>
+#include <QElapsedTimer>
+#include <QRegExpValidator>
+
+// records indexed per event loop pass, keeps the dialog responsive
+static const int CAPTURE_DIALOG_BATCH = 100000;
+
+CaptureDialog::CaptureDialog(const QString &fileName, QWidget *parent)
+    : QDialog(parent)
+    , fileName(fileName)
+    , model(&index)
+    , comboType(new QComboBox())
+    , spinId(new QSpinBox())
+    , comboCmd(new QComboBox())
+    , comboResult(new QComboBox())
+    , lineAddrFrom(new QLineEdit())
+    , lineAddrTo(new QLineEdit())
+    , comboTime(new QComboBox())
+    , pushSearch(new QPushButton(tr("Search")))
+    , pushAll(new QPushButton(tr("Show All")))
+    , pushReload(new QPushButton(tr("Reload")))
+    , tableRecords(new QTableView())
+    , progressIndex(new QProgressBar())
+    , labelStatus(new QLabel())
+{
+    comboType->addItem(tr("any"), -1);
+    comboType->addItem(tr("request"), MicontBusCaptureRecord::Request);
+    comboType->addItem(tr("response"), MicontBusCaptureRecord::Response);
+    comboType->addItem(tr("garbage"), MicontBusCaptureRecord::Garbage);
+
+    // -1 shows as "any"
+    spinId->setRange(-1, 255);
+    spinId->setValue(-1);
+    spinId->setSpecialValueText(tr("any"));
+
+    comboCmd->addItem(tr("any"), -1);
+    foreach (int cmd, QList<int>() << MicontBusPacket::CMD_GETSIZE << MicontBusPacket::CMD_GETBUF_B
+                                   << MicontBusPacket::CMD_PUTBUF_B)
+        comboCmd->addItem(MicontBusCaptureModel::cmdName(cmd), cmd);
+
+    comboResult->addItem(tr("any"), -1);
+    for (int result = MicontBusPacket::CMD_RESULT_OK; result <= MicontBusPacket::CMD_RESULT_ERRDONE; result += 0x10)
+        comboResult->addItem(MicontBusCaptureModel::resultName(result), result);
+
+    QRegExp rx("(0x[0-9a-fA-F]{1,4})?");
+    lineAddrFrom->setValidator(new QRegExpValidator(rx, this));
+    lineAddrFrom->setPlaceholderText(tr("from"));
+    lineAddrTo->setValidator(new QRegExpValidator(rx, this));
+    lineAddrTo->setPlaceholderText(tr("to"));
+
+    // seconds before the end of the capture, 0 for all
+    comboTime->addItem(tr("all"), 0);
+    comboTime->addItem(tr("last minute"), 60);
+    comboTime->addItem(tr("last 10 minutes"), 600);
+    comboTime->addItem(tr("last hour"), 3600);
+    comboTime->addItem(tr("last day"), 86400);
+
+    // fixed row heights keep the view from measuring rows it doesn't show
+    tableRecords->setModel(&model);
+    tableRecords->setSelectionBehavior(QAbstractItemView::SelectRows);
+    tableRecords->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    tableRecords->verticalHeader()->setVisible(false);
+    tableRecords->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    tableRecords->horizontalHeader()->setStretchLastSection(true);
+    tableRecords->setAlternatingRowColors(true);
+
+    QGridLayout *grid = new QGridLayout;
+    grid->addWidget(new QLabel(tr("Type:")), 0, 0);
+    grid->addWidget(comboType, 0, 1);
+    grid->addWidget(new QLabel(tr("Id:")), 0, 2);
+    grid->addWidget(spinId, 0, 3);
+    grid->addWidget(new QLabel(tr("Cmd:")), 0, 4);
+    grid->addWidget(comboCmd, 0, 5);
+    grid->addWidget(new QLabel(tr("Result:")), 0, 6);
+    grid->addWidget(comboResult, 0, 7);
+    grid->addWidget(new QLabel(tr("Addr:")), 1, 0);
+    grid->addWidget(lineAddrFrom, 1, 1);
+    grid->addWidget(lineAddrTo, 1, 2, 1, 2);
+    grid->addWidget(new QLabel(tr("Time:")), 1, 4);
+    grid->addWidget(comboTime, 1, 5);
+    grid->addWidget(pushSearch, 1, 6);
+    grid->addWidget(pushAll, 1, 7);
+    grid->addWidget(tableRecords, 2, 0, 1, 9);
+    grid->addWidget(progressIndex, 3, 0, 1, 4);
+    grid->addWidget(labelStatus, 3, 4, 1, 4);
+    grid->addWidget(pushReload, 3, 8);
+    grid->setColumnStretch(8, 1);
+    setLayout(grid);
+
+    setWindowTitle(tr("Capture %1").arg(fileName));
+    resize(900, 600);
+
+    connect(pushSearch, SIGNAL(clicked()),
+            this, SLOT(search()));
+    connect(pushAll, SIGNAL(clicked()),
+            this, SLOT(showAll()));
+    connect(pushReload, SIGNAL(clicked()),
+            this, SLOT(reload()));
+    connect(&timerIndex, SIGNAL(timeout()),
+            this, SLOT(indexMore()));
+
+    if (!index.open(fileName)) {
+        labelStatus->setText(tr("Error (%1)").arg(index.errorString()));
+        pushSearch->setEnabled(false);
+        pushAll->setEnabled(false);
+        pushReload->setEnabled(false);
+        return;
+    }
+
+    progressIndex->setRange(0, 1000);
+    timerIndex.start(0);
+}
+
+// Indexes the file a batch at a time; searches work on what is done.
+void CaptureDialog::indexMore()
+{
+    index.update(CAPTURE_DIALOG_BATCH);
+    model.refresh();
+
+    qint64 size = qMax<qint64>(1, index.fileSize());
+    progressIndex->setValue(index.indexedSize() * 1000 / size);
+    labelStatus->setText(tr("Indexed %1 records").arg(index.count()));
+
+    if (index.atEnd()) {
+        timerIndex.stop();
+        progressIndex->setValue(1000);
+    }
+}
+
+void CaptureDialog::search()
+{
+    MicontBusCaptureFilter filter;
+    if (!filterFromControls(&filter))
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    QVector<int> records = index.search(filter);
+    qint64 us = timer.nsecsElapsed() / 1000;
+
+    model.setRecords(records);
+    labelStatus->setText(tr("%1 of %2 records, %3 ms").arg(records.size()).arg(index.count())
+                         .arg(us / 1000.0, 0, 'f', 1));
+}
+
+void CaptureDialog::showAll()
+{
+    model.showAll();
+    labelStatus->setText(tr("%1 records").arg(index.count()));
+}
+
+// Picks up what the sniffer wrote since.
+void CaptureDialog::reload()
+{
+    if (!timerIndex.isActive())
+        timerIndex.start(0);
+}
+
+bool CaptureDialog::filterFromControls(MicontBusCaptureFilter *filter)
+{
+    filter->type = comboType->currentData().toInt();
+    filter->id = spinId->value();
+    filter->cmd = comboCmd->currentData().toInt();
+    filter->result = comboResult->currentData().toInt();
+
+    bool ok = true;
+    if (!lineAddrFrom->text().isEmpty())
+        filter->addrFrom = lineAddrFrom->text().toInt(&ok, 0);
+    if (ok && !lineAddrTo->text().isEmpty())
+        filter->addrTo = lineAddrTo->text().toInt(&ok, 0);
+    if (!ok) {
+        labelStatus->setText(tr("Invalid address"));
+        return false;
+    }
+    // a single address if only one end is given
+    if (filter->addrFrom >= 0 && filter->addrTo < 0)
+        filter->addrTo = filter->addrFrom;
+    else if (filter->addrTo >= 0 && filter->addrFrom < 0)
+        filter->addrFrom = filter->addrTo;
+
+    int seconds = comboTime->currentData().toInt();
+    if (seconds > 0)
+        filter->timeFrom = qMax<qint64>(1, index.lastTimestamp() - (qint64)seconds * 1000000);
+
+    return true;
+}
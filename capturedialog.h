@@ -0,0 +1,55 @@
+#ifndef CAPTUREDIALOG_H
+#define CAPTUREDIALOG_H
+
+#include <QDialog>
+#include <QTimer>
+
+#include "micontbuscaptureindex.h"
+#include "micontbuscapturemodel.h"
+
+QT_BEGIN_NAMESPACE
+class QLabel;
+class QLineEdit;
+class QSpinBox;
+class QComboBox;
+class QPushButton;
+class QProgressBar;
+class QTableView;
+QT_END_NAMESPACE
+
+class CaptureDialog : public QDialog
+{
+    Q_OBJECT
+public:
+    CaptureDialog(const QString &fileName, QWidget *parent = 0);
+
+private slots:
+    void indexMore();
+    void search();
+    void showAll();
+    void reload();
+
+private:
+    bool filterFromControls(MicontBusCaptureFilter *filter);
+
+    QString fileName;
+    MicontBusCaptureIndex index;
+    MicontBusCaptureModel model;
+    QTimer timerIndex;
+
+    QComboBox *comboType;
+    QSpinBox *spinId;
+    QComboBox *comboCmd;
+    QComboBox *comboResult;
+    QLineEdit *lineAddrFrom;
+    QLineEdit *lineAddrTo;
+    QComboBox *comboTime;
+    QPushButton *pushSearch;
+    QPushButton *pushAll;
+    QPushButton *pushReload;
+    QTableView *tableRecords;
+    QProgressBar *progressIndex;
+    QLabel *labelStatus;
+};
+
+#endif // CAPTUREDIALOG_H
@@ -0,0 +1,40 @@
+#-------------------------------------------------
+#
+# MicontBUS protocol core: codec, CRC, framing, the transaction
+# scheduler and a POSIX port, standard library only
+#
+#-------------------------------------------------
+
+CONFIG   -= qt
+# the same standard as micontbus.pri, which compiles these sources too
+CONFIG   += staticlib c++2a
+
+TARGET = micontbuscore
+TEMPLATE = lib
+
+SOURCES += \
+    micontbuscodec.cpp \
+    micontbusframepool.cpp \
+    micontbushealth.cpp \
+    micontbuslatencyhistogram.cpp \
+    micontbuslinestats.cpp \
+    micontbusretrypolicy.cpp \
+    micontbusrttestimator.cpp \
+    micontbusscheduler.cpp
+
+HEADERS  += \
+    micontbuscanceltoken.h \
+    micontbuscodec.h \
+    micontbusframepool.h \
+    micontbushealth.h \
+    micontbuslatencyhistogram.h \
+    micontbuslinestats.h \
+    micontbusport.h \
+    micontbusretrypolicy.h \
+    micontbusrttestimator.h \
+    micontbusscheduler.h
+
+unix {
+    SOURCES += micontbusposixport.cpp
+    HEADERS += micontbusposixport.h
+}
@@ -0,0 +1,31 @@
+#ifndef MICONTBUSCANCELTOKEN_H
+#define MICONTBUSCANCELTOKEN_H
+
+#include <atomic>
+#include <memory>
+
+/* Shared cancellation flag for a group of requests, e.g. everything a
+ * view has queued. Copies share the flag; a default constructed token is
+ * empty and never cancelled. Cancelling is a single atomic store and may
+ * be done from any thread. */
+class MicontBusCancelToken
+{
+public:
+    MicontBusCancelToken() {}
+
+    static MicontBusCancelToken create()
+    {
+        MicontBusCancelToken token;
+        token.d = std::make_shared<std::atomic<bool> >(false);
+        return token;
+    }
+
+    bool isNull() const { return !d; }
+    void cancel() { if (d) d->store(true, std::memory_order_relaxed); }
+    bool isCancelled() const { return d && d->load(std::memory_order_relaxed); }
+
+private:
+    std::shared_ptr<std::atomic<bool> > d;
+};
+
+#endif // MICONTBUSCANCELTOKEN_H
@@ -0,0 +1,67 @@
+#ifndef MICONTBUSCODEC_H
+#define MICONTBUSCODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/* MicontBUS frame layout, standard library only. A frame is
+ *
+ *     id, cmd, addr (2), [size (2)], [data], CRC (2)
+ *
+ * all little endian; size is there for GETBUF_B and PUTBUF_B, data for
+ * PUTBUF_B requests and OK responses to GETBUF_B and GETSIZE. The codec
+ * works on frames without CRC, like MicontBusPacket. */
+struct MicontBusMessage
+{
+    MicontBusMessage() : id(0), cmd(0), addr(0), size(0) {}
+
+    uint8_t id;
+    uint8_t cmd;
+    uint16_t addr;
+    uint16_t size;
+    std::vector<uint8_t> data;
+};
+
+class MicontBusCodec
+{
+public:
+    enum CmdCode {
+        CMD_GETSIZE =   0x01,
+        CMD_GETBUF_B =  0x02,
+        CMD_GETBUF =    0x03,
+        CMD_PUTBUF_B =  0x04,
+        CMD_PUTBUF =    0x05
+    };
+
+    enum ResultCode {
+        CMD_RESULT_OK =         0x10,
+        CMD_RESULT_WAIT =       0x20,
+        CMD_RESULT_BUSY =       0x30,
+        CMD_RESULT_UCMD =       0x40,
+        CMD_RESULT_ERRVAR =     0x50,
+        CMD_RESULT_ERRCMD =     0x60,
+        CMD_RESULT_ERRARG =     0x70,
+        CMD_RESULT_ERRBSIZE =   0x80,
+        CMD_RESULT_ERRBADDR =   0x90,
+        CMD_RESULT_ERRPWD =     0xa0,
+        CMD_RESULT_ERRLFT =     0xb0,
+        CMD_RESULT_ERRDONE =    0xc0
+    };
+
+    static uint16_t crc16(const void *data, size_t size);
+    static void appendCrc(std::vector<uint8_t> &frame);
+    static bool checkCrc(const void *frame, size_t size);
+
+    static std::vector<uint8_t> encode(const MicontBusMessage &message);
+    static bool decode(const void *frame, size_t size, MicontBusMessage *message);
+
+    static int expectedResponseSize(const void *request, size_t size);
+    static int requestSize(const void *header, size_t size);
+    static int responseSize(const void *header, size_t size);
+
+    static bool hasData(uint8_t cmd);
+};
+
+#endif // MICONTBUSCODEC_H
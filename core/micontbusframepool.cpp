@@ -0,0 +1,119 @@
+#include "micontbusframepool.h"
+
+#include <algorithm>
+
+#include <string.h>
+
+void MicontBusFrame::append(const char *data, int size)
+{
+    assert(d->size + size <= d->capacity);
+    memcpy(d->data + d->size, data, size);
+    d->size += size;
+}
+
+MicontBusFramePool::MicontBusFramePool(int count, int capacity)
+    : m_count(count), m_capacity(capacity), m_head(0), m_available(count), m_overflows(0)
+{
+    m_storage = new char[(size_t)count * capacity];
+    m_frames = new MicontBusFrameData[count];
+    m_next = new std::atomic<uint32_t>[count];
+
+    // touch everything now rather than on the first transactions
+    memset(m_storage, 0, (size_t)count * capacity);
+
+    for (int i = 0; i < count; i++) {
+        MicontBusFrameData &f = m_frames[i];
+        f.ref.store(0, std::memory_order_relaxed);
+        f.pool = this;
+        f.index = i;
+        f.capacity = capacity;
+        f.size = 0;
+        f.data = m_storage + (size_t)i * capacity;
+        m_next[i].store(i + 1 < count ? i + 2 : 0, std::memory_order_relaxed);
+    }
+    m_head.store(count > 0 ? 1 : 0, std::memory_order_release);
+}
+
+MicontBusFramePool::~MicontBusFramePool()
+{
+    delete[] m_next;
+    delete[] m_frames;
+    delete[] m_storage;
+}
+
+// Returns an empty frame of at least capacity bytes (the pool capacity if
+// 0). Never fails, see overflows().
+MicontBusFrame MicontBusFramePool::acquire(int capacity)
+{
+    if (capacity <= m_capacity) {
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        for (;;) {
+            uint32_t index = head & 0xffffffff;
+            if (index == 0)
+                break;
+
+            // the counter makes a concurrent pop and push of the same
+            // frame fail the exchange
+            uint64_t next = ((head >> 32) + 1) << 32 | m_next[index - 1].load(std::memory_order_relaxed);
+            if (m_head.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire)) {
+                MicontBusFrameData *f = &m_frames[index - 1];
+                m_available.fetch_sub(1, std::memory_order_relaxed);
+                f->ref.store(1, std::memory_order_relaxed);
+                f->size = 0;
+                return MicontBusFrame(f);
+            }
+        }
+    }
+
+    m_overflows.fetch_add(1, std::memory_order_relaxed);
+
+    MicontBusFrameData *f = new MicontBusFrameData;
+    f->ref.store(1, std::memory_order_relaxed);
+    f->pool = 0;
+    f->index = 0;
+    f->capacity = std::max(capacity, m_capacity);
+    f->size = 0;
+    f->data = new char[f->capacity];
+    return MicontBusFrame(f);
+}
+
+void MicontBusFramePool::release(MicontBusFrameData *frame)
+{
+    uint32_t index = frame->index + 1;
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    uint64_t next;
+
+    do {
+        m_next[frame->index].store(head & 0xffffffff, std::memory_order_relaxed);
+        next = ((head >> 32) + 1) << 32 | index;
+    } while (!m_head.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+
+    m_available.fetch_add(1, std::memory_order_relaxed);
+}
+
+int MicontBusFramePool::count() const
+{
+    return m_count;
+}
+
+int MicontBusFramePool::capacity() const
+{
+    return m_capacity;
+}
+
+int MicontBusFramePool::available() const
+{
+    return m_available.load(std::memory_order_relaxed);
+}
+
+uint32_t MicontBusFramePool::overflows() const
+{
+    return m_overflows.load(std::memory_order_relaxed);
+}
+
+// Pool shared by all masters and their consumers.
+MicontBusFramePool *MicontBusFramePool::global()
+{
+    static MicontBusFramePool pool(MICONTBUS_FRAME_POOL_COUNT);
+    return &pool;
+}
@@ -0,0 +1,130 @@
+#ifndef MICONTBUSFRAMEPOOL_H
+#define MICONTBUSFRAMEPOOL_H
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#ifdef QT_CORE_LIB
+#include <QByteArray>
+#include <QMetaType>
+#endif
+
+// header, size, 256 variables and CRC
+#define MICONTBUS_FRAME_CAPACITY    (6 + 256 * 4 + 2)
+// frames of the global pool, see MicontBusDecoder for what holds them
+#define MICONTBUS_FRAME_POOL_COUNT  256
+
+class MicontBusFramePool;
+
+struct MicontBusFrameData
+{
+    std::atomic<int> ref;
+    MicontBusFramePool *pool;   // 0 for heap frames that didn't fit the pool
+    uint32_t index;
+    int capacity;
+    int size;
+    char *data;
+};
+
+/* Reference to a pooled frame buffer. Copies share the buffer, the last
+ * one returns it to its pool. The bytes must not be modified once the
+ * frame has been handed to another thread. Built with Qt, frames convert
+ * to QByteArray and travel through queued signals. */
+class MicontBusFrame
+{
+public:
+    MicontBusFrame() : d(0) {}
+    MicontBusFrame(const MicontBusFrame &other) : d(other.d) { if (d) d->ref.fetch_add(1, std::memory_order_relaxed); }
+    ~MicontBusFrame() { release(); }
+
+    MicontBusFrame &operator=(const MicontBusFrame &other)
+    {
+        if (other.d)
+            other.d->ref.fetch_add(1, std::memory_order_relaxed);
+        release();
+        d = other.d;
+        return *this;
+    }
+
+    bool isNull() const { return d == 0; }
+    int size() const { return d ? d->size : 0; }
+    int capacity() const { return d ? d->capacity : 0; }
+    char *data() { return d->data; }
+    const char *constData() const { return d ? d->data : 0; }
+    const uint8_t *bytes() const { return reinterpret_cast<const uint8_t *>(constData()); }
+
+    void resize(int size) { assert(size <= d->capacity); d->size = size; }
+    void append(const char *data, int size);
+
+#ifdef QT_CORE_LIB
+    QByteArray toByteArray() const { return QByteArray(constData(), size()); }
+    // no copy, valid while this frame is referenced
+    QByteArray rawData() const { return QByteArray::fromRawData(constData(), size()); }
+#endif
+
+private:
+    friend class MicontBusFramePool;
+    explicit MicontBusFrame(MicontBusFrameData *data) : d(data) {}
+    void release();
+
+    MicontBusFrameData *d;
+};
+
+#ifdef QT_CORE_LIB
+Q_DECLARE_METATYPE(MicontBusFrame)
+#endif
+
+/* Fixed set of preallocated frame buffers shared by the bus threads and
+ * the consumers of their responses. Acquire and release go through a
+ * lock-free free list, so no allocation happens per transaction. When the
+ * pool is exhausted or a frame needs more than the pool capacity, the
+ * frame comes from the heap instead and is counted in overflows().
+ * Frames must not outlive their pool. */
+class MicontBusFramePool
+{
+public:
+    MicontBusFramePool(int count = 64, int capacity = MICONTBUS_FRAME_CAPACITY);
+    ~MicontBusFramePool();
+
+    MicontBusFrame acquire(int capacity = 0);
+
+    int count() const;
+    int capacity() const;
+    int available() const;
+    uint32_t overflows() const;
+
+    static MicontBusFramePool *global();
+
+private:
+    friend class MicontBusFrame;
+    void release(MicontBusFrameData *frame);
+
+    MicontBusFramePool(const MicontBusFramePool &) = delete;
+    MicontBusFramePool &operator=(const MicontBusFramePool &) = delete;
+
+    int m_count;
+    int m_capacity;
+    char *m_storage;
+    MicontBusFrameData *m_frames;
+    std::atomic<uint32_t> *m_next;
+    std::atomic<uint64_t> m_head;    // ABA counter << 32 | free frame index + 1
+    std::atomic<int> m_available;
+    std::atomic<uint32_t> m_overflows;
+};
+
+inline void MicontBusFrame::release()
+{
+    if (d && d->ref.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (d->pool) {
+            d->pool->release(d);
+        } else {
+            delete[] d->data;
+            delete d;
+        }
+    }
+    d = 0;
+}
+
+#endif // MICONTBUSFRAMEPOOL_H
@@ -0,0 +1,158 @@
+#include "micontbushealth.h"
+
+#include <algorithm>
+
+// weight of the newest frame in the CRC error rate
+static const double HEALTH_CRC_ALPHA = 0.125;
+
+MicontBusHealth::MicontBusHealth()
+    : m_maxTimeouts(3), m_maxCrcRate(0.5), m_probeInitial(100), m_probeMax(30000)
+{
+}
+
+int MicontBusHealth::maxTimeouts() const
+{
+    return m_maxTimeouts;
+}
+
+double MicontBusHealth::maxCrcRate() const
+{
+    return m_maxCrcRate;
+}
+
+void MicontBusHealth::setThresholds(int maxTimeouts, double maxCrcRate)
+{
+    m_maxTimeouts = maxTimeouts;
+    m_maxCrcRate = maxCrcRate;
+}
+
+void MicontBusHealth::setProbeBackoff(int64_t initial, int64_t max)
+{
+    m_probeInitial = std::max<int64_t>(1, initial);
+    m_probeMax = std::max(m_probeInitial, max);
+}
+
+bool MicontBusHealth::isDown(const std::string &portName, uint8_t id) const
+{
+    std::map<Key, Slave>::const_iterator it = m_slaves.find(Key(portName, id));
+    return it != m_slaves.end() && it->second.down;
+}
+
+int64_t MicontBusHealth::nextProbe(const std::string &portName, int64_t now, uint8_t *id) const
+{
+    int64_t wait = -1;
+
+    // the slaves of a port are adjacent in the map
+    std::map<Key, Slave>::const_iterator it = m_slaves.lower_bound(Key(portName, 0));
+    for (; it != m_slaves.end() && it->first.first == portName; ++it) {
+        if (!it->second.down)
+            continue;
+
+        int64_t delay = std::max<int64_t>(0, it->second.probeAt - now);
+        if (wait < 0 || delay < wait) {
+            wait = delay;
+            *id = it->first.second;
+        }
+    }
+
+    return wait;
+}
+
+void MicontBusHealth::probeSent(const std::string &portName, uint8_t id, int64_t now)
+{
+    std::map<Key, Slave>::iterator it = m_slaves.find(Key(portName, id));
+    if (it == m_slaves.end() || !it->second.down)
+        return;
+
+    it->second.probeAt = now + it->second.probeDelay;
+    it->second.probeDelay = std::min(it->second.probeDelay * 2, m_probeMax);
+}
+
+bool MicontBusHealth::addSuccess(const std::string &portName, uint8_t id)
+{
+    std::map<Key, Slave>::iterator it = m_slaves.find(Key(portName, id));
+    if (it == m_slaves.end())
+        return false;
+
+    Slave &slave = it->second;
+    bool changed = slave.down;
+    slave.down = false;
+    slave.timeouts = 0;
+    slave.crcRate *= 1.0 - HEALTH_CRC_ALPHA;
+    return changed;
+}
+
+bool MicontBusHealth::addTimeout(const std::string &portName, uint8_t id, int64_t now)
+{
+    Slave &slave = m_slaves[Key(portName, id)];
+
+    slave.timeouts++;
+    if (m_maxTimeouts > 0 && slave.timeouts >= m_maxTimeouts)
+        return trip(slave, now);
+    return false;
+}
+
+bool MicontBusHealth::addCrcError(const std::string &portName, uint8_t id, int64_t now)
+{
+    Slave &slave = m_slaves[Key(portName, id)];
+
+    // a corrupted frame still means something answered
+    slave.timeouts = 0;
+    slave.crcRate = slave.crcRate * (1.0 - HEALTH_CRC_ALPHA) + HEALTH_CRC_ALPHA;
+    if (m_maxCrcRate > 0 && slave.crcRate >= m_maxCrcRate)
+        return trip(slave, now);
+    return false;
+}
+
+int MicontBusHealth::consecutiveTimeouts(const std::string &portName, uint8_t id) const
+{
+    std::map<Key, Slave>::const_iterator it = m_slaves.find(Key(portName, id));
+    return it != m_slaves.end() ? it->second.timeouts : 0;
+}
+
+double MicontBusHealth::crcRate(const std::string &portName, uint8_t id) const
+{
+    std::map<Key, Slave>::const_iterator it = m_slaves.find(Key(portName, id));
+    return it != m_slaves.end() ? it->second.crcRate : 0;
+}
+
+void MicontBusHealth::clear()
+{
+    m_slaves.clear();
+}
+
+std::vector<MicontBusHealth::Key> MicontBusHealth::downSlaves() const
+{
+    std::vector<Key> keys;
+    for (std::map<Key, Slave>::const_iterator it = m_slaves.begin(); it != m_slaves.end(); ++it) {
+        if (it->second.down)
+            keys.push_back(it->first);
+    }
+    return keys;
+}
+
+// Marks a slave down that was down when a snapshot was taken, without
+// spending timeouts on it again. The first probe is due at once, so a
+// slave that came back meanwhile is up after one GETSIZE.
+void MicontBusHealth::restoreDown(const std::string &portName, uint8_t id, int64_t now)
+{
+    Slave &slave = m_slaves[Key(portName, id)];
+    if (slave.down)
+        return;
+
+    slave.down = true;
+    slave.timeouts = m_maxTimeouts;
+    slave.probeDelay = m_probeInitial;
+    slave.probeAt = now;
+}
+
+bool MicontBusHealth::trip(Slave &slave, int64_t now)
+{
+    if (slave.down)
+        return false;
+
+    slave.down = true;
+    slave.probeDelay = m_probeInitial;
+    slave.probeAt = now + slave.probeDelay;
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef MICONTBUSHEALTH_H
+#define MICONTBUSHEALTH_H
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Per (port, id) slave health with a circuit breaker: a slave that keeps
+ * timing out or returning corrupted frames is marked down, and only gets
+ * a CMD_GETSIZE probe with exponential backoff until it answers again.
+ * Times are in milliseconds on the caller's monotonic clock. */
+class MicontBusHealth
+{
+public:
+    MicontBusHealth();
+
+    int maxTimeouts() const;
+    double maxCrcRate() const;
+    void setThresholds(int maxTimeouts, double maxCrcRate);
+    void setProbeBackoff(int64_t initial, int64_t max);
+
+    bool isDown(const std::string &portName, uint8_t id) const;
+    int64_t nextProbe(const std::string &portName, int64_t now, uint8_t *id) const;
+    void probeSent(const std::string &portName, uint8_t id, int64_t now);
+
+    // return true when the slave changed state
+    bool addSuccess(const std::string &portName, uint8_t id);
+    bool addTimeout(const std::string &portName, uint8_t id, int64_t now);
+    bool addCrcError(const std::string &portName, uint8_t id, int64_t now);
+
+    int consecutiveTimeouts(const std::string &portName, uint8_t id) const;
+    double crcRate(const std::string &portName, uint8_t id) const;
+
+    void clear();
+
+    typedef std::pair<std::string, uint8_t> Key;
+    std::vector<Key> downSlaves() const;
+    void restoreDown(const std::string &portName, uint8_t id, int64_t now);
+
+private:
+
+    struct Slave {
+        Slave() : down(false), timeouts(0), crcRate(0), probeDelay(0), probeAt(0) {}
+        bool down;
+        int timeouts;
+        double crcRate;
+        int64_t probeDelay;
+        int64_t probeAt;
+    };
+
+    bool trip(Slave &slave, int64_t now);
+
+    std::map<Key, Slave> m_slaves;
+    int m_maxTimeouts;
+    double m_maxCrcRate;
+    int64_t m_probeInitial;
+    int64_t m_probeMax;
+};
+
+#endif // MICONTBUSHEALTH_H
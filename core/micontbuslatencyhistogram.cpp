@@ -0,0 +1,117 @@
+#include "micontbuslatencyhistogram.h"
+
+#include <algorithm>
+#include <sstream>
+
+MicontBusLatencyHistogram::MicontBusLatencyHistogram()
+{
+    clear();
+}
+
+MicontBusLatencyHistogram::MicontBusLatencyHistogram(const MicontBusLatencyHistogram &other)
+{
+    *this = other;
+}
+
+MicontBusLatencyHistogram &MicontBusLatencyHistogram::operator=(const MicontBusLatencyHistogram &other)
+{
+    for (int i = 0; i < BucketCount; i++)
+        m_buckets[i].store(other.m_buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_count.store(other.m_count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_sum.store(other.m_sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_max.store(other.m_max.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return *this;
+}
+
+// Plain loads and stores rather than read-modify-write, the writer is the
+// only one changing the counts.
+void MicontBusLatencyHistogram::add(int64_t us)
+{
+    if (us < 0)
+        us = 0;
+
+    int index = 0;
+    while (index < BucketCount - 1 && (us >> index) != 0)
+        index++;
+
+    m_buckets[index].store(m_buckets[index].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_count.store(m_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_sum.store(m_sum.load(std::memory_order_relaxed) + us, std::memory_order_relaxed);
+    if (us > m_max.load(std::memory_order_relaxed))
+        m_max.store(us, std::memory_order_relaxed);
+}
+
+void MicontBusLatencyHistogram::clear()
+{
+    for (int i = 0; i < BucketCount; i++)
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t MicontBusLatencyHistogram::count() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+uint32_t MicontBusLatencyHistogram::bucket(int index) const
+{
+    return m_buckets[index].load(std::memory_order_relaxed);
+}
+
+// Exclusive upper bound of a bucket, us.
+int64_t MicontBusLatencyHistogram::bucketLimit(int index)
+{
+    return (int64_t)1 << index;
+}
+
+int64_t MicontBusLatencyHistogram::max() const
+{
+    return m_max.load(std::memory_order_relaxed);
+}
+
+int64_t MicontBusLatencyHistogram::mean() const
+{
+    uint64_t count = this->count();
+    return count ? sum() / (int64_t)count : 0;
+}
+
+int64_t MicontBusLatencyHistogram::sum() const
+{
+    return m_sum.load(std::memory_order_relaxed);
+}
+
+// Upper bound of the bucket holding the p-th fraction (0..1) of samples.
+int64_t MicontBusLatencyHistogram::percentile(double p) const
+{
+    uint64_t count = this->count();
+    if (count == 0)
+        return 0;
+
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t)(p * count + 0.5));
+    uint64_t seen = 0;
+    for (int i = 0; i < BucketCount; i++) {
+        seen += bucket(i);
+        if (seen >= rank)
+            return std::min(bucketLimit(i), max());
+    }
+    return max();
+}
+
+std::string MicontBusLatencyHistogram::toString() const
+{
+    std::ostringstream s;
+    s << "n=" << count() << " mean=" << mean() << "us p50=" << percentile(0.5) << "us p99=" << percentile(0.99)
+      << "us max=" << max() << "us [";
+
+    const char *separator = "";
+    for (int i = 0; i < BucketCount; i++) {
+        if (bucket(i)) {
+            s << separator << "<" << bucketLimit(i) << "us:" << bucket(i);
+            separator = " ";
+        }
+    }
+    s << "]";
+    return s.str();
+}
@@ -0,0 +1,42 @@
+#ifndef MICONTBUSLATENCYHISTOGRAM_H
+#define MICONTBUSLATENCYHISTOGRAM_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+/* Power-of-two histogram of microsecond durations: bucket 0 counts values
+ * below 1 us, bucket n values in [2^(n-1), 2^n) us. There must be a single
+ * writer; copies may be taken from any thread without locking, counts of
+ * a copy taken during add() may be off by one. */
+class MicontBusLatencyHistogram
+{
+public:
+    enum { BucketCount = 32 };
+
+    MicontBusLatencyHistogram();
+    MicontBusLatencyHistogram(const MicontBusLatencyHistogram &other);
+    MicontBusLatencyHistogram &operator=(const MicontBusLatencyHistogram &other);
+
+    void add(int64_t us);
+    void clear();
+
+    uint64_t count() const;
+    uint32_t bucket(int index) const;
+    static int64_t bucketLimit(int index);
+    int64_t max() const;
+    int64_t mean() const;
+    int64_t sum() const;
+    int64_t percentile(double p) const;
+
+    std::string toString() const;
+
+private:
+    std::atomic<uint32_t> m_buckets[BucketCount];
+    std::atomic<uint64_t> m_count;
+    std::atomic<int64_t> m_sum;
+    std::atomic<int64_t> m_max;
+};
+
+#endif // MICONTBUSLATENCYHISTOGRAM_H
@@ -0,0 +1,87 @@
+#include "micontbuslinestats.h"
+
+#include <algorithm>
+
+#include <string.h>
+
+MicontBusLineStats::MicontBusLineStats()
+{
+    clear();
+}
+
+// now in ms, wire and duration in us. duration runs from the first byte
+// written to the last byte received.
+void MicontBusLineStats::addTransaction(int64_t now, int64_t wire, int64_t duration)
+{
+    Slot &s = slot(now);
+    s.wire += wire;
+    s.turnaround += std::max<int64_t>(0, duration - wire);
+    s.frames++;
+    s.answered++;
+}
+
+// wire is the request only, duration includes the whole response timeout.
+void MicontBusLineStats::addTimeout(int64_t now, int64_t wire, int64_t duration)
+{
+    Slot &s = slot(now);
+    s.wire += wire;
+    s.timeout += std::max<int64_t>(0, duration - wire);
+    s.frames++;
+}
+
+void MicontBusLineStats::clear()
+{
+    memset(m_slots, 0, sizeof(m_slots));
+    for (int i = 0; i < SlotCount; i++)
+        m_slots[i].second = -1;
+    m_first = -1;
+}
+
+// Report over the last seconds (at most SlotCount) up to now, ms.
+MicontBusLineReport MicontBusLineStats::report(int64_t now, int seconds) const
+{
+    MicontBusLineReport r;
+    if (m_first < 0)
+        return r;
+
+    seconds = std::min(std::max(1, seconds), (int)SlotCount);
+    int64_t current = now / 1000;
+
+    int64_t wire = 0, turnaround = 0, timeout = 0;
+    for (int i = 0; i < SlotCount; i++) {
+        const Slot &s = m_slots[i];
+        if (s.second < 0 || s.second > current || s.second <= current - seconds)
+            continue;
+        wire += s.wire;
+        turnaround += s.turnaround;
+        timeout += s.timeout;
+        r.frames += s.frames;
+        r.answered += s.answered;
+    }
+
+    // the window can't reach back past the first sample
+    r.window = std::min<int64_t>((int64_t)seconds * 1000, now - (current - seconds + 1) * 1000);
+    r.window = std::max<int64_t>(1, std::min(r.window, now - m_first + 1));
+
+    double window = r.window * 1000.0;
+    r.utilization = wire / window;
+    r.turnaround = turnaround / window;
+    r.timeouts = timeout / window;
+    r.idle = std::max(0.0, 1.0 - r.utilization - r.turnaround - r.timeouts);
+    r.meanTurnaround = r.answered ? turnaround / r.answered : 0;
+    return r;
+}
+
+MicontBusLineStats::Slot &MicontBusLineStats::slot(int64_t now)
+{
+    if (m_first < 0)
+        m_first = now;
+
+    int64_t second = now / 1000;
+    Slot &s = m_slots[second % SlotCount];
+    if (s.second != second) {
+        memset(&s, 0, sizeof(s));
+        s.second = second;
+    }
+    return s;
+}
@@ -0,0 +1,57 @@
+#ifndef MICONTBUSLINESTATS_H
+#define MICONTBUSLINESTATS_H
+
+#include <stdint.h>
+
+// Share of a window spent in each line state, fractions of window.
+struct MicontBusLineReport
+{
+    MicontBusLineReport()
+        : window(0), frames(0), answered(0), utilization(0), turnaround(0), timeouts(0), idle(0),
+          meanTurnaround(0) {}
+
+    int64_t window;          // ms covered
+    uint32_t frames;         // requests sent
+    uint32_t answered;
+    double utilization;     // characters on the wire, both directions
+    double turnaround;      // between request and response: slave, adapter and our own latency
+    double timeouts;        // waiting on slaves that didn't answer
+    double idle;            // nothing happening, including the master's gaps between frames
+    int64_t meanTurnaround;  // us per answered request
+};
+
+/* Sliding-window line accounting for one port. Each transaction is split
+ * into its theoretical wire time, from frame sizes, baud rate and
+ * character format, and the rest of its measured duration. Samples are
+ * kept in one second slots for the last minute, a transaction counts in
+ * the slot it ended in. */
+class MicontBusLineStats
+{
+public:
+    enum { SlotCount = 60 };
+
+    MicontBusLineStats();
+
+    void addTransaction(int64_t now, int64_t wire, int64_t duration);
+    void addTimeout(int64_t now, int64_t wire, int64_t duration);
+    void clear();
+
+    MicontBusLineReport report(int64_t now, int seconds) const;
+
+private:
+    struct Slot {
+        int64_t second;
+        int64_t wire;
+        int64_t turnaround;
+        int64_t timeout;
+        uint32_t frames;
+        uint32_t answered;
+    };
+
+    Slot &slot(int64_t now);
+
+    Slot m_slots[SlotCount];
+    int64_t m_first;
+};
+
+#endif // MICONTBUSLINESTATS_H
@@ -0,0 +1,65 @@
+#ifndef MICONTBUSPORT_H
+#define MICONTBUSPORT_H
+
+#include <stdint.h>
+
+#include <string>
+
+// Line settings beyond port name and baud rate. Backends that can't apply
+// an option ignore it.
+struct MicontBusSerialOptions
+{
+    enum Parity {
+        ParityNone,
+        ParityEven,
+        ParityOdd
+    };
+
+    MicontBusSerialOptions()
+        : dataBits(8), parity(ParityNone), stopBits(1), lowLatency(true), rs485(false), rs485RtsOnSend(true),
+          rs485DelayBeforeSend(0), rs485DelayAfterSend(0) {}
+
+    // start bit, data, parity and stop bits
+    int bitsPerCharacter() const { return 1 + dataBits + (parity != ParityNone ? 1 : 0) + stopBits; }
+
+    int dataBits;               // 5..8
+    Parity parity;
+    int stopBits;               // 1 or 2
+    bool lowLatency;            // ASYNC_LOW_LATENCY on the UART/USB driver
+    bool rs485;                 // kernel driven RS-485 direction (TIOCSRS485)
+    bool rs485RtsOnSend;        // RTS level while sending
+    int rs485DelayBeforeSend;   // ms
+    int rs485DelayAfterSend;    // ms
+
+    bool operator==(const MicontBusSerialOptions &o) const
+    {
+        return dataBits == o.dataBits && parity == o.parity && stopBits == o.stopBits
+                && lowLatency == o.lowLatency && rs485 == o.rs485 && rs485RtsOnSend == o.rs485RtsOnSend
+                && rs485DelayBeforeSend == o.rs485DelayBeforeSend && rs485DelayAfterSend == o.rs485DelayAfterSend;
+    }
+    bool operator!=(const MicontBusSerialOptions &o) const { return !(*this == o); }
+};
+
+/* Byte pipe to the bus without Qt, the calls are those of
+ * MicontBusTransport: read() returns what has arrived without blocking,
+ * the wait functions block for at most msecs. */
+class MicontBusPort
+{
+public:
+    virtual ~MicontBusPort() {}
+
+    virtual bool open(const std::string &portName, int32_t baudRate, const MicontBusSerialOptions &options) = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() const = 0;
+    virtual std::string errorString() const = 0;
+
+    virtual int64_t write(const char *data, int64_t size) = 0;
+    virtual bool waitForBytesWritten(int msecs) = 0;
+    virtual bool waitForReadyRead(int msecs) = 0;
+    virtual int64_t bytesAvailable() const = 0;
+    virtual int64_t read(char *data, int64_t maxSize) = 0;
+    // drops what was received and not read yet
+    virtual void discardInput() = 0;
+};
+
+#endif // MICONTBUSPORT_H
@@ -0,0 +1,278 @@
+#include "micontbusposixport.h"
+
+#include <chrono>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+
+static speed_t baudRateToSpeed(int32_t baudRate)
+{
+    switch (baudRate) {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+#ifdef B460800
+    case 460800: return B460800;
+#endif
+#ifdef B500000
+    case 500000: return B500000;
+#endif
+#ifdef B921600
+    case 921600: return B921600;
+#endif
+#ifdef B1000000
+    case 1000000: return B1000000;
+#endif
+#ifdef B2000000
+    case 2000000: return B2000000;
+#endif
+    }
+    return B0;
+}
+
+static int64_t msecsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+MicontBusPosixPort::MicontBusPosixPort()
+    : m_fd(-1)
+{
+}
+
+MicontBusPosixPort::~MicontBusPosixPort()
+{
+    close();
+}
+
+bool MicontBusPosixPort::open(const std::string &portName, int32_t baudRate, const MicontBusSerialOptions &options)
+{
+    close();
+
+    speed_t speed = baudRateToSpeed(baudRate);
+    if (speed == B0) {
+        m_errorString = "unsupported baud rate " + std::to_string(baudRate);
+        return false;
+    }
+
+    std::string path = !portName.empty() && portName[0] == '/' ? portName : "/dev/" + portName;
+    m_fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (m_fd < 0)
+        return fail("open " + path);
+
+    if (ioctl(m_fd, TIOCEXCL) < 0)
+        return fail("TIOCEXCL");
+
+    struct termios tio;
+    if (tcgetattr(m_fd, &tio) < 0)
+        return fail("tcgetattr");
+
+    // raw, reads return at once with whatever has arrived
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSIZE | CSTOPB | PARENB | PARODD | CRTSCTS);
+    switch (options.dataBits) {
+    case 5: tio.c_cflag |= CS5; break;
+    case 6: tio.c_cflag |= CS6; break;
+    case 7: tio.c_cflag |= CS7; break;
+    default: tio.c_cflag |= CS8; break;
+    }
+    if (options.parity != MicontBusSerialOptions::ParityNone)
+        tio.c_cflag |= PARENB | (options.parity == MicontBusSerialOptions::ParityOdd ? PARODD : 0);
+    if (options.stopBits == 2)
+        tio.c_cflag |= CSTOPB;
+    tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(m_fd, TCSANOW, &tio) < 0)
+        return fail("tcsetattr");
+
+#ifdef __linux__
+    // not supported by every driver (nor by ptys), best effort
+    struct serial_struct ss;
+    if (ioctl(m_fd, TIOCGSERIAL, &ss) == 0) {
+        if (options.lowLatency)
+            ss.flags |= ASYNC_LOW_LATENCY;
+        else
+            ss.flags &= ~ASYNC_LOW_LATENCY;
+        ioctl(m_fd, TIOCSSERIAL, &ss);
+    }
+
+    // without direction control half-duplex doesn't work, so this one must succeed
+    if (options.rs485) {
+        struct serial_rs485 rs;
+        memset(&rs, 0, sizeof(rs));
+        rs.flags = SER_RS485_ENABLED
+                | (options.rs485RtsOnSend ? SER_RS485_RTS_ON_SEND : SER_RS485_RTS_AFTER_SEND);
+        rs.delay_rts_before_send = options.rs485DelayBeforeSend;
+        rs.delay_rts_after_send = options.rs485DelayAfterSend;
+        if (ioctl(m_fd, TIOCSRS485, &rs) < 0)
+            return fail("TIOCSRS485");
+    }
+#else
+    if (options.rs485) {
+        errno = ENOTSUP;
+        return fail("RS-485");
+    }
+#endif
+
+    tcflush(m_fd, TCIOFLUSH);
+    return true;
+}
+
+void MicontBusPosixPort::close()
+{
+    // exclusive mode outlives the fd while anyone else holds the tty open
+    // (a pty's other side), the next open would get EBUSY
+    if (m_fd >= 0) {
+        ioctl(m_fd, TIOCNXCL);
+        ::close(m_fd);
+    }
+    m_fd = -1;
+    m_pending.clear();
+}
+
+bool MicontBusPosixPort::isOpen() const
+{
+    return m_fd >= 0;
+}
+
+std::string MicontBusPosixPort::errorString() const
+{
+    return m_errorString;
+}
+
+int64_t MicontBusPosixPort::write(const char *data, int64_t size)
+{
+    if (m_fd < 0)
+        return -1;
+
+    m_pending.append(data, size);
+    if (!flush())
+        return -1;
+    return size;
+}
+
+bool MicontBusPosixPort::waitForBytesWritten(int msecs)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    while (!m_pending.empty()) {
+        int left = msecs - msecsSince(start);
+        if (left <= 0 || !wait(POLLOUT, left) || !flush())
+            return false;
+    }
+    return true;
+}
+
+bool MicontBusPosixPort::waitForReadyRead(int msecs)
+{
+    return bytesAvailable() > 0 || wait(POLLIN, msecs);
+}
+
+int64_t MicontBusPosixPort::bytesAvailable() const
+{
+    int n = 0;
+    if (m_fd < 0 || ioctl(m_fd, FIONREAD, &n) < 0)
+        return 0;
+    return n;
+}
+
+int64_t MicontBusPosixPort::read(char *data, int64_t maxSize)
+{
+    if (m_fd < 0)
+        return -1;
+
+    ssize_t n;
+    do {
+        n = ::read(m_fd, data, maxSize);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        fail("read");
+        return -1;
+    }
+    return n;
+}
+
+void MicontBusPosixPort::discardInput()
+{
+    if (m_fd >= 0)
+        tcflush(m_fd, TCIFLUSH);
+}
+
+bool MicontBusPosixPort::fail(const std::string &what)
+{
+    m_errorString = what + ": " + strerror(errno);
+    close();
+    return false;
+}
+
+// Waits for events on the port for at most msecs.
+bool MicontBusPosixPort::wait(short events, int msecs)
+{
+    if (m_fd < 0)
+        return false;
+
+    struct pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    int n;
+    for (;;) {
+        int64_t left = msecs - msecsSince(start);
+        n = poll(&pfd, 1, left > 0 ? (int)left : 0);
+        if (n >= 0 || errno != EINTR)
+            break;
+    }
+
+    // the device went away (USB adapter unplugged, pty closed), reads would
+    // return nothing at once from now on: the port is closed so that the
+    // next open finds it again. What arrived before is read first.
+    if (n > 0 && (pfd.revents & (POLLHUP | POLLERR | POLLNVAL)) && bytesAvailable() == 0) {
+        errno = EIO;
+        fail("hangup");
+        return false;
+    }
+
+    return n > 0 && (pfd.revents & events);
+}
+
+// Hands as much of the pending data as possible to the driver.
+bool MicontBusPosixPort::flush()
+{
+    while (!m_pending.empty()) {
+        ssize_t n = ::write(m_fd, m_pending.data(), m_pending.size());
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            m_errorString = std::string("write: ") + strerror(errno);
+            return false;
+        }
+        m_pending.erase(0, n);
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef MICONTBUSPOSIXPORT_H
+#define MICONTBUSPOSIXPORT_H
+
+#include <string>
+
+#include "micontbusport.h"
+
+/* Serial port on a raw, non-blocking tty fd. Reads return whatever the
+ * driver has (VMIN = VTIME = 0) and waits are a single poll(). On Linux
+ * applies ASYNC_LOW_LATENCY and kernel RS-485 direction control when
+ * asked. Port names are taken relative to /dev unless absolute, so ptys
+ * (/dev/pts/N) work for testing. */
+class MicontBusPosixPort : public MicontBusPort
+{
+public:
+    MicontBusPosixPort();
+    ~MicontBusPosixPort();
+
+    bool open(const std::string &portName, int32_t baudRate, const MicontBusSerialOptions &options);
+    void close();
+    bool isOpen() const;
+    std::string errorString() const;
+
+    int64_t write(const char *data, int64_t size);
+    bool waitForBytesWritten(int msecs);
+    bool waitForReadyRead(int msecs);
+    int64_t bytesAvailable() const;
+    int64_t read(char *data, int64_t maxSize);
+    void discardInput();
+
+private:
+    bool fail(const std::string &what);
+    bool wait(short events, int msecs);
+    bool flush();
+
+    int m_fd;
+    std::string m_pending;  // written but not yet accepted by the driver
+    std::string m_errorString;
+};
+
+#endif // MICONTBUSPOSIXPORT_H
@@ -0,0 +1,61 @@
+#include "micontbusretrypolicy.h"
+
+#include <algorithm>
+#include <random>
+
+MicontBusRetryPolicy::MicontBusRetryPolicy()
+    : m_backoffBase(5), m_backoffMax(500)
+{
+    m_limits[RetryBusy] = 5;
+    m_limits[RetryCrc] = 2;
+    m_limits[RetryTimeout] = 1;
+}
+
+int MicontBusRetryPolicy::limit(RetryClass retryClass) const
+{
+    return m_limits[retryClass];
+}
+
+void MicontBusRetryPolicy::setLimit(RetryClass retryClass, int limit)
+{
+    m_limits[retryClass] = std::max(0, limit);
+}
+
+int32_t MicontBusRetryPolicy::backoffBase() const
+{
+    return m_backoffBase;
+}
+
+int32_t MicontBusRetryPolicy::backoffMax() const
+{
+    return m_backoffMax;
+}
+
+void MicontBusRetryPolicy::setBackoff(int32_t base, int32_t max)
+{
+    m_backoffBase = std::max<int32_t>(0, base);
+    m_backoffMax = std::max(m_backoffBase, max);
+}
+
+int32_t MicontBusRetryPolicy::backoff(int attempt) const
+{
+    if (m_backoffBase == 0)
+        return 0;
+
+    int64_t delay = (int64_t)m_backoffBase << std::min(attempt, 16);
+    delay = std::min(delay, (int64_t)m_backoffMax);
+
+    // "equal jitter": half fixed, half random, so that slaves answering
+    // BUSY at the same moment don't get polled again in lockstep
+    static thread_local std::minstd_rand random(std::random_device{}());
+    int32_t half = (int32_t)(delay / 2);
+    return half + (half > 0 ? std::uniform_int_distribution<int32_t>(0, half)(random) : 0);
+}
+
+MicontBusRetryPolicy MicontBusRetryPolicy::noRetry()
+{
+    MicontBusRetryPolicy policy;
+    for (int i = 0; i < RetryClassCount; i++)
+        policy.m_limits[i] = 0;
+    return policy;
+}
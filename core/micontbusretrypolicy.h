@@ -0,0 +1,37 @@
+#ifndef MICONTBUSRETRYPOLICY_H
+#define MICONTBUSRETRYPOLICY_H
+
+#include <stdint.h>
+
+/* Retry limits per failure class and jittered exponential backoff used by
+ * MicontBusScheduler to resubmit transactions. Times are in milliseconds. */
+class MicontBusRetryPolicy
+{
+public:
+    enum RetryClass {
+        RetryBusy,      // CMD_RESULT_BUSY or CMD_RESULT_WAIT response
+        RetryCrc,       // response CRC mismatch
+        RetryTimeout,   // no response within the timeout
+        RetryClassCount
+    };
+
+    MicontBusRetryPolicy();
+
+    int limit(RetryClass retryClass) const;
+    void setLimit(RetryClass retryClass, int limit);
+
+    int32_t backoffBase() const;
+    int32_t backoffMax() const;
+    void setBackoff(int32_t base, int32_t max);
+
+    int32_t backoff(int attempt) const;
+
+    static MicontBusRetryPolicy noRetry();
+
+private:
+    int m_limits[RetryClassCount];
+    int32_t m_backoffBase;
+    int32_t m_backoffMax;
+};
+
+#endif // MICONTBUSRETRYPOLICY_H
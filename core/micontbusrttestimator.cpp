@@ -0,0 +1,129 @@
+#include "micontbusrttestimator.h"
+
+#include <algorithm>
+#include <stdlib.h>
+
+// clock granularity added to the variance term, us
+static const int64_t RTT_GRANULARITY = 1000;
+// maximum number of timeout doublings
+static const int RTT_MAX_BACKOFF = 6;
+
+MicontBusRttEstimator::MicontBusRttEstimator()
+{
+}
+
+int32_t MicontBusRttEstimator::timeout(const std::string &portName, uint8_t id, uint8_t cmd, int64_t floor,
+                                       int32_t upperBound) const
+{
+    if (upperBound <= 0)
+        return upperBound;
+
+    const Estimate *e = find(portName, id, cmd);
+    if (!e)
+        return upperBound;
+
+    int64_t rto = e->srtt + std::max(RTT_GRANULARITY, 4 * e->rttvar);
+    rto = std::max(rto, floor) << e->backoff;
+
+    int64_t ms = (rto + 999) / 1000;
+    return (int32_t)std::min(std::max<int64_t>(1, ms), (int64_t)upperBound);
+}
+
+void MicontBusRttEstimator::addSample(const std::string &portName, uint8_t id, uint8_t cmd, int64_t rtt)
+{
+    Key k = key(portName, id, cmd);
+    std::map<Key, Estimate>::iterator it = m_estimates.find(k);
+
+    // a restored estimate is a starting point only, the line or the
+    // slave may have changed since
+    if (it == m_estimates.end() || it->second.restored) {
+        Estimate e;
+        e.srtt = rtt;
+        e.rttvar = rtt / 2;
+        m_estimates[k] = e;
+        return;
+    }
+
+    Estimate &e = it->second;
+    e.rttvar = (3 * e.rttvar + llabs(e.srtt - rtt)) / 4;
+    e.srtt = (7 * e.srtt + rtt) / 8;
+    e.backoff = 0;
+}
+
+void MicontBusRttEstimator::addTimeout(const std::string &portName, uint8_t id, uint8_t cmd)
+{
+    std::map<Key, Estimate>::iterator it = m_estimates.find(key(portName, id, cmd));
+    if (it == m_estimates.end())
+        return;
+
+    if (it->second.backoff < RTT_MAX_BACKOFF)
+        it->second.backoff++;
+}
+
+void MicontBusRttEstimator::clear()
+{
+    m_estimates.clear();
+}
+
+std::vector<MicontBusRttEstimator::Sample> MicontBusRttEstimator::estimates() const
+{
+    std::vector<Sample> samples;
+    for (std::map<Key, Estimate>::const_iterator it = m_estimates.begin(); it != m_estimates.end(); ++it) {
+        Sample s;
+        s.portName = it->first.first;
+        s.id = it->first.second >> 8;
+        s.cmd = it->first.second & 0x0f;
+        s.srtt = it->second.srtt;
+        s.rttvar = it->second.rttvar;
+        samples.push_back(s);
+    }
+    return samples;
+}
+
+// Seeds an estimate, e.g. from a snapshot of an earlier run, so that
+// timeouts are adaptive from the first frame. The first real sample
+// replaces it. Existing estimates are kept.
+void MicontBusRttEstimator::restore(const Sample &sample)
+{
+    Key k = key(sample.portName, sample.id, sample.cmd);
+    if (m_estimates.count(k) || sample.srtt <= 0)
+        return;
+
+    Estimate e;
+    e.srtt = sample.srtt;
+    e.rttvar = std::max<int64_t>(0, sample.rttvar);
+    e.restored = true;
+    m_estimates[k] = e;
+}
+
+int64_t MicontBusRttEstimator::srtt(const std::string &portName, uint8_t id, uint8_t cmd) const
+{
+    const Estimate *e = find(portName, id, cmd);
+    return e ? e->srtt : 0;
+}
+
+int64_t MicontBusRttEstimator::rttvar(const std::string &portName, uint8_t id, uint8_t cmd) const
+{
+    const Estimate *e = find(portName, id, cmd);
+    return e ? e->rttvar : 0;
+}
+
+int64_t MicontBusRttEstimator::frameTime(int bytes, int32_t baudRate, int bitsPerChar)
+{
+    if (baudRate <= 0)
+        return 0;
+
+    return (int64_t)bytes * bitsPerChar * 1000000 / baudRate;
+}
+
+MicontBusRttEstimator::Key MicontBusRttEstimator::key(const std::string &portName, uint8_t id, uint8_t cmd)
+{
+    return Key(portName, (uint16_t)((id << 8) | (cmd & 0x0f)));
+}
+
+const MicontBusRttEstimator::Estimate *MicontBusRttEstimator::find(const std::string &portName, uint8_t id,
+                                                                    uint8_t cmd) const
+{
+    std::map<Key, Estimate>::const_iterator it = m_estimates.find(key(portName, id, cmd));
+    return it != m_estimates.end() ? &it->second : 0;
+}
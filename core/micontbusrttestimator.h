@@ -0,0 +1,57 @@
+#ifndef MICONTBUSRTTESTIMATOR_H
+#define MICONTBUSRTTESTIMATOR_H
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Per (port, id, cmd) round-trip estimator in the style of TCP's RTO
+ * calculation (RFC 6298). All times are in microseconds except the
+ * resulting timeout, which is in milliseconds as the ports take it. */
+class MicontBusRttEstimator
+{
+public:
+    struct Sample {
+        std::string portName;
+        uint8_t id;
+        uint8_t cmd;
+        int64_t srtt;
+        int64_t rttvar;
+    };
+
+    MicontBusRttEstimator();
+
+    int32_t timeout(const std::string &portName, uint8_t id, uint8_t cmd, int64_t floor, int32_t upperBound) const;
+    void addSample(const std::string &portName, uint8_t id, uint8_t cmd, int64_t rtt);
+    void addTimeout(const std::string &portName, uint8_t id, uint8_t cmd);
+    void clear();
+
+    std::vector<Sample> estimates() const;
+    void restore(const Sample &sample);
+
+    int64_t srtt(const std::string &portName, uint8_t id, uint8_t cmd) const;
+    int64_t rttvar(const std::string &portName, uint8_t id, uint8_t cmd) const;
+
+    static int64_t frameTime(int bytes, int32_t baudRate, int bitsPerChar = 10);
+
+private:
+    typedef std::pair<std::string, uint16_t> Key;
+
+    struct Estimate {
+        Estimate() : srtt(0), rttvar(0), backoff(0), restored(false) {}
+        int64_t srtt;
+        int64_t rttvar;
+        int backoff;
+        bool restored;  // from a snapshot, until the first sample
+    };
+
+    static Key key(const std::string &portName, uint8_t id, uint8_t cmd);
+    const Estimate *find(const std::string &portName, uint8_t id, uint8_t cmd) const;
+
+    std::map<Key, Estimate> m_estimates;
+};
+
+#endif // MICONTBUSRTTESTIMATOR_H
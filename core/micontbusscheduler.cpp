@@ -0,0 +1,855 @@
+#include "micontbusscheduler.h"
+#include "micontbuscodec.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdlib.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include "micontbusposixport.h"
+#endif
+
+// under contention bulk gets at least one of this many frames
+static const int PRIORITY_BULK_SHARE = 8;
+
+MicontBusScheduler::MicontBusScheduler()
+    : m_start(std::chrono::steady_clock::now()), m_portGeneration(0), m_bulkStarvation(0), m_nextTag(0),
+      m_probeTimeout(0), m_quit(false), m_adaptive(true), m_pool(MicontBusFramePool::global()),
+      m_lastJitter(-1), m_lastWire(0), m_lastDuration(0), m_lastRoundTrip(0)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    m_portFactory = []() -> MicontBusPort * { return new MicontBusPosixPort; };
+#endif
+
+    m_busyTime = m_wireTime = m_turnaroundTime = m_timeoutTime = 0;
+    m_droppedCancelled = m_droppedExpired = 0;
+    for (int p = 0; p < PriorityCount; p++)
+        m_queueDepth[p] = 0;
+    statClear();
+}
+
+MicontBusScheduler::~MicontBusScheduler()
+{
+}
+
+// deadline is in ms from now, 0 for none. A request whose deadline has
+// passed or whose token was cancelled is dropped before it is sent and
+// not retried; it fails silently.
+uint32_t MicontBusScheduler::transaction(const std::string &portName, int32_t baudRate, int32_t waitTimeout,
+                                         const char *packet, int size, Priority priority, int32_t deadline,
+                                         const MicontBusCancelToken &token)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+
+    m_ports[portName] = baudRate;
+    // health probes due before anything was sent
+    if (!m_probeTimeout)
+        m_probeTimeout = waitTimeout;
+
+    Request request;
+    request.tag = ++m_nextTag;
+    request.priority = priority;
+    request.portName = portName;
+    request.baudRate = baudRate;
+    request.packet.assign(packet, size);
+    request.waitTimeout = waitTimeout;
+    request.queued = elapsedUs();
+    request.deadline = deadline > 0 ? elapsed() + deadline : 0;
+    request.token = token;
+    m_lanes[priority].push_back(request);
+    updateQueueDepth();
+
+    m_cond.notify_one();
+    return request.tag;
+}
+
+// The bus loop, returns once stop() was called. Requests still queued
+// then stay queued, see clear().
+void MicontBusScheduler::run(Listener *listener)
+{
+    std::string currentPortName;
+    int32_t currentBaudrate = 0;
+    bool currentAdaptive = true;
+    unsigned currentGeneration = 0;
+    MicontBusSerialOptions currentOptions;
+    std::unique_ptr<MicontBusPort> port;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    for (;;) {
+        Request request;
+        bool waited = false;
+
+        while (!m_quit) {
+            int64_t wait = takeRequest(&request);
+            if (wait == 0)
+                break;
+            if (!m_stale.empty()) {
+                // report what was dropped before going to sleep
+                std::vector<Request> dropped;
+                dropped.swap(m_stale);
+                lock.unlock();
+                failStale(listener, dropped);
+                lock.lock();
+                continue;
+            }
+            if (wait < 0)
+                m_cond.wait(lock);
+            else
+                m_cond.wait_for(lock, std::chrono::milliseconds(wait));
+            waited = true;
+        }
+        if (m_quit)
+            break;
+
+        // from the moment the request became ready to this thread running
+        if (waited && !request.probe) {
+            int64_t ready = std::max(request.queued, request.notBefore * 1000);
+            m_wakeupHistogram.add(elapsedUs() - ready);
+        }
+        uint8_t id = request.packet.empty() ? 0 : request.packet[0];
+        bool slaveDown = !request.probe && m_health.isDown(request.portName, id);
+        bool portChanged = !port || currentGeneration != m_portGeneration;
+        bool reopen = portChanged || !port->isOpen()
+                || currentPortName != request.portName || currentBaudrate != request.baudRate
+                || currentOptions != m_options;
+        currentPortName = request.portName;
+        currentBaudrate = request.baudRate;
+        currentAdaptive = m_adaptive;
+        currentGeneration = m_portGeneration;
+        currentOptions = m_options;
+        PortFactory factory = portChanged ? m_portFactory : PortFactory();
+        std::vector<Request> dropped;
+        dropped.swap(m_stale);
+        lock.unlock();
+
+        failStale(listener, dropped);
+
+        // suspended until a probe gets an answer
+        if (slaveDown) {
+            fail(listener, request, "slave " + std::to_string(id) + " down", FailureError);
+            lock.lock();
+            continue;
+        }
+
+        if (portChanged)
+            port.reset(factory ? factory() : 0);
+
+        if (reopen && (!port || !port->open(currentPortName, currentBaudrate, currentOptions))) {
+            std::string s = "can't open " + currentPortName + ", "
+                    + (port ? port->errorString() : std::string("no port for this platform"));
+            listener->portError(s);
+
+            // the rest of this port's queue would fail the same way,
+            // other ports go on
+            lock.lock();
+            std::vector<Request> failed = takePort(currentPortName);
+            lock.unlock();
+
+            if (!request.probe)
+                fail(listener, request, s, FailureSilent);
+            for (size_t i = 0; i < failed.size(); i++)
+                fail(listener, failed[i], s, FailureSilent);
+            lock.lock();
+            continue;
+        }
+
+        MicontBusFrame frame;
+        Result result = exchange(*port, currentBaudrate, currentOptions.bitsPerCharacter(),
+                                 currentAdaptive, request, &frame);
+
+        lock.lock();
+        MicontBusLineStats &line = m_lineStats[currentPortName];
+        if (result == ResultOk || result == ResultCrcError)
+            line.addTransaction(elapsed(), m_lastWire, m_lastDuration);
+        else
+            line.addTimeout(elapsed(), m_lastWire, m_lastDuration);
+
+        bool stateChanged = false;
+        switch (result) {
+        case ResultOk:
+            stateChanged = m_health.addSuccess(currentPortName, id);
+            if (m_lastJitter >= 0)
+                m_jitterHistogram.add(m_lastJitter);
+            break;
+        case ResultCrcError:
+            stateChanged = m_health.addCrcError(currentPortName, id, elapsed());
+            break;
+        case ResultReadTimeout:
+            stateChanged = m_health.addTimeout(currentPortName, id, elapsed());
+            break;
+        case ResultWriteTimeout:
+            break;
+        }
+        lock.unlock();
+
+        if (stateChanged) {
+            counters(currentPortName, id).down.store(result != ResultOk, std::memory_order_relaxed);
+            listener->slaveStateChanged(currentPortName, id, result == ResultOk);
+        }
+
+        if (!request.probe) {
+            switch (result) {
+            case ResultOk: {
+                uint8_t code = frame.bytes()[1] & 0xf0;
+                if ((code == MicontBusCodec::CMD_RESULT_BUSY || code == MicontBusCodec::CMD_RESULT_WAIT)
+                        && retry(request, MicontBusRetryPolicy::RetryBusy))
+                    break;
+                listener->response(request.tag, frame);
+                break;
+            }
+            case ResultCrcError:
+                if (retry(request, MicontBusRetryPolicy::RetryCrc))
+                    break;
+                fail(listener, request, "crc mismatch", FailureError);
+                break;
+            case ResultReadTimeout:
+                if (retry(request, MicontBusRetryPolicy::RetryTimeout))
+                    break;
+                fail(listener, request, "read timeout", FailureTimeout);
+                break;
+            case ResultWriteTimeout:
+                if (retry(request, MicontBusRetryPolicy::RetryTimeout))
+                    break;
+                fail(listener, request, "write timeout", FailureTimeout);
+                break;
+            }
+        }
+
+        lock.lock();
+    }
+}
+
+// Makes run() return once the transaction on the wire is done.
+void MicontBusScheduler::stop()
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_quit = true;
+    m_cond.notify_one();
+}
+
+// Empties the queue once run() has returned, so that it can be run again.
+// Returns the tags of the requests that were never sent.
+std::vector<uint32_t> MicontBusScheduler::clear()
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    std::vector<Request> requests = takeAll();
+    m_quit = false;
+
+    std::vector<uint32_t> tags;
+    for (size_t i = 0; i < requests.size(); i++)
+        tags.push_back(requests[i].tag);
+    return tags;
+}
+
+// Removes a request that is still queued; once on the wire it runs to the
+// end. Returns false if the tag is not queued, the caller reports the
+// cancellation otherwise.
+bool MicontBusScheduler::cancel(uint32_t tag)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    for (int p = 0; p < PriorityCount; p++) {
+        for (std::deque<Request>::iterator it = m_lanes[p].begin(); it != m_lanes[p].end(); ++it) {
+            if (it->tag == tag) {
+                m_lanes[p].erase(it);
+                updateQueueDepth();
+                m_droppedCancelled.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+int64_t MicontBusScheduler::elapsed() const
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+int64_t MicontBusScheduler::elapsedUs() const
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+// Picks the first ready request from the highest non-empty class. A
+// request is ready once its retry backoff has expired, so that traffic to
+// other slaves goes on while a busy one waits. Bulk transfers are served
+// at least once every PRIORITY_BULK_SHARE frames unless control writes
+// are pending. Due health probes of down slaves go first, cancelled and
+// expired requests are set aside before anything is picked. Returns 0 when
+// a request was taken, otherwise the time to the earliest pending one or
+// deadline, or -1 if nothing is queued. Called with the mutex held.
+int64_t MicontBusScheduler::takeRequest(Request *request)
+{
+    int64_t now = elapsed();
+    int ready[PriorityCount];
+
+    // the earliest probe over all ports
+    int64_t wait = -1;
+    std::string probePort;
+    uint8_t probeId = 0;
+    for (std::map<std::string, int32_t>::const_iterator it = m_ports.begin(); it != m_ports.end(); ++it) {
+        uint8_t id = 0;
+        int64_t delay = m_health.nextProbe(it->first, now, &id);
+        if (delay >= 0 && (wait < 0 || delay < wait)) {
+            wait = delay;
+            probePort = it->first;
+            probeId = id;
+        }
+    }
+    if (wait == 0) {
+        m_health.probeSent(probePort, probeId, now);
+
+        MicontBusMessage message;
+        message.id = probeId;
+        message.cmd = MicontBusCodec::CMD_GETSIZE;
+        std::vector<uint8_t> packet = MicontBusCodec::encode(message);
+
+        *request = Request();
+        request->priority = PriorityBulk;
+        request->portName = probePort;
+        request->baudRate = m_ports[probePort];
+        request->packet.assign(packet.begin(), packet.end());
+        request->waitTimeout = m_probeTimeout;
+        request->probe = true;
+        return 0;
+    }
+
+    int64_t expiry = dropStale(now);
+    if (expiry > 0 && (wait < 0 || expiry < wait))
+        wait = expiry;
+
+    for (int p = 0; p < PriorityCount; p++) {
+        ready[p] = -1;
+        for (size_t i = 0; i < m_lanes[p].size(); i++) {
+            int64_t delay = m_lanes[p][i].notBefore - now;
+            if (delay <= 0) {
+                ready[p] = i;
+                break;
+            }
+            if (wait < 0 || delay < wait)
+                wait = delay;
+        }
+    }
+
+    int lane = 0;
+    while (lane < PriorityCount && ready[lane] < 0)
+        lane++;
+    if (lane == PriorityCount)
+        return wait;
+
+    if (lane != PriorityControl && lane != PriorityBulk && ready[PriorityBulk] >= 0) {
+        if (++m_bulkStarvation >= PRIORITY_BULK_SHARE)
+            lane = PriorityBulk;
+    }
+    if (lane == PriorityBulk)
+        m_bulkStarvation = 0;
+
+    std::deque<Request>::iterator it = m_lanes[lane].begin() + ready[lane];
+    *request = *it;
+    m_lanes[lane].erase(it);
+    m_probeTimeout = request->waitTimeout;
+    updateQueueDepth();
+    return 0;
+}
+
+// Moves cancelled and expired requests to m_stale. Returns the time to the
+// next deadline, or -1 if none is pending. Called with the mutex held.
+int64_t MicontBusScheduler::dropStale(int64_t now)
+{
+    int64_t wait = -1;
+    bool dropped = false;
+
+    for (int p = 0; p < PriorityCount; p++) {
+        for (std::deque<Request>::iterator it = m_lanes[p].begin(); it != m_lanes[p].end(); ) {
+            if (it->token.isCancelled() || (it->deadline && it->deadline <= now)) {
+                m_stale.push_back(*it);
+                it = m_lanes[p].erase(it);
+                dropped = true;
+                continue;
+            }
+            if (it->deadline && (wait < 0 || it->deadline - now < wait))
+                wait = it->deadline - now;
+            ++it;
+        }
+    }
+
+    if (dropped)
+        updateQueueDepth();
+    return wait;
+}
+
+void MicontBusScheduler::failStale(Listener *listener, const std::vector<Request> &dropped)
+{
+    for (size_t i = 0; i < dropped.size(); i++) {
+        if (dropped[i].token.isCancelled()) {
+            m_droppedCancelled.fetch_add(1, std::memory_order_relaxed);
+            fail(listener, dropped[i], "cancelled", FailureSilent);
+        } else {
+            m_droppedExpired.fetch_add(1, std::memory_order_relaxed);
+            fail(listener, dropped[i], "deadline expired", FailureSilent);
+        }
+    }
+}
+
+void MicontBusScheduler::fail(Listener *listener, const Request &request, const std::string &s, Failure failure)
+{
+    uint8_t id = request.packet.empty() ? 0 : request.packet[0];
+    listener->failure(id, request.tag, s, failure);
+}
+
+// Empties all classes. Called with the mutex held.
+std::vector<MicontBusScheduler::Request> MicontBusScheduler::takeAll()
+{
+    std::vector<Request> requests;
+    requests.swap(m_stale);
+    for (int p = 0; p < PriorityCount; p++) {
+        requests.insert(requests.end(), m_lanes[p].begin(), m_lanes[p].end());
+        m_lanes[p].clear();
+    }
+    updateQueueDepth();
+    return requests;
+}
+
+// Removes the requests for a port from all classes. Called with the mutex
+// held.
+std::vector<MicontBusScheduler::Request> MicontBusScheduler::takePort(const std::string &portName)
+{
+    std::vector<Request> requests;
+    for (int p = 0; p < PriorityCount; p++) {
+        for (std::deque<Request>::iterator it = m_lanes[p].begin(); it != m_lanes[p].end(); ) {
+            if (it->portName == portName) {
+                requests.push_back(*it);
+                it = m_lanes[p].erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    updateQueueDepth();
+    return requests;
+}
+
+// Mirrors the lane sizes for lock-free readers. Called with the mutex held.
+void MicontBusScheduler::updateQueueDepth()
+{
+    for (int p = 0; p < PriorityCount; p++)
+        m_queueDepth[p].store(m_lanes[p].size(), std::memory_order_relaxed);
+}
+
+MicontBusScheduler::Result MicontBusScheduler::exchange(MicontBusPort &port, int32_t baudRate, int bitsPerChar,
+                                                        bool adaptive, Request &request, MicontBusFrame *response)
+{
+    const std::string &packet = request.packet;
+    const std::string &portName = request.portName;
+    int expected = MicontBusCodec::expectedResponseSize(packet.data(), packet.size()) + 2;
+
+    // response timeout: adaptive estimate bounded by the configured value
+    uint8_t id = packet.size() > 1 ? packet[0] : 0;
+    uint8_t cmd = packet.size() > 1 ? packet[1] : 0;
+    int responseTimeout = request.waitTimeout;
+    if (adaptive) {
+        int frameBytes = packet.size() + 2 + expected;
+        int64_t floor = MicontBusRttEstimator::frameTime(frameBytes, baudRate, bitsPerChar);
+        std::lock_guard<std::mutex> locker(m_rttMutex);
+        responseTimeout = m_rtt.timeout(portName, id, cmd, floor, request.waitTimeout);
+    }
+
+    // request and CRC built in place
+    MicontBusFrame tx = m_pool->acquire(packet.size() + 2);
+    tx.append(packet.data(), packet.size());
+    uint16_t txCrc = MicontBusCodec::crc16(packet.data(), packet.size());
+    char crcBytes[2] = { (char)(txCrc & 0xff), (char)(txCrc >> 8) };
+    tx.append(crcBytes, 2);
+
+    SlaveCounters &counters = this->counters(portName, id);
+
+    // whatever is waiting is a late answer to an earlier request, it must
+    // not be taken for this one
+    port.discardInput();
+
+    std::chrono::steady_clock::time_point busy = std::chrono::steady_clock::now();
+    auto busyUs = [&busy]() -> int64_t {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - busy).count();
+    };
+
+    port.write(tx.constData(), tx.size());
+
+    if (!port.waitForBytesWritten(request.waitTimeout)) {
+        m_statTimeouts++;
+        counters.timeouts.fetch_add(1, std::memory_order_relaxed);
+        account(0, busyUs(), false);
+        return ResultWriteTimeout;
+    }
+
+    m_statTxBytes += tx.size();
+    m_statTxPackets++;
+    counters.transactions.fetch_add(1, std::memory_order_relaxed);
+    counters.txBytes.fetch_add(tx.size(), std::memory_order_relaxed);
+
+    int64_t sent = busyUs();
+
+    if (!port.waitForReadyRead(responseTimeout)) {
+        m_rttMutex.lock();
+        m_rtt.addTimeout(portName, id, cmd);
+        m_rttMutex.unlock();
+        m_statTimeouts++;
+        counters.timeouts.fetch_add(1, std::memory_order_relaxed);
+        account(MicontBusRttEstimator::frameTime(tx.size(), baudRate, bitsPerChar), busyUs(), false);
+        return ResultReadTimeout;
+    }
+
+    int64_t roundTrip = busyUs() - sent;
+    m_lastRoundTrip.store(roundTrip, std::memory_order_relaxed);
+
+    // deviation from the smoothed round trip of this slave and command. A
+    // retried request may be answered by an earlier try, its round trip is
+    // no sample (Karn's rule)
+    bool retried = false;
+    for (int i = 0; i < MicontBusRetryPolicy::RetryClassCount; i++)
+        retried = retried || request.attempts[i] > 0;
+    m_lastJitter = -1;
+    if (!retried) {
+        std::lock_guard<std::mutex> locker(m_rttMutex);
+        int64_t srtt = m_rtt.srtt(portName, id, cmd);
+        m_lastJitter = srtt > 0 ? llabs(roundTrip - srtt) : -1;
+        m_rtt.addSample(portName, id, cmd, roundTrip);
+    }
+
+    // read straight into a pooled frame, moving to a larger one only if
+    // the slave sends more than the pool capacity
+    MicontBusFrame &rx = *response;
+    rx = m_pool->acquire(expected);
+    int64_t lastByte = 0;
+    do {
+        for (;;) {
+            int room = rx.capacity() - rx.size();
+            if (room == 0 && port.bytesAvailable() > 0) {
+                MicontBusFrame larger = m_pool->acquire(rx.capacity() * 2);
+                larger.append(rx.constData(), rx.size());
+                rx = larger;
+                room = rx.capacity() - rx.size();
+            }
+            int64_t n = port.read(rx.data() + rx.size(), room);
+            if (n <= 0)
+                break;
+            rx.resize(rx.size() + n);
+            lastByte = busyUs();
+        }
+    } while (port.waitForReadyRead(10));
+
+    m_statRxBytes += rx.size();
+    counters.rxBytes.fetch_add(rx.size(), std::memory_order_relaxed);
+
+    // the trailing wait for more bytes is not bus time
+    account(MicontBusRttEstimator::frameTime(tx.size() + rx.size(), baudRate, bitsPerChar), lastByte, true);
+
+    // check CRC, the shortest valid frame is the 4 byte header
+    if (rx.size() < 4 + 2 || !MicontBusCodec::checkCrc(rx.constData(), rx.size())) {
+        m_statCrcErrors++;
+        counters.crcErrors.fetch_add(1, std::memory_order_relaxed);
+        return ResultCrcError;
+    }
+    rx.resize(rx.size() - 2);
+
+    // a well formed answer to another request, from a slave that answered
+    // late: as useless as a corrupted one
+    const uint8_t *d = rx.bytes();
+    const uint8_t *q = reinterpret_cast<const uint8_t *>(packet.data());
+    if (packet.size() >= 4 && (d[0] != q[0] || (d[1] & 0x0f) != (q[1] & 0x0f) || d[2] != q[2] || d[3] != q[3])) {
+        m_statCrcErrors++;
+        counters.crcErrors.fetch_add(1, std::memory_order_relaxed);
+        return ResultCrcError;
+    }
+
+    m_statRxPackets++;
+    counters.responses.fetch_add(1, std::memory_order_relaxed);
+    return ResultOk;
+}
+
+// Splits a transaction of duration us into wire time and the rest, which
+// is turnaround if the slave answered and wasted on a timeout otherwise.
+void MicontBusScheduler::account(int64_t wire, int64_t duration, bool answered)
+{
+    m_lastWire = wire;
+    m_lastDuration = duration;
+
+    m_busyTime.fetch_add(duration, std::memory_order_relaxed);
+    m_wireTime.fetch_add(wire, std::memory_order_relaxed);
+    if (answered)
+        m_turnaroundTime.fetch_add(std::max<int64_t>(0, duration - wire), std::memory_order_relaxed);
+    else
+        m_timeoutTime.fetch_add(std::max<int64_t>(0, duration - wire), std::memory_order_relaxed);
+}
+
+// Requeues a failed request with a jittered backoff if its class still has
+// attempts left. Called from the bus thread.
+bool MicontBusScheduler::retry(Request &request, MicontBusRetryPolicy::RetryClass retryClass)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+
+    if (m_quit || request.attempts[retryClass] >= m_policy.limit(retryClass))
+        return false;
+
+    if (!request.packet.empty() && m_health.isDown(request.portName, request.packet[0]))
+        return false;
+
+    // nobody wants the result any more, or not by the time it could be had
+    int64_t notBefore = elapsed() + m_policy.backoff(request.attempts[retryClass]);
+    if (request.token.isCancelled() || (request.deadline && notBefore >= request.deadline))
+        return false;
+
+    request.notBefore = notBefore;
+    request.attempts[retryClass]++;
+    m_statRetries++;
+    if (!request.packet.empty())
+        counters(request.portName, request.packet[0]).retries.fetch_add(1, std::memory_order_relaxed);
+
+    // ahead of newer requests of its class once the backoff expires
+    m_lanes[request.priority].push_front(request);
+    updateQueueDepth();
+    return true;
+}
+
+// Takes effect with the next transaction, which reopens the port.
+void MicontBusScheduler::setPortFactory(const PortFactory &factory)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_portFactory = factory;
+    m_portGeneration++;
+}
+
+void MicontBusScheduler::setSerialOptions(const MicontBusSerialOptions &options)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_options = options;
+}
+
+MicontBusSerialOptions MicontBusScheduler::serialOptions()
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_options;
+}
+
+void MicontBusScheduler::setRetryPolicy(const MicontBusRetryPolicy &policy)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_policy = policy;
+}
+
+MicontBusRetryPolicy MicontBusScheduler::retryPolicy()
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_policy;
+}
+
+int MicontBusScheduler::queueSize() const
+{
+    int size = 0;
+    for (int p = 0; p < PriorityCount; p++)
+        size += m_queueDepth[p].load(std::memory_order_relaxed);
+    return size;
+}
+
+int MicontBusScheduler::queueSize(Priority priority) const
+{
+    return m_queueDepth[priority].load(std::memory_order_relaxed);
+}
+
+void MicontBusScheduler::setHealthThresholds(int maxTimeouts, double maxCrcRate)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_health.setThresholds(maxTimeouts, maxCrcRate);
+}
+
+bool MicontBusScheduler::isSlaveDown(const std::string &portName, uint8_t id)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_health.isDown(portName, id);
+}
+
+std::vector<MicontBusRttEstimator::Sample> MicontBusScheduler::rttEstimates()
+{
+    std::lock_guard<std::mutex> locker(m_rttMutex);
+    return m_rtt.estimates();
+}
+
+void MicontBusScheduler::restoreRttEstimates(const std::vector<MicontBusRttEstimator::Sample> &estimates)
+{
+    std::lock_guard<std::mutex> locker(m_rttMutex);
+    for (size_t i = 0; i < estimates.size(); i++)
+        m_rtt.restore(estimates[i]);
+}
+
+std::vector<MicontBusHealth::Key> MicontBusScheduler::downSlaves()
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_health.downSlaves();
+}
+
+// Down slaves are probed in the background as soon as their port has
+// been given a transaction, instead of being found out by timeouts.
+void MicontBusScheduler::restoreDownSlaves(const std::vector<MicontBusHealth::Key> &slaves)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    for (size_t i = 0; i < slaves.size(); i++) {
+        m_health.restoreDown(slaves[i].first, slaves[i].second, elapsed());
+        counters(slaves[i].first, slaves[i].second).down.store(true, std::memory_order_relaxed);
+    }
+}
+
+void MicontBusScheduler::setAdaptiveTimeout(bool enable)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_adaptive = enable;
+}
+
+bool MicontBusScheduler::adaptiveTimeout()
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_adaptive;
+}
+
+// us, of the last answered transaction
+int64_t MicontBusScheduler::lastRoundTrip() const
+{
+    return m_lastRoundTrip.load(std::memory_order_relaxed);
+}
+
+MicontBusLatencyHistogram MicontBusScheduler::wakeupLatency() const
+{
+    return m_wakeupHistogram;
+}
+
+MicontBusLatencyHistogram MicontBusScheduler::cycleJitter() const
+{
+    return m_jitterHistogram;
+}
+
+void MicontBusScheduler::clearLatency()
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_wakeupHistogram.clear();
+    m_jitterHistogram.clear();
+}
+
+// All zero for a port the scheduler hasn't used.
+const MicontBusScheduler::SlaveCounters &MicontBusScheduler::slaveCounters(const std::string &portName,
+                                                                           uint8_t id) const
+{
+    static const SlaveCounters none;
+
+    std::lock_guard<std::mutex> locker(m_countersMutex);
+    std::map<std::string, std::unique_ptr<PortCounters> >::const_iterator it = m_counters.find(portName);
+    return it != m_counters.end() ? it->second->slaves[id] : none;
+}
+
+// Ports with counters, in name order.
+std::vector<std::string> MicontBusScheduler::counterPorts() const
+{
+    std::lock_guard<std::mutex> locker(m_countersMutex);
+    std::vector<std::string> ports;
+    for (std::map<std::string, std::unique_ptr<PortCounters> >::const_iterator it = m_counters.begin();
+         it != m_counters.end(); ++it)
+        ports.push_back(it->first);
+    return ports;
+}
+
+// The counters of a slave, created with its port. The entries stay where
+// they are, so references handed out before remain valid.
+MicontBusScheduler::SlaveCounters &MicontBusScheduler::counters(const std::string &portName, uint8_t id)
+{
+    std::lock_guard<std::mutex> locker(m_countersMutex);
+    std::unique_ptr<PortCounters> &port = m_counters[portName];
+    if (!port)
+        port.reset(new PortCounters);
+    return port->slaves[id];
+}
+
+// Time spent exchanging frames on the bus, us.
+uint64_t MicontBusScheduler::busyTime() const
+{
+    return m_busyTime.load(std::memory_order_relaxed);
+}
+
+uint64_t MicontBusScheduler::wireTime() const
+{
+    return m_wireTime.load(std::memory_order_relaxed);
+}
+
+uint64_t MicontBusScheduler::turnaroundTime() const
+{
+    return m_turnaroundTime.load(std::memory_order_relaxed);
+}
+
+uint64_t MicontBusScheduler::timeoutTime() const
+{
+    return m_timeoutTime.load(std::memory_order_relaxed);
+}
+
+// Requests dropped before transmission, by cancellation and by deadline.
+uint64_t MicontBusScheduler::droppedCancelled() const
+{
+    return m_droppedCancelled.load(std::memory_order_relaxed);
+}
+
+uint64_t MicontBusScheduler::droppedExpired() const
+{
+    return m_droppedExpired.load(std::memory_order_relaxed);
+}
+
+// Line usage of a port over the last seconds (up to a minute).
+MicontBusLineReport MicontBusScheduler::lineReport(const std::string &portName, int seconds)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    std::map<std::string, MicontBusLineStats>::const_iterator it = m_lineStats.find(portName);
+    if (it == m_lineStats.end())
+        return MicontBusLineReport();
+    return it->second.report(elapsed(), seconds);
+}
+
+void MicontBusScheduler::statClear()
+{
+    m_statRxBytes = 0;
+    m_statTxBytes = 0;
+    m_statRxPackets = 0;
+    m_statTxPackets = 0;
+    m_statCrcErrors = 0;
+    m_statTimeouts = 0;
+    m_statRetries = 0;
+}
+
+uint32_t MicontBusScheduler::statTxBytes() const
+{
+    return m_statTxBytes;
+}
+
+uint32_t MicontBusScheduler::statRxBytes() const
+{
+    return m_statRxBytes;
+}
+
+uint32_t MicontBusScheduler::statTxPackets() const
+{
+    return m_statTxPackets;
+}
+
+uint32_t MicontBusScheduler::statRxPackets() const
+{
+    return m_statRxPackets;
+}
+
+uint32_t MicontBusScheduler::statCrcErrors() const
+{
+    return m_statCrcErrors;
+}
+
+uint32_t MicontBusScheduler::statTimeouts() const
+{
+    return m_statTimeouts;
+}
+
+uint32_t MicontBusScheduler::statRetries() const
+{
+    return m_statRetries;
+}
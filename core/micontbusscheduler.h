@@ -0,0 +1,250 @@
+#ifndef MICONTBUSSCHEDULER_H
+#define MICONTBUSSCHEDULER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "micontbusport.h"
+#include "micontbuscanceltoken.h"
+#include "micontbusframepool.h"
+#include "micontbushealth.h"
+#include "micontbuslatencyhistogram.h"
+#include "micontbuslinestats.h"
+#include "micontbusretrypolicy.h"
+#include "micontbusrttestimator.h"
+
+/* Transaction scheduler of a bus master, standard library only: priority
+ * lanes, retries with backoff, deadlines and cancellation, per-slave
+ * health with background probes, adaptive timeouts from round-trip
+ * estimates and line accounting, over a MicontBusPort.
+ *
+ * run() is the bus loop. It runs on a thread of the caller's until stop()
+ * and reports every transaction to a Listener from that thread. Everything
+ * else may be called from any thread. MicontBusMaster is this behind Qt
+ * signals. */
+class MicontBusScheduler
+{
+public:
+    // request classes, highest first
+    enum Priority {
+        PriorityControl,        // operator writes, setpoints
+        PriorityInteractive,    // reads someone is waiting on
+        PriorityPolling,        // cyclic polling
+        PriorityBulk,           // bulk transfers, discovery
+        PriorityCount
+    };
+
+    // how a failed transaction should be reported
+    enum Failure {
+        FailureSilent,      // to the requester only
+        FailureError,       // as an error of the bus too
+        FailureTimeout      // as a timeout of the bus too
+    };
+
+    /* Outcome of the transactions, called on the bus thread. A frame
+     * holds a response without its CRC and may be kept past the call. */
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+
+        virtual void response(uint32_t tag, const MicontBusFrame &frame) = 0;
+        virtual void failure(uint8_t id, uint32_t tag, const std::string &s, Failure failure) = 0;
+        virtual void portError(const std::string &s) = 0;
+        virtual void slaveStateChanged(const std::string &portName, uint8_t id, bool up) = 0;
+    };
+
+    // counters for monitoring of a slave on a port, written by the bus
+    // thread only and readable from any thread without locking
+    struct SlaveCounters {
+        SlaveCounters()
+            : transactions(0), responses(0), txBytes(0), rxBytes(0), crcErrors(0), timeouts(0), retries(0),
+              down(false) {}
+
+        std::atomic<uint64_t> transactions;
+        std::atomic<uint64_t> responses;
+        std::atomic<uint64_t> txBytes;
+        std::atomic<uint64_t> rxBytes;
+        std::atomic<uint64_t> crcErrors;
+        std::atomic<uint64_t> timeouts;
+        std::atomic<uint64_t> retries;
+        std::atomic<bool> down;
+    };
+
+    // creates the port on the bus thread, which owns it
+    typedef std::function<MicontBusPort *()> PortFactory;
+
+    MicontBusScheduler();
+    ~MicontBusScheduler();
+
+    uint32_t transaction(const std::string &portName, int32_t baudRate, int32_t waitTimeout,
+                         const char *packet, int size, Priority priority = PriorityInteractive,
+                         int32_t deadline = 0, const MicontBusCancelToken &token = MicontBusCancelToken());
+    bool cancel(uint32_t tag);
+
+    void run(Listener *listener);
+    void stop();
+    std::vector<uint32_t> clear();
+
+    void setPortFactory(const PortFactory &factory);
+    void setSerialOptions(const MicontBusSerialOptions &options);
+    MicontBusSerialOptions serialOptions();
+
+    void setRetryPolicy(const MicontBusRetryPolicy &policy);
+    MicontBusRetryPolicy retryPolicy();
+    int queueSize() const;
+    int queueSize(Priority priority) const;
+
+    void setHealthThresholds(int maxTimeouts, double maxCrcRate);
+    bool isSlaveDown(const std::string &portName, uint8_t id);
+
+    // learned line state, e.g. for a snapshot
+    std::vector<MicontBusRttEstimator::Sample> rttEstimates();
+    void restoreRttEstimates(const std::vector<MicontBusRttEstimator::Sample> &estimates);
+    std::vector<MicontBusHealth::Key> downSlaves();
+    void restoreDownSlaves(const std::vector<MicontBusHealth::Key> &slaves);
+
+    void setAdaptiveTimeout(bool enable);
+    bool adaptiveTimeout();
+    int64_t lastRoundTrip() const;
+
+    MicontBusLatencyHistogram wakeupLatency() const;
+    MicontBusLatencyHistogram cycleJitter() const;
+    void clearLatency();
+
+    const SlaveCounters &slaveCounters(const std::string &portName, uint8_t id) const;
+    std::vector<std::string> counterPorts() const;
+    uint64_t busyTime() const;
+    uint64_t wireTime() const;
+    uint64_t turnaroundTime() const;
+    uint64_t timeoutTime() const;
+    uint64_t droppedCancelled() const;
+    uint64_t droppedExpired() const;
+
+    MicontBusLineReport lineReport(const std::string &portName, int seconds);
+
+    void statClear();
+    uint32_t statTxBytes() const;
+    uint32_t statRxBytes() const;
+    uint32_t statTxPackets() const;
+    uint32_t statRxPackets() const;
+    uint32_t statCrcErrors() const;
+    uint32_t statTimeouts() const;
+    uint32_t statRetries() const;
+
+private:
+    struct Request {
+        Request() : tag(0), priority(PriorityInteractive), baudRate(0), waitTimeout(0), queued(0), notBefore(0), deadline(0),
+            probe(false)
+        {
+            for (int i = 0; i < MicontBusRetryPolicy::RetryClassCount; i++)
+                attempts[i] = 0;
+        }
+
+        uint32_t tag;
+        Priority priority;
+        std::string portName;
+        int32_t baudRate;
+        std::string packet;     // without CRC, short requests need no allocation
+        int32_t waitTimeout;
+        int attempts[MicontBusRetryPolicy::RetryClassCount];
+        int64_t queued;     // us
+        int64_t notBefore;  // ms
+        int64_t deadline;   // ms, 0 for none
+        MicontBusCancelToken token;
+        bool probe;     // internal health probe, not reported
+    };
+
+    enum Result {
+        ResultOk,
+        ResultCrcError,
+        ResultReadTimeout,
+        ResultWriteTimeout
+    };
+
+    int64_t elapsed() const;
+    int64_t elapsedUs() const;
+    int64_t takeRequest(Request *request);
+    int64_t dropStale(int64_t now);
+    void failStale(Listener *listener, const std::vector<Request> &dropped);
+    void fail(Listener *listener, const Request &request, const std::string &s, Failure failure);
+    std::vector<Request> takeAll();
+    std::vector<Request> takePort(const std::string &portName);
+    Result exchange(MicontBusPort &port, int32_t baudRate, int bitsPerChar, bool adaptive,
+                    Request &request, MicontBusFrame *response);
+    bool retry(Request &request, MicontBusRetryPolicy::RetryClass retryClass);
+    void updateQueueDepth();
+    void account(int64_t wire, int64_t duration, bool answered);
+    SlaveCounters &counters(const std::string &portName, uint8_t id);
+
+    std::chrono::steady_clock::time_point m_start;
+
+    // guarded by m_mutex
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::map<std::string, int32_t> m_ports;    // baud rate of each port used, for health probes
+    PortFactory m_portFactory;
+    unsigned m_portGeneration;  // bumped by setPortFactory(), the port is recreated
+    MicontBusSerialOptions m_options;
+    std::deque<Request> m_lanes[PriorityCount];
+    std::vector<Request> m_stale;   // cancelled or expired, not reported yet
+    int m_bulkStarvation;
+    uint32_t m_nextTag;
+    MicontBusRetryPolicy m_policy;
+    MicontBusHealth m_health;
+    int32_t m_probeTimeout;
+    bool m_quit;
+    bool m_adaptive;
+    std::map<std::string, MicontBusLineStats> m_lineStats;
+    // timing determinism, written under m_mutex and read without
+    MicontBusLatencyHistogram m_wakeupHistogram;
+    MicontBusLatencyHistogram m_jitterHistogram;
+
+    MicontBusFramePool *m_pool;
+
+    // written by the bus thread only
+    int64_t m_lastJitter;
+    int64_t m_lastWire;
+    int64_t m_lastDuration;
+    std::atomic<int64_t> m_lastRoundTrip;
+
+    // per port, created by the bus thread and never removed
+    struct PortCounters {
+        SlaveCounters slaves[256];
+    };
+    std::map<std::string, std::unique_ptr<PortCounters> > m_counters;
+    mutable std::mutex m_countersMutex;
+
+    std::atomic<uint64_t> m_busyTime;    // us, from first byte out to last byte in
+    std::atomic<uint64_t> m_wireTime;    // us, theoretical character time of the frames
+    std::atomic<uint64_t> m_turnaroundTime;
+    std::atomic<uint64_t> m_timeoutTime;
+    std::atomic<uint64_t> m_droppedCancelled;
+    std::atomic<uint64_t> m_droppedExpired;
+    std::atomic<int> m_queueDepth[PriorityCount];
+
+    // round-trip estimates, used by the bus thread without m_mutex
+    MicontBusRttEstimator m_rtt;
+    std::mutex m_rttMutex;
+
+// statistics
+    uint32_t m_statTxBytes;
+    uint32_t m_statRxBytes;
+    uint32_t m_statTxPackets;
+    uint32_t m_statRxPackets;
+    uint32_t m_statCrcErrors;
+    uint32_t m_statTimeouts;
+    uint32_t m_statRetries;
+};
+
+#endif // MICONTBUSSCHEDULER_H
@@ -1,8 +1,482 @@
 #include "window.h"
+#include "micontbusmaster.h"
+#include "micontbusgateway.h"
+#include "micontbusimagepublisher.h"
+#include "micontbushistorian.h"
+#include "micontbuschangedetector.h"
+#include "micontbusmetricsserver.h"
+#include "micontbussniffer.h"
+#include "micontbuscapture.h"
+#include "micontbussnapshot.h"
+#include "micontbusstress.h"
+#ifdef Q_OS_UNIX
+#include "micontbussimulator.h"
+#endif
+
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QTimer>
+#include <QFile>
+#include <QDateTime>
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include <QSocketNotifier>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+static bool isHeadless(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        if (!qstrcmp(argv[i], "--gateway") || !qstrcmp(argv[i], "--sniff")
+                || !qstrcmp(argv[i], "--stress"))
+            return true;
+    }
+    return false;
+}
+
+#ifdef Q_OS_UNIX
+static int quitPipe[2] = { -1, -1 };
+
+static void quitSignalHandler(int)
+{
+    char c = 0;
+    ssize_t n = ::write(quitPipe[1], &c, 1);
+    (void)n;
+}
+
+// SIGTERM and SIGINT end the event loop like a normal exit, so that the
+// aboutToQuit() handlers, e.g. the last snapshot save, still run. The
+// handler only writes to a pipe the event loop watches.
+static bool quitOnSignals(QCoreApplication &a)
+{
+    if (::pipe(quitPipe) < 0)
+        return false;
+    for (int i = 0; i < 2; i++) {
+        fcntl(quitPipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(quitPipe[i], F_SETFL, fcntl(quitPipe[i], F_GETFL) | O_NONBLOCK);
+    }
+
+    QSocketNotifier *notifier = new QSocketNotifier(quitPipe[0], QSocketNotifier::Read, &a);
+    QObject::connect(notifier, SIGNAL(activated(int)), &a, SLOT(quit()));
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = quitSignalHandler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    return sigaction(SIGTERM, &sa, 0) == 0 && sigaction(SIGINT, &sa, 0) == 0;
+}
+#endif
+
+static int runGateway(QCoreApplication &a)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("MicontBUS RTU Master");
+    parser.addHelpOption();
+
+    QCommandLineOption gatewayOption("gateway", "Run a TCP gateway on <tcp-port>, without GUI.", "tcp-port");
+    QCommandLineOption bindOption("bind", "Address the gateway listens on, any for all interfaces.", "address", "127.0.0.1");
+    QCommandLineOption portOption("port", "Serial port name.", "name");
+    QCommandLineOption speedOption("speed", "Serial port baud rate.", "baud", "115200");
+    QCommandLineOption timeoutOption("timeout", "Response timeout upper bound, ms.", "ms", "1000");
+    QCommandLineOption imageOption("image", "Publish polled variables to shared memory <name>.", "name");
+    QCommandLineOption historyOption("history", "Record polled variables to the historian in <dir>.", "dir");
+    QCommandLineOption retentionOption("retention", "Historian retention, hours.", "hours", "336");
+    QCommandLineOption changesOption("changes-only", "Record only changed variables to the historian.");
+    QCommandLineOption refreshOption("refresh", "With --changes-only, record all variables at least every <s> seconds, 0 for never.",
+                                     "s", "60");
+    QCommandLineOption deadbandOption("deadband", "Float deadband for recording, <id>:<addr>:<value>[%].", "band");
+    QCommandLineOption metricsOption("metrics", "Serve Prometheus metrics on localhost:<tcp-port>.", "tcp-port");
+    QCommandLineOption metricsSocketOption("metrics-socket", "Serve Prometheus metrics on local socket <name>.", "name");
+    QCommandLineOption backendOption("backend", "Serial backend: qt or posix (termios/poll).", "name", "qt");
+    QCommandLineOption dataBitsOption("data-bits", "Data bits per character, 5 to 8.", "n", "8");
+    QCommandLineOption parityOption("parity", "Parity: none, even or odd.", "name", "none");
+    QCommandLineOption stopBitsOption("stop-bits", "Stop bits, 1 or 2.", "n", "1");
+    QCommandLineOption rs485Option("rs485", "Enable kernel RS-485 direction control (posix backend).");
+    QCommandLineOption realtimeOption("realtime", "Run the bus thread under SCHED_FIFO <priority> with locked memory.", "priority");
+    QCommandLineOption cpuOption("cpu", "Pin the real-time bus thread to <cpu>.", "cpu");
+    QCommandLineOption latencyOption("latency-report", "Log wakeup latency and cycle jitter every <s> seconds.", "s");
+    QCommandLineOption sniffOption("sniff", "Listen only: decode the traffic of another master, without GUI.");
+    QCommandLineOption captureOption("capture", "Record the sniffed traffic to capture <file>.", "file");
+    QCommandLineOption gapOption("gap", "Pause that ends a sniffed frame, us.", "us", "20000");
+    QCommandLineOption decodeOption("decode-workers", "Threads decoding responses (up to 4), 0 to decode on the bus thread.", "n", "1");
+    QCommandLineOption snapshotOption("snapshot", "Restore learned bus state from <file> at start and keep it there.", "file");
+    QCommandLineOption snapshotIntervalOption("snapshot-interval", "Seconds between snapshot saves.", "s", "60");
+    QCommandLineOption stressOption("stress", "Generate load for <s> seconds and report, on simulated slaves without --port.", "s");
+    QCommandLineOption stressSlavesOption("stress-slaves", "Slaves to load, ids 1..<n>.", "n", "4");
+    QCommandLineOption stressVarsOption("stress-vars", "Variables of each loaded slave.", "n", "256");
+    QCommandLineOption stressRateOption("stress-rate", "Reads, writes and bulk reads per second.", "r,w,b", "200,20,5");
+    QCommandLineOption stressDeadlineOption("stress-deadline", "Deadline of each generated request, ms.", "ms", "0");
+    QCommandLineOption stressFaultsOption("stress-faults", "Faults of the simulated slaves, crc=%,truncate=%,late=%,busy=%,"
+                                          "storm=n,late-delay=ms,disconnect=ms,disconnect-time=ms.", "spec");
+    QCommandLineOption stressReportOption("stress-report", "Seconds between load reports.", "s", "10");
+    parser.addOption(gatewayOption);
+    parser.addOption(bindOption);
+    parser.addOption(portOption);
+    parser.addOption(speedOption);
+    parser.addOption(timeoutOption);
+    parser.addOption(imageOption);
+    parser.addOption(historyOption);
+    parser.addOption(retentionOption);
+    parser.addOption(changesOption);
+    parser.addOption(refreshOption);
+    parser.addOption(deadbandOption);
+    parser.addOption(metricsOption);
+    parser.addOption(metricsSocketOption);
+    parser.addOption(backendOption);
+    parser.addOption(dataBitsOption);
+    parser.addOption(parityOption);
+    parser.addOption(stopBitsOption);
+    parser.addOption(rs485Option);
+    parser.addOption(realtimeOption);
+    parser.addOption(cpuOption);
+    parser.addOption(latencyOption);
+    parser.addOption(decodeOption);
+    parser.addOption(sniffOption);
+    parser.addOption(captureOption);
+    parser.addOption(gapOption);
+    parser.addOption(snapshotOption);
+    parser.addOption(snapshotIntervalOption);
+    parser.addOption(stressOption);
+    parser.addOption(stressSlavesOption);
+    parser.addOption(stressVarsOption);
+    parser.addOption(stressRateOption);
+    parser.addOption(stressDeadlineOption);
+    parser.addOption(stressFaultsOption);
+    parser.addOption(stressReportOption);
+    parser.process(a);
+
+#ifdef Q_OS_UNIX
+    if (!quitOnSignals(a))
+        qWarning() << "can't handle SIGTERM and SIGINT, error code" << errno;
+#endif
+
+    bool stress = parser.isSet(stressOption);
+    if (!parser.isSet(portOption) && !stress) {
+        qCritical() << "--port is required in gateway and sniffer mode";
+        return 1;
+    }
+    QString portName = parser.value(portOption);
+
+    // the posix backend and a short timeout for load runs, unless asked otherwise
+    QString backendName = parser.value(backendOption);
+    int waitTimeout = parser.value(timeoutOption).toInt();
+    if (stress && !parser.isSet(backendOption))
+        backendName = "posix";
+    if (stress && !parser.isSet(timeoutOption))
+        waitTimeout = 100;
+
+    // outlive the master and the sniffer, whose threads write them
+    MicontBusImagePublisher image;
+    MicontBusHistorian historian;
+    MicontBusChangeDetector changes;
+    MicontBusCaptureWriter capture;
+#ifdef Q_OS_UNIX
+    MicontBusSimulator simulator;
+#endif
+
+    MicontBusTransport::Backend backend = MicontBusTransport::BackendQt;
+    if (backendName == "posix") {
+        if (!MicontBusTransport::isAvailable(MicontBusTransport::BackendPosix)) {
+            qCritical() << "posix backend is not available on this platform";
+            return 1;
+        }
+        backend = MicontBusTransport::BackendPosix;
+    } else if (backendName != "qt") {
+        qCritical() << "unknown backend" << backendName;
+        return 1;
+    }
+
+    // the gateway can write to the bus, so it stays local unless asked
+    QHostAddress bindAddress(QHostAddress::LocalHost);
+    if (parser.value(bindOption) == "any") {
+        bindAddress = QHostAddress::Any;
+    } else if (!bindAddress.setAddress(parser.value(bindOption))) {
+        qCritical() << "invalid bind address" << parser.value(bindOption);
+        return 1;
+    }
+
+    MicontBusSerialOptions options;
+    options.dataBits = parser.value(dataBitsOption).toInt();
+    options.stopBits = parser.value(stopBitsOption).toInt();
+    options.rs485 = parser.isSet(rs485Option);
+    if (options.dataBits < 5 || options.dataBits > 8) {
+        qCritical() << "data bits must be 5 to 8";
+        return 1;
+    }
+    if (options.stopBits != 1 && options.stopBits != 2) {
+        qCritical() << "stop bits must be 1 or 2";
+        return 1;
+    }
+    QString parity = parser.value(parityOption);
+    if (parity == "even") {
+        options.parity = MicontBusSerialOptions::ParityEven;
+    } else if (parity == "odd") {
+        options.parity = MicontBusSerialOptions::ParityOdd;
+    } else if (parity != "none") {
+        qCritical() << "unknown parity" << parity;
+        return 1;
+    }
+
+    MicontBusMaster master;
+    master.setBackend(backend);
+    master.setSerialOptions(options);
+
+    // responses come from the line instead of the master
+    bool sniff = parser.isSet(sniffOption);
+    MicontBusSniffer sniffer;
+    QObject *source = &master;
+    if (sniff) {
+        sniffer.setPort(portName, parser.value(speedOption).toInt());
+        sniffer.setBackend(backend);
+        sniffer.setSerialOptions(options);
+        sniffer.setGapTimeout(parser.value(gapOption).toInt());
+        if (parser.isSet(captureOption)) {
+            if (!capture.open(parser.value(captureOption), parser.value(speedOption).toInt())) {
+                qCritical() << capture.errorString();
+                return 1;
+            }
+            sniffer.setCapture(&capture);
+        }
+        QObject::connect(&sniffer, &MicontBusSniffer::error, &a, [](const QString &s) {
+            qCritical() << qPrintable(s);
+            QCoreApplication::exit(1);
+        });
+        source = &sniffer;
+    }
+
+    if (parser.isSet(realtimeOption)) {
+        MicontBusRealtimeOptions rt;
+        rt.enabled = true;
+        rt.priority = parser.value(realtimeOption).toInt();
+        if (parser.isSet(cpuOption))
+            rt.cpu = parser.value(cpuOption).toInt();
+        master.setRealtimeOptions(rt);
+    }
+
+    // the image has a single writer
+    int workers = parser.value(decodeOption).toInt();
+    if (workers > 1 && parser.isSet(imageOption)) {
+        qCritical() << "--image needs a single decode worker";
+        return 1;
+    }
+    master.setDecodeWorkers(workers);
+
+    QList<quint8> stressSlaves;
+    for (int id = 1; id <= qBound(1, parser.value(stressSlavesOption).toInt(), 255); id++)
+        stressSlaves.append(id);
+
+    // simulated slaves stand in for a missing --port
+    if (stress && !parser.isSet(portOption)) {
+#ifdef Q_OS_UNIX
+        QString spec = parser.value(stressFaultsOption);
+        bool ok = false;
+        MicontBusFaults faults = MicontBusFaults::fromString(spec, &ok);
+        if (!ok) {
+            qCritical() << "invalid faults" << spec;
+            return 1;
+        }
+        // past the master's timeout, so that late answers meet the next request
+        if (!spec.contains("late-delay"))
+            faults.lateDelay = 2 * waitTimeout;
+
+        simulator.setSlaves(stressSlaves, parser.value(stressVarsOption).toInt());
+        simulator.setFaults(faults);
+        if (!simulator.open(QString("/tmp/micontbus-stress-%1").arg(QCoreApplication::applicationPid()))) {
+            qCritical() << qPrintable(simulator.errorString());
+            return 1;
+        }
+        QObject::connect(&simulator, &MicontBusSimulator::error, &a, [](const QString &s) {
+            qCritical() << qPrintable(s);
+            QCoreApplication::exit(1);
+        });
+        simulator.start();
+        portName = simulator.portName();
+        qInfo() << "simulating" << stressSlaves.size() << "slaves on" << portName
+                << "with faults" << qPrintable(faults.toString());
+#else
+        qCritical() << "--stress needs --port on this platform";
+        return 1;
+#endif
+    }
+
+    QTimer latencyTimer;
+    if (parser.isSet(latencyOption)) {
+        QObject::connect(&latencyTimer, &QTimer::timeout, [&master]() {
+            qInfo() << "wakeup latency" << master.wakeupLatency().toString().c_str();
+            qInfo() << "cycle jitter" << master.cycleJitter().toString().c_str();
+        });
+        latencyTimer.start(parser.value(latencyOption).toInt() * 1000);
+    }
+
+    MicontBusGateway gateway(&master);
+    gateway.setSerialPort(portName,
+                          parser.value(speedOption).toInt(),
+                          waitTimeout);
+
+    if (parser.isSet(imageOption)) {
+        if (!image.open(parser.value(imageOption))) {
+            qCritical() << image.errorString();
+            return 1;
+        }
+        QObject::connect(source, SIGNAL(responseFrame(MicontBusFrame)),
+                         &image, SLOT(processFrame(MicontBusFrame)), Qt::DirectConnection);
+    }
+
+    if (parser.isSet(historyOption)) {
+        if (!historian.open(parser.value(historyOption))) {
+            qCritical() << historian.errorString();
+            return 1;
+        }
+        historian.setMaxSegments(parser.value(retentionOption).toInt());
+
+        if (parser.isSet(changesOption)) {
+            // a steady value would otherwise be recorded once, and a query
+            // over a later range would find nothing
+            bool ok = false;
+            qint64 refresh = parser.value(refreshOption).toLongLong(&ok);
+            if (!ok || refresh < 0) {
+                qCritical() << "invalid refresh interval" << parser.value(refreshOption);
+                return 1;
+            }
+            changes.setRefreshInterval(refresh * 1000);
+
+            foreach (QString band, parser.values(deadbandOption)) {
+                MicontBusChangeDetector::DeadbandType type = MicontBusChangeDetector::DeadbandAbsolute;
+                if (band.endsWith('%')) {
+                    type = MicontBusChangeDetector::DeadbandPercent;
+                    band.chop(1);
+                }
+                QStringList fields = band.split(':');
+                bool ok1 = false, ok2 = false, ok3 = false;
+                if (fields.size() == 3) {
+                    quint8 id = fields[0].toUShort(&ok1, 0);
+                    quint16 addr = fields[1].toUShort(&ok2, 0);
+                    changes.setDeadband(id, addr, type, fields[2].toDouble(&ok3));
+                }
+                if (!ok1 || !ok2 || !ok3) {
+                    qCritical() << "invalid deadband" << band;
+                    return 1;
+                }
+            }
+            QObject::connect(source, SIGNAL(response(QByteArray)),
+                             &changes, SLOT(processResponse(QByteArray)));
+            QObject::connect(&changes, SIGNAL(response(QByteArray)),
+                             &historian, SLOT(processResponse(QByteArray)));
+        } else {
+            QObject::connect(source, SIGNAL(response(QByteArray)),
+                             &historian, SLOT(processResponse(QByteArray)));
+        }
+    }
+
+    // before the first transaction, so that the bus thread starts from it
+    MicontBusSnapshot snapshot;
+    QTimer snapshotTimer;
+    if (parser.isSet(snapshotOption)) {
+        QString path = parser.value(snapshotOption);
+        if (!sniff)
+            snapshot.setMaster(&master);
+        if (image.isOpen())
+            snapshot.setImage(&image);
+
+        if (!QFile::exists(path)) {
+            qInfo() << "no snapshot at" << path << "yet";
+        } else if (snapshot.load(path)) {
+            qInfo() << "restored snapshot of" << QDateTime::fromMSecsSinceEpoch(snapshot.created()).toString(Qt::ISODate)
+                    << "with" << snapshot.roundTrips() << "round-trip estimates," << snapshot.downSlaves()
+                    << "down slaves," << snapshot.imageBlocks() << "image blocks";
+        } else {
+            qWarning() << "ignoring snapshot:" << qPrintable(snapshot.errorString());
+        }
+
+        // periodic saves are quiet unless they fail, the last one is logged
+        auto save = [&snapshot, path]() {
+            if (!snapshot.save(path)) {
+                qWarning() << "can't save snapshot:" << qPrintable(snapshot.errorString());
+                return false;
+            }
+            return true;
+        };
+        QObject::connect(&snapshotTimer, &QTimer::timeout, save);
+        QObject::connect(&a, &QCoreApplication::aboutToQuit, [save, path]() {
+            if (save())
+                qInfo() << "saved snapshot to" << path;
+        });
+        snapshotTimer.start(qMax(1, parser.value(snapshotIntervalOption).toInt()) * 1000);
+    }
+
+    MicontBusMetricsServer metrics;
+    if (sniff)
+        metrics.addSniffer(&sniffer, portName);
+    else
+        metrics.addMaster(&master, portName);
+    if (parser.isSet(metricsOption) && !metrics.listen(QHostAddress::LocalHost, parser.value(metricsOption).toUShort())) {
+        qCritical() << "can't serve metrics:" << metrics.errorString();
+        return 1;
+    }
+    if (parser.isSet(metricsSocketOption) && !metrics.listenLocal(parser.value(metricsSocketOption))) {
+        qCritical() << "can't serve metrics:" << metrics.errorString();
+        return 1;
+    }
+
+    if (stress) {
+        QStringList rates = parser.value(stressRateOption).split(',');
+        if (rates.size() != 3) {
+            qCritical() << "--stress-rate takes reads,writes,bulk";
+            return 1;
+        }
+
+        MicontBusStressOptions stressOptions;
+        stressOptions.readRate = rates[0].toDouble();
+        stressOptions.writeRate = rates[1].toDouble();
+        stressOptions.bulkRate = rates[2].toDouble();
+        stressOptions.slaveVars = parser.value(stressVarsOption).toInt();
+        stressOptions.bulkVars = qMin(stressOptions.bulkVars, stressOptions.slaveVars);
+        stressOptions.waitTimeout = waitTimeout;
+        stressOptions.deadline = parser.value(stressDeadlineOption).toInt();
+        stressOptions.duration = parser.value(stressOption).toInt();
+        stressOptions.reportInterval = qMax(1, parser.value(stressReportOption).toInt());
+
+        MicontBusStress load;
+        load.setOptions(stressOptions);
+        load.setSlaves(stressSlaves);
+
+#ifdef Q_OS_UNIX
+        if (simulator.isRunning())
+            load.setSimulator(&simulator);
+#endif
+        load.setMaster(&master, portName, parser.value(speedOption).toInt());
+
+        QObject::connect(&load, &MicontBusStress::finished, &a, [&load]() {
+            QCoreApplication::exit(load.exitCode());
+        });
+        load.start();
+        return a.exec();
+    }
+
+    if (sniff) {
+        sniffer.start();
+    } else if (!gateway.listen(bindAddress, parser.value(gatewayOption).toUShort())) {
+        qCritical() << "can't listen:" << gateway.errorString();
+        return 1;
+    }
+
+    return a.exec();
+}
 
 int main(int argc, char *argv[])
 {
+    if (isHeadless(argc, argv)) {
+        QCoreApplication a(argc, argv);
+        return runGateway(a);
+    }
+
     QApplication a(argc, argv);
     Window w;
     w.show();
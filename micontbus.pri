@@ -0,0 +1,90 @@
+#-------------------------------------------------
+#
+# MicontBUS bus layer without the GUI, shared by the master application
+# and the tests. The protocol core is compiled in rather than linked so
+# that either builds on its own.
+#
+#-------------------------------------------------
+
+QT       += serialport network
+
+CONFIG += c++2a
+# coroutines are behind a flag before GCC 11
+*-g++*: QMAKE_CXXFLAGS += -fcoroutines
+
+unix: LIBS += -lrt
+
+INCLUDEPATH += $$PWD $$PWD/core
+DEPENDPATH += $$PWD $$PWD/core
+
+SOURCES += \
+    $$PWD/core/micontbuscodec.cpp \
+    $$PWD/core/micontbusframepool.cpp \
+    $$PWD/core/micontbushealth.cpp \
+    $$PWD/core/micontbuslatencyhistogram.cpp \
+    $$PWD/core/micontbuslinestats.cpp \
+    $$PWD/core/micontbusretrypolicy.cpp \
+    $$PWD/core/micontbusrttestimator.cpp \
+    $$PWD/core/micontbusscheduler.cpp \
+    $$PWD/micontbuspacket.cpp \
+    $$PWD/micontbusasync.cpp \
+    $$PWD/micontbuscapture.cpp \
+    $$PWD/micontbuscaptureindex.cpp \
+    $$PWD/micontbuscapturemodel.cpp \
+    $$PWD/micontbuschangedetector.cpp \
+    $$PWD/micontbusdecoder.cpp \
+    $$PWD/micontbusframesizes.cpp \
+    $$PWD/micontbusgateway.cpp \
+    $$PWD/micontbushistorian.cpp \
+    $$PWD/micontbusimagepublisher.cpp \
+    $$PWD/micontbusmaster.cpp \
+    $$PWD/micontbusmetricsserver.cpp \
+    $$PWD/micontbusrealtime.cpp \
+    $$PWD/micontbusscanner.cpp \
+    $$PWD/micontbussnapshot.cpp \
+    $$PWD/micontbussniffer.cpp \
+    $$PWD/micontbusstress.cpp \
+    $$PWD/micontbustagdatabase.cpp \
+    $$PWD/micontbustransport.cpp
+
+HEADERS  += \
+    $$PWD/core/micontbuscanceltoken.h \
+    $$PWD/core/micontbuscodec.h \
+    $$PWD/core/micontbusframepool.h \
+    $$PWD/core/micontbushealth.h \
+    $$PWD/core/micontbuslatencyhistogram.h \
+    $$PWD/core/micontbuslinestats.h \
+    $$PWD/core/micontbusport.h \
+    $$PWD/core/micontbusretrypolicy.h \
+    $$PWD/core/micontbusrttestimator.h \
+    $$PWD/core/micontbusscheduler.h \
+    $$PWD/micontbuspacket.h \
+    $$PWD/micontbusprocessimage.h \
+    $$PWD/micontbusregistermap.h \
+    $$PWD/micontbusasync.h \
+    $$PWD/micontbuscapture.h \
+    $$PWD/micontbuscaptureindex.h \
+    $$PWD/micontbuscapturemodel.h \
+    $$PWD/micontbuschangedetector.h \
+    $$PWD/micontbusdecoder.h \
+    $$PWD/micontbusframesizes.h \
+    $$PWD/micontbusgateway.h \
+    $$PWD/micontbushistorian.h \
+    $$PWD/micontbusimagepublisher.h \
+    $$PWD/micontbusmaster.h \
+    $$PWD/micontbusmetricsserver.h \
+    $$PWD/micontbusrealtime.h \
+    $$PWD/micontbusscanner.h \
+    $$PWD/micontbussnapshot.h \
+    $$PWD/micontbussniffer.h \
+    $$PWD/micontbusspscring.h \
+    $$PWD/micontbusstress.h \
+    $$PWD/micontbustagdatabase.h \
+    $$PWD/micontbustransport.h
+
+unix {
+    SOURCES += $$PWD/core/micontbusposixport.cpp \
+        $$PWD/micontbussimulator.cpp
+    HEADERS += $$PWD/core/micontbusposixport.h \
+        $$PWD/micontbussimulator.h
+}
@@ -0,0 +1,13 @@
+#-------------------------------------------------
+#
+# Protocol core library for Qt-free users, the master application and
+# the tests. The application compiles the core in (micontbus.pri) and
+# builds on its own as well: qmake micontbus_master.pro
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS = core app tests
+
+app.file = micontbus_master.pro
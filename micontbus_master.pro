@@ -4,20 +4,19 @@
 #
 #-------------------------------------------------
 
-QT       += serialport
-
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 TARGET = micontbus_master
 TEMPLATE = app
 
+include(micontbus.pri)
 
 SOURCES += main.cpp\
-    micontbuspacket.cpp \
-    micontbusmaster.cpp \
+    capturedialog.cpp \
+    scandialog.cpp \
     window.cpp
 
 HEADERS  += \
-    micontbuspacket.h \
-    micontbusmaster.h \
+    capturedialog.h \
+    scandialog.h \
     window.h
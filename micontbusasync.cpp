@@ -0,0 +1,188 @@
+#include "micontbusasync.h"
+
+std::coroutine_handle<> MicontBusTask::FinalAwaiter::await_suspend(Handle h) noexcept
+{
+    promise_type &p = h.promise();
+    p.done = true;
+    if (p.continuation)
+        return p.continuation;
+    if (p.detached)
+        h.destroy();
+    return std::noop_coroutine();
+}
+
+// A task still running is left to finish on its own.
+MicontBusTask::~MicontBusTask()
+{
+    if (!m_handle)
+        return;
+    if (m_handle.promise().done)
+        m_handle.destroy();
+    else
+        m_handle.promise().detached = true;
+}
+
+// Fails at once on a bus that is going away.
+bool MicontBusAwaitable::await_ready()
+{
+    if (!m_bus->m_closing)
+        return false;
+    m_result.error = QObject::tr("bus closed");
+    return true;
+}
+
+void MicontBusAwaitable::await_suspend(std::coroutine_handle<> h)
+{
+    m_bus->submit(this, h);
+}
+
+MicontBusAsync::MicontBusAsync(MicontBusMaster *master, const QString &portName, qint32 baudRate, qint32 waitTimeout,
+                               QObject *parent)
+    : QObject(parent), m_master(master), m_portName(portName), m_baudRate(baudRate), m_waitTimeout(waitTimeout),
+      m_priority(MicontBusMaster::PriorityInteractive), m_deadline(0), m_closing(false),
+      m_token(MicontBusCancelToken::create())
+{
+    connect(m_master, SIGNAL(decoded(MicontBusResponse)),
+            this, SLOT(decoded(MicontBusResponse)));
+    connect(m_master, SIGNAL(transactionFailed(quint32,QString)),
+            this, SLOT(transactionFailed(quint32,QString)));
+}
+
+MicontBusAsync::~MicontBusAsync()
+{
+    m_closing = true;
+    m_token.cancel();
+
+    MicontBusResult result;
+    result.error = tr("bus closed");
+    while (!m_waiters.isEmpty())
+        resume(m_waiters.constBegin().key(), result);
+}
+
+QString MicontBusAsync::portName() const
+{
+    return m_portName;
+}
+
+// Priority of the requests queued from now on.
+void MicontBusAsync::setPriority(MicontBusMaster::Priority priority)
+{
+    m_priority = priority;
+}
+
+MicontBusMaster::Priority MicontBusAsync::priority() const
+{
+    return m_priority;
+}
+
+// Deadline of the requests queued from now on, ms from queuing, 0 for none.
+// A procedure gets "deadline expired" instead of a late result.
+void MicontBusAsync::setDeadline(qint32 deadline)
+{
+    m_deadline = deadline;
+}
+
+qint32 MicontBusAsync::deadline() const
+{
+    return m_deadline;
+}
+
+int MicontBusAsync::pendingCount() const
+{
+    return m_waiters.size();
+}
+
+// Whether tag is a transaction of this bus still waiting for its result.
+bool MicontBusAsync::isPending(quint32 tag) const
+{
+    return m_waiters.contains(tag);
+}
+
+MicontBusAwaitable MicontBusAsync::getSize(quint8 id)
+{
+    MicontBusPacket packet;
+    packet.setId(id);
+    packet.setCmd(MicontBusPacket::CMD_GETSIZE);
+    return MicontBusAwaitable(this, packet.serialize(), m_priority);
+}
+
+// count variables from addr, see MicontBusResult::variables.
+MicontBusAwaitable MicontBusAsync::read(quint8 id, quint16 addr, int count)
+{
+    return readBytes(id, addr, count * sizeof(quint32));
+}
+
+MicontBusAwaitable MicontBusAsync::readBytes(quint8 id, quint16 addr, int size)
+{
+    MicontBusPacket packet;
+    packet.setId(id);
+    packet.setCmd(MicontBusPacket::CMD_GETBUF_B);
+    packet.setAddr(addr);
+    packet.setSize(size);
+    return MicontBusAwaitable(this, packet.serialize(), m_priority);
+}
+
+// Writes go out as control requests, like the operator's writes.
+MicontBusAwaitable MicontBusAsync::write(quint8 id, quint16 addr, const QVector<tMicontVar> &vars)
+{
+    MicontBusPacket packet;
+    packet.setId(id);
+    packet.setCmd(MicontBusPacket::CMD_PUTBUF_B);
+    packet.setAddr(addr);
+    packet.setSize(vars.size() * sizeof(quint32));
+    packet.setVariables(vars);
+    return MicontBusAwaitable(this, packet.serialize(), MicontBusMaster::PriorityControl);
+}
+
+// Any request frame, without CRC.
+MicontBusAwaitable MicontBusAsync::transaction(const QByteArray &packet)
+{
+    return MicontBusAwaitable(this, packet, m_priority);
+}
+
+void MicontBusAsync::decoded(const MicontBusResponse &response)
+{
+    if (!m_waiters.contains(response.tag))
+        return;
+
+    MicontBusResult result;
+    result.packet = response.packet;
+    result.variables = response.variables;
+    if (!response.valid)
+        result.error = tr("packet parse error");
+    else if (result.result() != MicontBusPacket::CMD_RESULT_OK)
+        result.error = tr("slave result 0x%1").arg(result.result(), 2, 16, QLatin1Char('0'));
+    else
+        result.ok = true;
+    resume(response.tag, result);
+}
+
+void MicontBusAsync::transactionFailed(quint32 tag, const QString &s)
+{
+    if (!m_waiters.contains(tag))
+        return;
+
+    MicontBusResult result;
+    result.error = s;
+    resume(tag, result);
+}
+
+// The awaitable lives in the suspended coroutine's frame until it resumes.
+void MicontBusAsync::submit(MicontBusAwaitable *awaitable, std::coroutine_handle<> h)
+{
+    Waiter w;
+    w.awaitable = awaitable;
+    w.handle = h;
+
+    // results come back through the event loop, never before this returns
+    quint32 tag = m_master->transaction(m_portName, m_baudRate, m_waitTimeout, awaitable->m_packet,
+                                        awaitable->m_priority, m_deadline, m_token);
+    m_waiters.insert(tag, w);
+}
+
+void MicontBusAsync::resume(quint32 tag, const MicontBusResult &result)
+{
+    Waiter w = m_waiters.take(tag);
+    w.awaitable->m_result = result;
+    w.handle.resume();
+}
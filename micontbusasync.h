@@ -0,0 +1,166 @@
+#ifndef MICONTBUSASYNC_H
+#define MICONTBUSASYNC_H
+
+#include <QObject>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include <coroutine>
+#include <exception>
+
+#include "micontbusmaster.h"
+
+// Outcome of one awaited transaction.
+struct MicontBusResult
+{
+    MicontBusResult() : ok(false) {}
+
+    bool ok;
+    QString error;                  // set unless ok
+    MicontBusPacket packet;
+    QVector<tMicontVar> variables;
+
+    quint8 result() const { return packet.cmd() & 0xf0; }
+};
+
+/* Coroutine type for device procedures. The body starts running right
+ * away and runs until its first co_await. A task that is dropped goes on
+ * by itself and frees its frame when it finishes; a task can also be
+ * co_awaited from another task, which then resumes once it finishes. */
+class MicontBusTask
+{
+public:
+    struct promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(Handle h) noexcept;
+        void await_resume() const noexcept {}
+    };
+
+    struct promise_type {
+        promise_type() : done(false), detached(false) {}
+
+        MicontBusTask get_return_object() { return MicontBusTask(Handle::from_promise(*this)); }
+        std::suspend_never initial_suspend() const noexcept { return std::suspend_never(); }
+        FinalAwaiter final_suspend() const noexcept { return FinalAwaiter(); }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        std::coroutine_handle<> continuation;
+        bool done;
+        bool detached;
+    };
+
+    MicontBusTask(MicontBusTask &&other) : m_handle(other.m_handle) { other.m_handle = Handle(); }
+    ~MicontBusTask();
+
+    bool isDone() const { return !m_handle || m_handle.promise().done; }
+
+    bool await_ready() const noexcept { return isDone(); }
+    void await_suspend(std::coroutine_handle<> continuation) { m_handle.promise().continuation = continuation; }
+    void await_resume() const noexcept {}
+
+private:
+    explicit MicontBusTask(Handle h) : m_handle(h) {}
+    MicontBusTask(const MicontBusTask &);
+    MicontBusTask &operator=(const MicontBusTask &);
+
+    Handle m_handle;
+};
+
+class MicontBusAsync;
+
+// co_await on it queues the transaction and resumes with its result.
+class MicontBusAwaitable
+{
+public:
+    MicontBusAwaitable(MicontBusAsync *bus, const QByteArray &packet, MicontBusMaster::Priority priority)
+        : m_bus(bus), m_packet(packet), m_priority(priority) {}
+
+    bool await_ready();
+    void await_suspend(std::coroutine_handle<> h);
+    MicontBusResult await_resume() { return m_result; }
+
+private:
+    friend class MicontBusAsync;
+
+    MicontBusAsync *m_bus;
+    QByteArray m_packet;
+    MicontBusMaster::Priority m_priority;
+    MicontBusResult m_result;
+};
+
+/* Awaitable transactions on one port of a master, for writing multi-step
+ * procedures as plain sequential code:
+ *
+ *     MicontBusTask configure(MicontBusAsync &bus, quint8 id)
+ *     {
+ *         MicontBusResult size = co_await bus.getSize(id);
+ *         if (!size.ok)
+ *             co_return;
+ *         MicontBusResult header = co_await bus.read(id, 0x0000, 4);
+ *         ...
+ *         co_await bus.write(id, 0x0010, config);
+ *         MicontBusResult check = co_await bus.read(id, 0x0010, config.size());
+ *     }
+ *
+ * Coroutines suspend while their request is queued or on the wire and are
+ * resumed from the event loop of this object's thread, so any number of
+ * procedures, on any number of buses, run on that one thread without a
+ * stack of their own. Procedures still waiting when the bus is destroyed
+ * are resumed with an error and their queued requests never go out. */
+class MicontBusAsync : public QObject
+{
+    Q_OBJECT
+
+public:
+    MicontBusAsync(MicontBusMaster *master, const QString &portName, qint32 baudRate, qint32 waitTimeout,
+                   QObject *parent = 0);
+    ~MicontBusAsync();
+
+    QString portName() const;
+
+    void setPriority(MicontBusMaster::Priority priority);
+    MicontBusMaster::Priority priority() const;
+    void setDeadline(qint32 deadline);
+    qint32 deadline() const;
+    int pendingCount() const;
+    bool isPending(quint32 tag) const;
+
+    MicontBusAwaitable getSize(quint8 id);
+    MicontBusAwaitable read(quint8 id, quint16 addr, int count);
+    MicontBusAwaitable readBytes(quint8 id, quint16 addr, int size);
+    MicontBusAwaitable write(quint8 id, quint16 addr, const QVector<tMicontVar> &vars);
+    MicontBusAwaitable transaction(const QByteArray &packet);
+
+private slots:
+    void decoded(const MicontBusResponse &response);
+    void transactionFailed(quint32 tag, const QString &s);
+
+private:
+    friend class MicontBusAwaitable;
+
+    struct Waiter {
+        MicontBusAwaitable *awaitable;
+        std::coroutine_handle<> handle;
+    };
+
+    void submit(MicontBusAwaitable *awaitable, std::coroutine_handle<> h);
+    void resume(quint32 tag, const MicontBusResult &result);
+
+    MicontBusMaster *m_master;
+    QString m_portName;
+    qint32 m_baudRate;
+    qint32 m_waitTimeout;
+    MicontBusMaster::Priority m_priority;
+    qint32 m_deadline;
+    bool m_closing;
+    MicontBusCancelToken m_token;
+
+    QHash<quint32, Waiter> m_waiters;
+};
+
+#endif // MICONTBUSASYNC_H
@@ -0,0 +1,171 @@
+#include "micontbuscapture.h"
+
+#include <QDateTime>
+#include <QtEndian>
+
+#include <string.h>
+
+static const char CAPTURE_MAGIC[4] = { 'M', 'B', 'C', '1' };
+
+MicontBusCaptureWriter::MicontBusCaptureWriter()
+    : m_records(0)
+{
+}
+
+MicontBusCaptureWriter::~MicontBusCaptureWriter()
+{
+    close();
+}
+
+// Starts a new capture, replacing path.
+bool MicontBusCaptureWriter::open(const QString &path, qint32 baudRate)
+{
+    close();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        m_errorString = m_file.errorString();
+        return false;
+    }
+
+    uchar header[MicontBusCaptureReader::HeaderSize];
+    memcpy(header, CAPTURE_MAGIC, 4);
+    qToLittleEndian<qint32>(baudRate, header + 4);
+    qToLittleEndian<qint64>(QDateTime::currentMSecsSinceEpoch(), header + 8);
+    m_file.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+    m_records = 0;
+    return true;
+}
+
+void MicontBusCaptureWriter::close()
+{
+    m_file.close();
+}
+
+bool MicontBusCaptureWriter::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+QString MicontBusCaptureWriter::errorString() const
+{
+    return m_errorString;
+}
+
+// Goes through the QFile buffer, flush() makes it visible to readers.
+void MicontBusCaptureWriter::write(qint64 timestamp, MicontBusCaptureRecord::Type type, quint8 flags,
+                                   const char *data, int size)
+{
+    if (!m_file.isOpen())
+        return;
+
+    uchar header[MicontBusCaptureReader::RecordHeaderSize];
+    qToLittleEndian<qint64>(timestamp, header);
+    qToLittleEndian<quint16>(size, header + 8);
+    header[10] = type;
+    header[11] = flags;
+    m_file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    m_file.write(data, size);
+    m_records++;
+}
+
+void MicontBusCaptureWriter::flush()
+{
+    m_file.flush();
+}
+
+quint64 MicontBusCaptureWriter::records() const
+{
+    return m_records;
+}
+
+MicontBusCaptureReader::MicontBusCaptureReader()
+    : m_baudRate(0), m_startTime(0)
+{
+}
+
+bool MicontBusCaptureReader::open(const QString &path)
+{
+    close();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        m_errorString = m_file.errorString();
+        return false;
+    }
+
+    uchar header[HeaderSize];
+    if (m_file.read(reinterpret_cast<char *>(header), sizeof(header)) != sizeof(header)
+            || memcmp(header, CAPTURE_MAGIC, 4)) {
+        m_errorString = QString("%1 is not a capture file").arg(path);
+        m_file.close();
+        return false;
+    }
+
+    m_baudRate = qFromLittleEndian<qint32>(header + 4);
+    m_startTime = qFromLittleEndian<qint64>(header + 8);
+    return true;
+}
+
+void MicontBusCaptureReader::close()
+{
+    m_file.close();
+}
+
+QString MicontBusCaptureReader::errorString() const
+{
+    return m_errorString;
+}
+
+qint32 MicontBusCaptureReader::baudRate() const
+{
+    return m_baudRate;
+}
+
+qint64 MicontBusCaptureReader::startTime() const
+{
+    return m_startTime;
+}
+
+qint64 MicontBusCaptureReader::size() const
+{
+    return m_file.size();
+}
+
+// offset must be that of a record, see MicontBusCaptureRecord::offset.
+bool MicontBusCaptureReader::seek(qint64 offset)
+{
+    return m_file.seek(qMax<qint64>(HeaderSize, offset));
+}
+
+qint64 MicontBusCaptureReader::pos() const
+{
+    return m_file.pos();
+}
+
+// Reads the record at the current position. Returns false at the end of
+// the file, including a record still being written.
+bool MicontBusCaptureReader::next(MicontBusCaptureRecord *record)
+{
+    qint64 offset = m_file.pos();
+
+    uchar header[RecordHeaderSize];
+    if (m_file.read(reinterpret_cast<char *>(header), sizeof(header)) != sizeof(header)) {
+        m_file.seek(offset);
+        return false;
+    }
+
+    int size = qFromLittleEndian<quint16>(header + 8);
+    record->data = m_file.read(size);
+    if (record->data.size() != size) {
+        m_file.seek(offset);
+        return false;
+    }
+
+    record->offset = offset;
+    record->timestamp = qFromLittleEndian<qint64>(header);
+    record->type = (MicontBusCaptureRecord::Type)header[10];
+    record->flags = header[11];
+    return true;
+}
@@ -0,0 +1,89 @@
+#ifndef MICONTBUSCAPTURE_H
+#define MICONTBUSCAPTURE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+/* Bus capture file: a 16 byte header (magic "MBC1", baud rate, start time)
+ * followed by one record per frame seen on the line:
+ *
+ *     qint64  timestamp   us since epoch, first byte of the frame
+ *     quint16 size        bytes that follow, CRC included
+ *     quint8  type        MicontBusCaptureRecord::Type
+ *     quint8  flags       MicontBusCaptureRecord::Flag
+ *     size bytes
+ *
+ * all little endian. Bytes that didn't frame are kept as garbage records
+ * so that nothing seen on the line is lost. */
+struct MicontBusCaptureRecord
+{
+    enum Type {
+        Request,
+        Response,
+        Garbage
+    };
+
+    enum Flag {
+        FlagAnswer = 0x01,  // response to the request just before it
+        FlagGap = 0x02      // garbage cut short by a gap in the line
+    };
+
+    MicontBusCaptureRecord() : offset(0), timestamp(0), type(Garbage), flags(0) {}
+
+    qint64 offset;      // of the record in the file
+    qint64 timestamp;
+    Type type;
+    quint8 flags;
+    QByteArray data;
+};
+
+class MicontBusCaptureWriter
+{
+public:
+    MicontBusCaptureWriter();
+    ~MicontBusCaptureWriter();
+
+    bool open(const QString &path, qint32 baudRate);
+    void close();
+    bool isOpen() const;
+    QString errorString() const;
+
+    void write(qint64 timestamp, MicontBusCaptureRecord::Type type, quint8 flags, const char *data, int size);
+    void flush();
+
+    quint64 records() const;
+
+private:
+    QFile m_file;
+    QString m_errorString;
+    quint64 m_records;
+};
+
+class MicontBusCaptureReader
+{
+public:
+    enum { HeaderSize = 16, RecordHeaderSize = 12 };
+
+    MicontBusCaptureReader();
+
+    bool open(const QString &path);
+    void close();
+    QString errorString() const;
+
+    qint32 baudRate() const;
+    qint64 startTime() const;   // ms since epoch
+    qint64 size() const;
+
+    bool seek(qint64 offset);
+    qint64 pos() const;
+    bool next(MicontBusCaptureRecord *record);
+
+private:
+    QFile m_file;
+    QString m_errorString;
+    qint32 m_baudRate;
+    qint64 m_startTime;
+};
+
+#endif // MICONTBUSCAPTURE_H
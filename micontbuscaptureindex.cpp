@@ -0,0 +1,323 @@
+#include "micontbuscaptureindex.h"
+#include "micontbuspacket.h"
+
+#include <QtEndian>
+
+#include <algorithm>
+
+MicontBusCaptureIndex::MicontBusCaptureIndex()
+{
+    close();
+}
+
+bool MicontBusCaptureIndex::open(const QString &path)
+{
+    close();
+
+    if (!m_reader.open(path)) {
+        m_errorString = m_reader.errorString();
+        return false;
+    }
+    m_end = m_reader.pos();
+    return true;
+}
+
+void MicontBusCaptureIndex::close()
+{
+    m_reader.close();
+    m_end = 0;
+
+    m_offsets.clear();
+    m_times.clear();
+    m_types.clear();
+    m_flags.clear();
+    m_ids.clear();
+    m_cmds.clear();
+    m_addrs.clear();
+    m_spans.clear();
+    m_ordered = true;
+
+    for (int i = 0; i < 256; i++)
+        m_byId[i].clear();
+    for (int i = 0; i < 16; i++) {
+        m_byCmd[i].clear();
+        m_byResult[i].clear();
+    }
+
+    m_byAddr.clear();
+    m_addrSorted = 0;
+    m_maxSpan = 1;
+    m_lastRequest = -1;
+}
+
+QString MicontBusCaptureIndex::errorString() const
+{
+    return m_errorString;
+}
+
+// Indexes up to maxRecords (all if negative) of the records written since
+// the last call. Returns how many were added.
+int MicontBusCaptureIndex::update(int maxRecords)
+{
+    if (!m_reader.seek(m_end))
+        return 0;
+
+    MicontBusCaptureRecord r;
+    int added = 0;
+    while ((maxRecords < 0 || added < maxRecords) && m_reader.next(&r)) {
+        add(r);
+        added++;
+    }
+
+    m_end = m_reader.pos();
+    return added;
+}
+
+bool MicontBusCaptureIndex::atEnd() const
+{
+    return m_end >= m_reader.size();
+}
+
+qint64 MicontBusCaptureIndex::indexedSize() const
+{
+    return m_end;
+}
+
+qint64 MicontBusCaptureIndex::fileSize() const
+{
+    return m_reader.size();
+}
+
+int MicontBusCaptureIndex::count() const
+{
+    return m_offsets.size();
+}
+
+qint64 MicontBusCaptureIndex::offset(int record) const
+{
+    return m_offsets.at(record);
+}
+
+qint64 MicontBusCaptureIndex::timestamp(int record) const
+{
+    return m_times.at(record);
+}
+
+MicontBusCaptureRecord::Type MicontBusCaptureIndex::type(int record) const
+{
+    return (MicontBusCaptureRecord::Type)m_types.at(record);
+}
+
+quint8 MicontBusCaptureIndex::flags(int record) const
+{
+    return m_flags.at(record);
+}
+
+quint8 MicontBusCaptureIndex::id(int record) const
+{
+    return m_ids.at(record);
+}
+
+quint8 MicontBusCaptureIndex::cmd(int record) const
+{
+    return m_cmds.at(record);
+}
+
+int MicontBusCaptureIndex::addr(int record) const
+{
+    return m_addrs.at(record);
+}
+
+int MicontBusCaptureIndex::span(int record) const
+{
+    return m_spans.at(record);
+}
+
+qint64 MicontBusCaptureIndex::firstTimestamp() const
+{
+    return m_times.isEmpty() ? 0 : m_times.first();
+}
+
+qint64 MicontBusCaptureIndex::lastTimestamp() const
+{
+    return m_times.isEmpty() ? 0 : m_times.last();
+}
+
+// Record numbers matching filter, in file order.
+QVector<int> MicontBusCaptureIndex::search(const MicontBusCaptureFilter &filter) const
+{
+    QVector<int> result;
+
+    int first, last;
+    timeRange(filter, &first, &last);
+    if (first >= last)
+        return result;
+
+    // the candidate list with the fewest records in the time range
+    const QVector<int> *lists[3] = { 0, 0, 0 };
+    if (filter.id >= 0 && filter.id < 256)
+        lists[0] = &m_byId[filter.id];
+    if (filter.cmd >= 0 && filter.cmd < 16)
+        lists[1] = &m_byCmd[filter.cmd];
+    if (filter.result >= 0 && filter.result <= 0xf0)
+        lists[2] = &m_byResult[filter.result >> 4];
+
+    const int *begin = 0, *end = 0;
+    int best = last - first;
+    for (int i = 0; i < 3; i++) {
+        if (!lists[i])
+            continue;
+        const int *b = std::lower_bound(lists[i]->constBegin(), lists[i]->constEnd(), first);
+        const int *e = std::lower_bound(b, lists[i]->constEnd(), last);
+        if (e - b <= best) {
+            begin = b;
+            end = e;
+            best = e - b;
+        }
+    }
+
+    // blocks overlapping the address range start at most maxSpan before it
+    const AddrEntry *abegin = 0, *aend = 0;
+    if (filter.addrFrom >= 0 || filter.addrTo >= 0) {
+        sortAddresses();
+        int lo = qMax(0, filter.addrFrom);
+        int hi = filter.addrTo >= 0 ? filter.addrTo : 0xffff;
+        AddrEntry from = { (quint16)qMax(0, lo - m_maxSpan + 1), -1 };
+        AddrEntry to = { (quint16)qMin(hi, 0xffff), -1 };
+        abegin = std::lower_bound(m_byAddr.constBegin(), m_byAddr.constEnd(), from,
+                                  [](const AddrEntry &a, const AddrEntry &b) { return a.addr < b.addr; });
+        aend = std::upper_bound(abegin, m_byAddr.constEnd(), to,
+                                [](const AddrEntry &a, const AddrEntry &b) { return a.addr < b.addr; });
+    }
+
+    if (abegin && aend - abegin < best) {
+        for (const AddrEntry *a = abegin; a != aend; ++a) {
+            if (a->record >= first && a->record < last && matches(a->record, filter))
+                result.append(a->record);
+        }
+        std::sort(result.begin(), result.end());
+    } else if (begin) {
+        for (const int *r = begin; r != end; ++r) {
+            if (matches(*r, filter))
+                result.append(*r);
+        }
+    } else {
+        for (int r = first; r < last; r++) {
+            if (matches(r, filter))
+                result.append(r);
+        }
+    }
+
+    return result;
+}
+
+// Reads a record back from the file, e.g. for its data.
+bool MicontBusCaptureIndex::read(int record, MicontBusCaptureRecord *out)
+{
+    return m_reader.seek(m_offsets.at(record)) && m_reader.next(out);
+}
+
+void MicontBusCaptureIndex::add(const MicontBusCaptureRecord &r)
+{
+    int n = m_offsets.size();
+    quint8 id = 0, cmd = 0;
+    int addr = -1, span = 0;
+
+    if (r.type != MicontBusCaptureRecord::Garbage && r.data.size() >= 2) {
+        const uchar *d = reinterpret_cast<const uchar *>(r.data.constData());
+        id = d[0];
+        cmd = d[1];
+
+        quint8 c = cmd & 0xf;
+        if ((c == MicontBusPacket::CMD_GETBUF_B || c == MicontBusPacket::CMD_PUTBUF_B) && r.data.size() >= 6) {
+            addr = qFromLittleEndian<quint16>(d + 2);
+            span = qMax(1, (qFromLittleEndian<quint16>(d + 4) + 3) / 4);
+        } else if (r.type == MicontBusCaptureRecord::Response && (r.flags & MicontBusCaptureRecord::FlagAnswer)
+                   && m_lastRequest >= 0) {
+            addr = m_addrs.at(m_lastRequest);
+            span = m_spans.at(m_lastRequest);
+        }
+
+        m_byId[id].append(n);
+        m_byCmd[c].append(n);
+        m_byResult[cmd >> 4].append(n);
+        if (r.type == MicontBusCaptureRecord::Request)
+            m_lastRequest = n;
+    }
+
+    if (n && r.timestamp < m_times.last())
+        m_ordered = false;
+
+    m_offsets.append(r.offset);
+    m_times.append(r.timestamp);
+    m_types.append(r.type);
+    m_flags.append(r.flags);
+    m_ids.append(id);
+    m_cmds.append(cmd);
+    m_addrs.append(addr);
+    m_spans.append(span);
+
+    if (addr >= 0) {
+        AddrEntry e = { (quint16)addr, n };
+        m_byAddr.append(e);
+        m_maxSpan = qMax(m_maxSpan, span);
+    }
+}
+
+// Sorts what was added since the last time and merges it in.
+void MicontBusCaptureIndex::sortAddresses() const
+{
+    if (m_addrSorted == m_byAddr.size())
+        return;
+
+    auto less = [](const AddrEntry &a, const AddrEntry &b) {
+        return a.addr < b.addr || (a.addr == b.addr && a.record < b.record);
+    };
+    AddrEntry *begin = m_byAddr.begin();
+    std::sort(begin + m_addrSorted, m_byAddr.end(), less);
+    std::inplace_merge(begin, begin + m_addrSorted, m_byAddr.end(), less);
+    m_addrSorted = m_byAddr.size();
+}
+
+// Records [first, last) that can be in the time range of filter.
+void MicontBusCaptureIndex::timeRange(const MicontBusCaptureFilter &filter, int *first, int *last) const
+{
+    *first = 0;
+    *last = m_times.size();
+    if (!m_ordered)
+        return;
+
+    if (filter.timeFrom > 0)
+        *first = std::lower_bound(m_times.constBegin(), m_times.constEnd(), filter.timeFrom) - m_times.constBegin();
+    if (filter.timeTo > 0)
+        *last = std::upper_bound(m_times.constBegin(), m_times.constEnd(), filter.timeTo) - m_times.constBegin();
+}
+
+bool MicontBusCaptureIndex::matches(int record, const MicontBusCaptureFilter &filter) const
+{
+    if (filter.type >= 0 && m_types.at(record) != filter.type)
+        return false;
+    if ((filter.id >= 0 || filter.cmd >= 0 || filter.result >= 0)
+            && m_types.at(record) == MicontBusCaptureRecord::Garbage)
+        return false;
+    if (filter.id >= 0 && m_ids.at(record) != filter.id)
+        return false;
+    if (filter.cmd >= 0 && (m_cmds.at(record) & 0xf) != filter.cmd)
+        return false;
+    if (filter.result >= 0 && (m_cmds.at(record) & 0xf0) != filter.result)
+        return false;
+    if (filter.timeFrom > 0 && m_times.at(record) < filter.timeFrom)
+        return false;
+    if (filter.timeTo > 0 && m_times.at(record) > filter.timeTo)
+        return false;
+
+    if (filter.addrFrom >= 0 || filter.addrTo >= 0) {
+        int a = m_addrs.at(record);
+        int lo = qMax(0, filter.addrFrom);
+        int hi = filter.addrTo >= 0 ? filter.addrTo : 0xffff;
+        if (a < 0 || a > hi || a + m_spans.at(record) - 1 < lo)
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,106 @@
+#ifndef MICONTBUSCAPTUREINDEX_H
+#define MICONTBUSCAPTUREINDEX_H
+
+#include <QVector>
+#include <QString>
+
+#include "micontbuscapture.h"
+
+// Conditions of a capture search, -1 (or 0 for times) for "any".
+struct MicontBusCaptureFilter
+{
+    MicontBusCaptureFilter()
+        : type(-1), id(-1), cmd(-1), result(-1), addrFrom(-1), addrTo(-1), timeFrom(0), timeTo(0) {}
+
+    int type;           // MicontBusCaptureRecord::Type
+    int id;
+    int cmd;            // low nibble, MicontBusPacket::CMD_GETSIZE...
+    int result;         // high nibble, MicontBusPacket::CMD_RESULT_OK...
+    int addrFrom;       // variable addresses, a frame matches if its block
+    int addrTo;         // overlaps [addrFrom, addrTo]
+    qint64 timeFrom;    // us since epoch, inclusive
+    qint64 timeTo;
+};
+
+/* In-memory index over a capture file, so that searches don't read it.
+ * Every record gets a row of fixed-size columns (offset, time, id, command,
+ * result, address block); on top of those are posting lists of record
+ * numbers per slave id, command and result code, and the records sorted
+ * by block address. A search starts from whichever of these narrows it
+ * most, bounded by binary search on time, and checks the remaining
+ * conditions on the columns. Responses get the block of the request they
+ * answer when they don't carry one themselves.
+ *
+ * update() indexes what was appended since the last call, so a capture
+ * that is still being written can be followed. Records are kept in file
+ * order, which is time order for captures written by the sniffer. */
+class MicontBusCaptureIndex
+{
+public:
+    MicontBusCaptureIndex();
+
+    bool open(const QString &path);
+    void close();
+    QString errorString() const;
+
+    int update(int maxRecords = -1);
+    bool atEnd() const;
+    qint64 indexedSize() const;
+    qint64 fileSize() const;
+
+    int count() const;
+    qint64 offset(int record) const;
+    qint64 timestamp(int record) const;
+    MicontBusCaptureRecord::Type type(int record) const;
+    quint8 flags(int record) const;
+    quint8 id(int record) const;
+    quint8 cmd(int record) const;
+    int addr(int record) const;     // -1 if the frame has no block
+    int span(int record) const;     // variables
+
+    qint64 firstTimestamp() const;
+    qint64 lastTimestamp() const;
+
+    QVector<int> search(const MicontBusCaptureFilter &filter) const;
+    bool read(int record, MicontBusCaptureRecord *out);
+
+private:
+    struct AddrEntry {
+        quint16 addr;
+        int record;
+    };
+
+    void add(const MicontBusCaptureRecord &r);
+    void sortAddresses() const;
+    void timeRange(const MicontBusCaptureFilter &filter, int *first, int *last) const;
+    bool matches(int record, const MicontBusCaptureFilter &filter) const;
+
+    MicontBusCaptureReader m_reader;
+    QString m_errorString;
+    qint64 m_end;           // of the indexed part of the file
+
+    // columns, one entry per record
+    QVector<qint64> m_offsets;
+    QVector<qint64> m_times;
+    QVector<quint8> m_types;
+    QVector<quint8> m_flags;
+    QVector<quint8> m_ids;
+    QVector<quint8> m_cmds;
+    QVector<qint32> m_addrs;
+    QVector<quint16> m_spans;
+    bool m_ordered;         // times never go backwards
+
+    // posting lists, record numbers in ascending order
+    QVector<int> m_byId[256];
+    QVector<int> m_byCmd[16];
+    QVector<int> m_byResult[16];
+
+    // records with a block, sorted by address on the first search after update()
+    mutable QVector<AddrEntry> m_byAddr;
+    mutable int m_addrSorted;
+    int m_maxSpan;
+
+    int m_lastRequest;      // record of the latest request, -1 if none
+};
+
+#endif // MICONTBUSCAPTUREINDEX_H
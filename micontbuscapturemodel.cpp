@@ -0,0 +1,203 @@
+#include "micontbuscapturemodel.h"
+#include "micontbuscaptureindex.h"
+#include "micontbuspacket.h"
+
+#include <QDateTime>
+
+// records whose data is kept for repainting
+static const int CAPTURE_MODEL_CACHE = 1024;
+
+// bytes shown in the data column
+static const int CAPTURE_MODEL_DATA = 64;
+
+MicontBusCaptureModel::MicontBusCaptureModel(MicontBusCaptureIndex *index, QObject *parent)
+    : QAbstractTableModel(parent), m_index(index), m_all(true), m_rows(index->count())
+{
+}
+
+void MicontBusCaptureModel::showAll()
+{
+    beginResetModel();
+    m_records.clear();
+    m_all = true;
+    m_rows = m_index->count();
+    endResetModel();
+}
+
+// records are record numbers of the index, e.g. from search().
+void MicontBusCaptureModel::setRecords(const QVector<int> &records)
+{
+    beginResetModel();
+    m_records = records;
+    m_all = false;
+    m_rows = records.size();
+    endResetModel();
+}
+
+// Appends the records indexed since, when showing all of them.
+void MicontBusCaptureModel::refresh()
+{
+    if (!m_all || m_index->count() == m_rows)
+        return;
+
+    beginInsertRows(QModelIndex(), m_rows, m_index->count() - 1);
+    m_rows = m_index->count();
+    endInsertRows();
+}
+
+int MicontBusCaptureModel::record(int row) const
+{
+    return m_all ? row : m_records.at(row);
+}
+
+int MicontBusCaptureModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_rows;
+}
+
+int MicontBusCaptureModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant MicontBusCaptureModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_rows)
+        return QVariant();
+
+    int r = record(index.row());
+    bool garbage = m_index->type(r) == MicontBusCaptureRecord::Garbage;
+
+    if (role == Qt::TextAlignmentRole && index.column() != ColumnData)
+        return (int)(Qt::AlignRight | Qt::AlignVCenter);
+    if (role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (index.column()) {
+    case ColumnTime: {
+        qint64 t = m_index->timestamp(r);
+        return QString("%1%2").arg(QDateTime::fromMSecsSinceEpoch(t / 1000).toString("yyyy-MM-dd hh:mm:ss.zzz"))
+                              .arg(t % 1000, 3, 10, QLatin1Char('0'));
+    }
+    case ColumnType:
+        switch (m_index->type(r)) {
+        case MicontBusCaptureRecord::Request:
+            return tr("request");
+        case MicontBusCaptureRecord::Response:
+            return (m_index->flags(r) & MicontBusCaptureRecord::FlagAnswer) ? tr("response") : tr("unmatched");
+        default:
+            return tr("garbage");
+        }
+    case ColumnId:
+        return garbage ? QVariant() : QVariant((int)m_index->id(r));
+    case ColumnCmd:
+        return garbage ? QVariant() : QVariant(cmdName(m_index->cmd(r)));
+    case ColumnResult:
+        return garbage ? QVariant() : QVariant(resultName(m_index->cmd(r)));
+    case ColumnAddr:
+        if (m_index->addr(r) < 0)
+            return QVariant();
+        return QString("0x%1+%2").arg(m_index->addr(r), 4, 16, QLatin1Char('0')).arg(m_index->span(r));
+    case ColumnData: {
+        QByteArray data = recordData(r);
+        QString s = QString::fromLatin1(data.left(CAPTURE_MODEL_DATA).toHex(' '));
+        if (data.size() > CAPTURE_MODEL_DATA)
+            s.append(QString::fromLatin1(" ..."));
+        return s;
+    }
+    }
+
+    return QVariant();
+}
+
+QVariant MicontBusCaptureModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+        return QAbstractTableModel::headerData(section, orientation, role);
+
+    switch (section) {
+    case ColumnTime:
+        return tr("Time");
+    case ColumnType:
+        return tr("Type");
+    case ColumnId:
+        return tr("Id");
+    case ColumnCmd:
+        return tr("Cmd");
+    case ColumnResult:
+        return tr("Result");
+    case ColumnAddr:
+        return tr("Addr");
+    case ColumnData:
+        return tr("Data");
+    }
+
+    return QVariant();
+}
+
+QString MicontBusCaptureModel::cmdName(quint8 cmd)
+{
+    switch (cmd & 0x0f) {
+    case MicontBusPacket::CMD_GETSIZE:
+        return "GETSIZE";
+    case MicontBusPacket::CMD_GETBUF_B:
+        return "GETBUF_B";
+    case MicontBusPacket::CMD_GETBUF:
+        return "GETBUF";
+    case MicontBusPacket::CMD_PUTBUF_B:
+        return "PUTBUF_B";
+    case MicontBusPacket::CMD_PUTBUF:
+        return "PUTBUF";
+    }
+    return QString("0x%1").arg(cmd & 0x0f, 2, 16, QLatin1Char('0'));
+}
+
+// Empty for requests.
+QString MicontBusCaptureModel::resultName(quint8 cmd)
+{
+    switch (cmd & 0xf0) {
+    case 0:
+        return QString();
+    case MicontBusPacket::CMD_RESULT_OK:
+        return "OK";
+    case MicontBusPacket::CMD_RESULT_WAIT:
+        return "WAIT";
+    case MicontBusPacket::CMD_RESULT_BUSY:
+        return "BUSY";
+    case MicontBusPacket::CMD_RESULT_UCMD:
+        return "UCMD";
+    case MicontBusPacket::CMD_RESULT_ERRVAR:
+        return "ERRVAR";
+    case MicontBusPacket::CMD_RESULT_ERRCMD:
+        return "ERRCMD";
+    case MicontBusPacket::CMD_RESULT_ERRARG:
+        return "ERRARG";
+    case MicontBusPacket::CMD_RESULT_ERRBSIZE:
+        return "ERRBSIZE";
+    case MicontBusPacket::CMD_RESULT_ERRBADDR:
+        return "ERRBADDR";
+    case MicontBusPacket::CMD_RESULT_ERRPWD:
+        return "ERRPWD";
+    case MicontBusPacket::CMD_RESULT_ERRLFT:
+        return "ERRLFT";
+    case MicontBusPacket::CMD_RESULT_ERRDONE:
+        return "ERRDONE";
+    }
+    return QString("0x%1").arg(cmd & 0xf0, 2, 16, QLatin1Char('0'));
+}
+
+QByteArray MicontBusCaptureModel::recordData(int record) const
+{
+    QHash<int, QByteArray>::const_iterator it = m_cache.constFind(record);
+    if (it != m_cache.constEnd())
+        return it.value();
+
+    if (m_cache.size() >= CAPTURE_MODEL_CACHE)
+        m_cache.clear();
+
+    MicontBusCaptureRecord r;
+    if (!m_index->read(record, &r))
+        return QByteArray();
+    m_cache.insert(record, r.data);
+    return r.data;
+}
@@ -0,0 +1,57 @@
+#ifndef MICONTBUSCAPTUREMODEL_H
+#define MICONTBUSCAPTUREMODEL_H
+
+#include <QAbstractTableModel>
+#include <QHash>
+#include <QVector>
+
+class MicontBusCaptureIndex;
+
+/* Table over the records of a capture index, all of them or the result of
+ * a search. The columns come from the index; only the data column reads
+ * the file, and only for the rows a view asks for, so a view over millions
+ * of records costs what is on screen. */
+class MicontBusCaptureModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column {
+        ColumnTime,
+        ColumnType,
+        ColumnId,
+        ColumnCmd,
+        ColumnResult,
+        ColumnAddr,
+        ColumnData,
+        ColumnCount
+    };
+
+    MicontBusCaptureModel(MicontBusCaptureIndex *index, QObject *parent = 0);
+
+    void showAll();
+    void setRecords(const QVector<int> &records);
+    void refresh();
+    int record(int row) const;
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+
+    static QString cmdName(quint8 cmd);
+    static QString resultName(quint8 cmd);
+
+private:
+    QByteArray recordData(int record) const;
+
+    MicontBusCaptureIndex *m_index;
+    QVector<int> m_records;
+    bool m_all;
+    int m_rows;
+
+    // data of recently shown records
+    mutable QHash<int, QByteArray> m_cache;
+};
+
+#endif // MICONTBUSCAPTUREMODEL_H
@@ -0,0 +1,183 @@
+#include "micontbuschangedetector.h"
+#include "micontbuspacket.h"
+
+#include <QDateTime>
+#include <QVarLengthArray>
+#include <QtEndian>
+
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+MicontBusChangeDetector::MicontBusChangeDetector(QObject *parent)
+    : QObject(parent), m_refreshInterval(0), m_statVariables(0), m_statPublished(0)
+{
+}
+
+// Treats the variable as a float and suppresses changes within the band.
+void MicontBusChangeDetector::setDeadband(quint8 id, quint16 addr, DeadbandType type, double value)
+{
+    quint32 key = ((quint32)id << 16) | addr;
+    if (type == DeadbandNone) {
+        m_deadbands.remove(key);
+        return;
+    }
+
+    Deadband d;
+    d.type = type;
+    d.value = value;
+    m_deadbands.insert(key, d);
+}
+
+void MicontBusChangeDetector::clearDeadbands()
+{
+    m_deadbands.clear();
+}
+
+// Republishes whole plans at least this often (0 = never), so consumers
+// can tell a steady value from a lost slave.
+void MicontBusChangeDetector::setRefreshInterval(qint64 ms)
+{
+    m_refreshInterval = ms;
+}
+
+void MicontBusChangeDetector::reset()
+{
+    m_plans.clear();
+}
+
+quint64 MicontBusChangeDetector::statVariables() const
+{
+    return m_statVariables;
+}
+
+quint64 MicontBusChangeDetector::statPublished() const
+{
+    return m_statPublished;
+}
+
+// Sets a bit in mask for every 32 bit word that differs between a and b,
+// mask must hold (words + 63) / 64 entries. Returns the number of
+// differing words.
+int MicontBusChangeDetector::compare(const uchar *a, const uchar *b, int words, quint64 *mask)
+{
+    memset(mask, 0, ((words + 63) / 64) * sizeof(quint64));
+
+    int changed = 0;
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= words; i += 4) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i * 4));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i * 4));
+        int equal = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, vb)));
+        if (equal == 0xf)
+            continue;
+
+        quint64 bits = ~equal & 0xf;
+        mask[i / 64] |= bits << (i % 64);
+        changed += __builtin_popcount(bits);
+    }
+#endif
+    for (; i < words; i++) {
+        if (memcmp(a + i * 4, b + i * 4, 4)) {
+            mask[i / 64] |= (quint64)1 << (i % 64);
+            changed++;
+        }
+    }
+
+    return changed;
+}
+
+void MicontBusChangeDetector::processResponse(const QByteArray &rawPacket)
+{
+    if (rawPacket.size() < 6
+            || (quint8)rawPacket.at(1) != (MicontBusPacket::CMD_GETBUF_B | (int)MicontBusPacket::CMD_RESULT_OK)) {
+        emit response(rawPacket);
+        return;
+    }
+
+    const uchar *d = reinterpret_cast<const uchar *>(rawPacket.constData());
+    quint8 id = d[0];
+    quint16 addr = qFromLittleEndian<quint16>(d + 2);
+    quint16 size = qFromLittleEndian<quint16>(d + 4);
+    if (size % 4 != 0 || rawPacket.size() < 6 + size) {
+        emit response(rawPacket);
+        return;
+    }
+
+    int words = size / 4;
+    const char *data = rawPacket.constData() + 6;
+    m_statVariables += words;
+
+    quint64 key = ((quint64)size << 32) | ((quint32)id << 16) | addr;
+    Plan &plan = m_plans[key];
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    // first poll of the plan or due for a refresh: everything goes
+    if (plan.published.size() != size
+            || (m_refreshInterval > 0 && now - plan.lastRefresh >= m_refreshInterval)) {
+        plan.published = QByteArray(data, size);
+        plan.lastRefresh = now;
+        publish(id, addr, data, words);
+        return;
+    }
+
+    QVarLengthArray<quint64, 4> mask((words + 63) / 64);
+    char *published = plan.published.data();
+    if (compare(reinterpret_cast<const uchar *>(published), d + 6, words, mask.data()) == 0)
+        return;
+
+    // drop changes inside deadbands, then publish runs of what's left
+    int runStart = -1;
+    for (int i = 0; i <= words; i++) {
+        bool changed = false;
+        if (i < words && (mask[i / 64] >> (i % 64)) & 1) {
+            quint32 previous = qFromLittleEndian<quint32>(published + i * 4);
+            quint32 current = qFromLittleEndian<quint32>(data + i * 4);
+            changed = m_deadbands.isEmpty() || outsideDeadband(id, addr + i, previous, current);
+            if (changed)
+                memcpy(published + i * 4, data + i * 4, 4);
+        }
+
+        if (changed && runStart < 0) {
+            runStart = i;
+        } else if (!changed && runStart >= 0) {
+            publish(id, addr + runStart, data + runStart * 4, i - runStart);
+            runStart = -1;
+        }
+    }
+}
+
+bool MicontBusChangeDetector::outsideDeadband(quint8 id, quint16 addr, quint32 previous, quint32 current) const
+{
+    QHash<quint32, Deadband>::const_iterator it = m_deadbands.constFind(((quint32)id << 16) | addr);
+    if (it == m_deadbands.constEnd())
+        return true;
+
+    float p, c;
+    memcpy(&p, &previous, sizeof(p));
+    memcpy(&c, &current, sizeof(c));
+    if (isnan(p) != isnan(c))
+        return true;
+
+    double delta = fabs((double)c - p);
+    if (it.value().type == DeadbandPercent)
+        return delta > fabs((double)p) * it.value().value / 100.0;
+    return delta > it.value().value;
+}
+
+void MicontBusChangeDetector::publish(quint8 id, quint16 addr, const char *data, int words)
+{
+    m_statPublished += words;
+
+    MicontBusPacket packet;
+    packet.setId(id);
+    packet.setCmd(MicontBusPacket::CMD_GETBUF_B | (int)MicontBusPacket::CMD_RESULT_OK);
+    packet.setAddr(addr);
+    packet.setSize(words * 4);
+    packet.setData(QByteArray(data, words * 4));
+    emit response(packet.serialize());
+}
@@ -0,0 +1,70 @@
+#ifndef MICONTBUSCHANGEDETECTOR_H
+#define MICONTBUSCHANGEDETECTOR_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+
+/* Filter between the master and consumers of polled values. For every
+ * read plan, i.e. (id, address, count) of a GETBUF_B, it keeps the last
+ * published payload and compares new payloads word by word (SSE2 when
+ * available). Only runs of changed variables go on, as GETBUF_B responses
+ * of their own, so consumers need no changes. Float variables may have a
+ * deadband, against the last published value so slow drifts still show.
+ * Other responses pass through as they are.
+ *
+ * It is meant for consumers of a stream of values such as the historian.
+ * The GUI and the gateway answer requests and need every response whole,
+ * a filtered one would leave them without the values that didn't change. */
+class MicontBusChangeDetector : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum DeadbandType {
+        DeadbandNone,
+        DeadbandAbsolute,
+        DeadbandPercent     // of the last published value
+    };
+
+    MicontBusChangeDetector(QObject *parent = 0);
+
+    void setDeadband(quint8 id, quint16 addr, DeadbandType type, double value);
+    void clearDeadbands();
+    void setRefreshInterval(qint64 ms);
+    void reset();
+
+    quint64 statVariables() const;
+    quint64 statPublished() const;
+
+    static int compare(const uchar *a, const uchar *b, int words, quint64 *mask);
+
+public slots:
+    void processResponse(const QByteArray &rawPacket);
+
+signals:
+    void response(const QByteArray &packet);
+
+private:
+    struct Deadband {
+        DeadbandType type;
+        double value;
+    };
+
+    struct Plan {
+        Plan() : lastRefresh(0) {}
+        QByteArray published;
+        qint64 lastRefresh;
+    };
+
+    bool outsideDeadband(quint8 id, quint16 addr, quint32 previous, quint32 current) const;
+    void publish(quint8 id, quint16 addr, const char *data, int words);
+
+    QHash<quint64, Plan> m_plans;
+    QHash<quint32, Deadband> m_deadbands;
+    qint64 m_refreshInterval;
+    quint64 m_statVariables;
+    quint64 m_statPublished;
+};
+
+#endif // MICONTBUSCHANGEDETECTOR_H
@@ -0,0 +1,130 @@
+#include "micontbusdecoder.h"
+#include "micontbusmaster.h"
+
+static_assert(MicontBusDecoder::MaxWorkers * MicontBusDecoder::RingSize * 2 <= MICONTBUS_FRAME_POOL_COUNT,
+              "decoder rings must leave half the frame pool free");
+
+// Workers start right away with the scheduling of the calling thread, so
+// the master creates this before switching to real-time mode.
+MicontBusDecoder::MicontBusDecoder(MicontBusMaster *master, int workers)
+{
+    for (int i = 0; i < qBound(1, workers, (int)MaxWorkers); i++) {
+        Worker *w = new Worker(master);
+        w->start();
+        m_workers.append(w);
+    }
+}
+
+// Delivers whatever is still queued before the workers exit.
+MicontBusDecoder::~MicontBusDecoder()
+{
+    foreach (Worker *w, m_workers) {
+        w->stop();
+        delete w;
+    }
+}
+
+// Called from the bus thread only.
+void MicontBusDecoder::post(quint32 tag, const MicontBusFrame &frame)
+{
+    Entry entry;
+    entry.tag = tag;
+    entry.frame = frame;
+
+    quint8 id = frame.size() > 0 ? frame.bytes()[0] : 0;
+    m_workers[id % m_workers.size()]->post(entry);
+}
+
+// Called from the bus thread only, failure is a MicontBusScheduler::Failure.
+void MicontBusDecoder::postFailure(quint8 id, quint32 tag, const QString &s, int failure)
+{
+    Entry entry;
+    entry.tag = tag;
+    entry.error = s;
+    entry.failure = failure;
+
+    m_workers[id % m_workers.size()]->post(entry);
+}
+
+MicontBusDecoder::Worker::Worker(MicontBusMaster *master)
+    : m_master(master), m_sleeping(false), m_full(false), m_quit(false)
+{
+}
+
+// Waits for room if the worker is a full ring behind, responses are never
+// dropped. The bus thread sleeps rather than spins: under SCHED_FIFO a
+// spinning bus thread would keep a worker on the same CPU from ever
+// emptying the ring.
+void MicontBusDecoder::Worker::post(const Entry &entry)
+{
+    if (!m_ring.push(entry)) {
+        m_master->m_decodeStalls.fetch_add(1, std::memory_order_relaxed);
+
+        // same handshake as m_sleeping, the other way round
+        QMutexLocker locker(&m_mutex);
+        m_full.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!m_ring.push(entry))
+            m_room.wait(&m_mutex);
+        m_full.store(false, std::memory_order_relaxed);
+    }
+
+    // pairs with the worker's store to m_sleeping before it checks the ring
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed)) {
+        QMutexLocker locker(&m_mutex);
+        m_cond.wakeOne();
+    }
+}
+
+void MicontBusDecoder::Worker::stop()
+{
+    m_quit.store(true);
+    m_mutex.lock();
+    m_cond.wakeOne();
+    m_mutex.unlock();
+    wait();
+}
+
+void MicontBusDecoder::Worker::run()
+{
+    Entry entry;
+    forever {
+        while (m_ring.pop(&entry)) {
+            // pairs with post() setting m_full before it retries the push
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_full.load(std::memory_order_relaxed)) {
+                QMutexLocker locker(&m_mutex);
+                m_room.wakeOne();
+            }
+
+            deliver(entry);
+            entry = Entry();
+        }
+
+        if (m_quit.load())
+            break;
+
+        // the mutex is held from the last check until wait() releases it,
+        // so a wakeup from post() can't get lost
+        m_mutex.lock();
+        m_sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_ring.isEmpty() && !m_quit.load())
+            m_cond.wait(&m_mutex);
+        m_sleeping.store(false, std::memory_order_relaxed);
+        m_mutex.unlock();
+    }
+
+    // anything posted before stop()
+    while (m_ring.pop(&entry))
+        deliver(entry);
+}
+
+void MicontBusDecoder::Worker::deliver(const Entry &entry)
+{
+    if (entry.failure < 0)
+        m_master->deliver(entry.tag, entry.frame);
+    else
+        m_master->deliverFailure(entry.tag, entry.error, (MicontBusScheduler::Failure)entry.failure);
+}
@@ -0,0 +1,87 @@
+#ifndef MICONTBUSDECODER_H
+#define MICONTBUSDECODER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <QString>
+
+#include <atomic>
+
+#include "micontbuspacket.h"
+#include "micontbusframepool.h"
+#include "micontbusspscring.h"
+
+// A response parsed off the bus thread.
+struct MicontBusResponse
+{
+    MicontBusResponse() : tag(0), valid(false) {}
+
+    quint32 tag;
+    bool valid;                     // false if the frame didn't parse
+    MicontBusPacket packet;
+    QVector<tMicontVar> variables;  // data as variables, empty unless a multiple of 4 bytes
+};
+
+Q_DECLARE_METATYPE(MicontBusResponse)
+
+class MicontBusMaster;
+
+/* Second stage of the master: the bus thread only frames and checks CRCs
+ * and posts good frames here, one SPSC ring per worker thread. Workers
+ * parse the frames and deliver them through the master's signals, so
+ * slots connected with Qt::DirectConnection now run on a worker. Failed
+ * transactions are posted the same way, so everything about one slave
+ * goes to the same worker and keeps its order; with more than one worker,
+ * direct slots are called from several threads.
+ *
+ * The rings of all workers together hold at most half the global frame
+ * pool, the rest is left for frames on the bus thread and with consumers,
+ * so a backlog waits in the rings instead of spilling to the heap. */
+class MicontBusDecoder
+{
+public:
+    enum { RingSize = 32, MaxWorkers = 4 };
+
+    MicontBusDecoder(MicontBusMaster *master, int workers);
+    ~MicontBusDecoder();
+
+    void post(quint32 tag, const MicontBusFrame &frame);
+    void postFailure(quint8 id, quint32 tag, const QString &s, int failure);
+
+private:
+    struct Entry {
+        Entry() : tag(0), failure(-1) {}
+        quint32 tag;
+        MicontBusFrame frame;
+        QString error;
+        int failure;    // MicontBusScheduler::Failure, -1 for a response
+    };
+
+    class Worker : public QThread
+    {
+    public:
+        Worker(MicontBusMaster *master);
+
+        void post(const Entry &entry);
+        void stop();
+        void run();
+
+    private:
+        void deliver(const Entry &entry);
+
+        MicontBusMaster *m_master;
+        MicontBusSpscRing<Entry, RingSize> m_ring;
+        QMutex m_mutex;
+        QWaitCondition m_cond;      // the worker waits for entries
+        QWaitCondition m_room;      // the bus thread waits for a free slot
+        std::atomic<bool> m_sleeping;
+        std::atomic<bool> m_full;
+        std::atomic<bool> m_quit;
+    };
+
+    QVector<Worker *> m_workers;
+};
+
+#endif // MICONTBUSDECODER_H
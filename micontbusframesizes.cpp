@@ -0,0 +1,196 @@
+#include "micontbusframesizes.h"
+#include "micontbusframepool.h"
+
+#include <QSettings>
+#include <QStringList>
+#include <QUrl>
+
+// bound on the requests one search sends: a first try at the protocol
+// maximum, then halving down to a single variable
+static const int FRAME_SIZES_MAX_PROBES = 10;
+
+static const char FRAME_SIZES_GROUP[] = "FrameSizes";
+
+MicontBusFrameSizes::MicontBusFrameSizes(QObject *parent)
+    : QObject(parent), m_probeWrites(false)
+{
+}
+
+// Settings keys are FrameSizes/<port>/<id>/read and .../write, the port
+// name percent-encoded since device paths have slashes.
+void MicontBusFrameSizes::load()
+{
+    QSettings settings("MicontBUS", "MicontBUS RTU Master");
+    settings.beginGroup(FRAME_SIZES_GROUP);
+
+    m_limits.clear();
+    foreach (const QString &port, settings.childGroups()) {
+        QString portName = QUrl::fromPercentEncoding(port.toLatin1());
+        settings.beginGroup(port);
+        foreach (const QString &id, settings.childGroups()) {
+            bool ok;
+            uint n = id.toUInt(&ok);
+            if (!ok || n > 255)
+                continue;
+
+            Limits l;
+            l.read = settings.value(id + "/read").toInt();
+            l.write = settings.value(id + "/write").toInt();
+            if (l.read > 0 && l.write > 0)
+                m_limits.insert(Key(portName, n), l);
+        }
+        settings.endGroup();
+    }
+}
+
+void MicontBusFrameSizes::save() const
+{
+    QSettings settings("MicontBUS", "MicontBUS RTU Master");
+    settings.remove(FRAME_SIZES_GROUP);
+    settings.beginGroup(FRAME_SIZES_GROUP);
+
+    QHash<Key, Limits>::const_iterator it;
+    for (it = m_limits.constBegin(); it != m_limits.constEnd(); ++it) {
+        QString key = QString("%1/%2/").arg(QString::fromLatin1(QUrl::toPercentEncoding(it.key().first)))
+                                       .arg((int)it.key().second);
+        settings.setValue(key + "read", it.value().read);
+        settings.setValue(key + "write", it.value().write);
+    }
+}
+
+bool MicontBusFrameSizes::contains(const QString &portName, quint8 id) const
+{
+    return m_limits.contains(Key(portName, id));
+}
+
+MicontBusFrameSizes::Limits MicontBusFrameSizes::limits(const QString &portName, quint8 id) const
+{
+    return m_limits.value(Key(portName, id));
+}
+
+void MicontBusFrameSizes::setLimits(const QString &portName, quint8 id, const Limits &limits)
+{
+    m_limits.insert(Key(portName, id), limits);
+}
+
+// Forgets the slave, e.g. after a firmware change; save() to make it stick.
+void MicontBusFrameSizes::remove(const QString &portName, quint8 id)
+{
+    m_limits.remove(Key(portName, id));
+}
+
+// Data bytes of the largest GETBUF_B, fallback if the slave is unknown.
+int MicontBusFrameSizes::maxRead(const QString &portName, quint8 id, int fallback) const
+{
+    QHash<Key, Limits>::const_iterator it = m_limits.constFind(Key(portName, id));
+    return (it != m_limits.constEnd() && it.value().read > 0) ? it.value().read : fallback;
+}
+
+int MicontBusFrameSizes::maxWrite(const QString &portName, quint8 id, int fallback) const
+{
+    QHash<Key, Limits>::const_iterator it = m_limits.constFind(Key(portName, id));
+    return (it != m_limits.constEnd() && it.value().write > 0) ? it.value().write : fallback;
+}
+
+// Off by default, discovery then takes the read limit for writes too: a
+// PUTBUF_B request is as long as the GETBUF_B response of the same size.
+// Write probing reads the block and writes it back unchanged, which is
+// only safe where the controller doesn't update that block itself.
+void MicontBusFrameSizes::setProbeWrites(bool enable)
+{
+    m_probeWrites = enable;
+}
+
+bool MicontBusFrameSizes::probeWrites() const
+{
+    return m_probeWrites;
+}
+
+// Searches the limits of slave id on the bus's port with the block at
+// addr, stores and saves them and emits discovered(). good is always a
+// size the slave took, bad one it refused.
+MicontBusTask MicontBusFrameSizes::discover(MicontBusAsync *bus, quint8 id, quint16 addr)
+{
+    QString portName = bus->portName();
+    int maxVars = maxFrameData() / sizeof(quint32);
+
+    // a single variable has to go through, else it's the slave or the address
+    MicontBusResult result = co_await bus->read(id, addr, 1);
+    if (!result.ok) {
+        emit discoveryFailed(portName, id, result.error);
+        co_return;
+    }
+
+    int good = 1;
+    int bad = maxVars + 1;
+    int probes = 1;
+    while (bad - good > 1 && probes < FRAME_SIZES_MAX_PROBES) {
+        // most slaves take the maximum, try that first
+        int n = (probes == 1) ? maxVars : (good + bad) / 2;
+        result = co_await bus->read(id, addr, n);
+        probes++;
+
+        if (result.ok) {
+            good = n;
+        } else if (tooBig(result)) {
+            bad = n;
+        } else {
+            emit discoveryFailed(portName, id, result.error);
+            co_return;
+        }
+    }
+
+    Limits l;
+    l.read = good * sizeof(quint32);
+    l.write = l.read;
+
+    if (m_probeWrites) {
+        good = 0;
+        bad = l.read / sizeof(quint32) + 1;
+        probes = 0;
+        while (bad - good > 1 && probes < FRAME_SIZES_MAX_PROBES) {
+            int n = (probes == 0) ? bad - 1 : (good + bad) / 2;
+            MicontBusResult data = co_await bus->read(id, addr, n);
+            if (!data.ok) {
+                emit discoveryFailed(portName, id, data.error);
+                co_return;
+            }
+
+            result = co_await bus->write(id, addr, data.variables);
+            probes++;
+
+            if (result.ok) {
+                good = n;
+            } else if (tooBig(result)) {
+                bad = n;
+            } else {
+                emit discoveryFailed(portName, id, result.error);
+                co_return;
+            }
+        }
+
+        if (good == 0) {
+            emit discoveryFailed(portName, id, tr("no write size accepted"));
+            co_return;
+        }
+        l.write = good * sizeof(quint32);
+    }
+
+    setLimits(portName, id, l);
+    save();
+    emit discovered(portName, id, l.read, l.write);
+}
+
+// Data bytes that fit a frame of the pool, the upper bound of the search.
+int MicontBusFrameSizes::maxFrameData()
+{
+    return MICONTBUS_FRAME_CAPACITY - 6 - 2;
+}
+
+// A block past the end of the slave's memory is refused with ERRBADDR,
+// which limits transfers from there just the same.
+bool MicontBusFrameSizes::tooBig(const MicontBusResult &result)
+{
+    return result.result() == MicontBusPacket::CMD_RESULT_ERRBSIZE
+            || result.result() == MicontBusPacket::CMD_RESULT_ERRBADDR;
+}
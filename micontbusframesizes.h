@@ -0,0 +1,62 @@
+#ifndef MICONTBUSFRAMESIZES_H
+#define MICONTBUSFRAMESIZES_H
+
+#include <QObject>
+#include <QHash>
+#include <QPair>
+#include <QString>
+
+#include "micontbusasync.h"
+
+/* Largest GETBUF_B and PUTBUF_B data size each slave accepts. Controllers
+ * answer CMD_RESULT_ERRBSIZE to a request over their buffer; discover()
+ * finds the limit with a bounded binary search over whole variables, and
+ * the result is kept in QSettings so it is only looked for once per slave.
+ * Anything that splits a transfer into frames asks maxRead()/maxWrite()
+ * and gets the biggest frame the slave takes. */
+class MicontBusFrameSizes : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Limits {
+        Limits() : read(0), write(0) {}
+
+        int read;   // bytes, 0 if unknown
+        int write;
+    };
+
+    MicontBusFrameSizes(QObject *parent = 0);
+
+    void load();
+    void save() const;
+
+    bool contains(const QString &portName, quint8 id) const;
+    Limits limits(const QString &portName, quint8 id) const;
+    void setLimits(const QString &portName, quint8 id, const Limits &limits);
+    void remove(const QString &portName, quint8 id);
+
+    int maxRead(const QString &portName, quint8 id, int fallback) const;
+    int maxWrite(const QString &portName, quint8 id, int fallback) const;
+
+    void setProbeWrites(bool enable);
+    bool probeWrites() const;
+
+    MicontBusTask discover(MicontBusAsync *bus, quint8 id, quint16 addr = 0);
+
+    static int maxFrameData();
+
+signals:
+    void discovered(const QString &portName, quint8 id, int read, int write);
+    void discoveryFailed(const QString &portName, quint8 id, const QString &s);
+
+private:
+    typedef QPair<QString, quint8> Key;
+
+    static bool tooBig(const MicontBusResult &result);
+
+    QHash<Key, Limits> m_limits;
+    bool m_probeWrites;
+};
+
+#endif // MICONTBUSFRAMESIZES_H
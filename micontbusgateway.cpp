@@ -0,0 +1,262 @@
+#include "micontbusgateway.h"
+#include "micontbusmaster.h"
+#include "micontbuspacket.h"
+
+#include <QTcpServer>
+#include <QTcpSocket>
+
+// frames a client may queue before further ones are answered BUSY
+static const int GATEWAY_MAX_QUEUED = 64;
+
+MicontBusGateway::MicontBusGateway(MicontBusMaster *master, QObject *parent)
+    : QObject(parent)
+    , m_master(master)
+    , m_server(new QTcpServer(this))
+    , m_baudRate(115200)
+    , m_waitTimeout(1000)
+    , m_mergedReads(0)
+    , m_busyAnswers(0)
+    , m_token(MicontBusCancelToken::create())
+{
+    connect(m_server, SIGNAL(newConnection()),
+            this, SLOT(newConnection()));
+    connect(m_master, SIGNAL(transactionFrame(quint32,MicontBusFrame)),
+            this, SLOT(transactionFrame(quint32,MicontBusFrame)));
+    connect(m_master, SIGNAL(transactionFailed(quint32,QString)),
+            this, SLOT(transactionFailed(quint32,QString)));
+}
+
+MicontBusGateway::~MicontBusGateway()
+{
+    close();
+}
+
+void MicontBusGateway::setSerialPort(const QString &portName, qint32 baudRate, qint32 waitTimeout)
+{
+    m_portName = portName;
+    m_baudRate = baudRate;
+    m_waitTimeout = waitTimeout;
+}
+
+// The gateway has no authentication, anyone who can connect writes to the
+// bus; listen on QHostAddress::LocalHost unless the network is trusted.
+bool MicontBusGateway::listen(const QHostAddress &address, quint16 port)
+{
+    return m_server->listen(address, port);
+}
+
+void MicontBusGateway::close()
+{
+    m_server->close();
+
+    // queued requests of the clients are of no use now
+    m_token.cancel();
+    m_token = MicontBusCancelToken::create();
+
+    foreach (Client *client, m_clients) {
+        client->socket->disconnect(this);
+        client->socket->abort();
+        client->socket->deleteLater();
+        delete client;
+    }
+    m_clients.clear();
+    m_pending.clear();
+    m_pendingReads.clear();
+}
+
+QString MicontBusGateway::errorString() const
+{
+    return m_server->errorString();
+}
+
+// The port listened on, useful after listen(0).
+quint16 MicontBusGateway::serverPort() const
+{
+    return m_server->serverPort();
+}
+
+int MicontBusGateway::clientCount() const
+{
+    return m_clients.size();
+}
+
+quint32 MicontBusGateway::mergedReads() const
+{
+    return m_mergedReads;
+}
+
+quint32 MicontBusGateway::busyAnswers() const
+{
+    return m_busyAnswers;
+}
+
+void MicontBusGateway::newConnection()
+{
+    while (m_server->hasPendingConnections()) {
+        Client *client = new Client;
+        client->socket = m_server->nextPendingConnection();
+        client->socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        m_clients.insert(client->socket, client);
+
+        connect(client->socket, SIGNAL(readyRead()),
+                this, SLOT(clientReadyRead()));
+        connect(client->socket, SIGNAL(disconnected()),
+                this, SLOT(clientDisconnected()));
+    }
+}
+
+void MicontBusGateway::clientReadyRead()
+{
+    Client *client = clientFor(sender());
+    if (!client)
+        return;
+
+    client->buffer += client->socket->readAll();
+    parseFrames(client);
+    submitNext(client);
+}
+
+void MicontBusGateway::clientDisconnected()
+{
+    Client *client = clientFor(sender());
+    if (!client)
+        return;
+
+    // a shared read still completes for the other waiters, a request no
+    // one waits for any more is taken off the bus queue
+    if (client->inFlight) {
+        QHash<quint32, Pending>::iterator it = m_pending.find(client->inFlight);
+        if (it != m_pending.end()) {
+            it->waiters.removeAll(client);
+            if (it->waiters.isEmpty())
+                m_master->cancel(client->inFlight);
+        }
+    }
+
+    m_clients.remove(client->socket);
+    client->socket->deleteLater();
+    delete client;
+}
+
+void MicontBusGateway::transactionFrame(quint32 tag, const MicontBusFrame &frame)
+{
+    complete(tag, &frame);
+}
+
+void MicontBusGateway::transactionFailed(quint32 tag, const QString &s)
+{
+    Q_UNUSED(s)
+
+    complete(tag, 0);
+}
+
+MicontBusGateway::Client *MicontBusGateway::clientFor(QObject *socket)
+{
+    return m_clients.value(socket);
+}
+
+// Splits the client stream into request frames using the header length
+// rules, dropping a byte at a time on garbage or CRC mismatch to resync.
+// A header announcing more than a frame can hold is garbage too, waiting
+// for its bytes would stall the client for good.
+void MicontBusGateway::parseFrames(Client *client)
+{
+    forever {
+        int size = MicontBusPacket::requestSize(client->buffer);
+        if (size < 0 || size + 2 > MICONTBUS_FRAME_CAPACITY) {
+            client->buffer.remove(0, 1);
+            continue;
+        }
+        if (size == 0 || client->buffer.size() < size + 2)
+            break;
+
+        QByteArray frame = client->buffer.left(size);
+        quint16 crc = ((quint16)(quint8)client->buffer.at(size + 1) << 8) | (quint8)client->buffer.at(size);
+        if (crc != MicontBusMaster::crc16(frame)) {
+            client->buffer.remove(0, 1);
+            continue;
+        }
+        client->buffer.remove(0, size + 2);
+
+        if (client->requests.size() < GATEWAY_MAX_QUEUED)
+            client->requests.enqueue(frame);
+        else
+            answerBusy(client, frame);
+    }
+}
+
+void MicontBusGateway::submitNext(Client *client)
+{
+    if (client->inFlight || client->requests.isEmpty())
+        return;
+
+    QByteArray request = client->requests.dequeue();
+    bool read = (request.at(1) & 0xf) != MicontBusPacket::CMD_PUTBUF_B;
+
+    if (read) {
+        QHash<QByteArray, quint32>::const_iterator it = m_pendingReads.constFind(request);
+        if (it != m_pendingReads.constEnd()) {
+            m_pending[it.value()].waiters.append(client);
+            client->inFlight = it.value();
+            m_mergedReads++;
+            return;
+        }
+    }
+
+    quint32 tag = m_master->transaction(m_portName, m_baudRate, m_waitTimeout, request,
+                                        read ? MicontBusMaster::PriorityPolling : MicontBusMaster::PriorityControl,
+                                        0, m_token);
+
+    Pending &pending = m_pending[tag];
+    pending.request = request;
+    pending.waiters.append(client);
+    if (read)
+        m_pendingReads.insert(request, tag);
+    client->inFlight = tag;
+}
+
+void MicontBusGateway::complete(quint32 tag, const MicontBusFrame *frame)
+{
+    QHash<quint32, Pending>::iterator it = m_pending.find(tag);
+    if (it == m_pending.end())
+        return;
+
+    Pending pending = it.value();
+    m_pending.erase(it);
+    if (m_pendingReads.value(pending.request) == tag)
+        m_pendingReads.remove(pending.request);
+
+    // straight from the pooled frame into the socket buffers
+    char crcBytes[2] = { 0, 0 };
+    if (frame) {
+        quint16 crc = MicontBusMaster::crc16(frame->constData(), frame->size());
+        crcBytes[0] = crc & 0xff;
+        crcBytes[1] = crc >> 8;
+    }
+
+    foreach (Client *client, pending.waiters) {
+        if (frame) {
+            client->socket->write(frame->constData(), frame->size());
+            client->socket->write(crcBytes, 2);
+        } else {
+            answerBusy(client, pending.request);
+        }
+        client->inFlight = 0;
+        submitNext(client);
+    }
+}
+
+// The header of request with a BUSY result, as a slave would send it.
+void MicontBusGateway::answerBusy(Client *client, const QByteArray &request)
+{
+    int cmd = request.at(1) & 0x0f;
+    QByteArray frame = request.left(cmd == MicontBusPacket::CMD_GETSIZE ? 4 : 6);
+    frame[1] = (char)(cmd | MicontBusPacket::CMD_RESULT_BUSY);
+
+    quint16 crc = MicontBusMaster::crc16(frame);
+    frame.append((char)(crc & 0xff));
+    frame.append((char)(crc >> 8));
+
+    client->socket->write(frame);
+    m_busyAnswers++;
+}
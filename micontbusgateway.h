@@ -0,0 +1,89 @@
+#ifndef MICONTBUSGATEWAY_H
+#define MICONTBUSGATEWAY_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QQueue>
+#include <QByteArray>
+#include <QHostAddress>
+
+#include "micontbuscanceltoken.h"
+#include "micontbusframepool.h"
+
+QT_BEGIN_NAMESPACE
+class QTcpServer;
+class QTcpSocket;
+QT_END_NAMESPACE
+
+class MicontBusMaster;
+
+/* TCP gateway: accepts MicontBUS frames (with CRC, as on the wire) from
+ * any number of clients and multiplexes them onto one serial bus through
+ * the master's request queue. Each client has at most one request on the
+ * bus at a time, so clients are served round robin. Identical reads that
+ * are in flight at the same time go out once and the response is sent to
+ * every client that asked. Transactions that fail on the bus, and frames
+ * beyond what a client may queue, are answered with a BUSY result so that
+ * the client backs off instead of waiting out its own timeout. A BUSY for
+ * a full queue is sent at once, ahead of the answers still queued. */
+class MicontBusGateway : public QObject
+{
+    Q_OBJECT
+
+public:
+    MicontBusGateway(MicontBusMaster *master, QObject *parent = 0);
+    ~MicontBusGateway();
+
+    void setSerialPort(const QString &portName, qint32 baudRate, qint32 waitTimeout);
+    bool listen(const QHostAddress &address, quint16 port);
+    void close();
+    QString errorString() const;
+    quint16 serverPort() const;
+
+    int clientCount() const;
+    quint32 mergedReads() const;
+    quint32 busyAnswers() const;
+
+private slots:
+    void newConnection();
+    void clientReadyRead();
+    void clientDisconnected();
+    void transactionFrame(quint32 tag, const MicontBusFrame &frame);
+    void transactionFailed(quint32 tag, const QString &s);
+
+private:
+    struct Client {
+        Client() : socket(0), inFlight(0) {}
+        QTcpSocket *socket;
+        QByteArray buffer;
+        QQueue<QByteArray> requests;
+        quint32 inFlight;   // tag of the request on the bus, 0 if none
+    };
+
+    struct Pending {
+        QByteArray request;
+        QList<Client *> waiters;
+    };
+
+    Client *clientFor(QObject *socket);
+    void parseFrames(Client *client);
+    void submitNext(Client *client);
+    void complete(quint32 tag, const MicontBusFrame *frame);
+    void answerBusy(Client *client, const QByteArray &request);
+
+    MicontBusMaster *m_master;
+    QTcpServer *m_server;
+    QString m_portName;
+    qint32 m_baudRate;
+    qint32 m_waitTimeout;
+
+    QHash<QObject *, Client *> m_clients;
+    QHash<quint32, Pending> m_pending;
+    QHash<QByteArray, quint32> m_pendingReads;
+    quint32 m_mergedReads;
+    quint32 m_busyAnswers;
+    MicontBusCancelToken m_token;   // requests of the current listening session
+};
+
+#endif // MICONTBUSGATEWAY_H
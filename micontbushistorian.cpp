@@ -0,0 +1,489 @@
+#include "micontbushistorian.h"
+#include "micontbuspacket.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QtEndian>
+
+#include <algorithm>
+#include <string.h>
+
+static const char HISTORIAN_MAGIC[4] = { 'M', 'B', 'H', '1' };
+static const int HISTORIAN_FILE_HEADER = 4 + 8;
+static const int HISTORIAN_CHUNK_HEADER = 4 + 4 + 8 + 8 + 8 + 4 + 4;
+
+namespace {
+
+class BitReader
+{
+public:
+    BitReader(const char *data, qint64 size) : m_data(reinterpret_cast<const uchar *>(data)), m_size(size * 8), m_bit(0) {}
+
+    // Reads bits MSB first, zero past the end.
+    quint64 read(int bits)
+    {
+        quint64 value = 0;
+        while (bits-- > 0) {
+            int bit = 0;
+            if (m_bit < m_size)
+                bit = (m_data[m_bit >> 3] >> (7 - (m_bit & 7))) & 1;
+            m_bit++;
+            value = (value << 1) | bit;
+        }
+        return value;
+    }
+
+private:
+    const uchar *m_data;
+    qint64 m_size;
+    qint64 m_bit;
+};
+
+int leadingZeros(quint32 v)
+{
+    return v ? __builtin_clz(v) : 32;
+}
+
+int trailingZeros(quint32 v)
+{
+    return v ? __builtin_ctz(v) : 32;
+}
+
+qint64 signExtend(quint64 value, int bits)
+{
+    quint64 sign = (quint64)1 << (bits - 1);
+    return (qint64)((value ^ sign) - sign);
+}
+
+// Length of a segment up to the end of its last complete chunk, 0 if not
+// even the file header is complete, -1 if the file is no segment.
+qint64 completeLength(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+
+    qint64 size = file.size();
+    QByteArray magic = file.read(HISTORIAN_FILE_HEADER);
+    if (magic.size() < HISTORIAN_FILE_HEADER)
+        return 0;
+    if (memcmp(magic.constData(), HISTORIAN_MAGIC, 4))
+        return -1;
+
+    qint64 end = HISTORIAN_FILE_HEADER;
+    for (;;) {
+        uchar raw[HISTORIAN_CHUNK_HEADER];
+        if (file.read(reinterpret_cast<char *>(raw), sizeof(raw)) != sizeof(raw))
+            break;
+
+        quint32 count = qFromLittleEndian<quint32>(raw + 4);
+        qint64 next = end + HISTORIAN_CHUNK_HEADER + qFromLittleEndian<quint32>(raw + 32)
+                + qFromLittleEndian<quint32>(raw + 36);
+        if (count == 0 || next > size || !file.seek(next))
+            break;
+        end = next;
+    }
+    return end;
+}
+
+}
+
+void MicontBusHistorian::BitWriter::write(quint64 value, int bits)
+{
+    while (bits-- > 0) {
+        if ((m_bits & 7) == 0)
+            m_bytes.append('\0');
+        if ((value >> bits) & 1)
+            m_bytes.data()[m_bits >> 3] |= 0x80 >> (m_bits & 7);
+        m_bits++;
+    }
+}
+
+MicontBusHistorian::MicontBusHistorian(QObject *parent)
+    : QObject(parent), m_segmentStart(-1), m_segmentDuration(3600 * 1000),
+      m_maxSegments(24 * 14), m_chunkSize(1024)
+{
+}
+
+MicontBusHistorian::~MicontBusHistorian()
+{
+    close();
+}
+
+bool MicontBusHistorian::open(const QString &directory)
+{
+    close();
+
+    QDir dir;
+    if (!dir.mkpath(directory)) {
+        m_errorString = tr("can't create %1").arg(directory);
+        return false;
+    }
+
+    m_directory = directory;
+    return true;
+}
+
+void MicontBusHistorian::close()
+{
+    if (m_directory.isEmpty())
+        return;
+
+    flush();
+    m_file.close();
+    m_directory.clear();
+    m_segmentStart = -1;
+}
+
+bool MicontBusHistorian::isOpen() const
+{
+    return !m_directory.isEmpty();
+}
+
+QString MicontBusHistorian::errorString() const
+{
+    return m_errorString;
+}
+
+void MicontBusHistorian::setSegmentDuration(qint64 ms)
+{
+    m_segmentDuration = qMax<qint64>(1000, ms);
+}
+
+// Retention, in segments: weeks of data are maxSegments * segmentDuration.
+void MicontBusHistorian::setMaxSegments(int count)
+{
+    m_maxSegments = qMax(1, count);
+}
+
+void MicontBusHistorian::setChunkSize(int points)
+{
+    m_chunkSize = qMax(2, points);
+}
+
+void MicontBusHistorian::append(quint8 id, quint16 addr, qint64 timestamp, quint32 value)
+{
+    if (m_directory.isEmpty())
+        return;
+
+    if (m_segmentStart < 0 || timestamp >= m_segmentStart + m_segmentDuration) {
+        if (!startSegment(timestamp))
+            return;
+    }
+
+    quint32 series = ((quint32)id << 16) | addr;
+    Chunk &chunk = m_chunks[series];
+    encode(chunk, timestamp, value);
+
+    if (chunk.count >= m_chunkSize)
+        writeChunk(series, chunk);
+}
+
+// Writes out all open chunks; the data becomes durable but compresses
+// less than in full chunks.
+void MicontBusHistorian::flush()
+{
+    QHash<quint32, Chunk>::iterator it;
+    for (it = m_chunks.begin(); it != m_chunks.end(); ++it) {
+        if (it.value().count)
+            writeChunk(it.key(), it.value());
+    }
+    m_file.flush();
+}
+
+// Points of a series with from <= timestamp <= to, oldest first.
+QVector<MicontBusHistorian::Point> MicontBusHistorian::query(quint8 id, quint16 addr, qint64 from, qint64 to)
+{
+    QVector<Point> points;
+    if (m_directory.isEmpty() || from > to)
+        return points;
+
+    quint32 series = ((quint32)id << 16) | addr;
+    m_file.flush();
+
+    // a segment holds the data up to the start of the next one
+    QList<qint64> starts = segments();
+    for (int i = 0; i < starts.size(); i++) {
+        if (starts[i] > to)
+            break;
+        if (i + 1 < starts.size() && starts[i + 1] <= from)
+            continue;
+        querySegment(segmentPath(starts[i]), series, from, to, &points);
+    }
+
+    QHash<quint32, Chunk>::const_iterator it = m_chunks.constFind(series);
+    if (it != m_chunks.constEnd() && it.value().count) {
+        const Chunk &chunk = it.value();
+        if (chunk.maxTs >= from && chunk.minTs <= to) {
+            ChunkHeader header;
+            header.series = series;
+            header.count = chunk.count;
+            header.firstTs = chunk.firstTs;
+            header.timestampBytes = chunk.timestamps.bytes().size();
+            header.valueBytes = chunk.values.bytes().size();
+            decode(header, chunk.timestamps.bytes().constData(), chunk.values.bytes().constData(), from, to, &points);
+        }
+    }
+
+    return points;
+}
+
+void MicontBusHistorian::processResponse(const QByteArray &rawPacket)
+{
+    MicontBusPacket p;
+    if (!p.parse(rawPacket))
+        return;
+
+    if (p.cmd() != (MicontBusPacket::CMD_GETBUF_B | (int)MicontBusPacket::CMD_RESULT_OK))
+        return;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QVector<tMicontVar> vars = p.variables();
+    for (int i = 0; i < vars.size(); i++)
+        append(p.id(), p.addr() + i, now, vars[i].u);
+}
+
+// Timestamps: the first one is in the chunk header, then delta of deltas
+// in 0, 7, 9, 12 or 64 bit buckets. Values: the first one in full, then
+// 0 for an unchanged value, 10 plus the meaningful bits if they fit the
+// previous window, or 11, 5 bits of leading zeros, 5 bits of length - 1
+// and the meaningful bits.
+void MicontBusHistorian::encode(Chunk &chunk, qint64 timestamp, quint32 value)
+{
+    if (chunk.count == 0) {
+        chunk.firstTs = chunk.minTs = chunk.maxTs = chunk.prevTs = timestamp;
+        chunk.prevDelta = 0;
+        chunk.prevValue = value;
+        chunk.prevLeading = -1;
+        chunk.values.write(value, 32);
+        chunk.count = 1;
+        return;
+    }
+
+    qint64 delta = timestamp - chunk.prevTs;
+    qint64 dod = delta - chunk.prevDelta;
+    BitWriter &ts = chunk.timestamps;
+    if (dod == 0) {
+        ts.write(0, 1);
+    } else if (dod >= -64 && dod <= 63) {
+        ts.write(0x2, 2);
+        ts.write(dod, 7);
+    } else if (dod >= -256 && dod <= 255) {
+        ts.write(0x6, 3);
+        ts.write(dod, 9);
+    } else if (dod >= -2048 && dod <= 2047) {
+        ts.write(0xe, 4);
+        ts.write(dod, 12);
+    } else {
+        ts.write(0xf, 4);
+        ts.write(dod, 64);
+    }
+    chunk.prevDelta = delta;
+    chunk.prevTs = timestamp;
+    chunk.minTs = qMin(chunk.minTs, timestamp);
+    chunk.maxTs = qMax(chunk.maxTs, timestamp);
+
+    quint32 x = value ^ chunk.prevValue;
+    BitWriter &vs = chunk.values;
+    if (x == 0) {
+        vs.write(0, 1);
+    } else {
+        int leading = qMin(leadingZeros(x), 31);
+        int trailing = trailingZeros(x);
+        if (chunk.prevLeading >= 0 && leading >= chunk.prevLeading && trailing >= chunk.prevTrailing) {
+            vs.write(0x2, 2);
+            vs.write(x >> chunk.prevTrailing, 32 - chunk.prevLeading - chunk.prevTrailing);
+        } else {
+            int length = 32 - leading - trailing;
+            vs.write(0x3, 2);
+            vs.write(leading, 5);
+            vs.write(length - 1, 5);
+            vs.write(x >> trailing, length);
+            chunk.prevLeading = leading;
+            chunk.prevTrailing = trailing;
+        }
+    }
+    chunk.prevValue = value;
+    chunk.count++;
+}
+
+void MicontBusHistorian::decode(const ChunkHeader &header, const char *timestamps, const char *values,
+                                qint64 from, qint64 to, QVector<Point> *points)
+{
+    BitReader ts(timestamps, header.timestampBytes);
+    BitReader vs(values, header.valueBytes);
+
+    qint64 timestamp = header.firstTs;
+    qint64 delta = 0;
+    quint32 value = vs.read(32);
+    int leading = 0;
+    int trailing = 0;
+
+    for (quint32 i = 0; i < header.count; i++) {
+        if (i > 0) {
+            qint64 dod;
+            if (ts.read(1) == 0)
+                dod = 0;
+            else if (ts.read(1) == 0)
+                dod = signExtend(ts.read(7), 7);
+            else if (ts.read(1) == 0)
+                dod = signExtend(ts.read(9), 9);
+            else if (ts.read(1) == 0)
+                dod = signExtend(ts.read(12), 12);
+            else
+                dod = (qint64)ts.read(64);
+            delta += dod;
+            timestamp += delta;
+
+            if (vs.read(1)) {
+                if (vs.read(1)) {
+                    leading = vs.read(5);
+                    int length = vs.read(5) + 1;
+                    trailing = 32 - leading - length;
+                }
+                value ^= (quint32)vs.read(32 - leading - trailing) << trailing;
+            }
+        }
+
+        if (timestamp >= from && timestamp <= to) {
+            Point p;
+            p.timestamp = timestamp;
+            p.value = value;
+            points->append(p);
+        }
+    }
+}
+
+// Closes the current segment and opens the one holding timestamp.
+bool MicontBusHistorian::startSegment(qint64 timestamp)
+{
+    flush();
+    m_chunks.clear();
+    m_file.close();
+
+    qint64 start = timestamp - timestamp % m_segmentDuration;
+    m_file.setFileName(segmentPath(start));
+
+    // a write torn by a crash would have the new chunks appended after
+    // garbage and hide them from queries; cut it off first
+    bool exists = false;
+    if (m_file.exists()) {
+        qint64 length = completeLength(m_file.fileName());
+        if (length < 0) {
+            m_errorString = tr("%1 is not a historian segment").arg(m_file.fileName());
+            m_segmentStart = -1;
+            return false;
+        }
+        if (length < m_file.size() && !m_file.resize(length)) {
+            m_errorString = m_file.errorString();
+            m_segmentStart = -1;
+            return false;
+        }
+        exists = length > 0;
+    }
+
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        m_errorString = m_file.errorString();
+        m_segmentStart = -1;
+        return false;
+    }
+
+    if (!exists) {
+        uchar header[HISTORIAN_FILE_HEADER];
+        memcpy(header, HISTORIAN_MAGIC, 4);
+        qToLittleEndian<qint64>(start, header + 4);
+        m_file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    }
+
+    m_segmentStart = start;
+    applyRetention();
+    return true;
+}
+
+void MicontBusHistorian::writeChunk(quint32 series, Chunk &chunk)
+{
+    const QByteArray &ts = chunk.timestamps.bytes();
+    const QByteArray &vs = chunk.values.bytes();
+
+    uchar header[HISTORIAN_CHUNK_HEADER];
+    qToLittleEndian<quint32>(series, header);
+    qToLittleEndian<quint32>(chunk.count, header + 4);
+    qToLittleEndian<qint64>(chunk.firstTs, header + 8);
+    qToLittleEndian<qint64>(chunk.minTs, header + 16);
+    qToLittleEndian<qint64>(chunk.maxTs, header + 24);
+    qToLittleEndian<quint32>(ts.size(), header + 32);
+    qToLittleEndian<quint32>(vs.size(), header + 36);
+
+    m_file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    m_file.write(ts);
+    m_file.write(vs);
+
+    chunk = Chunk();
+}
+
+void MicontBusHistorian::applyRetention()
+{
+    QList<qint64> starts = segments();
+    while (starts.size() > m_maxSegments)
+        QFile::remove(segmentPath(starts.takeFirst()));
+}
+
+QList<qint64> MicontBusHistorian::segments() const
+{
+    QList<qint64> starts;
+    QDir dir(m_directory);
+    foreach (const QString &name, dir.entryList(QStringList() << "*.mbh", QDir::Files, QDir::Name)) {
+        bool ok;
+        qint64 start = name.left(name.size() - 4).toLongLong(&ok);
+        if (ok)
+            starts.append(start);
+    }
+    std::sort(starts.begin(), starts.end());
+    return starts;
+}
+
+QString MicontBusHistorian::segmentPath(qint64 start) const
+{
+    return QString("%1/%2.mbh").arg(m_directory).arg(start, 13, 10, QLatin1Char('0'));
+}
+
+// Scans the chunk headers of a segment, decoding only the matching ones.
+void MicontBusHistorian::querySegment(const QString &path, quint32 series, qint64 from, qint64 to,
+                                      QVector<Point> *points)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    QByteArray magic = file.read(HISTORIAN_FILE_HEADER);
+    if (magic.size() < HISTORIAN_FILE_HEADER || memcmp(magic.constData(), HISTORIAN_MAGIC, 4))
+        return;
+
+    QByteArray buf;
+    while (!file.atEnd()) {
+        uchar raw[HISTORIAN_CHUNK_HEADER];
+        if (file.read(reinterpret_cast<char *>(raw), sizeof(raw)) != sizeof(raw))
+            break;
+
+        ChunkHeader h;
+        h.series = qFromLittleEndian<quint32>(raw);
+        h.count = qFromLittleEndian<quint32>(raw + 4);
+        h.firstTs = qFromLittleEndian<qint64>(raw + 8);
+        h.minTs = qFromLittleEndian<qint64>(raw + 16);
+        h.maxTs = qFromLittleEndian<qint64>(raw + 24);
+        h.timestampBytes = qFromLittleEndian<quint32>(raw + 32);
+        h.valueBytes = qFromLittleEndian<quint32>(raw + 36);
+        qint64 size = (qint64)h.timestampBytes + h.valueBytes;
+
+        if (h.series != series || h.maxTs < from || h.minTs > to) {
+            if (!file.seek(file.pos() + size))
+                break;
+            continue;
+        }
+
+        buf.resize(size);
+        if (file.read(buf.data(), size) != size)
+            break;      // torn write at the end of the segment
+        decode(h, buf.constData(), buf.constData() + h.timestampBytes, from, to, points);
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef MICONTBUSHISTORIAN_H
+#define MICONTBUSHISTORIAN_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+#include <QFile>
+
+/* Time-series store for polled variables. Every (id, address) is a series
+ * of (ms timestamp, raw 32 bit value) points, compressed Gorilla style:
+ * timestamps as delta of deltas, values as XOR against the previous one,
+ * which suits floats and slowly changing integers alike. Points are
+ * gathered per series into chunks that keep the two columns apart; full
+ * chunks are appended to the current segment file. Segments cover a fixed
+ * time span each and only the newest maxSegments are kept. */
+class MicontBusHistorian : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Point {
+        qint64 timestamp;   // ms since epoch
+        quint32 value;      // raw variable, see tMicontVar
+    };
+
+    MicontBusHistorian(QObject *parent = 0);
+    ~MicontBusHistorian();
+
+    bool open(const QString &directory);
+    void close();
+    bool isOpen() const;
+    QString errorString() const;
+
+    void setSegmentDuration(qint64 ms);
+    void setMaxSegments(int count);
+    void setChunkSize(int points);
+
+    void append(quint8 id, quint16 addr, qint64 timestamp, quint32 value);
+    void flush();
+
+    QVector<Point> query(quint8 id, quint16 addr, qint64 from, qint64 to);
+
+public slots:
+    void processResponse(const QByteArray &rawPacket);
+
+private:
+    class BitWriter
+    {
+    public:
+        BitWriter() : m_bits(0) {}
+        void write(quint64 value, int bits);
+        const QByteArray &bytes() const { return m_bytes; }
+        void clear() { m_bytes.clear(); m_bits = 0; }
+    private:
+        QByteArray m_bytes;
+        qint64 m_bits;
+    };
+
+    struct Chunk {
+        Chunk() : count(0), firstTs(0), minTs(0), maxTs(0), prevTs(0), prevDelta(0),
+                  prevValue(0), prevLeading(-1), prevTrailing(0) {}
+
+        int count;
+        qint64 firstTs;
+        qint64 minTs;
+        qint64 maxTs;
+        qint64 prevTs;
+        qint64 prevDelta;
+        quint32 prevValue;
+        int prevLeading;    // -1 before the first non-zero XOR
+        int prevTrailing;
+        BitWriter timestamps;
+        BitWriter values;
+    };
+
+    struct ChunkHeader {
+        quint32 series;
+        quint32 count;
+        qint64 firstTs;
+        qint64 minTs;
+        qint64 maxTs;
+        quint32 timestampBytes;
+        quint32 valueBytes;
+    };
+
+    static void encode(Chunk &chunk, qint64 timestamp, quint32 value);
+    static void decode(const ChunkHeader &header, const char *timestamps, const char *values,
+                       qint64 from, qint64 to, QVector<Point> *points);
+
+    bool startSegment(qint64 timestamp);
+    void writeChunk(quint32 series, Chunk &chunk);
+    void applyRetention();
+    QList<qint64> segments() const;
+    QString segmentPath(qint64 start) const;
+    void querySegment(const QString &path, quint32 series, qint64 from, qint64 to, QVector<Point> *points);
+
+    QString m_directory;
+    QString m_errorString;
+    QFile m_file;
+    qint64 m_segmentStart;
+    qint64 m_segmentDuration;
+    int m_maxSegments;
+    int m_chunkSize;
+    QHash<quint32, Chunk> m_chunks;
+};
+
+#endif // MICONTBUSHISTORIAN_H
@@ -0,0 +1,193 @@
+#include "micontbusimagepublisher.h"
+#include "micontbusprocessimage.h"
+
+#include <QDateTime>
+#include <QtEndian>
+
+#include <errno.h>
+#include <new>
+
+MicontBusImagePublisher::MicontBusImagePublisher(QObject *parent)
+    : QObject(parent), m_image(0)
+{
+}
+
+MicontBusImagePublisher::~MicontBusImagePublisher()
+{
+    close();
+}
+
+bool MicontBusImagePublisher::open(const QString &name)
+{
+    close();
+
+    QByteArray shmName = name.toLocal8Bit();
+    int fd = shm_open(shmName.constData(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        m_errorString = tr("can't open %1, error code %2").arg(name).arg(errno);
+        return false;
+    }
+
+    if (ftruncate(fd, sizeof(MicontBusImageHeader)) < 0) {
+        m_errorString = tr("can't size %1, error code %2").arg(name).arg(errno);
+        ::close(fd);
+        return false;
+    }
+
+    void *p = mmap(0, sizeof(MicontBusImageHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        m_errorString = tr("can't map %1, error code %2").arg(name).arg(errno);
+        return false;
+    }
+
+    // start from an empty table in a new generation, readers still
+    // attached to an old image see their blocks change generation rather
+    // than silently hold another slave's variables
+    const MicontBusImageHeader *old = static_cast<const MicontBusImageHeader *>(p);
+    uint32_t generation = 1;
+    if (old->magic == MICONTBUS_IMAGE_MAGIC && old->version == MICONTBUS_IMAGE_VERSION)
+        generation = old->generation.load(std::memory_order_relaxed) + 1;
+
+    m_image = new (p) MicontBusImageHeader;
+    m_image->blockCount.store(0, std::memory_order_relaxed);
+    m_image->generation.store(generation, std::memory_order_release);
+    m_image->maxBlocks = MICONTBUS_IMAGE_BLOCKS;
+    m_image->maxVars = MICONTBUS_IMAGE_VARS;
+    m_image->version = MICONTBUS_IMAGE_VERSION;
+    m_image->magic = MICONTBUS_IMAGE_MAGIC;
+
+    m_name = name;
+    m_blocks.clear();
+    return true;
+}
+
+void MicontBusImagePublisher::close()
+{
+    if (!m_image)
+        return;
+
+    munmap(m_image, sizeof(MicontBusImageHeader));
+    shm_unlink(m_name.toLocal8Bit().constData());
+    m_image = 0;
+    m_blocks.clear();
+}
+
+bool MicontBusImagePublisher::isOpen() const
+{
+    return m_image != 0;
+}
+
+QString MicontBusImagePublisher::errorString() const
+{
+    return m_errorString;
+}
+
+void MicontBusImagePublisher::publish(quint8 id, quint16 addr, const QVector<tMicontVar> &vars, qint64 timestamp)
+{
+    QByteArray data(vars.size() * sizeof(quint32), 0);
+    uchar *p = reinterpret_cast<uchar *>(data.data());
+    for (int i = 0; i < vars.size(); i++)
+        qToLittleEndian<quint32>(vars[i].u, p + i * sizeof(quint32));
+
+    publish(id, addr, p, vars.size(), timestamp);
+}
+
+// Publishes count variables in wire (little-endian) order.
+void MicontBusImagePublisher::publish(quint8 id, quint16 addr, const uchar *data, int count, qint64 timestamp)
+{
+    if (!m_image)
+        return;
+
+    // longer reads span consecutive blocks
+    for (int first = 0; first < count; first += MICONTBUS_IMAGE_VARS) {
+        int index = block(id, addr + first);
+        if (index < 0)
+            return;
+
+        MicontBusImageBlock &b = m_image->blocks[index];
+        int n = qMin(count - first, MICONTBUS_IMAGE_VARS);
+        const uchar *src = data + first * sizeof(quint32);
+
+        uint32_t seq = b.seq.load(std::memory_order_relaxed);
+        b.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        b.count = n;
+        b.timestamp = timestamp;
+        for (int i = 0; i < n; i++)
+            b.vars[i] = qFromLittleEndian<quint32>(src + i * sizeof(quint32));
+
+        b.seq.store(seq + 2, std::memory_order_release);
+    }
+}
+
+int MicontBusImagePublisher::blockCount() const
+{
+    return m_image ? (int)m_image->blockCount.load(std::memory_order_acquire) : 0;
+}
+
+// Consistent copy of a block, safe from any thread while the writer runs.
+bool MicontBusImagePublisher::readBlock(int index, MicontBusImageSnapshot *snapshot) const
+{
+    return MicontBusProcessImageReader::read(&m_image->blocks[index], snapshot);
+}
+
+void MicontBusImagePublisher::processResponse(const QByteArray &rawPacket)
+{
+    MicontBusPacket p;
+    if (!p.parse(rawPacket))
+        return;
+
+    if (p.cmd() != (MicontBusPacket::CMD_GETBUF_B | (int)MicontBusPacket::CMD_RESULT_OK))
+        return;
+
+    publish(p.id(), p.addr(), p.variables(), QDateTime::currentMSecsSinceEpoch());
+}
+
+// Same as processResponse(), straight from the pooled frame.
+void MicontBusImagePublisher::processFrame(const MicontBusFrame &frame)
+{
+    const uchar *d = frame.bytes();
+    if (frame.size() < 6 || d[1] != (MicontBusPacket::CMD_GETBUF_B | (int)MicontBusPacket::CMD_RESULT_OK))
+        return;
+
+    quint16 addr = qFromLittleEndian<quint16>(d + 2);
+    quint16 size = qFromLittleEndian<quint16>(d + 4);
+    if (size % sizeof(quint32) != 0 || frame.size() < 6 + size)
+        return;
+
+    publish(d[0], addr, d + 6, size / sizeof(quint32), QDateTime::currentMSecsSinceEpoch());
+}
+
+int MicontBusImagePublisher::block(quint8 id, quint16 addr)
+{
+    quint32 key = ((quint32)id << 16) | addr;
+    QHash<quint32, int>::const_iterator it = m_blocks.constFind(key);
+    if (it != m_blocks.constEnd())
+        return it.value();
+
+    uint32_t index = m_image->blockCount.load(std::memory_order_relaxed);
+    if (index >= MICONTBUS_IMAGE_BLOCKS)
+        return -1;
+
+    // under the sequence lock, a reader of the previous generation may
+    // still be looking at the block; a writer that died inside it left
+    // the counter odd
+    MicontBusImageBlock &b = m_image->blocks[index];
+    uint32_t seq = b.seq.load(std::memory_order_relaxed) & ~1U;
+    b.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    b.id = id;
+    b.addr = addr;
+    b.generation = m_image->generation.load(std::memory_order_relaxed);
+    b.count = 0;
+    b.timestamp = 0;
+
+    b.seq.store(seq + 2, std::memory_order_release);
+    m_image->blockCount.store(index + 1, std::memory_order_release);
+
+    m_blocks.insert(key, index);
+    return index;
+}
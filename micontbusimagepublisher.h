@@ -0,0 +1,51 @@
+#ifndef MICONTBUSIMAGEPUBLISHER_H
+#define MICONTBUSIMAGEPUBLISHER_H
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+
+#include "micontbuspacket.h"
+#include "micontbusframepool.h"
+
+struct MicontBusImageHeader;
+struct MicontBusImageSnapshot;
+
+/* Writes polled variables into the shared-memory process image described
+ * in micontbusprocessimage.h. There must be a single writer per image;
+ * connect processFrame() directly to the responseFrame() of the master or
+ * sniffer so that it runs on their thread without copying or parsing the
+ * response. */
+class MicontBusImagePublisher : public QObject
+{
+    Q_OBJECT
+
+public:
+    MicontBusImagePublisher(QObject *parent = 0);
+    ~MicontBusImagePublisher();
+
+    bool open(const QString &name);
+    void close();
+    bool isOpen() const;
+    QString errorString() const;
+
+    void publish(quint8 id, quint16 addr, const QVector<tMicontVar> &vars, qint64 timestamp);
+    void publish(quint8 id, quint16 addr, const uchar *data, int count, qint64 timestamp);
+
+    int blockCount() const;
+    bool readBlock(int index, MicontBusImageSnapshot *snapshot) const;
+
+public slots:
+    void processResponse(const QByteArray &rawPacket);
+    void processFrame(const MicontBusFrame &frame);
+
+private:
+    int block(quint8 id, quint16 addr);
+
+    QString m_name;
+    QString m_errorString;
+    MicontBusImageHeader *m_image;
+    QHash<quint32, int> m_blocks;
+};
+
+#endif // MICONTBUSIMAGEPUBLISHER_H
@@ -1,207 +1,410 @@
 #include "micontbusmaster.h"
+#include "micontbuspacket.h"
 
-#include <QtSerialPort/QSerialPort>
-#include <QDataStream>
+#include <QScopedPointer>
+#include <QMetaMethod>
 #include <QDebug>
 
 QT_USE_NAMESPACE
 
+static_assert((int)MicontBusMaster::PriorityCount == (int)MicontBusScheduler::PriorityCount,
+              "master and scheduler priorities must match");
+
+/* Hands the scheduler's results to the decoder workers, or delivers them
+ * on the bus thread without any. */
+class MicontBusMasterListener : public MicontBusScheduler::Listener
+{
+public:
+    MicontBusMasterListener(MicontBusMaster *master, MicontBusDecoder *decoder)
+        : m_master(master), m_decoder(decoder) {}
+
+    void response(uint32_t tag, const MicontBusFrame &frame)
+    {
+        if (m_decoder)
+            m_decoder->post(tag, frame);
+        else
+            m_master->deliver(tag, frame);
+    }
+
+    // behind the responses of the same slave that are still being decoded
+    void failure(uint8_t id, uint32_t tag, const std::string &s, MicontBusScheduler::Failure failure)
+    {
+        if (m_decoder)
+            m_decoder->postFailure(id, tag, QString::fromStdString(s), failure);
+        else
+            m_master->deliverFailure(tag, QString::fromStdString(s), failure);
+    }
+
+    void portError(const std::string &s)
+    {
+        emit m_master->portError(QString::fromStdString(s));
+        emit m_master->error(QString::fromStdString(s));
+    }
+
+    void slaveStateChanged(const std::string &portName, uint8_t id, bool up)
+    {
+        emit m_master->slaveStateChanged(QString::fromStdString(portName), id, up);
+    }
+
+private:
+    MicontBusMaster *m_master;
+    MicontBusDecoder *m_decoder;
+};
+
 MicontBusMaster::MicontBusMaster(QObject *parent)
-    : QThread(parent), waitTimeout(0), quit(false)
+    : QThread(parent), transportBackend(MicontBusTransport::BackendQt), decodeWorkerCount(1), m_decodeStalls(0)
 {
+    qRegisterMetaType<MicontBusFrame>("MicontBusFrame");
+    qRegisterMetaType<MicontBusResponse>("MicontBusResponse");
+
+    setBackend(transportBackend);
 }
 
 MicontBusMaster::~MicontBusMaster()
 {
-    mutex.lock();
-    quit = true;
-    cond.wakeOne();
-    mutex.unlock();
-    wait();
+    stop();
 }
 
-void MicontBusMaster::transaction(const QString &portName, qint32 baudRate, qint32 waitTimeout, const QByteArray &packet)
+// deadline is in ms from now, 0 for none. A request whose deadline has
+// passed or whose token was cancelled is dropped before it is sent and
+// not retried; it fails with transactionFailed().
+quint32 MicontBusMaster::transaction(const QString &portName, qint32 baudRate, qint32 waitTimeout, const QByteArray &packet,
+                                     Priority priority, qint32 deadline, const MicontBusCancelToken &token)
 {
-    QMutexLocker locker(&mutex);
-
-    this->portName = portName;
-    this->baudRate = baudRate;
-    this->waitTimeout = waitTimeout;
-    this->packet = packet;
-
+    quint32 tag = scheduler.transaction(portName.toStdString(), baudRate, waitTimeout, packet.constData(), packet.size(),
+                                        (MicontBusScheduler::Priority)priority, deadline, token);
     if (!isRunning())
         start();
-    else
-        cond.wakeOne();
+    return tag;
 }
 
 void MicontBusMaster::run()
 {
-    bool currentPortNameChanged = false;
-
     mutex.lock();
-    QString currentPortName = portName;
-    currentPortNameChanged = true;
-    qint32 currentBaudrate = baudRate;
-    int currentWaitTimeout = waitTimeout;
-    QByteArray currentRequest = packet;
+    MicontBusRealtimeOptions rt = realtime;
+    int workers = decodeWorkerCount;
     mutex.unlock();
 
-    QSerialPort serial;
+    // before real-time mode, the workers must not inherit it
+    QScopedPointer<MicontBusDecoder> decoder(workers > 0 ? new MicontBusDecoder(this, workers) : 0);
 
-    while (!quit) {
-        if (currentPortNameChanged) {
-            serial.close();
-            serial.setPortName(currentPortName);
-            serial.setBaudRate(currentBaudrate);
+    QString rtError;
+    if (!MicontBusRealtime::apply(rt, &rtError)) {
+        qWarning() << "real-time mode:" << rtError;
+        emit error(tr("real-time mode: %1").arg(rtError));
+    }
 
-            if (!serial.open(QIODevice::ReadWrite)) {
-                emit error(tr("can't open %1, error code %2")
-                           .arg(portName).arg(serial.error()));
-                return;
-            }
-        }
+    MicontBusMasterListener listener(this, decoder.data());
+    scheduler.run(&listener);
+}
+
+// On a decoder worker or on the bus thread without one.
+void MicontBusMaster::deliverFailure(quint32 tag, const QString &s, MicontBusScheduler::Failure failure)
+{
+    if (failure == MicontBusScheduler::FailureError)
+        emit error(s);
+    else if (failure == MicontBusScheduler::FailureTimeout)
+        emit timeout(s);
+    emit transactionFailed(tag, s);
+}
 
-        QDataStream s(&currentRequest, QIODevice::Append);
-        s.setByteOrder(QDataStream::LittleEndian);
-        s << crc16(currentRequest);
+// Hands a good response to the subscribers, on a decoder worker or on the
+// bus thread without one. The frame signals pass the pooled frame on; a
+// copy out of the pool is only made for listeners of the QByteArray ones.
+void MicontBusMaster::deliver(quint32 tag, const MicontBusFrame &frame)
+{
 #ifdef QT_DEBUG
-        qDebug() << "<<" << currentRequest.toHex();
+    qDebug() << ">>" << frame.rawData().toHex();
 #endif
-        serial.write(currentRequest);
+    emit responseFrame(frame);
+    emit transactionFrame(tag, frame);
 
-        if (serial.waitForBytesWritten(waitTimeout)) {
-            m_statTxBytes += currentRequest.size();
-            m_statTxPackets++;
+    static const QMetaMethod responseSignal = QMetaMethod::fromSignal(&MicontBusMaster::response);
+    static const QMetaMethod doneSignal = QMetaMethod::fromSignal(&MicontBusMaster::transactionDone);
+    QByteArray responseData;
+    if (isSignalConnected(responseSignal) || isSignalConnected(doneSignal)) {
+        // one copy, shared by both signals
+        responseData = frame.toByteArray();
+        emit this->response(responseData);
+        emit transactionDone(tag, responseData);
+    }
 
-            if (serial.waitForReadyRead(currentWaitTimeout)) {
-                QByteArray responseData = serial.readAll();
-                while (serial.waitForReadyRead(10))
-                    responseData += serial.readAll();               
-#ifdef QT_DEBUG
-                qDebug() << ">>" << responseData.toHex();
-#endif
-                m_statRxBytes += responseData.size();
-
-                // check CRC
-                quint16 crc = ((quint16)responseData.at(responseData.size() - 1) << 8) | (responseData.at(responseData.size() - 2) & 0xff);
-                responseData.chop(2);
-                if (crc == crc16(responseData)) {
-                    m_statRxPackets++;
-                    emit this->response(responseData);
-                } else {
-                    m_statCrcErrors++;
-                    emit error(tr("crc mismatch"));
-                }
-            } else {
-                m_statTimeouts++;
-                emit timeout(tr("read timeout"));
-            }
-
-        } else {
-            m_statTimeouts++;
-            emit timeout(tr("write timeout"));
-        }
-
-        mutex.lock();
-        cond.wait(&mutex);
-        if (currentPortName != portName || currentBaudrate != baudRate) {
-            currentPortName = portName;
-            currentBaudrate = baudRate;
-            currentPortNameChanged = true;
-        } else {
-            currentPortNameChanged = false;
-        }
-        currentWaitTimeout = waitTimeout;
-        currentRequest = packet;
-        mutex.unlock();
+    static const QMetaMethod decodedSignal = QMetaMethod::fromSignal(&MicontBusMaster::decoded);
+    if (isSignalConnected(decodedSignal)) {
+        MicontBusResponse r;
+        r.tag = tag;
+        r.valid = r.packet.parse(responseData.isNull() ? frame.rawData() : responseData);
+        if (r.valid)
+            r.variables = r.packet.variables();
+        emit decoded(r);
     }
+}
+
+void MicontBusMaster::stop()
+{
+    scheduler.stop();
+    wait();
+
+    // the port is closed now, the next transaction reopens it
+    foreach (quint32 tag, scheduler.clear())
+        emit transactionFailed(tag, tr("cancelled"));
+}
+
+// Removes a request that is still queued; once on the wire it runs to the
+// end. Returns false if the tag is not queued.
+bool MicontBusMaster::cancel(quint32 tag)
+{
+    if (!scheduler.cancel(tag))
+        return false;
+
+    emit transactionFailed(tag, tr("cancelled"));
+    return true;
+}
+
+void MicontBusMaster::setRetryPolicy(const MicontBusRetryPolicy &policy)
+{
+    scheduler.setRetryPolicy(policy);
+}
+
+MicontBusRetryPolicy MicontBusMaster::retryPolicy()
+{
+    return scheduler.retryPolicy();
+}
+
+int MicontBusMaster::queueSize()
+{
+    return scheduler.queueSize();
+}
+
+int MicontBusMaster::queueSize(Priority priority)
+{
+    return scheduler.queueSize((MicontBusScheduler::Priority)priority);
+}
+
+void MicontBusMaster::setHealthThresholds(int maxTimeouts, double maxCrcRate)
+{
+    scheduler.setHealthThresholds(maxTimeouts, maxCrcRate);
+}
+
+bool MicontBusMaster::isSlaveDown(const QString &portName, quint8 id)
+{
+    return scheduler.isSlaveDown(portName.toStdString(), id);
+}
+
+QList<MicontBusRttEstimator::Sample> MicontBusMaster::rttEstimates()
+{
+    QList<MicontBusRttEstimator::Sample> estimates;
+    for (const MicontBusRttEstimator::Sample &sample : scheduler.rttEstimates())
+        estimates.append(sample);
+    return estimates;
+}
+
+void MicontBusMaster::restoreRttEstimates(const QList<MicontBusRttEstimator::Sample> &estimates)
+{
+    scheduler.restoreRttEstimates(std::vector<MicontBusRttEstimator::Sample>(estimates.constBegin(), estimates.constEnd()));
+}
+
+QList<MicontBusHealth::Key> MicontBusMaster::downSlaves()
+{
+    QList<MicontBusHealth::Key> slaves;
+    for (const MicontBusHealth::Key &key : scheduler.downSlaves())
+        slaves.append(key);
+    return slaves;
+}
+
+// Down slaves are probed in the background as soon as their port has
+// been given a transaction, instead of being found out by timeouts.
+void MicontBusMaster::restoreDownSlaves(const QList<MicontBusHealth::Key> &slaves)
+{
+    scheduler.restoreDownSlaves(std::vector<MicontBusHealth::Key>(slaves.constBegin(), slaves.constEnd()));
+}
+
+// Takes effect with the next transaction, which reopens the port.
+void MicontBusMaster::setBackend(MicontBusTransport::Backend backend)
+{
+    QMutexLocker locker(&mutex);
+    transportBackend = backend;
+    scheduler.setPortFactory([backend]() { return MicontBusTransport::create(backend); });
+}
+
+MicontBusTransport::Backend MicontBusMaster::backend()
+{
+    QMutexLocker locker(&mutex);
+    return transportBackend;
+}
+
+void MicontBusMaster::setSerialOptions(const MicontBusSerialOptions &options)
+{
+    scheduler.setSerialOptions(options);
+}
+
+MicontBusSerialOptions MicontBusMaster::serialOptions()
+{
+    return scheduler.serialOptions();
+}
+
+// Takes effect when the bus thread next starts, e.g. after stop().
+void MicontBusMaster::setRealtimeOptions(const MicontBusRealtimeOptions &options)
+{
+    QMutexLocker locker(&mutex);
+    realtime = options;
+}
+
+MicontBusRealtimeOptions MicontBusMaster::realtimeOptions()
+{
+    QMutexLocker locker(&mutex);
+    return realtime;
+}
+
+MicontBusLatencyHistogram MicontBusMaster::wakeupLatency()
+{
+    return scheduler.wakeupLatency();
+}
+
+MicontBusLatencyHistogram MicontBusMaster::cycleJitter()
+{
+    return scheduler.cycleJitter();
+}
+
+void MicontBusMaster::clearLatency()
+{
+    scheduler.clearLatency();
+}
+
+// Number of threads parsing and delivering responses, 0 to do it on the
+// bus thread, at most MicontBusDecoder::MaxWorkers. Takes effect when the
+// bus thread next starts.
+void MicontBusMaster::setDecodeWorkers(int count)
+{
+    QMutexLocker locker(&mutex);
+    decodeWorkerCount = count;
+}
+
+int MicontBusMaster::decodeWorkers()
+{
+    QMutexLocker locker(&mutex);
+    return decodeWorkerCount;
+}
+
+// Times the bus thread found a worker's ring full and had to wait.
+quint64 MicontBusMaster::decodeStalls() const
+{
+    return m_decodeStalls.load(std::memory_order_relaxed);
+}
+
+void MicontBusMaster::setAdaptiveTimeout(bool enable)
+{
+    scheduler.setAdaptiveTimeout(enable);
+}
 
+bool MicontBusMaster::adaptiveTimeout()
+{
+    return scheduler.adaptiveTimeout();
+}
+
+qint64 MicontBusMaster::lastRoundTrip()
+{
+    return scheduler.lastRoundTrip();
+}
+
+const MicontBusMaster::SlaveCounters &MicontBusMaster::slaveCounters(const QString &portName, quint8 id) const
+{
+    return scheduler.slaveCounters(portName.toStdString(), id);
+}
+
+// Ports the per-slave counters were kept for.
+QStringList MicontBusMaster::counterPorts() const
+{
+    QStringList ports;
+    for (const std::string &port : scheduler.counterPorts())
+        ports << QString::fromStdString(port);
+    return ports;
+}
+
+// Time spent exchanging frames on the bus, us.
+quint64 MicontBusMaster::busyTime() const
+{
+    return scheduler.busyTime();
+}
+
+quint64 MicontBusMaster::wireTime() const
+{
+    return scheduler.wireTime();
+}
+
+quint64 MicontBusMaster::turnaroundTime() const
+{
+    return scheduler.turnaroundTime();
+}
+
+quint64 MicontBusMaster::timeoutTime() const
+{
+    return scheduler.timeoutTime();
+}
+
+// Requests dropped before transmission, by cancellation and by deadline.
+quint64 MicontBusMaster::droppedCancelled() const
+{
+    return scheduler.droppedCancelled();
+}
+
+quint64 MicontBusMaster::droppedExpired() const
+{
+    return scheduler.droppedExpired();
+}
+
+// Line usage of a port over the last seconds (up to a minute).
+MicontBusLineReport MicontBusMaster::lineReport(const QString &portName, int seconds)
+{
+    return scheduler.lineReport(portName.toStdString(), seconds);
 }
 
 void MicontBusMaster::statClear()
 {
-    m_statRxBytes = 0;
-    m_statTxBytes = 0;
-    m_statRxPackets = 0;
-    m_statTxPackets = 0;
-    m_statCrcErrors = 0;
-    m_statTimeouts = 0;
+    scheduler.statClear();
 }
 
 quint32 MicontBusMaster::statTxBytes()
 {
-    return m_statTxBytes;
+    return scheduler.statTxBytes();
 }
 
 quint32 MicontBusMaster::statRxBytes()
 {
-    return m_statRxBytes;
+    return scheduler.statRxBytes();
 }
 
 quint32 MicontBusMaster::statTxPackets()
 {
-    return m_statTxPackets;
+    return scheduler.statTxPackets();
 }
 
 quint32 MicontBusMaster::statRxPackets()
 {
-    return m_statRxPackets;
+    return scheduler.statRxPackets();
 }
 
 quint32 MicontBusMaster::statCrcErrors()
 {
-    return m_statCrcErrors;
+    return scheduler.statCrcErrors();
 }
 
 quint32 MicontBusMaster::statTimeouts()
 {
-    return m_statTimeouts;
+    return scheduler.statTimeouts();
+}
+
+quint32 MicontBusMaster::statRetries()
+{
+    return scheduler.statRetries();
 }
 
 quint16 MicontBusMaster::crc16(const QByteArray &array)
 {
-    static const quint16 wCRCTable[] = {
-    0X0000, 0XC0C1, 0XC181, 0X0140, 0XC301, 0X03C0, 0X0280, 0XC241,
-    0XC601, 0X06C0, 0X0780, 0XC741, 0X0500, 0XC5C1, 0XC481, 0X0440,
-    0XCC01, 0X0CC0, 0X0D80, 0XCD41, 0X0F00, 0XCFC1, 0XCE81, 0X0E40,
-    0X0A00, 0XCAC1, 0XCB81, 0X0B40, 0XC901, 0X09C0, 0X0880, 0XC841,
-    0XD801, 0X18C0, 0X1980, 0XD941, 0X1B00, 0XDBC1, 0XDA81, 0X1A40,
-    0X1E00, 0XDEC1, 0XDF81, 0X1F40, 0XDD01, 0X1DC0, 0X1C80, 0XDC41,
-    0X1400, 0XD4C1, 0XD581, 0X1540, 0XD701, 0X17C0, 0X1680, 0XD641,
-    0XD201, 0X12C0, 0X1380, 0XD341, 0X1100, 0XD1C1, 0XD081, 0X1040,
-    0XF001, 0X30C0, 0X3180, 0XF141, 0X3300, 0XF3C1, 0XF281, 0X3240,
-    0X3600, 0XF6C1, 0XF781, 0X3740, 0XF501, 0X35C0, 0X3480, 0XF441,
-    0X3C00, 0XFCC1, 0XFD81, 0X3D40, 0XFF01, 0X3FC0, 0X3E80, 0XFE41,
-    0XFA01, 0X3AC0, 0X3B80, 0XFB41, 0X3900, 0XF9C1, 0XF881, 0X3840,
-    0X2800, 0XE8C1, 0XE981, 0X2940, 0XEB01, 0X2BC0, 0X2A80, 0XEA41,
-    0XEE01, 0X2EC0, 0X2F80, 0XEF41, 0X2D00, 0XEDC1, 0XEC81, 0X2C40,
-    0XE401, 0X24C0, 0X2580, 0XE541, 0X2700, 0XE7C1, 0XE681, 0X2640,
-    0X2200, 0XE2C1, 0XE381, 0X2340, 0XE101, 0X21C0, 0X2080, 0XE041,
-    0XA001, 0X60C0, 0X6180, 0XA141, 0X6300, 0XA3C1, 0XA281, 0X6240,
-    0X6600, 0XA6C1, 0XA781, 0X6740, 0XA501, 0X65C0, 0X6480, 0XA441,
-    0X6C00, 0XACC1, 0XAD81, 0X6D40, 0XAF01, 0X6FC0, 0X6E80, 0XAE41,
-    0XAA01, 0X6AC0, 0X6B80, 0XAB41, 0X6900, 0XA9C1, 0XA881, 0X6840,
-    0X7800, 0XB8C1, 0XB981, 0X7940, 0XBB01, 0X7BC0, 0X7A80, 0XBA41,
-    0XBE01, 0X7EC0, 0X7F80, 0XBF41, 0X7D00, 0XBDC1, 0XBC81, 0X7C40,
-    0XB401, 0X74C0, 0X7580, 0XB541, 0X7700, 0XB7C1, 0XB681, 0X7640,
-    0X7200, 0XB2C1, 0XB381, 0X7340, 0XB101, 0X71C0, 0X7080, 0XB041,
-    0X5000, 0X90C1, 0X9181, 0X5140, 0X9301, 0X53C0, 0X5280, 0X9241,
-    0X9601, 0X56C0, 0X5780, 0X9741, 0X5500, 0X95C1, 0X9481, 0X5440,
-    0X9C01, 0X5CC0, 0X5D80, 0X9D41, 0X5F00, 0X9FC1, 0X9E81, 0X5E40,
-    0X5A00, 0X9AC1, 0X9B81, 0X5B40, 0X9901, 0X59C0, 0X5880, 0X9841,
-    0X8801, 0X48C0, 0X4980, 0X8941, 0X4B00, 0X8BC1, 0X8A81, 0X4A40,
-    0X4E00, 0X8EC1, 0X8F81, 0X4F40, 0X8D01, 0X4DC0, 0X4C80, 0X8C41,
-    0X4400, 0X84C1, 0X8581, 0X4540, 0X8701, 0X47C0, 0X4680, 0X8641,
-    0X8201, 0X42C0, 0X4380, 0X8341, 0X4100, 0X81C1, 0X8081, 0X4040 };
-
-    quint8 nTemp;
-    quint16 wCRCWord = 0xFFFF;
-
-    for (int i = 0; i < array.length(); ++i) {
-          nTemp = (quint8)array.at(i) ^ wCRCWord;
-          wCRCWord >>= 8;
-          wCRCWord ^= wCRCTable[nTemp];
-    }
-    return wCRCWord;
+    return crc16(array.constData(), array.size());
+}
+
+quint16 MicontBusMaster::crc16(const char *data, int size)
+{
+    return MicontBusCodec::crc16(data, size);
 }
@@ -3,19 +3,90 @@
 
 #include <QThread>
 #include <QMutex>
-#include <QWaitCondition>
 #include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringList>
 
+#include <atomic>
+
+#include "micontbusscheduler.h"
+#include "micontbustransport.h"
+#include "micontbusrealtime.h"
+#include "micontbusdecoder.h"
+
+/* MicontBusScheduler on a QThread of its own, with Qt types and the
+ * outcome of transactions as signals. Responses are parsed and delivered
+ * by MicontBusDecoder workers unless there are none. */
 class MicontBusMaster : public QThread
 {
     Q_OBJECT
 
 public:
+    // request classes, highest first, as MicontBusScheduler::Priority
+    enum Priority {
+        PriorityControl,        // operator writes, setpoints
+        PriorityInteractive,    // reads someone is waiting on
+        PriorityPolling,        // cyclic polling
+        PriorityBulk,           // bulk transfers, discovery
+        PriorityCount
+    };
+
+    typedef MicontBusScheduler::SlaveCounters SlaveCounters;
+
     MicontBusMaster(QObject *parent = 0);
     ~MicontBusMaster();
 
-    void transaction(const QString &portName, qint32 baudRate, qint32 waitTimeout, const QByteArray &packet);
+    quint32 transaction(const QString &portName, qint32 baudRate, qint32 waitTimeout, const QByteArray &packet,
+                        Priority priority = PriorityInteractive, qint32 deadline = 0,
+                        const MicontBusCancelToken &token = MicontBusCancelToken());
+    bool cancel(quint32 tag);
     void run();
+    void stop();
+
+    void setRetryPolicy(const MicontBusRetryPolicy &policy);
+    MicontBusRetryPolicy retryPolicy();
+    int queueSize();
+    int queueSize(Priority priority);
+
+    void setHealthThresholds(int maxTimeouts, double maxCrcRate);
+    bool isSlaveDown(const QString &portName, quint8 id);
+
+    // learned line state, for MicontBusSnapshot
+    QList<MicontBusRttEstimator::Sample> rttEstimates();
+    void restoreRttEstimates(const QList<MicontBusRttEstimator::Sample> &estimates);
+    QList<MicontBusHealth::Key> downSlaves();
+    void restoreDownSlaves(const QList<MicontBusHealth::Key> &slaves);
+
+    void setBackend(MicontBusTransport::Backend backend);
+    MicontBusTransport::Backend backend();
+    void setSerialOptions(const MicontBusSerialOptions &options);
+    MicontBusSerialOptions serialOptions();
+
+    void setRealtimeOptions(const MicontBusRealtimeOptions &options);
+    MicontBusRealtimeOptions realtimeOptions();
+    MicontBusLatencyHistogram wakeupLatency();
+    MicontBusLatencyHistogram cycleJitter();
+    void clearLatency();
+
+    void setDecodeWorkers(int count);
+    int decodeWorkers();
+    quint64 decodeStalls() const;
+
+    void setAdaptiveTimeout(bool enable);
+    bool adaptiveTimeout();
+    qint64 lastRoundTrip();
+
+    const SlaveCounters &slaveCounters(const QString &portName, quint8 id) const;
+    QStringList counterPorts() const;
+    quint64 busyTime() const;
+    quint64 wireTime() const;
+    quint64 turnaroundTime() const;
+    quint64 timeoutTime() const;
+    quint64 droppedCancelled() const;
+    quint64 droppedExpired() const;
+
+    MicontBusLineReport lineReport(const QString &portName, int seconds);
 
     void statClear(void);
     quint32 statTxBytes();
@@ -24,31 +95,38 @@ public:
     quint32 statRxPackets();
     quint32 statCrcErrors();
     quint32 statTimeouts();
+    quint32 statRetries();
+
+    static quint16 crc16(const QByteArray &array);
+    static quint16 crc16(const char *data, int size);
 
 signals:
     void response(const QByteArray &packet);
+    void responseFrame(const MicontBusFrame &frame);
+    void decoded(const MicontBusResponse &response);
     void error(const QString &s);
     void timeout(const QString &s);
+    void portError(const QString &s);
+    void transactionDone(quint32 tag, const QByteArray &packet);
+    void transactionFrame(quint32 tag, const MicontBusFrame &frame);
+    void transactionFailed(quint32 tag, const QString &s);
+    void slaveStateChanged(const QString &portName, int id, bool up);
 
 private:
-    QString portName;
-    qint32  baudRate;
-    qint32  waitTimeout;
-    QByteArray packet;
-    QMutex mutex;
-    QWaitCondition cond;
-    bool quit;
+    friend class MicontBusDecoder;
+    friend class MicontBusMasterListener;
 
-// statistics
-    quint32 m_statTxBytes;
-    quint32 m_statRxBytes;
-    quint32 m_statTxPackets;
-    quint32 m_statRxPackets;
-    quint32 m_statCrcErrors;
-    quint32 m_statTimeouts;
+    void deliverFailure(quint32 tag, const QString &s, MicontBusScheduler::Failure failure);
+    void deliver(quint32 tag, const MicontBusFrame &frame);
 
-private:
-    quint16 crc16(const QByteArray &array);
+    MicontBusScheduler scheduler;
+
+    // settings of the bus thread itself
+    QMutex mutex;
+    MicontBusTransport::Backend transportBackend;
+    MicontBusRealtimeOptions realtime;
+    int decodeWorkerCount;
+    std::atomic<quint64> m_decodeStalls;
 };
 
 #endif // MICONTBUSMASTER_H
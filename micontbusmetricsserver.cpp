@@ -0,0 +1,348 @@
+#include "micontbusmetricsserver.h"
+#include "micontbusmaster.h"
+#include "micontbussniffer.h"
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+static const int METRICS_MAX_REQUEST = 8192;
+
+static const char *priorityNames[MicontBusMaster::PriorityCount] = {
+    "control", "interactive", "polling", "bulk"
+};
+
+MicontBusMetricsServer::MicontBusMetricsServer(QObject *parent)
+    : QObject(parent), m_tcpServer(new QTcpServer(this)), m_localServer(new QLocalServer(this))
+{
+    connect(m_tcpServer, SIGNAL(newConnection()), this, SLOT(newTcpConnection()));
+    connect(m_localServer, SIGNAL(newConnection()), this, SLOT(newLocalConnection()));
+}
+
+MicontBusMetricsServer::~MicontBusMetricsServer()
+{
+    close();
+}
+
+// The master must outlive the server. portName labels the series of the
+// master as a whole; those of its slaves carry the port they are on.
+void MicontBusMetricsServer::addMaster(MicontBusMaster *master, const QString &portName)
+{
+    Source s;
+    s.master = master;
+    s.portLabel = labelValue(portName);
+    m_sources.append(s);
+}
+
+// Traffic of another master, seen in listen-only mode.
+void MicontBusMetricsServer::addSniffer(MicontBusSniffer *sniffer, const QString &portName)
+{
+    SnifferSource s;
+    s.sniffer = sniffer;
+    s.portLabel = labelValue(portName);
+    m_sniffers.append(s);
+}
+
+bool MicontBusMetricsServer::listen(const QHostAddress &address, quint16 port)
+{
+    if (!m_tcpServer->listen(address, port)) {
+        m_errorString = m_tcpServer->errorString();
+        return false;
+    }
+    return true;
+}
+
+bool MicontBusMetricsServer::listenLocal(const QString &name)
+{
+    QLocalServer::removeServer(name);
+    if (!m_localServer->listen(name)) {
+        m_errorString = m_localServer->errorString();
+        return false;
+    }
+    return true;
+}
+
+void MicontBusMetricsServer::close()
+{
+    m_tcpServer->close();
+    m_localServer->close();
+}
+
+QString MicontBusMetricsServer::errorString() const
+{
+    return m_errorString;
+}
+
+// The TCP port listened on, useful after listen() on port 0.
+quint16 MicontBusMetricsServer::serverPort() const
+{
+    return m_tcpServer->serverPort();
+}
+
+// Label values escaped as the text format wants them.
+QString MicontBusMetricsServer::labelValue(const QString &value)
+{
+    QString out;
+    out.reserve(value.size());
+    foreach (QChar c, value) {
+        if (c == '\\')
+            out += "\\\\";
+        else if (c == '"')
+            out += "\\\"";
+        else if (c == '\n')
+            out += "\\n";
+        else
+            out += c;
+    }
+    return out;
+}
+
+// Slaves that were addressed at all: a write that timed out doesn't count
+// as a transaction, a slave held down may not have been tried yet.
+static bool hasTraffic(const MicontBusMaster::SlaveCounters &c)
+{
+    return c.transactions.load(std::memory_order_relaxed) || c.timeouts.load(std::memory_order_relaxed)
+            || c.retries.load(std::memory_order_relaxed) || c.down.load(std::memory_order_relaxed);
+}
+
+static void renderHeader(QByteArray &out, const char *name, const char *type, const char *help)
+{
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+static void renderSample(QByteArray &out, const char *name, const QString &labels, const QByteArray &value)
+{
+    out += name;
+    out += '{';
+    out += labels.toUtf8();
+    out += "} ";
+    out += value;
+    out += '\n';
+}
+
+QByteArray MicontBusMetricsServer::render() const
+{
+    static const struct {
+        const char *name;
+        const char *help;
+        std::atomic<uint64_t> MicontBusMaster::SlaveCounters::*counter;
+    } slaveCounters[] = {
+        { "micontbus_transactions_total", "Requests sent to the slave.", &MicontBusMaster::SlaveCounters::transactions },
+        { "micontbus_responses_total", "Valid responses from the slave.", &MicontBusMaster::SlaveCounters::responses },
+        { "micontbus_tx_bytes_total", "Bytes sent to the slave.", &MicontBusMaster::SlaveCounters::txBytes },
+        { "micontbus_rx_bytes_total", "Bytes received from the slave.", &MicontBusMaster::SlaveCounters::rxBytes },
+        { "micontbus_crc_errors_total", "Responses with a bad CRC.", &MicontBusMaster::SlaveCounters::crcErrors },
+        { "micontbus_timeouts_total", "Read and write timeouts.", &MicontBusMaster::SlaveCounters::timeouts },
+        { "micontbus_retries_total", "Requests requeued by the retry policy.", &MicontBusMaster::SlaveCounters::retries },
+    };
+
+    QByteArray out;
+    out.reserve(16384);
+
+    for (unsigned k = 0; k < sizeof(slaveCounters) / sizeof(slaveCounters[0]); k++) {
+        renderHeader(out, slaveCounters[k].name, "counter", slaveCounters[k].help);
+        foreach (const Source &s, m_sources) {
+            foreach (const QString &port, s.master->counterPorts()) {
+                QString portLabel = labelValue(port);
+                for (int id = 0; id < 256; id++) {
+                    const MicontBusMaster::SlaveCounters &c = s.master->slaveCounters(port, id);
+                    if (!hasTraffic(c))
+                        continue;
+                    renderSample(out, slaveCounters[k].name, QString("port=\"%1\",slave=\"%2\"").arg(portLabel).arg(id),
+                                 QByteArray::number((quint64)(c.*slaveCounters[k].counter).load(std::memory_order_relaxed)));
+                }
+            }
+        }
+    }
+
+    renderHeader(out, "micontbus_slave_up", "gauge", "0 while the health tracker holds the slave down.");
+    foreach (const Source &s, m_sources) {
+        foreach (const QString &port, s.master->counterPorts()) {
+            QString portLabel = labelValue(port);
+            for (int id = 0; id < 256; id++) {
+                const MicontBusMaster::SlaveCounters &c = s.master->slaveCounters(port, id);
+                if (!hasTraffic(c))
+                    continue;
+                renderSample(out, "micontbus_slave_up", QString("port=\"%1\",slave=\"%2\"").arg(portLabel).arg(id),
+                             c.down.load(std::memory_order_relaxed) ? "0" : "1");
+            }
+        }
+    }
+
+    renderHeader(out, "micontbus_queue_depth", "gauge", "Requests waiting for the bus.");
+    foreach (const Source &s, m_sources) {
+        for (int p = 0; p < MicontBusMaster::PriorityCount; p++) {
+            renderSample(out, "micontbus_queue_depth", QString("port=\"%1\",priority=\"%2\"").arg(s.portLabel).arg(priorityNames[p]),
+                         QByteArray::number(s.master->queueSize((MicontBusMaster::Priority)p)));
+        }
+    }
+
+    renderHeader(out, "micontbus_busy_seconds_total", "counter", "Time spent exchanging frames; its rate is the bus utilization.");
+    foreach (const Source &s, m_sources) {
+        renderSample(out, "micontbus_busy_seconds_total", QString("port=\"%1\"").arg(s.portLabel),
+                     QByteArray::number(s.master->busyTime() / 1e6, 'f', 6));
+    }
+
+    renderHeader(out, "micontbus_wire_seconds_total", "counter", "Character time of the frames sent and received at the line's baud rate and format.");
+    foreach (const Source &s, m_sources) {
+        renderSample(out, "micontbus_wire_seconds_total", QString("port=\"%1\"").arg(s.portLabel),
+                     QByteArray::number(s.master->wireTime() / 1e6, 'f', 6));
+    }
+
+    renderHeader(out, "micontbus_turnaround_seconds_total", "counter", "Time between requests and their responses beyond the wire time.");
+    foreach (const Source &s, m_sources) {
+        renderSample(out, "micontbus_turnaround_seconds_total", QString("port=\"%1\"").arg(s.portLabel),
+                     QByteArray::number(s.master->turnaroundTime() / 1e6, 'f', 6));
+    }
+
+    renderHeader(out, "micontbus_timeout_wait_seconds_total", "counter", "Time spent waiting on slaves that didn't answer.");
+    foreach (const Source &s, m_sources) {
+        renderSample(out, "micontbus_timeout_wait_seconds_total", QString("port=\"%1\"").arg(s.portLabel),
+                     QByteArray::number(s.master->timeoutTime() / 1e6, 'f', 6));
+    }
+
+    renderHeader(out, "micontbus_requests_dropped_total", "counter", "Requests dropped before transmission because they were cancelled or their deadline passed.");
+    foreach (const Source &s, m_sources) {
+        renderSample(out, "micontbus_requests_dropped_total", QString("port=\"%1\",reason=\"cancelled\"").arg(s.portLabel),
+                     QByteArray::number(s.master->droppedCancelled()));
+        renderSample(out, "micontbus_requests_dropped_total", QString("port=\"%1\",reason=\"expired\"").arg(s.portLabel),
+                     QByteArray::number(s.master->droppedExpired()));
+    }
+
+    renderHeader(out, "micontbus_decode_stalls_total", "counter", "Times the bus thread waited for a decode worker to catch up.");
+    foreach (const Source &s, m_sources)
+        renderSample(out, "micontbus_decode_stalls_total", QString("port=\"%1\"").arg(s.portLabel), QByteArray::number(s.master->decodeStalls()));
+
+    renderHeader(out, "micontbus_wakeup_latency_seconds", "histogram", "Delay from a request becoming ready to the bus thread running.");
+    foreach (const Source &s, m_sources)
+        renderHistogram(out, "micontbus_wakeup_latency_seconds", QString("port=\"%1\"").arg(s.portLabel), s.master->wakeupLatency());
+
+    renderHeader(out, "micontbus_cycle_jitter_seconds", "histogram", "Deviation of round trips from their smoothed value.");
+    foreach (const Source &s, m_sources)
+        renderHistogram(out, "micontbus_cycle_jitter_seconds", QString("port=\"%1\"").arg(s.portLabel), s.master->cycleJitter());
+
+    static const struct {
+        const char *name;
+        const char *help;
+        std::atomic<quint64> MicontBusSniffer::Counters::*counter;
+    } snifferCounters[] = {
+        { "micontbus_sniffed_bytes_total", "Bytes seen on the line.", &MicontBusSniffer::Counters::bytes },
+        { "micontbus_sniffed_requests_total", "Requests seen on the line.", &MicontBusSniffer::Counters::requests },
+        { "micontbus_sniffed_responses_total", "Responses seen on the line.", &MicontBusSniffer::Counters::responses },
+        { "micontbus_sniffed_answered_total", "Requests followed by their response.", &MicontBusSniffer::Counters::answered },
+        { "micontbus_sniffed_unanswered_total", "Requests the slave didn't answer.", &MicontBusSniffer::Counters::unanswered },
+        { "micontbus_sniffed_garbage_bytes_total", "Bytes that didn't frame.", &MicontBusSniffer::Counters::garbageBytes },
+        { "micontbus_sniffed_resyncs_total", "Runs of garbage before the framing recovered.", &MicontBusSniffer::Counters::resyncs },
+    };
+
+    if (!m_sniffers.isEmpty()) {
+        for (unsigned k = 0; k < sizeof(snifferCounters) / sizeof(snifferCounters[0]); k++) {
+            renderHeader(out, snifferCounters[k].name, "counter", snifferCounters[k].help);
+            foreach (const SnifferSource &s, m_sniffers) {
+                const MicontBusSniffer::Counters &c = s.sniffer->counters();
+                renderSample(out, snifferCounters[k].name, QString("port=\"%1\"").arg(s.portLabel),
+                             QByteArray::number((c.*snifferCounters[k].counter).load(std::memory_order_relaxed)));
+            }
+        }
+
+        renderHeader(out, "micontbus_sniffed_turnaround_seconds", "histogram", "From the end of a request to the start of its response.");
+        foreach (const SnifferSource &s, m_sniffers)
+            renderHistogram(out, "micontbus_sniffed_turnaround_seconds", QString("port=\"%1\"").arg(s.portLabel), s.sniffer->turnaround());
+    }
+
+    return out;
+}
+
+// Buckets hold whole microseconds below bucketLimit(), hence le = limit - 1.
+void MicontBusMetricsServer::renderHistogram(QByteArray &out, const char *name, const QString &labels,
+                                             const MicontBusLatencyHistogram &h)
+{
+    QByteArray bucket = QByteArray(name) + "_bucket";
+    quint64 cumulative = 0;
+
+    for (int i = 0; i < MicontBusLatencyHistogram::BucketCount; i++) {
+        cumulative += h.bucket(i);
+        QString le = QString::number((MicontBusLatencyHistogram::bucketLimit(i) - 1) / 1e6, 'g', 9);
+        renderSample(out, bucket.constData(), QString("%1,le=\"%2\"").arg(labels).arg(le), QByteArray::number(cumulative));
+    }
+    renderSample(out, bucket.constData(), QString("%1,le=\"+Inf\"").arg(labels), QByteArray::number((quint64)h.count()));
+    renderSample(out, (QByteArray(name) + "_sum").constData(), labels, QByteArray::number(h.sum() / 1e6, 'f', 6));
+    renderSample(out, (QByteArray(name) + "_count").constData(), labels, QByteArray::number((quint64)h.count()));
+}
+
+void MicontBusMetricsServer::newTcpConnection()
+{
+    while (m_tcpServer->hasPendingConnections())
+        addClient(m_tcpServer->nextPendingConnection());
+}
+
+void MicontBusMetricsServer::newLocalConnection()
+{
+    while (m_localServer->hasPendingConnections())
+        addClient(m_localServer->nextPendingConnection());
+}
+
+void MicontBusMetricsServer::addClient(QIODevice *socket)
+{
+    m_requests.insert(socket, QByteArray());
+    connect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+    connect(socket, SIGNAL(disconnected()), this, SLOT(clientDisconnected()));
+}
+
+void MicontBusMetricsServer::readRequest()
+{
+    QIODevice *socket = qobject_cast<QIODevice *>(sender());
+    if (!socket || !m_requests.contains(socket))
+        return;
+
+    QByteArray &request = m_requests[socket];
+    request += socket->readAll();
+
+    int end = request.indexOf("\r\n\r\n");
+    if (end < 0) {
+        if (request.size() > METRICS_MAX_REQUEST)
+            socket->close();
+        return;
+    }
+
+    QList<QByteArray> line = request.left(request.indexOf("\r\n")).split(' ');
+    QByteArray status, body, type = "text/plain; charset=utf-8";
+    if (line.size() < 3 || line[0] != "GET") {
+        status = "405 Method Not Allowed";
+    } else if (line[1] != "/metrics" && !line[1].startsWith("/metrics?")) {
+        status = "404 Not Found";
+    } else {
+        status = "200 OK";
+        body = render();
+        type = "text/plain; version=0.0.4; charset=utf-8";
+    }
+
+    QByteArray response = "HTTP/1.0 " + status + "\r\n"
+            + "Content-Type: " + type + "\r\n"
+            + "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+            + "Connection: close\r\n\r\n" + body;
+    socket->write(response);
+
+    // flushes before disconnecting
+    m_requests.remove(socket);
+    socket->close();
+}
+
+void MicontBusMetricsServer::clientDisconnected()
+{
+    QIODevice *socket = qobject_cast<QIODevice *>(sender());
+    if (!socket)
+        return;
+
+    m_requests.remove(socket);
+    socket->deleteLater();
+}
@@ -0,0 +1,73 @@
+#ifndef MICONTBUSMETRICSSERVER_H
+#define MICONTBUSMETRICSSERVER_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QHostAddress>
+
+QT_BEGIN_NAMESPACE
+class QTcpServer;
+class QLocalServer;
+class QIODevice;
+QT_END_NAMESPACE
+
+class MicontBusMaster;
+class MicontBusSniffer;
+class MicontBusLatencyHistogram;
+
+/* Serves the counters of one or more masters and sniffers in Prometheus
+ * text format on GET /metrics, over TCP and/or a local (Unix) socket.
+ * Rendering only reads lock-free counters, a scrape never waits for the
+ * bus thread. One request per connection. */
+class MicontBusMetricsServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    MicontBusMetricsServer(QObject *parent = 0);
+    ~MicontBusMetricsServer();
+
+    void addMaster(MicontBusMaster *master, const QString &portName);
+    void addSniffer(MicontBusSniffer *sniffer, const QString &portName);
+
+    bool listen(const QHostAddress &address, quint16 port);
+    bool listenLocal(const QString &name);
+    void close();
+    QString errorString() const;
+    quint16 serverPort() const;
+
+    QByteArray render() const;
+
+    static QString labelValue(const QString &value);
+
+private slots:
+    void newTcpConnection();
+    void newLocalConnection();
+    void readRequest();
+    void clientDisconnected();
+
+private:
+    struct Source {
+        MicontBusMaster *master;
+        QString portLabel;  // escaped
+    };
+
+    struct SnifferSource {
+        MicontBusSniffer *sniffer;
+        QString portLabel;
+    };
+
+    void addClient(QIODevice *socket);
+    static void renderHistogram(QByteArray &out, const char *name, const QString &labels,
+                                const MicontBusLatencyHistogram &h);
+
+    QTcpServer *m_tcpServer;
+    QLocalServer *m_localServer;
+    QList<Source> m_sources;
+    QList<SnifferSource> m_sniffers;
+    QHash<QIODevice *, QByteArray> m_requests;
+    QString m_errorString;
+};
+
+#endif // MICONTBUSMETRICSSERVER_H
@@ -116,80 +116,64 @@ void MicontBusPacket::setVariables(const QVector<tMicontVar> &vars)
     }
 }
 
+// Frame rules are those of MicontBusCodec::decode(); data and size are
+// only replaced when the frame carries them.
 bool MicontBusPacket::parse(const QByteArray &rawPacket)
 {
-    quint32 size = rawPacket.size();
-
-    if (size < 4)
+    if (rawPacket.size() < 4)
         return false;
 
-    QDataStream s(rawPacket);
-    s.setByteOrder(QDataStream::LittleEndian);
-    s >> m_id >> m_cmd >> m_addr;
-    size -= 4;
-
-    switch (m_cmd & 0xf) {
-        case CMD_GETSIZE:
-            if ((m_cmd & 0xf0) != CMD_RESULT_OK)
-                break;
-
-            if (size != 4)
-                return false;
-
-            m_data = rawPacket.right(4);
-            size -= 4;
-            break;
-        case CMD_PUTBUF_B:
-        case CMD_GETBUF_B:
-            if (size < 2)
-                return false;
-
-            s >> m_size;
-            size -= 2;
-
-            if ((m_cmd & 0xf) == CMD_PUTBUF_B)
-                break;
-
-            if ((m_cmd & 0xf0) != CMD_RESULT_OK)
-                break;
-
-            if (m_size != size)
-                return false;
-
-            m_data = rawPacket.right(m_size);
-            size -= m_size;
-            break;
-        default:
-            return false;
-    }
+    MicontBusMessage message;
+    bool ok = MicontBusCodec::decode(rawPacket.constData(), rawPacket.size(), &message);
 
-    if (size > 0)
-        return false;
+    m_id = message.id;
+    m_cmd = message.cmd;
+    m_addr = message.addr;
+    if (((m_cmd & 0xf) == CMD_GETBUF_B || (m_cmd & 0xf) == CMD_PUTBUF_B) && rawPacket.size() >= 6)
+        m_size = message.size;
+    if (ok && MicontBusCodec::hasData(m_cmd))
+        m_data = QByteArray(reinterpret_cast<const char *>(message.data.data()), message.data.size());
 
-    return true;
+    return ok;
 }
 
 QByteArray MicontBusPacket::serialize() const
 {
-    QByteArray packet;
-    QDataStream s(&packet, QIODevice::WriteOnly);
-    s.setByteOrder(QDataStream::LittleEndian);
-
-    s << m_id;
-    s << m_cmd;
-    s << m_addr;
+    // header by the codec, the data appended without a detour through it
+    MicontBusMessage message;
+    message.id = m_id;
+    message.cmd = m_cmd;
+    message.addr = m_addr;
+    message.size = m_size;
+    std::vector<uint8_t> header = MicontBusCodec::encode(message);
 
-    if ((m_cmd & 0x0f) == CMD_GETBUF_B || (m_cmd & 0x0f) == CMD_PUTBUF_B)
-        s << m_size;
-
-    if (m_cmd == CMD_PUTBUF_B ||
-        m_cmd == (CMD_GETBUF_B | CMD_RESULT_OK) ||
-        m_cmd == (CMD_GETSIZE | CMD_RESULT_OK))
+    QByteArray packet(reinterpret_cast<const char *>(header.data()), header.size());
+    if (MicontBusCodec::hasData(m_cmd))
         packet.append(m_data);
 
     return packet;
 }
 
+int MicontBusPacket::expectedResponseSize(const QByteArray &request)
+{
+    return MicontBusCodec::expectedResponseSize(request.constData(), request.size());
+}
+
+// Length of the request frame (without CRC) starting at header, 0 if more
+// bytes are needed to tell, -1 if header is not a valid request.
+int MicontBusPacket::requestSize(const QByteArray &header)
+{
+    return MicontBusCodec::requestSize(header.constData(), header.size());
+}
+
+// Length of the response frame (without CRC) starting at header, by the
+// rules of parse(). 0 if more bytes are needed to tell, -1 if header is not
+// a valid response.
+int MicontBusPacket::responseSize(const QByteArray &header)
+{
+    return MicontBusCodec::responseSize(header.constData(), header.size());
+}
+
 QDebug operator<<(QDebug dbg, const MicontBusPacket &packet)
 {
     dbg.nospace() << "MicontBusPacket(id: " << packet.id()
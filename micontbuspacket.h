@@ -5,6 +5,8 @@
 #include <QMetaType>
 #include <QByteArray>
 
+#include "micontbuscodec.h"
+
 typedef union {
     quint32 u;
     qint32 i;
@@ -16,30 +18,31 @@ class MicontBusPacket
 public:
 
     enum CmdCode {
-        CMD_GETSIZE =   0x01,
-        CMD_GETBUF_B =  0x02,
-        CMD_GETBUF =    0x03,
-        CMD_PUTBUF_B =  0x04,
-        CMD_PUTBUF =    0x05,
+        CMD_GETSIZE =   MicontBusCodec::CMD_GETSIZE,
+        CMD_GETBUF_B =  MicontBusCodec::CMD_GETBUF_B,
+        CMD_GETBUF =    MicontBusCodec::CMD_GETBUF,
+        CMD_PUTBUF_B =  MicontBusCodec::CMD_PUTBUF_B,
+        CMD_PUTBUF =    MicontBusCodec::CMD_PUTBUF,
     };
 
     enum ResultCode {
-        CMD_RESULT_OK =         0x10,
-        CMD_RESULT_WAIT =       0x20,
-        CMD_RESULT_BUSY =       0x30,
-        CMD_RESULT_UCMD =       0x40,
-        CMD_RESULT_ERRVAR =     0x50,
-        CMD_RESULT_ERRCMD =     0x60,
-        CMD_RESULT_ERRARG =     0x70,
-        CMD_RESULT_ERRBSIZE =   0x80,
-        CMD_RESULT_ERRBADDR =   0x90,
-        CMD_RESULT_ERRPWD =     0xa0,
-        CMD_RESULT_ERRLFT =     0xb0,
-        CMD_RESULT_ERRDONE =    0xc0,
+        CMD_RESULT_OK =         MicontBusCodec::CMD_RESULT_OK,
+        CMD_RESULT_WAIT =       MicontBusCodec::CMD_RESULT_WAIT,
+        CMD_RESULT_BUSY =       MicontBusCodec::CMD_RESULT_BUSY,
+        CMD_RESULT_UCMD =       MicontBusCodec::CMD_RESULT_UCMD,
+        CMD_RESULT_ERRVAR =     MicontBusCodec::CMD_RESULT_ERRVAR,
+        CMD_RESULT_ERRCMD =     MicontBusCodec::CMD_RESULT_ERRCMD,
+        CMD_RESULT_ERRARG =     MicontBusCodec::CMD_RESULT_ERRARG,
+        CMD_RESULT_ERRBSIZE =   MicontBusCodec::CMD_RESULT_ERRBSIZE,
+        CMD_RESULT_ERRBADDR =   MicontBusCodec::CMD_RESULT_ERRBADDR,
+        CMD_RESULT_ERRPWD =     MicontBusCodec::CMD_RESULT_ERRPWD,
+        CMD_RESULT_ERRLFT =     MicontBusCodec::CMD_RESULT_ERRLFT,
+        CMD_RESULT_ERRDONE =    MicontBusCodec::CMD_RESULT_ERRDONE,
     };
 
     MicontBusPacket();
     MicontBusPacket(const MicontBusPacket &other);
+    MicontBusPacket &operator=(const MicontBusPacket &other) = default;
     ~MicontBusPacket();
 
     quint8 id() const;
@@ -65,6 +68,10 @@ public:
     bool parse(const QByteArray &rawPacket);
     QByteArray serialize() const;
 
+    static int expectedResponseSize(const QByteArray &request);
+    static int requestSize(const QByteArray &header);
+    static int responseSize(const QByteArray &header);
+
 private:
     quint8 m_id;
     quint8 m_cmd;
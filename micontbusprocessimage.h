@@ -0,0 +1,145 @@
+#ifndef MICONTBUSPROCESSIMAGE_H
+#define MICONTBUSPROCESSIMAGE_H
+
+/* Layout of the shared-memory process image and a reader for it. This
+ * header depends on the C++ and POSIX libraries only, so that HMI, logger
+ * and control processes can include it without Qt.
+ *
+ * The image is a POSIX shared-memory object holding a fixed table of
+ * blocks, one per (slave id, start address) that has been polled. Each
+ * block is published under a sequence lock: the writer makes the counter
+ * odd, updates the block and makes it even again, and a reader retries
+ * its copy until it sees the same even value before and after. Reads take
+ * no locks and no system calls.
+ *
+ * A publisher that opens the image again starts a new generation and
+ * hands the blocks out afresh, so a block pointer kept from find() may
+ * come to hold another slave's variables. The snapshot carries the id,
+ * address and generation it was copied with; once the generation differs
+ * from the one the block was found in, look it up again. */
+
+#include <atomic>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define MICONTBUS_IMAGE_MAGIC       0x4950424dU     // "MBPI"
+#define MICONTBUS_IMAGE_VERSION     2
+#define MICONTBUS_IMAGE_BLOCKS      1024
+#define MICONTBUS_IMAGE_VARS        64
+// a writer is inside a block for a microsecond or so, one that stays
+// longer has died there
+#define MICONTBUS_IMAGE_READ_TRIES  100000
+
+struct MicontBusImageBlock {
+    std::atomic<uint32_t> seq;          // odd while the writer is inside
+    uint8_t id;                         // set under seq when the block is handed out
+    uint8_t reserved0;
+    uint16_t addr;
+    uint16_t count;
+    uint16_t reserved1;
+    uint32_t generation;                // of the header, when the block was handed out
+    int64_t timestamp;                  // ms since epoch of the last update
+    uint32_t vars[MICONTBUS_IMAGE_VARS];
+};
+
+struct MicontBusImageHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t maxBlocks;
+    uint32_t maxVars;
+    std::atomic<uint32_t> blockCount;   // blocks in use, grows only within a generation
+    std::atomic<uint32_t> generation;   // bumped each time a publisher opens the image
+    uint32_t reserved[2];
+    MicontBusImageBlock blocks[MICONTBUS_IMAGE_BLOCKS];
+};
+
+struct MicontBusImageSnapshot {
+    uint8_t id;
+    uint16_t addr;
+    uint32_t generation;
+    uint16_t count;
+    int64_t timestamp;
+    uint32_t vars[MICONTBUS_IMAGE_VARS];
+};
+
+class MicontBusProcessImageReader
+{
+public:
+    MicontBusProcessImageReader() : m_image(0) {}
+    ~MicontBusProcessImageReader() { close(); }
+
+    bool open(const char *name)
+    {
+        close();
+
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0)
+            return false;
+
+        void *p = mmap(0, sizeof(MicontBusImageHeader), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            return false;
+
+        m_image = static_cast<const MicontBusImageHeader *>(p);
+        if (m_image->magic != MICONTBUS_IMAGE_MAGIC || m_image->version != MICONTBUS_IMAGE_VERSION) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (m_image)
+            munmap(const_cast<MicontBusImageHeader *>(m_image), sizeof(MicontBusImageHeader));
+        m_image = 0;
+    }
+
+    bool isOpen() const { return m_image != 0; }
+
+    uint32_t generation() const { return m_image->generation.load(std::memory_order_acquire); }
+
+    // Look the block up once and keep the pointer, it never moves.
+    const MicontBusImageBlock *find(uint8_t id, uint16_t addr) const
+    {
+        uint32_t count = m_image->blockCount.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < count; i++) {
+            if (m_image->blocks[i].id == id && m_image->blocks[i].addr == addr)
+                return &m_image->blocks[i];
+        }
+        return 0;
+    }
+
+    // False if no consistent copy could be had, e.g. because the writer
+    // died while updating the block.
+    static bool read(const MicontBusImageBlock *block, MicontBusImageSnapshot *snapshot,
+                     int tries = MICONTBUS_IMAGE_READ_TRIES)
+    {
+        for (int i = 0; i < tries; i++) {
+            uint32_t seq = block->seq.load(std::memory_order_acquire);
+            if (seq & 1)
+                continue;
+
+            snapshot->id = block->id;
+            snapshot->addr = block->addr;
+            snapshot->generation = block->generation;
+            snapshot->count = block->count;
+            snapshot->timestamp = block->timestamp;
+            memcpy(snapshot->vars, block->vars, sizeof(snapshot->vars));
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (block->seq.load(std::memory_order_relaxed) == seq)
+                return true;
+        }
+        return false;
+    }
+
+private:
+    const MicontBusImageHeader *m_image;
+};
+
+#endif // MICONTBUSPROCESSIMAGE_H
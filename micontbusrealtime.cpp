@@ -0,0 +1,61 @@
+#include "micontbusrealtime.h"
+
+#include <QStringList>
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef Q_OS_LINUX
+// Touches the stack the bus thread will use so that it doesn't fault later.
+static void __attribute__((noinline)) prefaultStack(int size)
+{
+    volatile char *stack = static_cast<volatile char *>(__builtin_alloca(size));
+    for (int i = 0; i < size; i += 4096)
+        stack[i] = 0;
+}
+#endif
+
+bool MicontBusRealtime::apply(const MicontBusRealtimeOptions &options, QString *errorString)
+{
+    if (!options.enabled)
+        return true;
+
+#ifdef Q_OS_LINUX
+    QStringList errors;
+
+    if (options.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(options.cpu, &set);
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (rc != 0)
+            errors << QString("can't pin to CPU %1: %2").arg(options.cpu).arg(strerror(rc));
+    }
+
+    if (options.lockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        errors << QString("can't lock memory: %1").arg(strerror(errno));
+
+    // touched pages stay resident only once memory is locked, harmless otherwise
+    if (options.prefaultStack > 0)
+        prefaultStack(options.prefaultStack);
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = options.priority;
+    int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (rc != 0)
+        errors << QString("can't set SCHED_FIFO priority %1: %2").arg(options.priority).arg(strerror(rc));
+
+    *errorString = errors.join("; ");
+    return errors.isEmpty();
+#else
+    *errorString = "real-time mode is only supported on Linux";
+    return false;
+#endif
+}
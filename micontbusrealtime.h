@@ -0,0 +1,31 @@
+#ifndef MICONTBUSREALTIME_H
+#define MICONTBUSREALTIME_H
+
+#include <QString>
+
+#include "micontbuslatencyhistogram.h"
+
+struct MicontBusRealtimeOptions
+{
+    MicontBusRealtimeOptions()
+        : enabled(false), cpu(-1), priority(80), lockMemory(true), prefaultStack(256 * 1024) {}
+
+    bool enabled;
+    int cpu;            // CPU to pin the bus thread to, -1 for any
+    int priority;       // SCHED_FIFO priority, 1..99
+    bool lockMemory;    // mlockall() current and future pages
+    int prefaultStack;  // bytes of stack to touch up front
+};
+
+/* Applies the options to the calling thread. Every step is tried, those
+ * that succeed stay in effect even if others fail; returns false and
+ * lists all failures, "; " separated, in errorString. Real-time
+ * scheduling needs CAP_SYS_NICE, locking memory CAP_IPC_LOCK or a large
+ * enough RLIMIT_MEMLOCK. */
+class MicontBusRealtime
+{
+public:
+    static bool apply(const MicontBusRealtimeOptions &options, QString *errorString);
+};
+
+#endif // MICONTBUSREALTIME_H
@@ -0,0 +1,224 @@
+#ifndef MICONTBUSREGISTERMAP_H
+#define MICONTBUSREGISTERMAP_H
+
+#include <QByteArray>
+#include <QtEndian>
+
+#include <string.h>
+#include <type_traits>
+
+#include "micontbuspacket.h"
+
+/* Compile-time register layouts. A controller's variables are declared
+ * once as fields and grouped into a map:
+ *
+ *     MICONTBUS_FIELD(Status, quint32, 0x0000, 1);
+ *     MICONTBUS_FIELD(Speed, float, 0x0001, 1);
+ *     MICONTBUS_FIELD(Currents, float, 0x0004, 3);
+ *     typedef MicontBusRegisterMap<Status, Speed, Currents> DriveMap;
+ *
+ *     master.transaction(port, baud, timeout, DriveMap::readRequest(id));
+ *     ...
+ *     DriveMap::Block b;
+ *     if (b.parse(rawPacket))
+ *         speed = b.get<Speed>();
+ *
+ * The map covers the address range of all its fields and is read or
+ * written with one GETBUF_B/PUTBUF_B frame. Field offsets, the frame
+ * size and type conversions are all resolved at compile time. Element
+ * indexes are checked at run time against the field's count: out of
+ * range, reads give a zero value and writes do nothing. */
+
+// Conversion between a variable's wire representation and its C++ type.
+template<typename T> struct MicontBusVarTraits;
+
+template<> struct MicontBusVarTraits<quint32>
+{
+    static quint32 fromRaw(quint32 raw) { return raw; }
+    static quint32 toRaw(quint32 value) { return value; }
+};
+
+template<> struct MicontBusVarTraits<qint32>
+{
+    static qint32 fromRaw(quint32 raw) { return (qint32)raw; }
+    static quint32 toRaw(qint32 value) { return (quint32)value; }
+};
+
+template<> struct MicontBusVarTraits<float>
+{
+    static float fromRaw(quint32 raw) { float f; memcpy(&f, &raw, sizeof(f)); return f; }
+    static quint32 toRaw(float value) { quint32 raw; memcpy(&raw, &value, sizeof(raw)); return raw; }
+};
+
+template<typename T, quint16 Addr, int Count = 1>
+struct MicontBusField
+{
+    static_assert(Count > 0, "a field holds at least one variable");
+
+    typedef T Type;
+    static const quint16 addr = Addr;
+    static const int count = Count;
+};
+
+#define MICONTBUS_FIELD(name, type, addr, count) \
+    struct name : MicontBusField<type, addr, count> { static const char *fieldName() { return #name; } }
+
+template<typename... Fields> struct MicontBusFieldRange;
+
+template<typename F>
+struct MicontBusFieldRange<F>
+{
+    static const int first = F::addr;
+    static const int last = F::addr + F::count;
+};
+
+template<typename F, typename... Rest>
+struct MicontBusFieldRange<F, Rest...>
+{
+    typedef MicontBusFieldRange<Rest...> R;
+    static const int first = F::addr < R::first ? F::addr : R::first;
+    static const int last = F::addr + F::count > R::last ? F::addr + F::count : R::last;
+};
+
+template<typename F, typename... Fields> struct MicontBusHasField : std::false_type {};
+
+template<typename F, typename First, typename... Rest>
+struct MicontBusHasField<F, First, Rest...>
+    : std::integral_constant<bool, std::is_same<F, First>::value || MicontBusHasField<F, Rest...>::value> {};
+
+template<typename... Fields>
+class MicontBusRegisterMap
+{
+    typedef MicontBusFieldRange<Fields...> Range;
+
+public:
+    static const quint16 addr = Range::first;
+    static const int count = Range::last - Range::first;
+    static const int size = count * sizeof(quint32);
+
+    static_assert(Range::last <= 0x10000, "register map exceeds the address space");
+    static_assert(size <= 0xffff, "register map doesn't fit in one frame");
+
+    template<typename F> struct Offset
+    {
+        static_assert(MicontBusHasField<F, Fields...>::value, "field is not part of this register map");
+        static const int value = (F::addr - Range::first) * sizeof(quint32);
+    };
+
+    // Byte offset of element index of F in the map, -1 past the field.
+    template<typename F>
+    static int offset(int index)
+    {
+        if (index < 0 || index >= F::count)
+            return -1;
+        return Offset<F>::value + index * sizeof(quint32);
+    }
+
+    static QByteArray readRequest(quint8 id)
+    {
+        MicontBusPacket packet;
+        packet.setId(id);
+        packet.setCmd(MicontBusPacket::CMD_GETBUF_B);
+        packet.setAddr(addr);
+        packet.setSize(size);
+        return packet.serialize();
+    }
+
+    // Reads a field straight from the data of a GETBUF_B response. *ok is
+    // false if data is too short to hold the element.
+    template<typename F>
+    static typename F::Type get(const QByteArray &data, int index = 0, bool *ok = 0)
+    {
+        int at = offset<F>(index);
+        bool valid = at >= 0 && data.size() >= at + (int)sizeof(quint32);
+        if (ok)
+            *ok = valid;
+        if (!valid)
+            return typename F::Type();
+
+        const uchar *p = reinterpret_cast<const uchar *>(data.constData());
+        return MicontBusVarTraits<typename F::Type>::fromRaw(qFromLittleEndian<quint32>(p + at));
+    }
+
+    // Raw image of the whole map, little-endian as on the wire.
+    class Block
+    {
+    public:
+        Block() { memset(m_data, 0, sizeof(m_data)); }
+
+        bool parse(const QByteArray &rawPacket)
+        {
+            MicontBusPacket p;
+            if (!p.parse(rawPacket)
+                    || p.cmd() != (MicontBusPacket::CMD_GETBUF_B | (int)MicontBusPacket::CMD_RESULT_OK)
+                    || p.addr() != addr)
+                return false;
+            return setData(p.data());
+        }
+
+        bool setData(const QByteArray &data)
+        {
+            if (data.size() < size)
+                return false;
+            memcpy(m_data, data.constData(), size);
+            return true;
+        }
+
+        QByteArray data() const { return QByteArray(reinterpret_cast<const char *>(m_data), size); }
+
+        template<typename F>
+        typename F::Type get(int index = 0) const
+        {
+            int at = offset<F>(index);
+            if (at < 0)
+                return typename F::Type();
+            return MicontBusVarTraits<typename F::Type>::fromRaw(qFromLittleEndian<quint32>(m_data + at));
+        }
+
+        template<typename F>
+        bool set(typename F::Type value, int index = 0)
+        {
+            int at = offset<F>(index);
+            if (at < 0)
+                return false;
+            qToLittleEndian<quint32>(MicontBusVarTraits<typename F::Type>::toRaw(value), m_data + at);
+            return true;
+        }
+
+        QByteArray writeRequest(quint8 id) const
+        {
+            MicontBusPacket packet;
+            packet.setId(id);
+            packet.setCmd(MicontBusPacket::CMD_PUTBUF_B);
+            packet.setAddr(addr);
+            packet.setSize(size);
+            packet.setData(data());
+            return packet.serialize();
+        }
+
+    private:
+        uchar m_data[size];
+    };
+
+    // Writes a single field, leaving the rest of the map untouched. Empty
+    // if index is past the field.
+    template<typename F>
+    static QByteArray writeRequest(quint8 id, typename F::Type value, int index = 0)
+    {
+        if (offset<F>(index) < 0)
+            return QByteArray();
+
+        uchar raw[sizeof(quint32)];
+        qToLittleEndian<quint32>(MicontBusVarTraits<typename F::Type>::toRaw(value), raw);
+
+        MicontBusPacket packet;
+        packet.setId(id);
+        packet.setCmd(MicontBusPacket::CMD_PUTBUF_B);
+        packet.setAddr(F::addr + index);
+        packet.setSize(sizeof(quint32));
+        packet.setData(QByteArray(reinterpret_cast<const char *>(raw), sizeof(raw)));
+        return packet.serialize();
+    }
+};
+
+#endif // MICONTBUSREGISTERMAP_H
@@ -0,0 +1,176 @@
+#include "micontbusscanner.h"
+#include "micontbusmaster.h"
+#include "micontbuspacket.h"
+#include "micontbusrttestimator.h"
+
+#include <QVector>
+
+// GETSIZE request and response, both with CRC
+static const int SCAN_FRAME_BYTES = 6 + 10;
+// slave turnaround and USB adapter latency allowance, ms
+static const qint32 SCAN_TURNAROUND = 10;
+
+MicontBusScanner::MicontBusScanner(QObject *parent)
+    : QObject(parent), m_backend(MicontBusTransport::BackendQt), m_baudRate(0), m_waitTimeout(0), m_lastId(0), m_done(0), m_total(0)
+{
+}
+
+MicontBusScanner::~MicontBusScanner()
+{
+    stop();
+}
+
+// Character format of the ports, for the next start().
+void MicontBusScanner::setSerialOptions(const MicontBusSerialOptions &options)
+{
+    m_options = options;
+}
+
+void MicontBusScanner::setBackend(MicontBusTransport::Backend backend)
+{
+    m_backend = backend;
+}
+
+void MicontBusScanner::start(const QStringList &portNames, qint32 baudRate, qint32 waitTimeout,
+                             quint8 firstId, quint8 lastId)
+{
+    stop();
+
+    m_baudRate = baudRate;
+    m_waitTimeout = (waitTimeout > 0) ? waitTimeout : scanTimeout(baudRate, m_options.bitsPerCharacter());
+    m_lastId = lastId;
+    m_done = 0;
+    m_total = portNames.size() * (lastId - firstId + 1);
+
+    foreach (const QString &portName, portNames) {
+        PortScan *scan = new PortScan;
+        scan->master = new MicontBusMaster(this);
+        scan->master->setRetryPolicy(MicontBusRetryPolicy::noRetry());
+        scan->master->setSerialOptions(m_options);
+        scan->master->setBackend(m_backend);
+        scan->portName = portName;
+        scan->id = firstId;
+        scan->done = false;
+        m_scans.append(scan);
+
+        connect(scan->master, SIGNAL(response(QByteArray)),
+                this, SLOT(processResponse(QByteArray)));
+        connect(scan->master, SIGNAL(error(QString)),
+                this, SLOT(processFailure()));
+        connect(scan->master, SIGNAL(timeout(QString)),
+                this, SLOT(processFailure()));
+        connect(scan->master, SIGNAL(portError(QString)),
+                this, SLOT(processPortError(QString)));
+    }
+
+    if (m_scans.isEmpty()) {
+        emit finished();
+        return;
+    }
+
+    foreach (PortScan *scan, m_scans)
+        probeNext(scan);
+}
+
+void MicontBusScanner::stop()
+{
+    foreach (PortScan *scan, m_scans) {
+        scan->master->disconnect(this);
+        delete scan->master;
+        delete scan;
+    }
+    m_scans.clear();
+}
+
+bool MicontBusScanner::isRunning() const
+{
+    foreach (PortScan *scan, m_scans) {
+        if (!scan->done)
+            return true;
+    }
+    return false;
+}
+
+qint32 MicontBusScanner::scanTimeout(qint32 baudRate, int bitsPerChar)
+{
+    qint64 wire = MicontBusRttEstimator::frameTime(SCAN_FRAME_BYTES, baudRate, bitsPerChar);
+    return (qint32)((wire + 999) / 1000) + SCAN_TURNAROUND;
+}
+
+void MicontBusScanner::processResponse(const QByteArray &rawPacket)
+{
+    PortScan *scan = scanFor(sender());
+    if (!scan || scan->done)
+        return;
+
+    // a slave that answers at all is there, whatever the result
+    MicontBusPacket p;
+    if (p.parse(rawPacket) && p.id() == scan->id && (p.cmd() & 0x0f) == MicontBusPacket::CMD_GETSIZE) {
+        quint8 result = p.cmd() & 0xf0;
+        QVector<tMicontVar> vars = p.variables();
+        quint32 size = (result == MicontBusPacket::CMD_RESULT_OK && !vars.isEmpty()) ? vars[0].u : 0;
+        emit slaveFound(scan->portName, p.id(), result, size, scan->master->lastRoundTrip());
+    }
+
+    advance(scan);
+}
+
+void MicontBusScanner::processFailure()
+{
+    PortScan *scan = scanFor(sender());
+    if (!scan || scan->done)
+        return;
+
+    advance(scan);
+}
+
+void MicontBusScanner::processPortError(const QString &s)
+{
+    Q_UNUSED(s)
+
+    PortScan *scan = scanFor(sender());
+    if (!scan || scan->done)
+        return;
+
+    // the port is unusable, account the rest of its ids as done
+    m_done += m_lastId - scan->id + 1;
+    finishPort(scan);
+}
+
+MicontBusScanner::PortScan *MicontBusScanner::scanFor(QObject *master)
+{
+    foreach (PortScan *scan, m_scans) {
+        if (scan->master == master)
+            return scan;
+    }
+    return 0;
+}
+
+void MicontBusScanner::probeNext(PortScan *scan)
+{
+    MicontBusPacket packet;
+    packet.setId(scan->id);
+    packet.setCmd(MicontBusPacket::CMD_GETSIZE);
+    scan->master->transaction(scan->portName, m_baudRate, m_waitTimeout, packet.serialize(),
+                              MicontBusMaster::PriorityBulk);
+}
+
+void MicontBusScanner::advance(PortScan *scan)
+{
+    emit progress(++m_done, m_total);
+
+    if (++scan->id > m_lastId)
+        finishPort(scan);
+    else
+        probeNext(scan);
+}
+
+void MicontBusScanner::finishPort(PortScan *scan)
+{
+    scan->done = true;
+
+    if (!isRunning()) {
+        emit progress(m_total, m_total);
+        emit finished();
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef MICONTBUSSCANNER_H
+#define MICONTBUSSCANNER_H
+
+#include <QObject>
+#include <QList>
+#include <QStringList>
+
+#include "micontbustransport.h"
+
+class MicontBusMaster;
+
+/* Bus discovery: probes every id with CMD_GETSIZE on all given ports at
+ * once, one MicontBusMaster (and thread) per port. Slaves that answer
+ * BUSY or an error are reported too, with their result code; only OK
+ * answers carry a size. */
+class MicontBusScanner : public QObject
+{
+    Q_OBJECT
+
+public:
+    MicontBusScanner(QObject *parent = 0);
+    ~MicontBusScanner();
+
+    void setSerialOptions(const MicontBusSerialOptions &options);
+    void setBackend(MicontBusTransport::Backend backend);
+    void start(const QStringList &portNames, qint32 baudRate, qint32 waitTimeout = 0,
+               quint8 firstId = 0, quint8 lastId = 255);
+    void stop();
+    bool isRunning() const;
+
+    static qint32 scanTimeout(qint32 baudRate, int bitsPerChar = 10);
+
+signals:
+    void slaveFound(const QString &portName, quint8 id, quint8 result, quint32 size, qint64 turnaround);
+    void progress(int done, int total);
+    void finished();
+
+private slots:
+    void processResponse(const QByteArray &rawPacket);
+    void processFailure();
+    void processPortError(const QString &s);
+
+private:
+    struct PortScan {
+        MicontBusMaster *master;
+        QString portName;
+        int id;
+        bool done;
+    };
+
+    PortScan *scanFor(QObject *master);
+    void probeNext(PortScan *scan);
+    void advance(PortScan *scan);
+    void finishPort(PortScan *scan);
+
+    QList<PortScan *> m_scans;
+    MicontBusSerialOptions m_options;
+    MicontBusTransport::Backend m_backend;
+    qint32 m_baudRate;
+    qint32 m_waitTimeout;
+    int m_lastId;
+    int m_done;
+    int m_total;
+};
+
+#endif // MICONTBUSSCANNER_H
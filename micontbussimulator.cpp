@@ -0,0 +1,427 @@
+#include "micontbussimulator.h"
+#include "micontbusframepool.h"
+#include "micontbuscodec.h"
+
+#include <QFile>
+#include <QStringList>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+// longest wait of the simulator loop, ms
+static const int SIMULATOR_POLL = 50;
+
+MicontBusFaults MicontBusFaults::fromString(const QString &s, bool *ok)
+{
+    MicontBusFaults faults;
+    bool valid = true;
+
+    foreach (const QString &item, s.split(',', QString::SkipEmptyParts)) {
+        QStringList kv = item.split('=');
+        bool numberOk = false;
+        double value = kv.size() == 2 ? kv[1].toDouble(&numberOk) : 0;
+        if (!numberOk || value < 0) {
+            valid = false;
+            continue;
+        }
+
+        QString key = kv[0].trimmed();
+        if (key == "crc")
+            faults.crc = value;
+        else if (key == "truncate")
+            faults.truncate = value;
+        else if (key == "late")
+            faults.late = value;
+        else if (key == "busy")
+            faults.busy = value;
+        else if (key == "storm")
+            faults.busyStorm = qMax(1, (int)value);
+        else if (key == "late-delay")
+            faults.lateDelay = value;
+        else if (key == "disconnect")
+            faults.disconnectInterval = value;
+        else if (key == "disconnect-time")
+            faults.disconnectTime = value;
+        else
+            valid = false;
+    }
+
+    if (ok)
+        *ok = valid;
+    return faults;
+}
+
+QString MicontBusFaults::toString() const
+{
+    return QString("crc=%1,truncate=%2,late=%3,busy=%4,storm=%5,late-delay=%6,disconnect=%7,disconnect-time=%8")
+            .arg(crc).arg(truncate).arg(late).arg(busy).arg(busyStorm).arg(lateDelay)
+            .arg(disconnectInterval).arg(disconnectTime);
+}
+
+MicontBusSimulator::MicontBusSimulator(QObject *parent)
+    : QThread(parent), m_master(-1), m_slave(-1), m_maxData(maxDataDefault()), m_quit(false),
+      m_nextDisconnect(0), m_reconnect(0), m_random(0x2545f491)
+{
+    m_counters.requests = m_counters.responses = 0;
+    m_counters.crcFaults = m_counters.truncated = m_counters.late = m_counters.busy = 0;
+    m_counters.disconnects = m_counters.garbageBytes = 0;
+}
+
+MicontBusSimulator::~MicontBusSimulator()
+{
+    stop();
+    close();
+}
+
+// Slaves with vars variables each, all zero. Set before start().
+void MicontBusSimulator::setSlaves(const QList<quint8> &ids, int vars)
+{
+    m_slaves.clear();
+    foreach (quint8 id, ids)
+        m_slaves[id].vars.fill(0, vars);
+}
+
+void MicontBusSimulator::setFaults(const MicontBusFaults &faults)
+{
+    m_faults = faults;
+}
+
+// Seed of the fault injection, a given seed and load give the same faults.
+// Set before start().
+void MicontBusSimulator::setSeed(quint32 seed)
+{
+    m_random = seed ? seed : 0x2545f491;
+}
+
+// Largest GETBUF_B/PUTBUF_B data the slaves take, bytes.
+void MicontBusSimulator::setMaxData(int bytes)
+{
+    m_maxData = bytes;
+}
+
+// Creates the pty and the symlink at linkPath the master opens.
+bool MicontBusSimulator::open(const QString &linkPath)
+{
+    close();
+    m_link = linkPath;
+    m_clock.start();
+    m_nextDisconnect = m_faults.disconnectInterval;
+    return openPty();
+}
+
+void MicontBusSimulator::close()
+{
+    closePty();
+    if (!m_link.isEmpty())
+        ::unlink(QFile::encodeName(m_link).constData());
+}
+
+QString MicontBusSimulator::portName() const
+{
+    return m_link;
+}
+
+QString MicontBusSimulator::errorString() const
+{
+    return m_errorString;
+}
+
+void MicontBusSimulator::run()
+{
+    char chunk[4096];
+
+    while (!m_quit.load()) {
+        qint64 now = m_clock.elapsed();
+
+        if (m_master >= 0 && m_faults.disconnectInterval > 0 && now >= m_nextDisconnect) {
+            closePty();
+            ::unlink(QFile::encodeName(m_link).constData());
+            m_reconnect = now + m_faults.disconnectTime;
+            m_counters.disconnects.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (m_master < 0 && now >= m_reconnect) {
+            if (!openPty()) {
+                emit error(m_errorString);
+                break;
+            }
+            m_nextDisconnect = now + m_faults.disconnectInterval;
+        }
+
+        // late responses that are due, in order
+        int wait = SIMULATOR_POLL;
+        while (!m_delayed.isEmpty() && m_delayed.first().due <= now)
+            writeAll(m_delayed.takeFirst().frame);
+        if (!m_delayed.isEmpty())
+            wait = qMin<qint64>(wait, m_delayed.first().due - now);
+
+        if (m_master < 0) {
+            msleep(qMax<qint64>(1, qMin<qint64>(wait, m_reconnect - now)));
+            continue;
+        }
+
+        struct pollfd pfd;
+        pfd.fd = m_master;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int n = poll(&pfd, 1, qMax(0, wait));
+        if (n < 0 && errno != EINTR) {
+            m_errorString = tr("poll: %1").arg(strerror(errno));
+            emit error(m_errorString);
+            break;
+        }
+
+        if (n == 0) {
+            // a partial request the line went quiet on is never completed
+            if (!m_buffer.isEmpty() && wait == SIMULATOR_POLL) {
+                m_counters.garbageBytes.fetch_add(m_buffer.size(), std::memory_order_relaxed);
+                m_buffer.clear();
+            }
+            continue;
+        }
+
+        forever {
+            ssize_t r = ::read(m_master, chunk, sizeof(chunk));
+            if (r <= 0)
+                break;
+            m_buffer.append(chunk, r);
+        }
+        parse();
+    }
+}
+
+void MicontBusSimulator::stop()
+{
+    m_quit.store(true);
+    wait();
+    m_quit.store(false);
+}
+
+const MicontBusSimulator::Counters &MicontBusSimulator::counters() const
+{
+    return m_counters;
+}
+
+int MicontBusSimulator::maxDataDefault()
+{
+    return MICONTBUS_FRAME_CAPACITY - 6 - 2;
+}
+
+// New pty, raw on the slave side, published at the link.
+bool MicontBusSimulator::openPty()
+{
+    m_master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (m_master < 0 || grantpt(m_master) < 0 || unlockpt(m_master) < 0) {
+        m_errorString = tr("can't create pty: %1").arg(strerror(errno));
+        closePty();
+        return false;
+    }
+
+    QByteArray name = ptsname(m_master);
+    m_slave = ::open(name.constData(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (m_slave < 0) {
+        m_errorString = tr("can't open %1: %2").arg(QString::fromLocal8Bit(name)).arg(strerror(errno));
+        closePty();
+        return false;
+    }
+
+    struct termios tio;
+    if (tcgetattr(m_slave, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(m_slave, TCSANOW, &tio);
+    }
+
+    // replaced in one step, the master never sees a missing link here
+    QByteArray link = QFile::encodeName(m_link);
+    QByteArray tmp = link + ".tmp";
+    ::unlink(tmp.constData());
+    if (::symlink(name.constData(), tmp.constData()) < 0 || ::rename(tmp.constData(), link.constData()) < 0) {
+        m_errorString = tr("can't link %1: %2").arg(m_link).arg(strerror(errno));
+        closePty();
+        return false;
+    }
+
+    m_buffer.clear();
+    m_delayed.clear();
+    return true;
+}
+
+void MicontBusSimulator::closePty()
+{
+    if (m_slave >= 0)
+        ::close(m_slave);
+    if (m_master >= 0)
+        ::close(m_master);
+    m_slave = m_master = -1;
+}
+
+// Answers the complete requests in the buffer. Bytes that don't frame are
+// dropped one at a time until a request does.
+void MicontBusSimulator::parse()
+{
+    int head = 0;
+
+    while (m_buffer.size() - head >= 2) {
+        const char *d = m_buffer.constData() + head;
+        int available = m_buffer.size() - head;
+
+        int size = MicontBusCodec::requestSize(d, available);
+        if (size == 0 || (size > 0 && size + 2 > available && size <= m_maxData + 6))
+            break;
+        if (size < 0 || size > m_maxData + 6 || !MicontBusCodec::checkCrc(d, size + 2)) {
+            m_counters.garbageBytes.fetch_add(1, std::memory_order_relaxed);
+            head++;
+            continue;
+        }
+
+        m_counters.requests.fetch_add(1, std::memory_order_relaxed);
+        QByteArray response = answer(QByteArray(d, size));
+        head += size + 2;
+        if (!response.isEmpty())
+            send(response);
+    }
+
+    m_buffer.remove(0, head);
+}
+
+// The response to a request without CRC, empty if nobody answers it.
+QByteArray MicontBusSimulator::answer(const QByteArray &request)
+{
+    // decode() takes responses, a request is read here; its length is
+    // known to be right
+    const uchar *d = reinterpret_cast<const uchar *>(request.constData());
+    MicontBusMessage q;
+    q.id = d[0];
+    q.cmd = d[1];
+    q.addr = d[2] | (d[3] << 8);
+    if (request.size() >= 6)
+        q.size = d[4] | (d[5] << 8);
+    if (q.cmd == MicontBusCodec::CMD_PUTBUF_B)
+        q.data.assign(d + 6, d + request.size());
+
+    QHash<quint8, Slave>::iterator it = m_slaves.find(q.id);
+    if (it == m_slaves.end())
+        return QByteArray();
+    Slave &slave = it.value();
+
+    MicontBusMessage r;
+    r.id = q.id;
+    r.addr = q.addr;
+    r.size = q.size;
+
+    if (slave.busyLeft == 0 && chance(m_faults.busy))
+        slave.busyLeft = m_faults.busyStorm;
+    if (slave.busyLeft > 0) {
+        slave.busyLeft--;
+        m_counters.busy.fetch_add(1, std::memory_order_relaxed);
+        r.cmd = q.cmd | MicontBusCodec::CMD_RESULT_BUSY;
+    } else {
+        int first = q.addr;
+        int count = q.size / 4;
+
+        switch (q.cmd) {
+        case MicontBusCodec::CMD_GETSIZE: {
+            quint32 bytes = slave.vars.size() * 4;
+            r.cmd = q.cmd | MicontBusCodec::CMD_RESULT_OK;
+            for (int i = 0; i < 4; i++)
+                r.data.push_back(bytes >> (8 * i));
+            break;
+        }
+        case MicontBusCodec::CMD_GETBUF_B:
+        case MicontBusCodec::CMD_PUTBUF_B:
+            if (q.size % 4 || q.size == 0)
+                r.cmd = q.cmd | MicontBusCodec::CMD_RESULT_ERRARG;
+            else if (q.size > m_maxData)
+                r.cmd = q.cmd | MicontBusCodec::CMD_RESULT_ERRBSIZE;
+            else if (first + count > slave.vars.size())
+                r.cmd = q.cmd | MicontBusCodec::CMD_RESULT_ERRBADDR;
+            else if (q.cmd == MicontBusCodec::CMD_GETBUF_B) {
+                r.cmd = q.cmd | MicontBusCodec::CMD_RESULT_OK;
+                for (int v = 0; v < count; v++) {
+                    quint32 var = slave.vars.at(first + v);
+                    for (int i = 0; i < 4; i++)
+                        r.data.push_back(var >> (8 * i));
+                }
+            } else {
+                r.cmd = q.cmd | MicontBusCodec::CMD_RESULT_OK;
+                for (int v = 0; v < count; v++) {
+                    const uint8_t *p = &q.data[v * 4];
+                    slave.vars[first + v] = p[0] | (p[1] << 8) | (p[2] << 16) | ((quint32)p[3] << 24);
+                }
+            }
+            break;
+        default:
+            r.cmd = q.cmd | MicontBusCodec::CMD_RESULT_UCMD;
+            break;
+        }
+    }
+
+    std::vector<uint8_t> frame = MicontBusCodec::encode(r);
+    MicontBusCodec::appendCrc(frame);
+    return QByteArray(reinterpret_cast<const char *>(frame.data()), frame.size());
+}
+
+// Sends a response, through the fault injection.
+void MicontBusSimulator::send(QByteArray frame)
+{
+    if (chance(m_faults.truncate)) {
+        frame.chop(1 + m_random % (frame.size() - 1));
+        m_counters.truncated.fetch_add(1, std::memory_order_relaxed);
+    } else if (chance(m_faults.crc)) {
+        frame[frame.size() - 1] = frame.at(frame.size() - 1) ^ (1 << (m_random % 8));
+        m_counters.crcFaults.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    m_counters.responses.fetch_add(1, std::memory_order_relaxed);
+
+    if (chance(m_faults.late)) {
+        Delayed d;
+        d.due = m_clock.elapsed() + m_faults.lateDelay;
+        d.frame = frame;
+        m_delayed.append(d);
+        m_counters.late.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    writeAll(frame);
+}
+
+void MicontBusSimulator::writeAll(const QByteArray &frame)
+{
+    int done = 0;
+    while (m_master >= 0 && done < frame.size()) {
+        ssize_t n = ::write(m_master, frame.constData() + done, frame.size() - done);
+        if (n >= 0) {
+            done += n;
+            continue;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return;
+
+        // the master isn't reading, nothing more to do for this frame
+        struct pollfd pfd;
+        pfd.fd = m_master;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, SIMULATOR_POLL) <= 0)
+            return;
+    }
+}
+
+// xorshift32, good enough for picking faults and cheap on the hot path
+bool MicontBusSimulator::chance(double percent)
+{
+    if (percent <= 0)
+        return false;
+
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+    return (m_random % 1000000) < percent * 10000;
+}
@@ -0,0 +1,120 @@
+#ifndef MICONTBUSSIMULATOR_H
+#define MICONTBUSSIMULATOR_H
+
+#include <QThread>
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include <QElapsedTimer>
+
+#include <atomic>
+
+// Faults injected by MicontBusSimulator, probabilities in percent of the
+// responses.
+struct MicontBusFaults
+{
+    MicontBusFaults()
+        : crc(0), truncate(0), late(0), busy(0), busyStorm(20), lateDelay(200),
+          disconnectInterval(0), disconnectTime(500) {}
+
+    double crc;             // a bit of the CRC flipped
+    double truncate;        // cut short by a random number of bytes
+    double late;            // held back by lateDelay, past the master's timeout
+    double busy;            // the slave starts a BUSY storm
+    int busyStorm;          // responses a BUSY storm lasts
+    int lateDelay;          // ms
+    int disconnectInterval; // ms between port disconnects, 0 for none
+    int disconnectTime;     // ms the port is away
+
+    static MicontBusFaults fromString(const QString &s, bool *ok = 0);
+    QString toString() const;
+};
+
+/* Simulated slaves on a pseudo terminal, for exercising a master without
+ * hardware. Each slave answers GETSIZE, GETBUF_B and PUTBUF_B on its own
+ * variable memory, with the result codes a controller gives for bad
+ * addresses and sizes, and faults are injected into the responses as set.
+ * The port is reached through a symlink that survives disconnects: a
+ * disconnect closes the pty, removes the link for a while and then points
+ * it at a new pty, like a USB adapter re-enumerating. Unix only. */
+class MicontBusSimulator : public QThread
+{
+    Q_OBJECT
+
+public:
+    struct Counters {
+        std::atomic<quint64> requests;
+        std::atomic<quint64> responses;
+        std::atomic<quint64> crcFaults;
+        std::atomic<quint64> truncated;
+        std::atomic<quint64> late;
+        std::atomic<quint64> busy;          // BUSY responses of storms
+        std::atomic<quint64> disconnects;
+        std::atomic<quint64> garbageBytes;  // received bytes that didn't frame
+    };
+
+    MicontBusSimulator(QObject *parent = 0);
+    ~MicontBusSimulator();
+
+    void setSlaves(const QList<quint8> &ids, int vars);
+    void setFaults(const MicontBusFaults &faults);
+    void setMaxData(int bytes);
+    void setSeed(quint32 seed);
+
+    bool open(const QString &linkPath);
+    void close();
+    QString portName() const;
+    QString errorString() const;
+
+    void run();
+    void stop();
+
+    const Counters &counters() const;
+
+    static int maxDataDefault();
+
+signals:
+    void error(const QString &s);
+
+private:
+    struct Slave {
+        Slave() : busyLeft(0) {}
+        QVector<quint32> vars;
+        int busyLeft;
+    };
+
+    struct Delayed {
+        qint64 due;     // ms on m_clock
+        QByteArray frame;
+    };
+
+    bool openPty();
+    void closePty();
+    void parse();
+    QByteArray answer(const QByteArray &request);
+    void send(QByteArray frame);
+    void writeAll(const QByteArray &frame);
+    bool chance(double percent);
+
+    QString m_link;
+    QString m_errorString;
+    int m_master;   // pty master fd, -1 while disconnected
+    int m_slave;    // kept open so that the master side never sees a hangup
+    QHash<quint8, Slave> m_slaves;
+    MicontBusFaults m_faults;
+    int m_maxData;
+    std::atomic<bool> m_quit;
+
+    // simulator thread only
+    QByteArray m_buffer;
+    QList<Delayed> m_delayed;
+    QElapsedTimer m_clock;
+    qint64 m_nextDisconnect;
+    qint64 m_reconnect;
+    quint32 m_random;
+
+    Counters m_counters;
+};
+
+#endif // MICONTBUSSIMULATOR_H
@@ -0,0 +1,308 @@
+#include "micontbussnapshot.h"
+#include "micontbusmaster.h"
+#include "micontbusimagepublisher.h"
+#include "micontbusprocessimage.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QSaveFile>
+#include <QStringList>
+#include <QVector>
+#include <QtEndian>
+
+#include <string.h>
+
+static_assert(sizeof(MicontBusSnapshotHeader) == 24, "snapshot record layout");
+static_assert(sizeof(MicontBusSnapshotSection) == 24, "snapshot record layout");
+static_assert(sizeof(MicontBusSnapshotRoundTrip) == 24, "snapshot record layout");
+static_assert(sizeof(MicontBusSnapshotImageBlock) == 16 + 4 * MICONTBUS_SNAPSHOT_VARS, "snapshot record layout");
+static_assert(MICONTBUS_SNAPSHOT_VARS == MICONTBUS_IMAGE_VARS, "snapshot record layout");
+
+// Appends count records at the next 8 byte boundary and describes them in
+// the section table.
+static void appendSection(QByteArray *file, QVector<MicontBusSnapshotSection> *table, quint32 type,
+                          const void *records, int recordSize, int count)
+{
+    file->append(QByteArray((8 - file->size() % 8) % 8, 0));
+
+    MicontBusSnapshotSection s;
+    memset(&s, 0, sizeof(s));
+    s.type = type;
+    s.recordSize = recordSize;
+    s.count = count;
+    s.offset = file->size();
+    table->append(s);
+
+    file->append(static_cast<const char *>(records), recordSize * count);
+}
+
+// Records of a section as T, or 0 if it is out of the file or its records
+// are too short or misaligned for T.
+template <typename T>
+static const uchar *sectionRecords(const uchar *base, qint64 size, const MicontBusSnapshotSection &s)
+{
+    if (s.recordSize < sizeof(T) || s.recordSize % alignof(T) || s.offset % 8)
+        return 0;
+    if (s.offset > (quint64)size || (quint64)s.count * s.recordSize > (quint64)size - s.offset)
+        return 0;
+    return base + s.offset;
+}
+
+MicontBusSnapshot::MicontBusSnapshot()
+    : m_master(0), m_image(0), m_created(0), m_roundTrips(0), m_downSlaves(0), m_imageBlocks(0)
+{
+}
+
+void MicontBusSnapshot::setMaster(MicontBusMaster *master)
+{
+    m_master = master;
+}
+
+void MicontBusSnapshot::setImage(MicontBusImagePublisher *image)
+{
+    m_image = image;
+}
+
+// Writes the current state to path, replacing it atomically. Safe while
+// the master runs.
+bool MicontBusSnapshot::save(const QString &path)
+{
+    QList<QByteArray> ports;
+    QVector<MicontBusSnapshotRoundTrip> roundTrips;
+    QVector<MicontBusSnapshotDownSlave> downSlaves;
+    QVector<MicontBusSnapshotImageBlock> blocks;
+
+    // port names too long for a record are left out with their entries
+    auto portIndex = [&ports](const QString &name) -> int {
+        QByteArray utf8 = name.toUtf8();
+        if (utf8.size() >= MICONTBUS_SNAPSHOT_PORT_NAME)
+            return -1;
+        int index = ports.indexOf(utf8);
+        if (index < 0) {
+            index = ports.size();
+            ports.append(utf8);
+        }
+        return index;
+    };
+
+    if (m_master) {
+        foreach (const MicontBusRttEstimator::Sample &sample, m_master->rttEstimates()) {
+            int port = portIndex(QString::fromStdString(sample.portName));
+            if (port < 0)
+                continue;
+            MicontBusSnapshotRoundTrip r;
+            memset(&r, 0, sizeof(r));
+            r.port = port;
+            r.id = sample.id;
+            r.cmd = sample.cmd;
+            r.srtt = sample.srtt;
+            r.rttvar = sample.rttvar;
+            roundTrips.append(r);
+        }
+
+        foreach (const MicontBusHealth::Key &key, m_master->downSlaves()) {
+            int port = portIndex(QString::fromStdString(key.first));
+            if (port < 0)
+                continue;
+            MicontBusSnapshotDownSlave d;
+            memset(&d, 0, sizeof(d));
+            d.port = port;
+            d.id = key.second;
+            downSlaves.append(d);
+        }
+    }
+
+    if (m_image) {
+        int count = m_image->blockCount();
+        blocks.reserve(count);
+        for (int i = 0; i < count; i++) {
+            MicontBusImageSnapshot snapshot;
+            if (!m_image->readBlock(i, &snapshot))
+                continue;
+            MicontBusSnapshotImageBlock b;
+            memset(&b, 0, sizeof(b));
+            b.id = snapshot.id;
+            b.addr = snapshot.addr;
+            b.count = snapshot.count;
+            b.timestamp = snapshot.timestamp;
+            memcpy(b.vars, snapshot.vars, sizeof(b.vars));
+            blocks.append(b);
+        }
+    }
+
+    QVector<MicontBusSnapshotPort> portRecords(ports.size());
+    for (int i = 0; i < ports.size(); i++) {
+        memset(&portRecords[i], 0, sizeof(MicontBusSnapshotPort));
+        memcpy(portRecords[i].name, ports.at(i).constData(), ports.at(i).size());
+    }
+
+    // header and section table first, filled in once the offsets are known
+    const int sectionCount = 4;
+    QByteArray file(sizeof(MicontBusSnapshotHeader) + sectionCount * sizeof(MicontBusSnapshotSection), 0);
+    QVector<MicontBusSnapshotSection> table;
+    appendSection(&file, &table, MicontBusSnapshotSection::Ports, portRecords.constData(),
+                  sizeof(MicontBusSnapshotPort), portRecords.size());
+    appendSection(&file, &table, MicontBusSnapshotSection::RoundTrips, roundTrips.constData(),
+                  sizeof(MicontBusSnapshotRoundTrip), roundTrips.size());
+    appendSection(&file, &table, MicontBusSnapshotSection::DownSlaves, downSlaves.constData(),
+                  sizeof(MicontBusSnapshotDownSlave), downSlaves.size());
+    appendSection(&file, &table, MicontBusSnapshotSection::Image, blocks.constData(),
+                  sizeof(MicontBusSnapshotImageBlock), blocks.size());
+
+    MicontBusSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MICONTBUS_SNAPSHOT_MAGIC;
+    header.version = MICONTBUS_SNAPSHOT_VERSION;
+    header.byteOrder = MICONTBUS_SNAPSHOT_BYTE_ORDER;
+    header.sectionCount = sectionCount;
+    header.created = QDateTime::currentMSecsSinceEpoch();
+    memcpy(file.data(), &header, sizeof(header));
+    memcpy(file.data() + sizeof(header), table.constData(), sectionCount * sizeof(MicontBusSnapshotSection));
+
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly))
+        return fail(out.errorString());
+    if (out.write(file) != file.size() || !out.commit())
+        return fail(out.errorString());
+    return true;
+}
+
+// Restores the state in path into the master and image. Call before the
+// master gets its first transaction.
+bool MicontBusSnapshot::load(const QString &path)
+{
+    m_created = 0;
+    m_roundTrips = m_downSlaves = m_imageBlocks = 0;
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return fail(file.errorString());
+
+    qint64 size = file.size();
+    if (size < (qint64)sizeof(MicontBusSnapshotHeader))
+        return fail(QString("%1 is not a snapshot").arg(path));
+
+    const uchar *base = file.map(0, size);
+    if (!base)
+        return fail(file.errorString());
+
+    const MicontBusSnapshotHeader *header = reinterpret_cast<const MicontBusSnapshotHeader *>(base);
+    if (header->magic != MICONTBUS_SNAPSHOT_MAGIC || header->byteOrder != MICONTBUS_SNAPSHOT_BYTE_ORDER)
+        return fail(QString("%1 is not a snapshot").arg(path));
+    if (header->version != MICONTBUS_SNAPSHOT_VERSION)
+        return fail(QString("%1 has snapshot version %2, expected %3")
+                    .arg(path).arg(header->version).arg(MICONTBUS_SNAPSHOT_VERSION));
+    if ((quint64)header->sectionCount * sizeof(MicontBusSnapshotSection) > (quint64)size - sizeof(*header))
+        return fail(QString("%1 is truncated").arg(path));
+
+    const MicontBusSnapshotSection *sections =
+            reinterpret_cast<const MicontBusSnapshotSection *>(base + sizeof(*header));
+
+    // the other sections refer to ports by index
+    QStringList ports;
+    for (quint32 i = 0; i < header->sectionCount; i++) {
+        const MicontBusSnapshotSection &s = sections[i];
+        const uchar *records = sectionRecords<MicontBusSnapshotPort>(base, size, s);
+        if (s.type != MicontBusSnapshotSection::Ports || !records)
+            continue;
+        for (quint32 r = 0; r < s.count; r++) {
+            const char *name = reinterpret_cast<const MicontBusSnapshotPort *>(records + r * s.recordSize)->name;
+            ports.append(QString::fromUtf8(name, qstrnlen(name, MICONTBUS_SNAPSHOT_PORT_NAME)));
+        }
+    }
+
+    QList<MicontBusRttEstimator::Sample> samples;
+    QList<MicontBusHealth::Key> down;
+
+    for (quint32 i = 0; i < header->sectionCount; i++) {
+        const MicontBusSnapshotSection &s = sections[i];
+
+        switch (s.type) {
+        case MicontBusSnapshotSection::RoundTrips: {
+            const uchar *records = sectionRecords<MicontBusSnapshotRoundTrip>(base, size, s);
+            for (quint32 r = 0; records && r < s.count; r++) {
+                const MicontBusSnapshotRoundTrip *t =
+                        reinterpret_cast<const MicontBusSnapshotRoundTrip *>(records + r * s.recordSize);
+                if (t->port >= ports.size())
+                    continue;
+                MicontBusRttEstimator::Sample sample;
+                sample.portName = ports.at(t->port).toStdString();
+                sample.id = t->id;
+                sample.cmd = t->cmd;
+                sample.srtt = t->srtt;
+                sample.rttvar = t->rttvar;
+                samples.append(sample);
+            }
+            break;
+        }
+        case MicontBusSnapshotSection::DownSlaves: {
+            const uchar *records = sectionRecords<MicontBusSnapshotDownSlave>(base, size, s);
+            for (quint32 r = 0; records && r < s.count; r++) {
+                const MicontBusSnapshotDownSlave *d =
+                        reinterpret_cast<const MicontBusSnapshotDownSlave *>(records + r * s.recordSize);
+                if (d->port < ports.size())
+                    down.append(MicontBusHealth::Key(ports.at(d->port).toStdString(), d->id));
+            }
+            break;
+        }
+        case MicontBusSnapshotSection::Image: {
+            const uchar *records = sectionRecords<MicontBusSnapshotImageBlock>(base, size, s);
+            for (quint32 r = 0; m_image && records && r < s.count; r++) {
+                const MicontBusSnapshotImageBlock *b =
+                        reinterpret_cast<const MicontBusSnapshotImageBlock *>(records + r * s.recordSize);
+                if (b->count == 0 || b->count > MICONTBUS_SNAPSHOT_VARS)
+                    continue;
+
+                // publish() takes the variables as on the wire
+                uchar data[4 * MICONTBUS_SNAPSHOT_VARS];
+                for (int v = 0; v < b->count; v++)
+                    qToLittleEndian<quint32>(b->vars[v], data + 4 * v);
+                m_image->publish(b->id, b->addr, data, b->count, b->timestamp);
+                m_imageBlocks++;
+            }
+            break;
+        }
+        }
+    }
+
+    if (m_master) {
+        m_master->restoreRttEstimates(samples);
+        m_master->restoreDownSlaves(down);
+        m_roundTrips = samples.size();
+        m_downSlaves = down.size();
+    }
+
+    m_created = header->created;
+    return true;
+}
+
+QString MicontBusSnapshot::errorString() const
+{
+    return m_errorString;
+}
+
+qint64 MicontBusSnapshot::created() const
+{
+    return m_created;
+}
+
+int MicontBusSnapshot::roundTrips() const
+{
+    return m_roundTrips;
+}
+
+int MicontBusSnapshot::downSlaves() const
+{
+    return m_downSlaves;
+}
+
+int MicontBusSnapshot::imageBlocks() const
+{
+    return m_imageBlocks;
+}
+
+bool MicontBusSnapshot::fail(const QString &s)
+{
+    m_errorString = s;
+    return false;
+}
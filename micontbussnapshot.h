@@ -0,0 +1,120 @@
+#ifndef MICONTBUSSNAPSHOT_H
+#define MICONTBUSSNAPSHOT_H
+
+#include <QString>
+#include <QtGlobal>
+
+class MicontBusMaster;
+class MicontBusImagePublisher;
+
+/* Snapshot file of what a running master has learned about its bus, so
+ * that a restart begins from it rather than from nothing: round-trip
+ * estimates (adaptive timeouts from the first frame), slaves that were
+ * down (probed in the background rather than found out by timeouts) and
+ * the last process image (readers see the last values, with their old
+ * timestamps, until the first poll). Frame size limits are kept in
+ * QSettings by MicontBusFrameSizes, and tag read plans are compiled from
+ * them. Restored state is revalidated by the traffic itself: the first
+ * round trip replaces a restored estimate, a probe answer brings a slave
+ * up, a poll overwrites its image block.
+ *
+ * The file is laid out to be used in place from a read-only mapping, all
+ * in host byte order:
+ *
+ *     MicontBusSnapshotHeader     magic "MBSN", version, byte order
+ *     MicontBusSnapshotSection    one per section
+ *     records                     of each section, 8 byte aligned
+ *
+ * Loading skips sections of unknown type and reads the known prefix of
+ * records that have grown, so a file written by a newer build of the same
+ * version still loads. */
+
+#define MICONTBUS_SNAPSHOT_MAGIC        0x4e53424dU     // "MBSN"
+#define MICONTBUS_SNAPSHOT_VERSION      1
+#define MICONTBUS_SNAPSHOT_BYTE_ORDER   0x01020304U
+#define MICONTBUS_SNAPSHOT_PORT_NAME    64
+#define MICONTBUS_SNAPSHOT_VARS         64
+
+struct MicontBusSnapshotHeader {
+    quint32 magic;
+    quint32 version;
+    quint32 byteOrder;
+    quint32 sectionCount;
+    qint64 created;             // ms since epoch
+};
+
+struct MicontBusSnapshotSection {
+    enum Type {
+        Ports = 1,
+        RoundTrips,
+        DownSlaves,
+        Image
+    };
+
+    quint32 type;
+    quint32 recordSize;
+    quint32 count;
+    quint32 reserved;
+    quint64 offset;             // from the start of the file
+};
+
+struct MicontBusSnapshotPort {
+    char name[MICONTBUS_SNAPSHOT_PORT_NAME];    // UTF-8, NUL terminated
+};
+
+struct MicontBusSnapshotRoundTrip {
+    quint16 port;               // index in the Ports section
+    quint8 id;
+    quint8 cmd;
+    quint32 reserved;
+    qint64 srtt;                // us
+    qint64 rttvar;
+};
+
+struct MicontBusSnapshotDownSlave {
+    quint16 port;
+    quint8 id;
+    quint8 reserved;
+};
+
+struct MicontBusSnapshotImageBlock {
+    quint8 id;
+    quint8 reserved0;
+    quint16 addr;
+    quint16 count;
+    quint16 reserved1;
+    qint64 timestamp;           // ms since epoch
+    quint32 vars[MICONTBUS_SNAPSHOT_VARS];
+};
+
+class MicontBusSnapshot
+{
+public:
+    MicontBusSnapshot();
+
+    void setMaster(MicontBusMaster *master);
+    void setImage(MicontBusImagePublisher *image);
+
+    bool save(const QString &path);
+    bool load(const QString &path);
+    QString errorString() const;
+
+    // of the last load
+    qint64 created() const;
+    int roundTrips() const;
+    int downSlaves() const;
+    int imageBlocks() const;
+
+private:
+    bool fail(const QString &s);
+
+    MicontBusMaster *m_master;
+    MicontBusImagePublisher *m_image;
+    QString m_errorString;
+    qint64 m_created;
+    int m_roundTrips;
+    int m_downSlaves;
+    int m_imageBlocks;
+};
+
+#endif // MICONTBUSSNAPSHOT_H
@@ -0,0 +1,327 @@
+#include "micontbussniffer.h"
+#include "micontbusmaster.h"
+#include "micontbuspacket.h"
+#include "micontbusrttestimator.h"
+
+#include <QDateTime>
+#include <QMetaMethod>
+#include <QScopedPointer>
+
+// garbage is written out in records of at most this many bytes
+static const int SNIFFER_MAX_GARBAGE = 1024;
+
+// consumed bytes are dropped from the buffer once there are this many
+static const int SNIFFER_COMPACT = 4096;
+
+MicontBusSniffer::MicontBusSniffer(QObject *parent)
+    : QThread(parent), m_baudRate(115200), m_backend(MicontBusTransport::BackendQt), m_gapTimeout(20000),
+      m_capture(0), m_quit(false), m_head(0), m_garbage(-1), m_charTime(0), m_gap(0),
+      m_pool(MicontBusFramePool::global())
+{
+    qRegisterMetaType<MicontBusFrame>("MicontBusFrame");
+
+    m_counters.bytes = m_counters.requests = m_counters.responses = 0;
+    m_counters.answered = m_counters.unanswered = 0;
+    m_counters.garbageBytes = m_counters.resyncs = 0;
+
+    m_clock.start();
+    m_epoch = QDateTime::currentMSecsSinceEpoch() * 1000 - m_clock.nsecsElapsed() / 1000;
+}
+
+MicontBusSniffer::~MicontBusSniffer()
+{
+    stop();
+}
+
+// The settings are read when the thread starts.
+void MicontBusSniffer::setPort(const QString &portName, qint32 baudRate)
+{
+    m_portName = portName;
+    m_baudRate = baudRate;
+}
+
+void MicontBusSniffer::setBackend(MicontBusTransport::Backend backend)
+{
+    m_backend = backend;
+}
+
+void MicontBusSniffer::setSerialOptions(const MicontBusSerialOptions &options)
+{
+    m_options = options;
+}
+
+// Pause in us that ends a frame, at least 4 character times. It must
+// cover the delivery jitter of the adapter: USB converters hand data over
+// in bursts, up to their latency timer apart.
+void MicontBusSniffer::setGapTimeout(int us)
+{
+    m_gapTimeout = us;
+}
+
+// Written from the sniffer thread, must outlive it.
+void MicontBusSniffer::setCapture(MicontBusCaptureWriter *capture)
+{
+    m_capture = capture;
+}
+
+void MicontBusSniffer::run()
+{
+    QScopedPointer<MicontBusPort> serial(MicontBusTransport::create(m_backend));
+    if (!serial->open(m_portName.toStdString(), m_baudRate, m_options)) {
+        emit error(tr("can't open %1, %2").arg(m_portName).arg(QString::fromStdString(serial->errorString())));
+        return;
+    }
+
+    m_charTime = qMax<qint64>(1, MicontBusRttEstimator::frameTime(1, m_baudRate, m_options.bitsPerCharacter()));
+    m_gap = qMax<qint64>(m_gapTimeout, 4 * m_charTime);
+    m_buffer.clear();
+    m_times.clear();
+    m_head = 0;
+    m_garbage = -1;
+    m_pending = Pending();
+
+    int poll = qMax<int>(1, m_gap / 1000);
+    char chunk[4096];
+
+    while (!m_quit.load()) {
+        if (!serial->waitForReadyRead(poll)) {
+            if (!serial->isOpen()) {
+                emit error(tr("%1: %2").arg(m_portName).arg(QString::fromStdString(serial->errorString())));
+                break;
+            }
+
+            // the line went quiet, what is left can't be completed
+            if (m_head < m_buffer.size() && m_clock.nsecsElapsed() / 1000 - m_times.last() > m_gap)
+                parse(true);
+            if (m_capture)
+                m_capture->flush();
+            continue;
+        }
+
+        // drain the driver in one go, timestamped on arrival
+        forever {
+            qint64 n = serial->read(chunk, sizeof(chunk));
+            if (n <= 0)
+                break;
+            append(chunk, n, m_clock.nsecsElapsed() / 1000);
+            if (n < (qint64)sizeof(chunk))
+                break;
+        }
+        parse(false);
+    }
+
+    flushGarbage(false);
+    if (m_capture)
+        m_capture->flush();
+}
+
+void MicontBusSniffer::stop()
+{
+    m_quit.store(true);
+    wait();
+    m_quit.store(false);
+}
+
+const MicontBusSniffer::Counters &MicontBusSniffer::counters() const
+{
+    return m_counters;
+}
+
+// Line usage by the other master over the last seconds.
+MicontBusLineReport MicontBusSniffer::lineReport(int seconds)
+{
+    QMutexLocker locker(&m_mutex);
+    return m_lineStats.report(m_clock.elapsed(), seconds);
+}
+
+// From the end of a request to the start of its response.
+MicontBusLatencyHistogram MicontBusSniffer::turnaround()
+{
+    return m_turnaround;
+}
+
+// A chunk read at now arrived at the line rate, the last byte just now.
+// Times never go backwards, a chunk delivered late is laid out after the
+// previous one.
+void MicontBusSniffer::append(const char *data, int size, qint64 now)
+{
+    qint64 t = now - (qint64)(size - 1) * m_charTime;
+    if (!m_times.isEmpty())
+        t = qMax(t, m_times.last() + m_charTime);
+
+    m_buffer.append(data, size);
+    m_times.reserve(m_times.size() + size);
+    for (int i = 0; i < size; i++, t += m_charTime)
+        m_times.append(t);
+
+    m_counters.bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+// Takes all complete frames off the buffer. When idle, bytes that wait
+// for more are given up as garbage.
+void MicontBusSniffer::parse(bool idle)
+{
+    const uchar *d = reinterpret_cast<const uchar *>(m_buffer.constData());
+
+    while (m_head < m_buffer.size()) {
+        int size = frameSize(m_head);
+        if (size < 0 || size + 2 > MICONTBUS_FRAME_CAPACITY) {
+            skipByte();
+            continue;
+        }
+
+        int end = size ? m_head + size + 2 : m_buffer.size();
+        if (gapWithin(m_head + 1, qMin(end, m_buffer.size()))) {
+            skipByte();
+            continue;
+        }
+
+        if (!size || end > m_buffer.size()) {
+            if (!idle)
+                break;
+            skipByte();
+            continue;
+        }
+
+        quint16 crc = ((quint16)d[m_head + size + 1] << 8) | d[m_head + size];
+        if (crc != MicontBusMaster::crc16(m_buffer.constData() + m_head, size)) {
+            skipByte();
+            continue;
+        }
+
+        flushGarbage(false);
+        frame(size);
+    }
+
+    if (idle)
+        flushGarbage(true);
+    compact();
+}
+
+// Length without CRC of the frame at index, see MicontBusPacket.
+int MicontBusSniffer::frameSize(int at) const
+{
+    QByteArray header = QByteArray::fromRawData(m_buffer.constData() + at, m_buffer.size() - at);
+    if (header.size() < 2)
+        return 0;
+    if (header.at(1) & 0xf0)
+        return MicontBusPacket::responseSize(header);
+    return MicontBusPacket::requestSize(header);
+}
+
+// index > 0
+bool MicontBusSniffer::gapBefore(int index) const
+{
+    return m_times.at(index) - m_times.at(index - 1) - m_charTime > m_gap;
+}
+
+bool MicontBusSniffer::gapWithin(int from, int to) const
+{
+    for (int i = from; i < to; i++) {
+        if (gapBefore(i))
+            return true;
+    }
+    return false;
+}
+
+void MicontBusSniffer::skipByte()
+{
+    if (m_garbage < 0)
+        m_garbage = m_head;
+    m_head++;
+    m_counters.garbageBytes.fetch_add(1, std::memory_order_relaxed);
+
+    if (m_head - m_garbage >= SNIFFER_MAX_GARBAGE)
+        flushGarbage(false);
+}
+
+void MicontBusSniffer::flushGarbage(bool gap)
+{
+    if (m_garbage < 0)
+        return;
+
+    m_counters.resyncs.fetch_add(1, std::memory_order_relaxed);
+    if (m_capture) {
+        m_capture->write(m_epoch + m_times.at(m_garbage) - m_charTime, MicontBusCaptureRecord::Garbage,
+                         gap ? MicontBusCaptureRecord::FlagGap : 0,
+                         m_buffer.constData() + m_garbage, m_head - m_garbage);
+    }
+    m_garbage = -1;
+}
+
+// Handles the good frame of size bytes plus CRC at the head.
+void MicontBusSniffer::frame(int size)
+{
+    const char *p = m_buffer.constData() + m_head;
+    int total = size + 2;
+    qint64 start = m_times.at(m_head) - m_charTime;
+    qint64 end = m_times.at(m_head + total - 1);
+    int bits = m_options.bitsPerCharacter();
+    bool request = !(p[1] & 0xf0);
+    quint8 flags = 0;
+
+    if (request) {
+        m_counters.requests.fetch_add(1, std::memory_order_relaxed);
+
+        // the slave never answered, the line was held until now
+        if (m_pending.valid) {
+            m_counters.unanswered.fetch_add(1, std::memory_order_relaxed);
+            QMutexLocker locker(&m_mutex);
+            m_lineStats.addTimeout(start / 1000, MicontBusRttEstimator::frameTime(m_pending.size, m_baudRate, bits),
+                                   start - m_pending.start);
+        }
+
+        m_pending.valid = true;
+        m_pending.id = p[0];
+        m_pending.cmd = p[1];
+        m_pending.start = start;
+        m_pending.end = end;
+        m_pending.size = total;
+    } else {
+        m_counters.responses.fetch_add(1, std::memory_order_relaxed);
+
+        if (m_pending.valid && m_pending.id == (quint8)p[0] && (m_pending.cmd & 0xf) == (p[1] & 0xf)) {
+            flags |= MicontBusCaptureRecord::FlagAnswer;
+            m_counters.answered.fetch_add(1, std::memory_order_relaxed);
+            m_turnaround.add(qMax<qint64>(0, start - m_pending.end));
+
+            QMutexLocker locker(&m_mutex);
+            m_lineStats.addTransaction(end / 1000,
+                                       MicontBusRttEstimator::frameTime(m_pending.size + total, m_baudRate, bits),
+                                       end - m_pending.start);
+            m_pending.valid = false;
+        }
+    }
+
+    if (m_capture) {
+        m_capture->write(m_epoch + start, request ? MicontBusCaptureRecord::Request : MicontBusCaptureRecord::Response,
+                         flags, p, total);
+    }
+
+    // responses carry id and address, that's all the subscribers need
+    if (!request) {
+        MicontBusFrame f = m_pool->acquire(size);
+        f.append(p, size);
+        emit responseFrame(f);
+
+        static const QMetaMethod responseSignal = QMetaMethod::fromSignal(&MicontBusSniffer::response);
+        if (isSignalConnected(responseSignal))
+            emit response(QByteArray(p, size));
+    }
+
+    m_head += total;
+}
+
+// Drops consumed bytes, keeping a pending garbage run.
+void MicontBusSniffer::compact()
+{
+    int cut = m_garbage >= 0 ? m_garbage : m_head;
+    if (cut == 0 || (cut < SNIFFER_COMPACT && cut < m_buffer.size()))
+        return;
+
+    m_buffer.remove(0, cut);
+    m_times.remove(0, cut);
+    m_head -= cut;
+    if (m_garbage >= 0)
+        m_garbage -= cut;
+}
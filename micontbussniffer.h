@@ -0,0 +1,114 @@
+#ifndef MICONTBUSSNIFFER_H
+#define MICONTBUSSNIFFER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QByteArray>
+#include <QVector>
+#include <QElapsedTimer>
+
+#include <atomic>
+
+#include "micontbustransport.h"
+#include "micontbusframepool.h"
+#include "micontbuslinestats.h"
+#include "micontbusrealtime.h"
+#include "micontbuscapture.h"
+
+/* Listen-only bus monitor for segments driven by another master. Reads
+ * the port continuously and never writes to it. Frame boundaries are
+ * found from the header length rules (requests have no result code,
+ * responses do) and confirmed by the CRC; on a mismatch the stream is
+ * scanned on a byte at a time. A pause longer than the gap timeout can't
+ * be inside a frame, so a candidate spanning one is dropped without
+ * waiting for the rest of it. Requests are paired with the response that
+ * follows from the same slave.
+ *
+ * Responses come out of responseFrame() and response() like the master's,
+ * so the process image, historian and change detector connect the same
+ * way; the capture file, if set, gets every frame and the garbage between
+ * them. All of it runs on the sniffer thread. */
+class MicontBusSniffer : public QThread
+{
+    Q_OBJECT
+
+public:
+    struct Counters {
+        std::atomic<quint64> bytes;
+        std::atomic<quint64> requests;
+        std::atomic<quint64> responses;
+        std::atomic<quint64> answered;      // requests followed by their response
+        std::atomic<quint64> unanswered;
+        std::atomic<quint64> garbageBytes;  // bytes that didn't frame
+        std::atomic<quint64> resyncs;       // garbage runs
+    };
+
+    MicontBusSniffer(QObject *parent = 0);
+    ~MicontBusSniffer();
+
+    void setPort(const QString &portName, qint32 baudRate);
+    void setBackend(MicontBusTransport::Backend backend);
+    void setSerialOptions(const MicontBusSerialOptions &options);
+    void setGapTimeout(int us);
+    void setCapture(MicontBusCaptureWriter *capture);
+
+    void run();
+    void stop();
+
+    const Counters &counters() const;
+    MicontBusLineReport lineReport(int seconds);
+    MicontBusLatencyHistogram turnaround();
+
+signals:
+    void response(const QByteArray &packet);
+    void responseFrame(const MicontBusFrame &frame);
+    void error(const QString &s);
+
+private:
+    struct Pending {
+        Pending() : valid(false), id(0), cmd(0), start(0), end(0), size(0) {}
+        bool valid;
+        quint8 id;
+        quint8 cmd;
+        qint64 start;   // us, first and last byte
+        qint64 end;
+        int size;
+    };
+
+    void append(const char *data, int size, qint64 now);
+    void parse(bool idle);
+    int frameSize(int at) const;
+    bool gapBefore(int index) const;
+    bool gapWithin(int from, int to) const;
+    void skipByte();
+    void flushGarbage(bool gap);
+    void frame(int size);
+    void compact();
+
+    QString m_portName;
+    qint32 m_baudRate;
+    MicontBusTransport::Backend m_backend;
+    MicontBusSerialOptions m_options;
+    int m_gapTimeout;
+    MicontBusCaptureWriter *m_capture;
+    std::atomic<bool> m_quit;
+
+    // parser state, sniffer thread only
+    QByteArray m_buffer;
+    QVector<qint64> m_times;    // us, estimated arrival of each byte in m_buffer
+    int m_head;
+    int m_garbage;              // start of the pending garbage run, -1 if none
+    qint64 m_charTime;          // us
+    qint64 m_gap;               // us
+    qint64 m_epoch;             // us since epoch at clock start
+    QElapsedTimer m_clock;
+    Pending m_pending;
+    MicontBusFramePool *m_pool;
+
+    Counters m_counters;
+    QMutex m_mutex;
+    MicontBusLineStats m_lineStats;             // guarded by m_mutex
+    MicontBusLatencyHistogram m_turnaround;     // single writer
+};
+
+#endif // MICONTBUSSNIFFER_H
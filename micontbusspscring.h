@@ -0,0 +1,72 @@
+#ifndef MICONTBUSSPSCRING_H
+#define MICONTBUSSPSCRING_H
+
+#include <QtGlobal>
+
+#include <atomic>
+
+#define MICONTBUS_CACHE_LINE    64
+
+/* Bounded lock-free queue between exactly one producer thread and one
+ * consumer thread. Size must be a power of two. The indices run freely
+ * and are masked on access, each one is written by its own side only and
+ * sits on its own cache line so that the two sides don't share a line
+ * while the ring is neither full nor empty. */
+template<typename T, unsigned Size>
+class MicontBusSpscRing
+{
+    static_assert(Size >= 2 && (Size & (Size - 1)) == 0, "ring size must be a power of two");
+
+public:
+    MicontBusSpscRing() : m_head(0), m_cachedTail(0), m_tail(0), m_cachedHead(0) {}
+
+    // Producer side. Returns false if the ring is full.
+    bool push(const T &value)
+    {
+        unsigned tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cachedHead == Size) {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if (tail - m_cachedHead == Size)
+                return false;
+        }
+        m_slots[tail & (Size - 1)] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the ring is empty. The slot is reset
+    // so that it doesn't keep a reference until it is reused.
+    bool pop(T *value)
+    {
+        unsigned head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cachedTail) {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cachedTail)
+                return false;
+        }
+        T &slot = m_slots[head & (Size - 1)];
+        *value = slot;
+        slot = T();
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Either side, exact only when the other side is idle.
+    bool isEmpty() const
+    {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+private:
+    // consumer
+    alignas(MICONTBUS_CACHE_LINE) std::atomic<unsigned> m_head;
+    unsigned m_cachedTail;
+
+    // producer
+    alignas(MICONTBUS_CACHE_LINE) std::atomic<unsigned> m_tail;
+    unsigned m_cachedHead;
+
+    alignas(MICONTBUS_CACHE_LINE) T m_slots[Size];
+};
+
+#endif // MICONTBUSSPSCRING_H
@@ -0,0 +1,324 @@
+#include "micontbusstress.h"
+#include "micontbuspacket.h"
+#include "micontbussimulator.h"
+
+#include <QFile>
+#include <QStringList>
+#include <QDebug>
+
+#include <unistd.h>
+
+// submission timer period, ms
+static const int STRESS_TICK = 10;
+// longest wait for outstanding requests once the run is over, ms
+static const int STRESS_DRAIN = 10000;
+
+static const char *const className[] = { "read", "write", "bulk" };
+
+MicontBusStress::MicontBusStress(QObject *parent)
+    : QObject(parent), m_master(0), m_baudRate(0), m_simulator(0), m_lastTick(0),
+      m_random(0x9e3779b9), m_draining(false), m_mismatched(0), m_unknown(0), m_maxQueue(0),
+      m_maxPending(0), m_firstRss(0), m_lastRss(0), m_lastReport(0)
+{
+    for (int c = 0; c < ClassCount; c++)
+        m_credit[c] = 0;
+
+    connect(&m_tickTimer, SIGNAL(timeout()), this, SLOT(tick()));
+    connect(&m_reportTimer, SIGNAL(timeout()), this, SLOT(report()));
+}
+
+MicontBusStress::~MicontBusStress()
+{
+}
+
+void MicontBusStress::setOptions(const MicontBusStressOptions &options)
+{
+    m_options = options;
+}
+
+void MicontBusStress::setSlaves(const QList<quint8> &ids)
+{
+    m_slaves = ids;
+}
+
+void MicontBusStress::setMaster(MicontBusMaster *master, const QString &portName, qint32 baudRate)
+{
+    if (m_master)
+        m_master->disconnect(this);
+
+    m_master = master;
+    m_portName = portName;
+    m_baudRate = baudRate;
+
+    if (m_master) {
+        connect(m_master, SIGNAL(transactionDone(quint32,QByteArray)),
+                this, SLOT(processDone(quint32,QByteArray)));
+        connect(m_master, SIGNAL(transactionFailed(quint32,QString)),
+                this, SLOT(processFailed(quint32,QString)));
+    }
+}
+
+void MicontBusStress::setSimulator(MicontBusSimulator *simulator)
+{
+    m_simulator = simulator;
+}
+
+// Seed of the slaves, addresses and data picked, for repeatable runs.
+void MicontBusStress::setSeed(quint32 seed)
+{
+    m_random = seed ? seed : 0x9e3779b9;
+}
+
+void MicontBusStress::start()
+{
+    m_clock.start();
+    m_lastTick = m_lastReport = 0;
+    m_firstRss = m_lastRss = residentKb();
+    m_draining = false;
+
+    m_tickTimer.start(STRESS_TICK);
+    m_reportTimer.start(m_options.reportInterval * 1000);
+}
+
+int MicontBusStress::exitCode() const
+{
+    return m_mismatched || m_unknown || !m_pending.isEmpty() ? 2 : 0;
+}
+
+// Requests answered OK, of all classes.
+quint64 MicontBusStress::completed() const
+{
+    quint64 n = 0;
+    for (int c = 0; c < ClassCount; c++)
+        n += m_totals[c].done;
+    return n;
+}
+
+quint64 MicontBusStress::mismatched() const
+{
+    return m_mismatched;
+}
+
+quint64 MicontBusStress::unknown() const
+{
+    return m_unknown;
+}
+
+// Requests without an answer yet, after finished() the ones that never got one.
+int MicontBusStress::pending() const
+{
+    return m_pending.size();
+}
+
+// Issues what the rates allow for the time since the last tick. The load
+// is open loop: requests go out whether or not the earlier ones are done,
+// so a master that falls behind shows as a growing queue.
+void MicontBusStress::tick()
+{
+    qint64 now = m_clock.elapsed();
+    qint64 elapsed = now - m_lastTick;
+    m_lastTick = now;
+
+    int queue = m_master ? m_master->queueSize() : 0;
+    m_maxQueue = qMax(m_maxQueue, queue);
+    m_maxPending = qMax(m_maxPending, m_pending.size());
+
+    if (m_draining) {
+        if (m_pending.isEmpty() || now >= m_options.duration * 1000LL + STRESS_DRAIN)
+            finish();
+        return;
+    }
+
+    if (now >= m_options.duration * 1000LL) {
+        m_draining = true;
+        return;
+    }
+
+    const double rates[ClassCount] = { m_options.readRate, m_options.writeRate, m_options.bulkRate };
+    for (int c = 0; c < ClassCount; c++) {
+        m_credit[c] += rates[c] * elapsed / 1000.0;
+        while (m_credit[c] >= 1) {
+            submit((Class)c);
+            m_credit[c] -= 1;
+        }
+    }
+}
+
+void MicontBusStress::report()
+{
+    qint64 now = m_clock.elapsed();
+    double seconds = qMax<qint64>(1, now - m_lastReport) / 1000.0;
+    m_lastReport = now;
+    m_lastRss = residentKb();
+
+    QStringList rates;
+    for (int c = 0; c < ClassCount; c++) {
+        rates << QString("%1 %2/s (%3 failed/s) p50=%4us p99=%5us p99.9=%6us max=%7us")
+                 .arg(className[c])
+                 .arg((m_totals[c].done - m_lastTotals[c].done) / seconds, 0, 'f', 1)
+                 .arg((m_totals[c].failed - m_lastTotals[c].failed) / seconds, 0, 'f', 1)
+                 .arg(m_latency[c].percentile(0.5)).arg(m_latency[c].percentile(0.99))
+                 .arg(m_latency[c].percentile(0.999)).arg(m_latency[c].max());
+        m_lastTotals[c] = m_totals[c];
+    }
+
+    int queue = m_master ? m_master->queueSize() : 0;
+
+    qInfo() << "stress" << now / 1000 << "s:" << qPrintable(rates.join(", "));
+    qInfo() << "stress queue" << queue << "max" << m_maxQueue << "pending" << m_pending.size()
+            << "rss" << m_lastRss << "kB" << "mismatched" << m_mismatched << "unknown" << m_unknown;
+
+    if (!m_failures.isEmpty()) {
+        QStringList failures;
+        for (QMap<QString, quint64>::const_iterator it = m_failures.constBegin(); it != m_failures.constEnd(); ++it)
+            failures << QString("%1=%2").arg(it.key()).arg(it.value());
+        qInfo() << "stress failures" << qPrintable(failures.join(" "));
+    }
+
+    if (m_simulator) {
+        const MicontBusSimulator::Counters &s = m_simulator->counters();
+        qInfo() << "stress simulator requests" << s.requests.load() << "responses" << s.responses.load()
+                << "crc" << s.crcFaults.load() << "truncated" << s.truncated.load()
+                << "late" << s.late.load() << "busy" << s.busy.load()
+                << "disconnects" << s.disconnects.load() << "garbage" << s.garbageBytes.load();
+    }
+}
+
+void MicontBusStress::processDone(quint32 tag, const QByteArray &packet)
+{
+    Pending p;
+    if (!take(tag, &p))
+        return;
+
+    // the request is a well formed header, the response at least one
+    const uchar *q = reinterpret_cast<const uchar *>(p.request.constData());
+    const uchar *r = reinterpret_cast<const uchar *>(packet.constData());
+    if (packet.size() < 4 || r[0] != q[0] || (r[1] & 0x0f) != q[1] || r[2] != q[2] || r[3] != q[3]) {
+        m_mismatched++;
+        m_totals[p.cls].failed++;
+        return;
+    }
+
+    // BUSY storms that outlast the retries end up here
+    if ((r[1] & 0xf0) != MicontBusPacket::CMD_RESULT_OK) {
+        fail(p.cls, QString("result 0x%1").arg(r[1] & 0xf0, 2, 16, QChar('0')));
+        return;
+    }
+
+    m_totals[p.cls].done++;
+    m_latency[p.cls].add(m_clock.nsecsElapsed() / 1000 - p.submitted);
+}
+
+void MicontBusStress::processFailed(quint32 tag, const QString &s)
+{
+    Pending p;
+    if (!take(tag, &p))
+        return;
+
+    // messages that carry a port name or an id, bucketed
+    QString reason = s;
+    if (s.startsWith("slave"))
+        reason = "slave down";
+    else if (s.startsWith("can't open"))
+        reason = "port error";
+    fail(p.cls, reason);
+}
+
+void MicontBusStress::submit(Class cls)
+{
+    if (!m_master || m_slaves.isEmpty())
+        return;
+
+    int vars = cls == ClassBulk ? m_options.bulkVars : m_options.readVars;
+    vars = qBound(1, vars, m_options.slaveVars);
+
+    MicontBusPacket packet;
+    packet.setId(m_slaves.at(random() % m_slaves.size()));
+    packet.setCmd(cls == ClassWrite ? MicontBusPacket::CMD_PUTBUF_B : MicontBusPacket::CMD_GETBUF_B);
+    packet.setAddr(random() % (m_options.slaveVars - vars + 1));
+    packet.setSize(vars * 4);
+    if (cls == ClassWrite) {
+        QByteArray data(vars * 4, 0);
+        for (int i = 0; i < data.size(); i++)
+            data[i] = random();
+        packet.setData(data);
+    }
+
+    Pending p;
+    p.cls = cls;
+    p.request = packet.serialize();
+    p.submitted = m_clock.nsecsElapsed() / 1000;
+
+    // answers are queued to this thread, the entry is in place before one
+    // can be seen
+    static const MicontBusMaster::Priority priorities[ClassCount] = {
+        MicontBusMaster::PriorityPolling, MicontBusMaster::PriorityControl, MicontBusMaster::PriorityBulk
+    };
+    quint32 tag = m_master->transaction(m_portName, m_baudRate, m_options.waitTimeout, p.request,
+                                        priorities[cls], m_options.deadline);
+    m_pending.insert(tag, p);
+}
+
+bool MicontBusStress::take(quint32 tag, Pending *pending)
+{
+    QHash<quint32, Pending>::iterator it = m_pending.find(tag);
+    if (it == m_pending.end()) {
+        m_unknown++;
+        return false;
+    }
+
+    *pending = it.value();
+    m_pending.erase(it);
+    return true;
+}
+
+void MicontBusStress::fail(Class cls, const QString &reason)
+{
+    m_totals[cls].failed++;
+    m_failures[reason]++;
+}
+
+void MicontBusStress::finish()
+{
+    m_tickTimer.stop();
+    m_reportTimer.stop();
+    report();
+
+    for (int c = 0; c < ClassCount; c++) {
+        qInfo() << "stress total" << className[c] << "done" << m_totals[c].done << "failed" << m_totals[c].failed
+                << m_latency[c].toString().c_str();
+    }
+    qInfo() << "stress rss" << m_firstRss << "->" << m_lastRss << "kB, max queue" << m_maxQueue
+            << "max pending" << m_maxPending;
+
+    if (m_mismatched)
+        qWarning() << "stress:" << m_mismatched << "responses answered another request";
+    if (m_unknown)
+        qWarning() << "stress:" << m_unknown << "answers to unknown or finished requests";
+    if (!m_pending.isEmpty())
+        qWarning() << "stress:" << m_pending.size() << "requests never finished";
+
+    emit finished();
+}
+
+// xorshift32, like the simulator's
+quint32 MicontBusStress::random()
+{
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+    return m_random;
+}
+
+// Resident set of this process, kB, 0 where /proc isn't available.
+qint64 MicontBusStress::residentKb()
+{
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QIODevice::ReadOnly))
+        return 0;
+
+    QList<QByteArray> fields = statm.readAll().split(' ');
+    if (fields.size() < 2)
+        return 0;
+    return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE) / 1024;
+}
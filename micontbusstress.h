@@ -0,0 +1,131 @@
+#ifndef MICONTBUSSTRESS_H
+#define MICONTBUSSTRESS_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QTimer>
+
+#include "micontbusmaster.h"
+#include "micontbusrealtime.h"
+
+class MicontBusSimulator;
+
+struct MicontBusStressOptions
+{
+    MicontBusStressOptions()
+        : readRate(200), writeRate(20), bulkRate(5), readVars(4), bulkVars(64), slaveVars(256),
+          waitTimeout(100), deadline(0), duration(60), reportInterval(10) {}
+
+    double readRate;    // requests per second of each class
+    double writeRate;
+    double bulkRate;
+    int readVars;       // variables per request
+    int bulkVars;
+    int slaveVars;      // variables each slave has
+    int waitTimeout;    // ms
+    int deadline;       // ms, 0 for none
+    int duration;       // s
+    int reportInterval; // s
+};
+
+/* Load generator for soak tests: issues polling reads, control writes and
+ * bulk reads to random slaves at fixed rates through a MicontBusMaster,
+ * and reports throughput, latency tails, failures by reason, queue depth
+ * and memory growth every reportInterval seconds.
+ * Responses that don't belong to their request (another id, command or
+ * address) are counted apart, they mean a late answer was taken for the
+ * next one. Against a MicontBusSimulator its injected faults are reported
+ * alongside. */
+class MicontBusStress : public QObject
+{
+    Q_OBJECT
+
+public:
+    MicontBusStress(QObject *parent = 0);
+    ~MicontBusStress();
+
+    void setOptions(const MicontBusStressOptions &options);
+    void setSlaves(const QList<quint8> &ids);
+    void setMaster(MicontBusMaster *master, const QString &portName, qint32 baudRate);
+    void setSimulator(MicontBusSimulator *simulator);
+    void setSeed(quint32 seed);
+
+    void start();
+
+    // nonzero if responses were mismatched or requests never finished
+    int exitCode() const;
+    quint64 completed() const;
+    quint64 mismatched() const;
+    quint64 unknown() const;
+    int pending() const;
+
+signals:
+    void finished();
+
+private slots:
+    void tick();
+    void report();
+    void processDone(quint32 tag, const QByteArray &packet);
+    void processFailed(quint32 tag, const QString &s);
+
+private:
+    enum Class {
+        ClassRead,
+        ClassWrite,
+        ClassBulk,
+        ClassCount
+    };
+
+    struct Pending {
+        Class cls;
+        QByteArray request;
+        qint64 submitted;   // us on m_clock
+    };
+
+    struct Totals {
+        Totals() : done(0), failed(0) {}
+        quint64 done;
+        quint64 failed;
+    };
+
+    void submit(Class cls);
+    bool take(quint32 tag, Pending *pending);
+    void fail(Class cls, const QString &reason);
+    void finish();
+    quint32 random();
+    static qint64 residentKb();
+
+    MicontBusStressOptions m_options;
+    QList<quint8> m_slaves;
+    MicontBusMaster *m_master;
+    QString m_portName;
+    qint32 m_baudRate;
+    MicontBusSimulator *m_simulator;
+
+    QTimer m_tickTimer;
+    QTimer m_reportTimer;
+    QElapsedTimer m_clock;
+    qint64 m_lastTick;
+    double m_credit[ClassCount];
+    quint32 m_random;
+    bool m_draining;
+
+    QHash<quint32, Pending> m_pending;
+    MicontBusLatencyHistogram m_latency[ClassCount];
+    Totals m_totals[ClassCount];
+    Totals m_lastTotals[ClassCount];
+    QMap<QString, quint64> m_failures;
+    quint64 m_mismatched;
+    quint64 m_unknown;      // answers to tags that were never issued or already answered
+    int m_maxQueue;
+    int m_maxPending;
+    qint64 m_firstRss;
+    qint64 m_lastRss;
+    qint64 m_lastReport;
+};
+
+#endif // MICONTBUSSTRESS_H
@@ -0,0 +1,282 @@
+#include "micontbustagdatabase.h"
+#include "micontbuspacket.h"
+#include "micontbusframesizes.h"
+
+#include <QFile>
+#include <QTextStream>
+#include <QtEndian>
+
+#include <algorithm>
+#include <string.h>
+
+MicontBusTagDatabase::MicontBusTagDatabase()
+    : m_maxVars(64), m_maxGap(4), m_sizes(0)
+{
+}
+
+// One tag per line: name;port;id;addr;type;scale
+// port may be empty, addr may be hex (0x...), type is uint, int or float,
+// scale defaults to 1. Empty lines and lines starting with # are skipped.
+bool MicontBusTagDatabase::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        m_errorString = file.errorString();
+        return false;
+    }
+
+    QVector<MicontBusTag> tags;
+    QHash<QString, int> names;
+    QTextStream in(&file);
+    int line = 0;
+
+    while (!in.atEnd()) {
+        QString s = in.readLine().trimmed();
+        line++;
+        if (s.isEmpty() || s.startsWith('#'))
+            continue;
+
+        QStringList fields = s.split(';');
+        if (fields.size() < 5) {
+            m_errorString = QString("line %1: expected name;port;id;addr;type[;scale]").arg(line);
+            return false;
+        }
+
+        MicontBusTag tag;
+        bool ok1, ok2, ok3, ok4 = true;
+        tag.name = fields[0].trimmed();
+        tag.portName = fields[1].trimmed();
+        uint id = fields[2].trimmed().toUInt(&ok1, 0);
+        tag.addr = fields[3].trimmed().toUShort(&ok2, 0);
+        tag.type = typeFromString(fields[4].trimmed(), &ok3);
+        if (fields.size() > 5)
+            tag.scale = fields[5].trimmed().toDouble(&ok4);
+
+        if (tag.name.isEmpty() || !ok1 || id > 255 || !ok2 || !ok3 || !ok4) {
+            m_errorString = QString("line %1: invalid tag").arg(line);
+            return false;
+        }
+        if (names.contains(tag.name)) {
+            m_errorString = QString("line %1: duplicate tag %2").arg(line).arg(tag.name);
+            return false;
+        }
+
+        tag.id = id;
+        names.insert(tag.name, tags.size());
+        tags.append(tag);
+    }
+
+    m_tags = tags;
+    m_names = names;
+    m_plans.clear();
+    return true;
+}
+
+QString MicontBusTagDatabase::errorString() const
+{
+    return m_errorString;
+}
+
+void MicontBusTagDatabase::clear()
+{
+    m_tags.clear();
+    m_names.clear();
+    m_plans.clear();
+}
+
+int MicontBusTagDatabase::count() const
+{
+    return m_tags.size();
+}
+
+const MicontBusTag &MicontBusTagDatabase::tag(int index) const
+{
+    return m_tags.at(index);
+}
+
+int MicontBusTagDatabase::indexOf(const QString &name) const
+{
+    return m_names.value(name, -1);
+}
+
+void MicontBusTagDatabase::setMaxVars(int maxVars)
+{
+    m_maxVars = qMax(1, maxVars);
+}
+
+void MicontBusTagDatabase::setMaxGap(int maxGap)
+{
+    m_maxGap = qMax(0, maxGap);
+}
+
+// Slaves with a discovered limit get plans up to it instead of maxVars.
+void MicontBusTagDatabase::setFrameSizes(const MicontBusFrameSizes *sizes)
+{
+    m_sizes = sizes;
+}
+
+// Compiles the named tags (all if names is empty) that live on portName
+// (any port if empty) into read plans. Tags are sorted by slave and
+// address; a tag joins the current plan if it is on the same slave, no
+// more than maxGap unused variables away and the plan stays within the
+// slave's frame size limit, maxVars if unknown. Returns the number of plans.
+int MicontBusTagDatabase::compile(const QStringList &names, const QString &portName)
+{
+    QVector<int> order;
+    if (names.isEmpty()) {
+        for (int i = 0; i < m_tags.size(); i++)
+            order.append(i);
+    } else {
+        foreach (const QString &name, names) {
+            int i = indexOf(name);
+            if (i >= 0)
+                order.append(i);
+        }
+    }
+
+    if (!portName.isEmpty()) {
+        QVector<int> filtered;
+        foreach (int i, order) {
+            if (m_tags[i].portName.isEmpty() || m_tags[i].portName == portName)
+                filtered.append(i);
+        }
+        order = filtered;
+    }
+
+    const QVector<MicontBusTag> &tags = m_tags;
+    std::sort(order.begin(), order.end(), [&tags](int a, int b) {
+        if (tags[a].portName != tags[b].portName)
+            return tags[a].portName < tags[b].portName;
+        if (tags[a].id != tags[b].id)
+            return tags[a].id < tags[b].id;
+        return tags[a].addr < tags[b].addr;
+    });
+
+    m_plans.clear();
+    int maxVars = m_maxVars;
+
+    foreach (int i, order) {
+        const MicontBusTag &t = m_tags[i];
+        ReadPlan *plan = m_plans.isEmpty() ? 0 : &m_plans.last();
+
+        bool join = plan && plan->portName == t.portName && plan->id == t.id
+                && t.addr <= plan->addr + plan->count + m_maxGap
+                && t.addr + 1 - plan->addr <= maxVars;
+
+        if (!join) {
+            m_plans.append(ReadPlan());
+            plan = &m_plans.last();
+            plan->portName = t.portName;
+            plan->id = t.id;
+            plan->addr = t.addr;
+            plan->count = 0;
+
+            if (m_sizes) {
+                const QString &port = t.portName.isEmpty() ? portName : t.portName;
+                maxVars = m_sizes->maxRead(port, t.id, m_maxVars * sizeof(quint32)) / sizeof(quint32);
+            }
+        }
+
+        plan->count = qMax<int>(plan->count, t.addr + 1 - plan->addr);
+
+        ReadPlan::Decode d;
+        d.tag = i;
+        d.offset = (t.addr - plan->addr) * sizeof(quint32);
+        d.type = t.type;
+        d.scale = t.scale;
+        plan->decodes.append(d);
+    }
+
+    return m_plans.size();
+}
+
+int MicontBusTagDatabase::planCount() const
+{
+    return m_plans.size();
+}
+
+const MicontBusTagDatabase::ReadPlan &MicontBusTagDatabase::plan(int index) const
+{
+    return m_plans.at(index);
+}
+
+QByteArray MicontBusTagDatabase::planRequest(int index) const
+{
+    const ReadPlan &p = m_plans.at(index);
+
+    MicontBusPacket packet;
+    packet.setId(p.id);
+    packet.setCmd(MicontBusPacket::CMD_GETBUF_B);
+    packet.setAddr(p.addr);
+    packet.setSize(p.count * sizeof(quint32));
+    return packet.serialize();
+}
+
+// Decodes the data of a plan's GETBUF_B response into its tags.
+bool MicontBusTagDatabase::decode(int index, const QByteArray &data)
+{
+    if (index < 0 || index >= m_plans.size())
+        return false;
+
+    const ReadPlan &p = m_plans.at(index);
+    if (data.size() < p.count * (int)sizeof(quint32))
+        return false;
+
+    const uchar *d = reinterpret_cast<const uchar *>(data.constData());
+    const ReadPlan::Decode *e = p.decodes.constData();
+    const ReadPlan::Decode *end = e + p.decodes.size();
+
+    for (; e != end; ++e) {
+        MicontBusTag &t = m_tags[e->tag];
+        quint32 raw = qFromLittleEndian<quint32>(d + e->offset);
+        float f;
+
+        t.raw = raw;
+        switch (e->type) {
+        case MicontBusTag::TypeUInt:
+            t.value = raw * e->scale;
+            break;
+        case MicontBusTag::TypeInt:
+            t.value = (qint32)raw * e->scale;
+            break;
+        case MicontBusTag::TypeFloat:
+            memcpy(&f, &raw, sizeof(f));
+            t.value = f * e->scale;
+            break;
+        }
+        t.valid = true;
+    }
+
+    return true;
+}
+
+MicontBusTag::Type MicontBusTagDatabase::typeFromString(const QString &s, bool *ok)
+{
+    if (ok)
+        *ok = true;
+
+    QString type = s.toLower();
+    if (type == "uint")
+        return MicontBusTag::TypeUInt;
+    if (type == "int")
+        return MicontBusTag::TypeInt;
+    if (type == "float")
+        return MicontBusTag::TypeFloat;
+
+    if (ok)
+        *ok = false;
+    return MicontBusTag::TypeUInt;
+}
+
+QString MicontBusTagDatabase::typeToString(MicontBusTag::Type type)
+{
+    switch (type) {
+    case MicontBusTag::TypeUInt:
+        return "uint";
+    case MicontBusTag::TypeInt:
+        return "int";
+    case MicontBusTag::TypeFloat:
+        return "float";
+    }
+    return QString();
+}
@@ -0,0 +1,91 @@
+#ifndef MICONTBUSTAGDATABASE_H
+#define MICONTBUSTAGDATABASE_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QByteArray>
+
+class MicontBusFrameSizes;
+
+struct MicontBusTag
+{
+    enum Type {
+        TypeUInt,
+        TypeInt,
+        TypeFloat
+    };
+
+    MicontBusTag() : id(0), addr(0), type(TypeUInt), scale(1.0), raw(0), value(0), valid(false) {}
+
+    QString name;
+    QString portName;   // empty for "any port"
+    quint8 id;
+    quint16 addr;       // variable address
+    Type type;
+    double scale;
+
+    // last decoded value
+    quint32 raw;
+    double value;
+    bool valid;
+};
+
+/* Tag layer on top of GETBUF_B: maps tag names to (port, id, address,
+ * type, scale) and compiles a set of subscribed tags into read plans, one
+ * GETBUF_B frame each, by merging nearby addresses of a slave. Decoding a
+ * plan's response writes straight into the tags through precomputed
+ * offsets, with no lookups by name or address. */
+class MicontBusTagDatabase
+{
+public:
+    struct ReadPlan {
+        struct Decode {
+            int tag;
+            int offset;     // byte offset in the response data
+            MicontBusTag::Type type;
+            double scale;
+        };
+
+        QString portName;
+        quint8 id;
+        quint16 addr;
+        quint16 count;      // variables to read
+        QVector<Decode> decodes;
+    };
+
+    MicontBusTagDatabase();
+
+    bool load(const QString &fileName);
+    QString errorString() const;
+    void clear();
+
+    int count() const;
+    const MicontBusTag &tag(int index) const;
+    int indexOf(const QString &name) const;
+
+    void setMaxVars(int maxVars);
+    void setMaxGap(int maxGap);
+    void setFrameSizes(const MicontBusFrameSizes *sizes);
+
+    int compile(const QStringList &names = QStringList(), const QString &portName = QString());
+    int planCount() const;
+    const ReadPlan &plan(int index) const;
+    QByteArray planRequest(int index) const;
+    bool decode(int index, const QByteArray &data);
+
+    static MicontBusTag::Type typeFromString(const QString &s, bool *ok = 0);
+    static QString typeToString(MicontBusTag::Type type);
+
+private:
+    QVector<MicontBusTag> m_tags;
+    QHash<QString, int> m_names;
+    QVector<ReadPlan> m_plans;
+    QString m_errorString;
+    int m_maxVars;
+    int m_maxGap;
+    const MicontBusFrameSizes *m_sizes;
+};
+
+#endif // MICONTBUSTAGDATABASE_H
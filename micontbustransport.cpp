@@ -0,0 +1,110 @@
+#include "micontbustransport.h"
+#ifdef Q_OS_UNIX
+#include "micontbusposixport.h"
+#endif
+
+#include <QtSerialPort/QSerialPort>
+
+QT_USE_NAMESPACE
+
+MicontBusPort *MicontBusTransport::create(Backend backend)
+{
+#ifdef Q_OS_UNIX
+    if (backend == BackendPosix)
+        return new MicontBusPosixPort;
+#else
+    Q_UNUSED(backend)
+#endif
+    return new MicontBusQtTransport;
+}
+
+bool MicontBusTransport::isAvailable(Backend backend)
+{
+#ifdef Q_OS_UNIX
+    Q_UNUSED(backend)
+    return true;
+#else
+    return backend == BackendQt;
+#endif
+}
+
+MicontBusQtTransport::MicontBusQtTransport()
+    : serial(new QSerialPort)
+{
+}
+
+MicontBusQtTransport::~MicontBusQtTransport()
+{
+    delete serial;
+}
+
+// QSerialPort has no low-latency or RS-485 settings, only the character
+// format is applied.
+bool MicontBusQtTransport::open(const std::string &portName, int32_t baudRate, const MicontBusSerialOptions &options)
+{
+    serial->close();
+    serial->setPortName(QString::fromStdString(portName));
+    if (!serial->open(QIODevice::ReadWrite))
+        return false;
+
+    QSerialPort::Parity parity = QSerialPort::NoParity;
+    if (options.parity == MicontBusSerialOptions::ParityEven)
+        parity = QSerialPort::EvenParity;
+    else if (options.parity == MicontBusSerialOptions::ParityOdd)
+        parity = QSerialPort::OddParity;
+
+    if (!serial->setBaudRate(baudRate)
+            || !serial->setDataBits((QSerialPort::DataBits)options.dataBits)
+            || !serial->setParity(parity)
+            || !serial->setStopBits(options.stopBits == 2 ? QSerialPort::TwoStop : QSerialPort::OneStop)) {
+        serial->close();
+        return false;
+    }
+    return true;
+}
+
+void MicontBusQtTransport::close()
+{
+    serial->close();
+}
+
+bool MicontBusQtTransport::isOpen() const
+{
+    return serial->isOpen();
+}
+
+std::string MicontBusQtTransport::errorString() const
+{
+    return QString("error code %1").arg(serial->error()).toStdString();
+}
+
+int64_t MicontBusQtTransport::write(const char *data, int64_t size)
+{
+    return serial->write(data, size);
+}
+
+bool MicontBusQtTransport::waitForBytesWritten(int msecs)
+{
+    return serial->waitForBytesWritten(msecs);
+}
+
+bool MicontBusQtTransport::waitForReadyRead(int msecs)
+{
+    return serial->waitForReadyRead(msecs);
+}
+
+int64_t MicontBusQtTransport::bytesAvailable() const
+{
+    return serial->bytesAvailable();
+}
+
+int64_t MicontBusQtTransport::read(char *data, int64_t maxSize)
+{
+    return serial->read(data, maxSize);
+}
+
+// Both QSerialPort's buffer and the driver's.
+void MicontBusQtTransport::discardInput()
+{
+    serial->clear(QSerialPort::Input);
+}
@@ -0,0 +1,48 @@
+#ifndef MICONTBUSTRANSPORT_H
+#define MICONTBUSTRANSPORT_H
+
+#include <QtGlobal>
+
+#include "micontbusport.h"
+
+QT_BEGIN_NAMESPACE
+class QSerialPort;
+QT_END_NAMESPACE
+
+/* Serial backends of the master and the sniffer. Both are a
+ * MicontBusPort, which is all MicontBusScheduler needs. */
+class MicontBusTransport
+{
+public:
+    enum Backend {
+        BackendQt,      // QSerialPort, portable
+        BackendPosix    // MicontBusPosixPort of the core library, Unix only
+    };
+
+    static MicontBusPort *create(Backend backend);
+    static bool isAvailable(Backend backend);
+};
+
+class MicontBusQtTransport : public MicontBusPort
+{
+public:
+    MicontBusQtTransport();
+    ~MicontBusQtTransport();
+
+    bool open(const std::string &portName, int32_t baudRate, const MicontBusSerialOptions &options);
+    void close();
+    bool isOpen() const;
+    std::string errorString() const;
+
+    int64_t write(const char *data, int64_t size);
+    bool waitForBytesWritten(int msecs);
+    bool waitForReadyRead(int msecs);
+    int64_t bytesAvailable() const;
+    int64_t read(char *data, int64_t maxSize);
+    void discardInput();
+
+private:
+    QSerialPort *serial;
+};
+
+#endif // MICONTBUSTRANSPORT_H
@@ -0,0 +1,123 @@
+#include "scandialog.h"
+#include "micontbuscapturemodel.h"
+#include "micontbuspacket.h"
+
+#include <QLabel>
+#include <QPushButton>
+#include <QProgressBar>
+#include <QTableWidget>
+#include <QHeaderView>
+#include <QGridLayout>
+
+ScanDialog::ScanDialog(const QStringList &portNames, qint32 baudRate, const MicontBusSerialOptions &options,
+                       MicontBusTransport::Backend backend, QWidget *parent)
+    : QDialog(parent)
+    , portNames(portNames)
+    , baudRate(baudRate)
+    , tableSlaves(new QTableWidget())
+    , progressScan(new QProgressBar())
+    , labelStatus(new QLabel())
+    , pushScan(new QPushButton(QIcon("icons/network.svg"), tr("Scan")))
+    , pushStop(new QPushButton(tr("Stop")))
+{
+    tableSlaves->setSelectionBehavior(QAbstractItemView::SelectRows);
+    tableSlaves->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    tableSlaves->verticalHeader()->setVisible(false);
+    tableSlaves->setColumnCount(5);
+    tableSlaves->setHorizontalHeaderLabels(QStringList() << tr("Port") << tr("Id") << tr("Result") << tr("Size")
+                                           << tr("Turnaround, us"));
+    tableSlaves->horizontalHeader()->setStretchLastSection(true);
+    tableSlaves->setSortingEnabled(true);
+
+    pushStop->setEnabled(false);
+
+    QGridLayout *grid = new QGridLayout;
+    grid->addWidget(new QLabel(tr("Ports: %1, speed: %2, timeout: %3 ms")
+                               .arg(portNames.join(", ")).arg(baudRate)
+                               .arg(MicontBusScanner::scanTimeout(baudRate, options.bitsPerCharacter()))), 0, 0, 1, 3);
+    grid->addWidget(tableSlaves, 1, 0, 1, 3);
+    grid->addWidget(progressScan, 2, 0, 1, 3);
+    grid->addWidget(labelStatus, 3, 0);
+    grid->addWidget(pushScan, 3, 1);
+    grid->addWidget(pushStop, 3, 2);
+    grid->setColumnStretch(0, 1);
+    setLayout(grid);
+
+    setWindowTitle(tr("MicontBUS Discovery"));
+    resize(480, 400);
+
+    scanner.setSerialOptions(options);
+    scanner.setBackend(backend);
+
+    connect(pushScan, SIGNAL(clicked()),
+            this, SLOT(startScan()));
+    connect(pushStop, SIGNAL(clicked()),
+            this, SLOT(stopScan()));
+    connect(tableSlaves, SIGNAL(cellActivated(int,int)),
+            this, SLOT(itemActivated(int)));
+    connect(&scanner, SIGNAL(slaveFound(QString,quint8,quint8,quint32,qint64)),
+            this, SLOT(slaveFound(QString,quint8,quint8,quint32,qint64)));
+    connect(&scanner, SIGNAL(progress(int,int)),
+            this, SLOT(scanProgress(int,int)));
+    connect(&scanner, SIGNAL(finished()),
+            this, SLOT(scanFinished()));
+}
+
+void ScanDialog::startScan()
+{
+    tableSlaves->setSortingEnabled(false);
+    tableSlaves->clearContents();
+    tableSlaves->setRowCount(0);
+    progressScan->setValue(0);
+    labelStatus->setText(tr("Scanning..."));
+    pushScan->setEnabled(false);
+    pushStop->setEnabled(true);
+
+    scanner.start(portNames, baudRate);
+}
+
+void ScanDialog::stopScan()
+{
+    scanner.stop();
+    scanFinished();
+}
+
+void ScanDialog::slaveFound(const QString &portName, quint8 id, quint8 result, quint32 size, qint64 turnaround)
+{
+    int row = tableSlaves->rowCount();
+    tableSlaves->insertRow(row);
+
+    QTableWidgetItem *item;
+    tableSlaves->setItem(row, 0, new QTableWidgetItem(portName));
+    item = new QTableWidgetItem;
+    item->setData(Qt::DisplayRole, id);
+    tableSlaves->setItem(row, 1, item);
+    tableSlaves->setItem(row, 2, new QTableWidgetItem(MicontBusCaptureModel::resultName(result)));
+    item = new QTableWidgetItem;
+    if (result == MicontBusPacket::CMD_RESULT_OK)
+        item->setData(Qt::DisplayRole, size);
+    tableSlaves->setItem(row, 3, item);
+    item = new QTableWidgetItem;
+    item->setData(Qt::DisplayRole, turnaround);
+    tableSlaves->setItem(row, 4, item);
+}
+
+void ScanDialog::scanProgress(int done, int total)
+{
+    progressScan->setRange(0, total);
+    progressScan->setValue(done);
+}
+
+void ScanDialog::scanFinished()
+{
+    labelStatus->setText(tr("Found %1 slave(s)").arg(tableSlaves->rowCount()));
+    pushScan->setEnabled(true);
+    pushStop->setEnabled(false);
+    tableSlaves->setSortingEnabled(true);
+}
+
+void ScanDialog::itemActivated(int row)
+{
+    emit slaveSelected(tableSlaves->item(row, 0)->text(),
+                       tableSlaves->item(row, 1)->data(Qt::DisplayRole).toInt());
+}
@@ -0,0 +1,47 @@
+#ifndef SCANDIALOG_H
+#define SCANDIALOG_H
+
+#include <QDialog>
+#include <QStringList>
+
+#include "micontbusscanner.h"
+
+QT_BEGIN_NAMESPACE
+class QLabel;
+class QPushButton;
+class QProgressBar;
+class QTableWidget;
+QT_END_NAMESPACE
+
+class ScanDialog : public QDialog
+{
+    Q_OBJECT
+public:
+    ScanDialog(const QStringList &portNames, qint32 baudRate, const MicontBusSerialOptions &options,
+               MicontBusTransport::Backend backend, QWidget *parent = 0);
+
+signals:
+    void slaveSelected(const QString &portName, int id);
+
+private slots:
+    void startScan();
+    void stopScan();
+    void slaveFound(const QString &portName, quint8 id, quint8 result, quint32 size, qint64 turnaround);
+    void scanProgress(int done, int total);
+    void scanFinished();
+    void itemActivated(int row);
+
+private:
+    QStringList portNames;
+    qint32 baudRate;
+
+    QTableWidget *tableSlaves;
+    QProgressBar *progressScan;
+    QLabel *labelStatus;
+    QPushButton *pushScan;
+    QPushButton *pushStop;
+
+    MicontBusScanner scanner;
+};
+
+#endif // SCANDIALOG_H
@@ -0,0 +1,13 @@
+# MicontBusAsync coroutines on the master, the bus simulated on a pty
+
+QT       += testlib
+QT       -= gui
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_async
+TEMPLATE = app
+
+include(../../micontbus.pri)
+
+SOURCES += tst_async.cpp
@@ -0,0 +1,164 @@
+#include <QtTest>
+
+#include "micontbusasync.h"
+#include "micontbusmaster.h"
+#include "micontbussimulator.h"
+
+class TestAsync : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+    void sequence();
+    void concurrent();
+    void failure();
+    void busClosed();
+
+private:
+    MicontBusSimulator m_simulator;
+    MicontBusMaster *m_master;
+    MicontBusAsync *m_bus;
+};
+
+// What a procedure saw, filled in as it goes.
+struct Trace
+{
+    Trace() : done(false) {}
+
+    QStringList errors;
+    QVector<quint32> values;
+    bool done;
+};
+
+// write, read back and check, as a device procedure would
+static MicontBusTask writeAndVerify(MicontBusAsync *bus, quint8 id, quint16 addr, quint32 seed, Trace *trace)
+{
+    MicontBusResult size = co_await bus->getSize(id);
+    if (!size.ok)
+        trace->errors << size.error;
+
+    QVector<tMicontVar> vars(3);
+    for (int i = 0; i < vars.size(); i++)
+        vars[i].u = seed + i;
+    MicontBusResult written = co_await bus->write(id, addr, vars);
+    if (!written.ok)
+        trace->errors << written.error;
+
+    MicontBusResult read = co_await bus->read(id, addr, vars.size());
+    if (!read.ok)
+        trace->errors << read.error;
+    foreach (const tMicontVar &v, read.variables)
+        trace->values << v.u;
+    trace->done = true;
+}
+
+// one task awaiting another
+static MicontBusTask outer(MicontBusAsync *bus, Trace *inner, Trace *trace)
+{
+    co_await writeAndVerify(bus, 1, 16, 100, inner);
+    MicontBusResult read = co_await bus->read(1, 16, 1);
+    if (read.ok && read.variables.size() == 1)
+        trace->values << read.variables[0].u;
+    trace->done = true;
+}
+
+static MicontBusTask readOnce(MicontBusAsync *bus, quint8 id, Trace *trace)
+{
+    MicontBusResult read = co_await bus->read(id, 0, 1);
+    if (!read.ok)
+        trace->errors << read.error;
+    trace->done = true;
+}
+
+void TestAsync::initTestCase()
+{
+    m_simulator.setSlaves(QList<quint8>() << 1 << 2, 64);
+    QVERIFY2(m_simulator.open(QString("/tmp/tst_async-%1").arg(QCoreApplication::applicationPid())),
+             qPrintable(m_simulator.errorString()));
+    m_simulator.start();
+}
+
+void TestAsync::cleanupTestCase()
+{
+    m_simulator.stop();
+    m_simulator.close();
+}
+
+void TestAsync::init()
+{
+    m_master = new MicontBusMaster;
+    m_master->setBackend(MicontBusTransport::BackendPosix);
+    m_bus = new MicontBusAsync(m_master, m_simulator.portName(), 115200, 50);
+}
+
+void TestAsync::cleanup()
+{
+    delete m_bus;
+    delete m_master;
+}
+
+void TestAsync::sequence()
+{
+    Trace trace;
+    writeAndVerify(m_bus, 1, 8, 0x11223344, &trace);
+    QVERIFY(!trace.done);
+    QCOMPARE(m_bus->pendingCount(), 1);
+
+    QTRY_VERIFY_WITH_TIMEOUT(trace.done, 10000);
+    QVERIFY2(trace.errors.isEmpty(), qPrintable(trace.errors.join(", ")));
+    QCOMPARE(trace.values, QVector<quint32>() << 0x11223344 << 0x11223345 << 0x11223346);
+    QCOMPARE(m_bus->pendingCount(), 0);
+
+    Trace inner, trace2;
+    outer(m_bus, &inner, &trace2);
+    QTRY_VERIFY_WITH_TIMEOUT(trace2.done, 10000);
+    QVERIFY(inner.done);
+    QCOMPARE(trace2.values, QVector<quint32>() << 100);
+}
+
+// many procedures on both slaves interleave on this one thread
+void TestAsync::concurrent()
+{
+    const int count = 40;
+    QVector<Trace> traces(count);
+    for (int i = 0; i < count; i++)
+        writeAndVerify(m_bus, 1 + i % 2, 3 * (i / 2), 1000 * i, &traces[i]);
+    QCOMPARE(m_bus->pendingCount(), count);
+
+    for (int i = 0; i < count; i++) {
+        QTRY_VERIFY_WITH_TIMEOUT(traces[i].done, 30000);
+        QVERIFY2(traces[i].errors.isEmpty(), qPrintable(traces[i].errors.join(", ")));
+        QCOMPARE(traces[i].values, QVector<quint32>() << 1000 * i << 1000 * i + 1 << 1000 * i + 2);
+    }
+}
+
+// no slave 9: the procedure resumes with the master's error
+void TestAsync::failure()
+{
+    Trace trace;
+    readOnce(m_bus, 9, &trace);
+    QTRY_VERIFY_WITH_TIMEOUT(trace.done, 10000);
+    QCOMPARE(trace.errors.size(), 1);
+    QVERIFY(!trace.errors.first().isEmpty());
+}
+
+// still waiting when the bus goes away: resumed with an error at once
+void TestAsync::busClosed()
+{
+    Trace trace;
+    readOnce(m_bus, 9, &trace);
+    QVERIFY(!trace.done);
+
+    delete m_bus;
+    m_bus = 0;
+    QVERIFY(trace.done);
+    QCOMPARE(trace.errors, QStringList() << "bus closed");
+}
+
+QTEST_GUILESS_MAIN(TestAsync)
+
+#include "tst_async.moc"
@@ -0,0 +1,28 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+/* Minimal checks for the tests that don't link Qt: a failed CHECK prints
+ * where and counts, main() returns checkFailures() so that make check
+ * sees it. */
+static int checkFailureCount = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            checkFailureCount++; \
+        } \
+    } while (0)
+
+static inline int checkFailures(const char *name)
+{
+    if (checkFailureCount)
+        fprintf(stderr, "%s: %d checks failed\n", name, checkFailureCount);
+    else
+        printf("%s: passed\n", name);
+    return checkFailureCount ? 1 : 0;
+}
+
+#endif // CHECK_H
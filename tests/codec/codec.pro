@@ -0,0 +1,15 @@
+# MicontBusCodec, standard library only
+
+CONFIG   -= qt
+CONFIG   += console testcase c++2a
+CONFIG   -= app_bundle
+
+TARGET = tst_codec
+TEMPLATE = app
+
+INCLUDEPATH += ../../core
+
+SOURCES += tst_codec.cpp \
+    ../../core/micontbuscodec.cpp
+
+HEADERS += ../check.h
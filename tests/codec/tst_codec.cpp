@@ -0,0 +1,135 @@
+#include "micontbuscodec.h"
+#include "../check.h"
+
+#include <string.h>
+
+typedef MicontBusCodec C;
+
+static std::vector<uint8_t> bytes(std::initializer_list<uint8_t> l)
+{
+    return std::vector<uint8_t>(l);
+}
+
+static void testCrc()
+{
+    // CRC-16/MODBUS check value
+    CHECK(C::crc16("123456789", 9) == 0x4b37);
+    CHECK(C::crc16("", 0) == 0xffff);
+
+    std::vector<uint8_t> frame = bytes({ 0x01, C::CMD_GETSIZE, 0x00, 0x00 });
+    C::appendCrc(frame);
+    CHECK(frame.size() == 6);
+    CHECK(C::checkCrc(frame.data(), frame.size()));
+    frame[2] ^= 0x01;
+    CHECK(!C::checkCrc(frame.data(), frame.size()));
+    CHECK(!C::checkCrc(frame.data(), 1));
+}
+
+static void testEncode()
+{
+    MicontBusMessage m;
+    m.id = 7;
+    m.cmd = C::CMD_GETBUF_B;
+    m.addr = 0x1234;
+    m.size = 8;
+    CHECK(C::encode(m) == bytes({ 7, C::CMD_GETBUF_B, 0x34, 0x12, 8, 0 }));
+
+    // data only goes out with the commands that carry it
+    m.data = bytes({ 1, 2, 3, 4, 5, 6, 7, 8 });
+    CHECK(C::encode(m).size() == 6);
+
+    m.cmd = C::CMD_PUTBUF_B;
+    CHECK(C::encode(m) == bytes({ 7, C::CMD_PUTBUF_B, 0x34, 0x12, 8, 0, 1, 2, 3, 4, 5, 6, 7, 8 }));
+
+    m.cmd = C::CMD_GETSIZE;
+    m.addr = 0;
+    CHECK(C::encode(m) == bytes({ 7, C::CMD_GETSIZE, 0, 0 }));
+}
+
+static void testDecode()
+{
+    MicontBusMessage m;
+
+    std::vector<uint8_t> getsize = bytes({ 3, C::CMD_GETSIZE | (int)C::CMD_RESULT_OK, 0, 0, 0x00, 0x01, 0, 0 });
+    CHECK(C::decode(getsize.data(), getsize.size(), &m));
+    CHECK(m.id == 3 && m.cmd == (C::CMD_GETSIZE | (int)C::CMD_RESULT_OK));
+    CHECK(m.data == bytes({ 0x00, 0x01, 0, 0 }));
+    CHECK(!C::decode(getsize.data(), getsize.size() - 1, &m));
+
+    std::vector<uint8_t> getbuf = bytes({ 3, C::CMD_GETBUF_B | (int)C::CMD_RESULT_OK, 0x10, 0, 4, 0, 9, 8, 7, 6 });
+    CHECK(C::decode(getbuf.data(), getbuf.size(), &m));
+    CHECK(m.addr == 0x10 && m.size == 4 && m.data == bytes({ 9, 8, 7, 6 }));
+    CHECK(!C::decode(getbuf.data(), getbuf.size() - 1, &m));
+    getbuf.push_back(0);
+    CHECK(!C::decode(getbuf.data(), getbuf.size(), &m));
+
+    // errors carry the header only
+    std::vector<uint8_t> busy = bytes({ 3, C::CMD_GETBUF_B | (int)C::CMD_RESULT_BUSY, 0x10, 0, 4, 0 });
+    CHECK(C::decode(busy.data(), busy.size(), &m));
+    CHECK(m.data.empty());
+
+    std::vector<uint8_t> put = bytes({ 3, C::CMD_PUTBUF_B | (int)C::CMD_RESULT_OK, 0x10, 0, 4, 0 });
+    CHECK(C::decode(put.data(), put.size(), &m));
+
+    std::vector<uint8_t> unknown = bytes({ 3, 0x0f, 0, 0 });
+    CHECK(!C::decode(unknown.data(), unknown.size(), &m));
+    CHECK(!C::decode(unknown.data(), 3, &m));
+
+    // what encode() writes decode() reads back
+    MicontBusMessage in;
+    in.id = 9;
+    in.cmd = C::CMD_GETBUF_B | (int)C::CMD_RESULT_OK;
+    in.addr = 0xbeef;
+    in.size = 3;
+    in.data = bytes({ 1, 2, 3 });
+    std::vector<uint8_t> frame = C::encode(in);
+    CHECK(C::decode(frame.data(), frame.size(), &m));
+    CHECK(m.id == in.id && m.cmd == in.cmd && m.addr == in.addr && m.size == in.size && m.data == in.data);
+}
+
+static void testSizes()
+{
+    std::vector<uint8_t> getsize = bytes({ 1, C::CMD_GETSIZE, 0, 0 });
+    std::vector<uint8_t> getbuf = bytes({ 1, C::CMD_GETBUF_B, 0, 0, 16, 0 });
+    std::vector<uint8_t> putbuf = bytes({ 1, C::CMD_PUTBUF_B, 0, 0, 2, 0, 0xaa, 0xbb });
+
+    CHECK(C::expectedResponseSize(getsize.data(), getsize.size()) == 8);
+    CHECK(C::expectedResponseSize(getbuf.data(), getbuf.size()) == 22);
+    CHECK(C::expectedResponseSize(getbuf.data(), 4) == 0);
+    CHECK(C::expectedResponseSize(putbuf.data(), putbuf.size()) == 6);
+
+    CHECK(C::requestSize(getsize.data(), 1) == 0);
+    CHECK(C::requestSize(getsize.data(), getsize.size()) == 4);
+    CHECK(C::requestSize(getbuf.data(), 2) == 6);
+    CHECK(C::requestSize(putbuf.data(), 4) == 0);
+    CHECK(C::requestSize(putbuf.data(), putbuf.size()) == 8);
+
+    // responses aren't requests and the other way round
+    std::vector<uint8_t> ok = bytes({ 1, C::CMD_GETBUF_B | (int)C::CMD_RESULT_OK, 0, 0, 16, 0 });
+    std::vector<uint8_t> err = bytes({ 1, C::CMD_GETBUF_B | (int)C::CMD_RESULT_ERRBADDR, 0, 0 });
+    CHECK(C::requestSize(ok.data(), ok.size()) == -1);
+    CHECK(C::responseSize(getbuf.data(), getbuf.size()) == -1);
+
+    CHECK(C::responseSize(ok.data(), 4) == 0);
+    CHECK(C::responseSize(ok.data(), ok.size()) == 22);
+    CHECK(C::responseSize(err.data(), err.size()) == 6);
+
+    std::vector<uint8_t> sizeOk = bytes({ 1, C::CMD_GETSIZE | (int)C::CMD_RESULT_OK });
+    std::vector<uint8_t> sizeErr = bytes({ 1, C::CMD_GETSIZE | (int)C::CMD_RESULT_UCMD });
+    CHECK(C::responseSize(sizeOk.data(), sizeOk.size()) == 8);
+    CHECK(C::responseSize(sizeErr.data(), sizeErr.size()) == 4);
+
+    CHECK(C::hasData(C::CMD_PUTBUF_B));
+    CHECK(C::hasData(C::CMD_GETBUF_B | (int)C::CMD_RESULT_OK));
+    CHECK(!C::hasData(C::CMD_GETBUF_B));
+    CHECK(!C::hasData(C::CMD_GETBUF_B | (int)C::CMD_RESULT_BUSY));
+}
+
+int main()
+{
+    testCrc();
+    testEncode();
+    testDecode();
+    testSizes();
+    return checkFailures("tst_codec");
+}
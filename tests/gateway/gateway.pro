@@ -0,0 +1,13 @@
+# MicontBusGateway over loopback TCP, the bus simulated on a pty
+
+QT       += testlib
+QT       -= gui
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_gateway
+TEMPLATE = app
+
+include(../../micontbus.pri)
+
+SOURCES += tst_gateway.cpp
@@ -0,0 +1,181 @@
+#include <QtTest>
+#include <QTcpSocket>
+
+#include "micontbusgateway.h"
+#include "micontbusmaster.h"
+#include "micontbuspacket.h"
+#include "micontbussimulator.h"
+
+class TestGateway : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+    void read();
+    void failedIsBusy();
+    void queueFullIsBusy();
+    void oversizeIsGarbage();
+
+private:
+    static QByteArray request(quint8 id, int cmd, quint16 addr, quint16 size);
+    void receive(int count, QList<QByteArray> *frames);
+
+    MicontBusSimulator m_simulator;
+    MicontBusMaster *m_master;
+    MicontBusGateway *m_gateway;
+    QTcpSocket *m_socket;
+};
+
+void TestGateway::initTestCase()
+{
+    m_simulator.setSlaves(QList<quint8>() << 1, 64);
+    QVERIFY2(m_simulator.open(QString("/tmp/tst_gateway-%1").arg(QCoreApplication::applicationPid())),
+             qPrintable(m_simulator.errorString()));
+    m_simulator.start();
+}
+
+void TestGateway::cleanupTestCase()
+{
+    m_simulator.stop();
+    m_simulator.close();
+}
+
+void TestGateway::init()
+{
+    m_master = new MicontBusMaster;
+    m_master->setBackend(MicontBusTransport::BackendPosix);
+
+    m_gateway = new MicontBusGateway(m_master);
+    m_gateway->setSerialPort(m_simulator.portName(), 115200, 50);
+    QVERIFY(m_gateway->listen(QHostAddress::LocalHost, 0));
+
+    m_socket = new QTcpSocket;
+    m_socket->connectToHost(QHostAddress(QHostAddress::LocalHost), m_gateway->serverPort());
+    QVERIFY(m_socket->waitForConnected(5000));
+    QTRY_COMPARE(m_gateway->clientCount(), 1);
+}
+
+void TestGateway::cleanup()
+{
+    delete m_socket;
+    delete m_gateway;
+    delete m_master;
+}
+
+// A request frame with CRC, as a client sends it.
+QByteArray TestGateway::request(quint8 id, int cmd, quint16 addr, quint16 size)
+{
+    MicontBusPacket packet;
+    packet.setId(id);
+    packet.setCmd(cmd);
+    packet.setAddr(addr);
+    packet.setSize(size);
+    if (cmd == MicontBusPacket::CMD_PUTBUF_B)
+        packet.setData(QByteArray(size, 0x5a));
+
+    QByteArray frame = packet.serialize();
+    quint16 crc = MicontBusMaster::crc16(frame);
+    frame.append((char)(crc & 0xff));
+    frame.append((char)(crc >> 8));
+    return frame;
+}
+
+// Reads count response frames, checking their CRC; frames are without it.
+void TestGateway::receive(int count, QList<QByteArray> *frames)
+{
+    QByteArray buffer;
+    frames->clear();
+
+    QElapsedTimer timer;
+    timer.start();
+    while (frames->size() < count && timer.elapsed() < 10000) {
+        if (!m_socket->bytesAvailable())
+            m_socket->waitForReadyRead(100);
+        buffer += m_socket->readAll();
+
+        forever {
+            int size = MicontBusPacket::responseSize(buffer);
+            QVERIFY2(size >= 0, buffer.toHex().constData());
+            if (size == 0 || buffer.size() < size + 2)
+                break;
+
+            QByteArray frame = buffer.left(size);
+            quint16 crc = ((quint16)(quint8)buffer.at(size + 1) << 8) | (quint8)buffer.at(size);
+            QCOMPARE(crc, MicontBusMaster::crc16(frame));
+            frames->append(frame);
+            buffer.remove(0, size + 2);
+        }
+    }
+
+    QCOMPARE(frames->size(), count);
+    QVERIFY(buffer.isEmpty());
+}
+
+void TestGateway::read()
+{
+    m_socket->write(request(1, MicontBusPacket::CMD_PUTBUF_B, 8, 4));
+    m_socket->write(request(1, MicontBusPacket::CMD_GETBUF_B, 8, 4));
+
+    QList<QByteArray> frames;
+    receive(2, &frames);
+    QCOMPARE(frames.at(0), QByteArray::fromHex("011408000400"));
+    QCOMPARE(frames.at(1), QByteArray::fromHex("0112080004005a5a5a5a"));
+    QCOMPARE(m_gateway->busyAnswers(), 0u);
+}
+
+// no slave 9: the master times out, the client is told
+void TestGateway::failedIsBusy()
+{
+    m_socket->write(request(9, MicontBusPacket::CMD_GETBUF_B, 0, 4));
+    m_socket->write(request(9, MicontBusPacket::CMD_GETSIZE, 0, 0));
+
+    QList<QByteArray> frames;
+    receive(2, &frames);
+    QCOMPARE(frames.at(0), QByteArray::fromHex("093200000400"));
+    QCOMPARE(frames.at(1), QByteArray::fromHex("09310000"));
+    QCOMPARE(m_gateway->busyAnswers(), 2u);
+}
+
+// every frame gets an answer, those beyond the queue a BUSY at once
+void TestGateway::queueFullIsBusy()
+{
+    const int count = 80;
+    QByteArray burst;
+    for (int i = 0; i < count; i++)
+        burst += request(1, MicontBusPacket::CMD_GETBUF_B, i % 60, 4);
+    m_socket->write(burst);
+
+    QList<QByteArray> frames;
+    receive(count, &frames);
+
+    int ok = 0, busy = 0;
+    foreach (const QByteArray &frame, frames) {
+        if ((quint8)frame.at(1) == (MicontBusPacket::CMD_GETBUF_B | (int)MicontBusPacket::CMD_RESULT_OK))
+            ok++;
+        else if ((quint8)frame.at(1) == (MicontBusPacket::CMD_GETBUF_B | (int)MicontBusPacket::CMD_RESULT_BUSY))
+            busy++;
+    }
+    QVERIFY(busy > 0);
+    QCOMPARE(ok + busy, count);
+    QCOMPARE((int)m_gateway->busyAnswers(), busy);
+}
+
+// a PUTBUF_B header announcing 65535 bytes is skipped, not waited for
+void TestGateway::oversizeIsGarbage()
+{
+    m_socket->write(QByteArray::fromHex("01040000ffff"));
+    m_socket->write(request(1, MicontBusPacket::CMD_GETBUF_B, 8, 4));
+
+    QList<QByteArray> frames;
+    receive(1, &frames);
+    QCOMPARE((quint8)frames.at(0).at(1), (quint8)(MicontBusPacket::CMD_GETBUF_B | (int)MicontBusPacket::CMD_RESULT_OK));
+    QCOMPARE(m_gateway->busyAnswers(), 0u);
+}
+
+QTEST_GUILESS_MAIN(TestGateway)
+
+#include "tst_gateway.moc"
@@ -0,0 +1,13 @@
+# MicontBusHistorian: the point codec and reopening segments
+
+QT       += testlib
+QT       -= gui
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_historian
+TEMPLATE = app
+
+include(../../micontbus.pri)
+
+SOURCES += tst_historian.cpp
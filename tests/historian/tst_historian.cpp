@@ -0,0 +1,122 @@
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "micontbushistorian.h"
+
+class TestHistorian : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void codec();
+    void tornChunk();
+
+private:
+    static bool samePoints(const QVector<MicontBusHistorian::Point> &points, const QList<qint64> &timestamps,
+                           const QList<quint32> &values);
+};
+
+// the start of an hour, segments hold one each by default
+static const qint64 BASE = Q_INT64_C(1700000000000) / 3600000 * 3600000;
+
+bool TestHistorian::samePoints(const QVector<MicontBusHistorian::Point> &points, const QList<qint64> &timestamps,
+                               const QList<quint32> &values)
+{
+    if (points.size() != timestamps.size())
+        return false;
+    for (int i = 0; i < points.size(); i++) {
+        if (points[i].timestamp != timestamps[i] || points[i].value != values[i])
+            return false;
+    }
+    return true;
+}
+
+// Every timestamp bucket and value case, read back from the open chunk
+// and from the segment file.
+void TestHistorian::codec()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    MicontBusHistorian historian;
+    QVERIFY2(historian.open(dir.path()), qPrintable(historian.errorString()));
+    historian.setChunkSize(1000);
+
+    QList<qint64> timestamps;
+    timestamps << BASE
+               << BASE + 1000           // dod 1000, 12 bits
+               << BASE + 2000           // dod 0
+               << BASE + 2990           // dod -10, 7 bits
+               << BASE + 3980           // dod 0
+               << BASE + 4000           // dod -970, 12 bits
+               << BASE + 4200           // dod 180, 9 bits
+               << BASE + 3004000        // dod 2999600, 64 bits
+               << BASE + 3004001        // dod -2999799, 64 bits
+               << BASE + 3004002;       // dod 0
+    QList<quint32> values;
+    values << 0
+           << 0                 // unchanged
+           << 0x3f800000        // new window, 7 bits
+           << 0x3f000000        // inside it
+           << 0xbf000001        // new window, all 32 bits
+           << 0x3f000001        // the 32 bit window again
+           << 0xc0fffffe        // every bit flipped
+           << 0xc0fffffe
+           << 0x00000001
+           << 0x00000000;
+
+    for (int i = 0; i < timestamps.size(); i++)
+        historian.append(3, 0x40, timestamps[i], values[i]);
+
+    QVector<MicontBusHistorian::Point> points = historian.query(3, 0x40, BASE, BASE + 3600000);
+    QVERIFY(samePoints(points, timestamps, values));
+
+    historian.flush();
+    points = historian.query(3, 0x40, BASE, BASE + 3600000);
+    QVERIFY(samePoints(points, timestamps, values));
+
+    // a range inside the chunk, other series empty
+    points = historian.query(3, 0x40, BASE + 2990, BASE + 4000);
+    QVERIFY(samePoints(points, timestamps.mid(3, 3), values.mid(3, 3)));
+    QVERIFY(historian.query(3, 0x41, BASE, BASE + 3600000).isEmpty());
+}
+
+// A crash in the middle of writing a chunk leaves part of it behind; what
+// is written after reopening must still be found.
+void TestHistorian::tornChunk()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QList<qint64> timestamps;
+    timestamps << BASE + 100 << BASE + 200 << BASE + 300;
+    QList<quint32> values;
+    values << 1 << 2 << 3;
+
+    MicontBusHistorian historian;
+    QVERIFY(historian.open(dir.path()));
+    for (int i = 0; i < timestamps.size(); i++)
+        historian.append(3, 0x40, timestamps[i], values[i]);
+    historian.close();
+
+    QStringList segments = QDir(dir.path()).entryList(QStringList() << "*.mbh", QDir::Files);
+    QCOMPARE(segments.size(), 1);
+    QFile segment(dir.path() + "/" + segments.first());
+    qint64 complete = segment.size();
+    QVERIFY(segment.open(QIODevice::WriteOnly | QIODevice::Append));
+    segment.write(QByteArray(10, '\xff'));
+    segment.close();
+
+    QVERIFY(historian.open(dir.path()));
+    historian.append(3, 0x40, BASE + 400, 4);
+    historian.flush();
+    timestamps << BASE + 400;
+    values << 4;
+
+    QVERIFY(samePoints(historian.query(3, 0x40, BASE, BASE + 3600000), timestamps, values));
+    historian.close();
+    QVERIFY(QFileInfo(segment.fileName()).size() > complete);
+}
+
+QTEST_GUILESS_MAIN(TestHistorian)
+
+#include "tst_historian.moc"
@@ -0,0 +1,13 @@
+# MicontBusMetricsServer scraped over loopback TCP
+
+QT       += testlib
+QT       -= gui
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_metricsserver
+TEMPLATE = app
+
+include(../../micontbus.pri)
+
+SOURCES += tst_metricsserver.cpp
@@ -0,0 +1,114 @@
+#include <QtTest>
+#include <QTcpSocket>
+
+#include "micontbusmaster.h"
+#include "micontbusmetricsserver.h"
+
+class TestMetricsServer : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void labelValue();
+    void scrape();
+    void notFound();
+
+private:
+    void get(MicontBusMetricsServer *server, const QByteArray &path, QByteArray *response);
+};
+
+// The whole response to a GET of path on server's loopback port.
+void TestMetricsServer::get(MicontBusMetricsServer *server, const QByteArray &path, QByteArray *response)
+{
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress(QHostAddress::LocalHost), server->serverPort());
+    socket.write("GET " + path + " HTTP/1.0\r\nHost: localhost\r\n\r\n");
+
+    // the server closes once it has answered, what it sent stays readable
+    QTRY_COMPARE_WITH_TIMEOUT(socket.state(), QAbstractSocket::UnconnectedState, 5000);
+    *response = socket.readAll();
+}
+
+void TestMetricsServer::labelValue()
+{
+    QCOMPARE(MicontBusMetricsServer::labelValue("ttyUSB0"), QString("ttyUSB0"));
+    QCOMPARE(MicontBusMetricsServer::labelValue("a\\b\"c\nd"), QString("a\\\\b\\\"c\\nd"));
+}
+
+void TestMetricsServer::scrape()
+{
+    const QString portName = "tty\"A\\1\n";
+
+    // held down from a snapshot: no transaction yet, but reported
+    MicontBusMaster master;
+    master.restoreDownSlaves(QList<MicontBusHealth::Key>() << MicontBusHealth::Key(portName.toStdString(), 5)
+                             << MicontBusHealth::Key("ttyB", 7));
+
+    MicontBusMetricsServer server;
+    server.addMaster(&master, portName);
+    QVERIFY2(server.listen(QHostAddress(QHostAddress::LocalHost), 0), qPrintable(server.errorString()));
+
+    QByteArray response;
+    get(&server, "/metrics", &response);
+    int end = response.indexOf("\r\n\r\n");
+    QVERIFY(end > 0);
+    QVERIFY(response.startsWith("HTTP/1.0 200 OK\r\n"));
+    QVERIFY(response.left(end).contains("Content-Type: text/plain; version=0.0.4"));
+
+    QByteArray body = response.mid(end + 4);
+    QVERIFY(response.left(end).contains("Content-Length: " + QByteArray::number(body.size())));
+    QVERIFY(body.endsWith('\n'));
+
+    // name{label="value",...} value, values escaped
+    QRegExp sample("([a-zA-Z_:][a-zA-Z0-9_:]*)\\{((?:[a-zA-Z_][a-zA-Z0-9_]*=\"(?:[^\"\\\\\\n]|\\\\.)*\",?)*)\\} (\\S+)");
+    QRegExp comment("# (HELP|TYPE) ([a-zA-Z_:][a-zA-Z0-9_:]*) .+");
+    QSet<QString> typed;
+    QHash<QString, QString> values;
+
+    foreach (const QByteArray &line, body.left(body.size() - 1).split('\n')) {
+        QString s = QString::fromUtf8(line);
+        if (comment.exactMatch(s)) {
+            if (comment.cap(1) == "TYPE")
+                typed.insert(comment.cap(2));
+            continue;
+        }
+        QVERIFY2(sample.exactMatch(s), qPrintable(s));
+
+        QString name = sample.cap(1);
+        QString family = name;
+        family.remove(QRegExp("_(bucket|sum|count)$"));
+        QVERIFY2(typed.contains(name) || typed.contains(family), qPrintable(s));
+
+        bool ok;
+        sample.cap(3).toDouble(&ok);
+        QVERIFY2(ok || sample.cap(3) == "+Inf", qPrintable(s));
+        values.insert(name + "{" + sample.cap(2) + "}", sample.cap(3));
+    }
+
+    const QString port = "port=\"tty\\\"A\\\\1\\n\"";
+    QCOMPARE(values.value("micontbus_slave_up{" + port + ",slave=\"5\"}"), QString("0"));
+    QCOMPARE(values.value("micontbus_transactions_total{" + port + ",slave=\"5\"}"), QString("0"));
+    QVERIFY(!values.contains("micontbus_slave_up{" + port + ",slave=\"6\"}"));
+    // slaves are labelled with their own port, not the master's
+    QCOMPARE(values.value("micontbus_slave_up{port=\"ttyB\",slave=\"7\"}"), QString("0"));
+    QVERIFY(!values.contains("micontbus_slave_up{" + port + ",slave=\"7\"}"));
+    QVERIFY(!values.contains("micontbus_slave_up{port=\"ttyB\",slave=\"5\"}"));
+    QCOMPARE(values.value("micontbus_queue_depth{" + port + ",priority=\"polling\"}"), QString("0"));
+    QCOMPARE(values.value("micontbus_wakeup_latency_seconds_count{" + port + "}"), QString("0"));
+}
+
+void TestMetricsServer::notFound()
+{
+    MicontBusMetricsServer server;
+    QVERIFY(server.listen(QHostAddress(QHostAddress::LocalHost), 0));
+
+    QByteArray response;
+    get(&server, "/", &response);
+    QVERIFY(response.startsWith("HTTP/1.0 404 Not Found\r\n"));
+    get(&server, "/metrics?format=text", &response);
+    QVERIFY(response.startsWith("HTTP/1.0 200 OK\r\n"));
+}
+
+QTEST_GUILESS_MAIN(TestMetricsServer)
+
+#include "tst_metricsserver.moc"
@@ -0,0 +1,16 @@
+# MicontBusPosixPort against a pty, standard library only
+
+CONFIG   -= qt
+CONFIG   += console testcase c++2a
+CONFIG   -= app_bundle
+
+TARGET = tst_posixport
+TEMPLATE = app
+
+INCLUDEPATH += ../../core
+
+SOURCES += tst_posixport.cpp \
+    ../../core/micontbusposixport.cpp
+
+HEADERS += ../check.h
+
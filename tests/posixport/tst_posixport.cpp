@@ -0,0 +1,105 @@
+#include "micontbusposixport.h"
+#include "../check.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The slave end of a new pty, -1 on failure; *master is the other end.
+static int openPty(std::string *slaveName)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+        return -1;
+    *slaveName = ptsname(master);
+    return master;
+}
+
+static void testUnsupported()
+{
+    MicontBusPosixPort port;
+    CHECK(!port.open("/dev/null", 12345, MicontBusSerialOptions()));
+    CHECK(!port.isOpen());
+    CHECK(port.errorString().find("baud") != std::string::npos);
+
+    CHECK(!port.open("/nonexistent/tty", 115200, MicontBusSerialOptions()));
+    CHECK(!port.isOpen());
+    CHECK(!port.errorString().empty());
+}
+
+static void testReadWrite()
+{
+    std::string name;
+    int master = openPty(&name);
+    CHECK(master >= 0);
+    if (master < 0)
+        return;
+
+    MicontBusPosixPort port;
+    MicontBusSerialOptions options;
+    options.parity = MicontBusSerialOptions::ParityEven;
+    options.stopBits = 2;
+    CHECK(port.open(name, 115200, options));
+    CHECK(port.isOpen());
+
+    // nothing there, the wait times out
+    CHECK(!port.waitForReadyRead(20));
+
+    CHECK(port.write("\x01\x01\x00\x00", 4) == 4);
+    CHECK(port.waitForBytesWritten(100));
+    char buf[16];
+    CHECK(::read(master, buf, sizeof(buf)) == 4);
+    CHECK(memcmp(buf, "\x01\x01\x00\x00", 4) == 0);
+
+    CHECK(::write(master, "\x01\x11\x00\x00\x00\x01", 6) == 6);
+    CHECK(port.waitForReadyRead(100));
+    CHECK(port.bytesAvailable() == 6);
+    CHECK(port.read(buf, sizeof(buf)) == 6);
+    CHECK(memcmp(buf, "\x01\x11\x00\x00\x00\x01", 6) == 0);
+    CHECK(port.read(buf, sizeof(buf)) == 0);
+
+    // a late answer is dropped unread
+    CHECK(::write(master, "\x02\x11\x00\x00", 4) == 4);
+    CHECK(port.waitForReadyRead(100));
+    port.discardInput();
+    CHECK(port.bytesAvailable() == 0);
+    CHECK(port.read(buf, sizeof(buf)) == 0);
+
+    // the other end going away closes the port
+    ::close(master);
+    CHECK(!port.waitForReadyRead(100));
+    CHECK(!port.isOpen());
+    CHECK(port.errorString().find("hangup") != std::string::npos);
+    CHECK(port.read(buf, sizeof(buf)) == -1);
+}
+
+// like the simulator, someone else keeps the tty open between our opens;
+// exclusive mode must not stay behind (root isn't held back by it)
+static void testReopen()
+{
+    std::string name;
+    int master = openPty(&name);
+    CHECK(master >= 0);
+    if (master < 0)
+        return;
+    int other = ::open(name.c_str(), O_RDWR | O_NOCTTY);
+    CHECK(other >= 0);
+
+    MicontBusPosixPort port;
+    CHECK(port.open(name, 115200, MicontBusSerialOptions()));
+    port.close();
+    CHECK(port.open(name, 115200, MicontBusSerialOptions()));
+    port.close();
+
+    ::close(other);
+    ::close(master);
+}
+
+int main()
+{
+    testUnsupported();
+    testReadWrite();
+    testReopen();
+    return checkFailures("tst_posixport");
+}
@@ -0,0 +1,13 @@
+# The posix backend of MicontBusTransport and the master on it, on a simulated pty
+
+QT       += testlib
+QT       -= gui
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_posixtransport
+TEMPLATE = app
+
+include(../../micontbus.pri)
+
+SOURCES += tst_posixtransport.cpp
@@ -0,0 +1,139 @@
+#include <QtTest>
+
+#include "micontbusmaster.h"
+#include "micontbuspacket.h"
+#include "micontbustransport.h"
+#include "micontbussimulator.h"
+
+class TestPosixTransport : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void exchange();
+    void options();
+    void master();
+
+private:
+    static QByteArray withCrc(const QByteArray &frame);
+
+    MicontBusSimulator m_simulator;
+};
+
+void TestPosixTransport::initTestCase()
+{
+    m_simulator.setSlaves(QList<quint8>() << 2, 16);
+    QVERIFY2(m_simulator.open(QString("/tmp/tst_posixtransport-%1").arg(QCoreApplication::applicationPid())),
+             qPrintable(m_simulator.errorString()));
+    m_simulator.start();
+}
+
+void TestPosixTransport::cleanupTestCase()
+{
+    m_simulator.stop();
+    m_simulator.close();
+}
+
+QByteArray TestPosixTransport::withCrc(const QByteArray &frame)
+{
+    quint16 crc = MicontBusMaster::crc16(frame);
+    return frame + QByteArray(1, (char)(crc & 0xff)) + QByteArray(1, (char)(crc >> 8));
+}
+
+// a GETSIZE round trip through the transport alone
+void TestPosixTransport::exchange()
+{
+    QVERIFY(MicontBusTransport::isAvailable(MicontBusTransport::BackendPosix));
+
+    QScopedPointer<MicontBusPort> port(MicontBusTransport::create(MicontBusTransport::BackendPosix));
+    MicontBusPort &transport = *port;
+    QVERIFY2(transport.open(m_simulator.portName().toStdString(), 115200, MicontBusSerialOptions()),
+             transport.errorString().c_str());
+    QVERIFY(transport.isOpen());
+
+    QByteArray request = withCrc(QByteArray::fromHex("02010000"));
+    QCOMPARE(transport.write(request.constData(), request.size()), (int64_t)request.size());
+    QVERIFY(transport.waitForBytesWritten(100));
+
+    // 16 variables, 64 bytes
+    QByteArray expected = withCrc(QByteArray::fromHex("0211000040000000"));
+    QByteArray response;
+    QElapsedTimer timer;
+    timer.start();
+    while (response.size() < expected.size() && timer.elapsed() < 2000) {
+        if (!transport.waitForReadyRead(100))
+            continue;
+        char buf[64];
+        qint64 n = transport.read(buf, sizeof(buf));
+        QVERIFY(n >= 0);
+        response.append(buf, n);
+    }
+    QCOMPARE(response, expected);
+
+    // nothing more comes
+    QVERIFY(!transport.waitForReadyRead(50));
+
+    transport.close();
+    QVERIFY(!transport.isOpen());
+}
+
+void TestPosixTransport::options()
+{
+    QScopedPointer<MicontBusPort> port(MicontBusTransport::create(MicontBusTransport::BackendPosix));
+    MicontBusPort &transport = *port;
+
+    QVERIFY(!transport.open(m_simulator.portName().toStdString(), 12345, MicontBusSerialOptions()));
+    QVERIFY(!transport.errorString().empty());
+
+    MicontBusSerialOptions options;
+    options.dataBits = 7;
+    options.parity = MicontBusSerialOptions::ParityOdd;
+    options.stopBits = 2;
+    QVERIFY2(transport.open(m_simulator.portName().toStdString(), 9600, options), transport.errorString().c_str());
+
+    QVERIFY(!transport.open("/nonexistent/tty", 9600, options));
+    QVERIFY(!transport.isOpen());
+}
+
+// the master on the posix backend, write then read back
+void TestPosixTransport::master()
+{
+    MicontBusMaster master;
+    master.setBackend(MicontBusTransport::BackendPosix);
+
+    QSignalSpy done(&master, SIGNAL(transactionDone(quint32,QByteArray)));
+    QSignalSpy failed(&master, SIGNAL(transactionFailed(quint32,QString)));
+
+    MicontBusPacket write;
+    write.setId(2);
+    write.setCmd(MicontBusPacket::CMD_PUTBUF_B);
+    write.setAddr(4);
+    write.setSize(8);
+    write.setData(QByteArray::fromHex("0102030405060708"));
+    quint32 writeTag = master.transaction(m_simulator.portName(), 115200, 200, write.serialize());
+
+    MicontBusPacket read;
+    read.setId(2);
+    read.setCmd(MicontBusPacket::CMD_GETBUF_B);
+    read.setAddr(4);
+    read.setSize(8);
+    quint32 readTag = master.transaction(m_simulator.portName(), 115200, 200, read.serialize(),
+                                         MicontBusMaster::PriorityPolling);
+
+    QTRY_COMPARE_WITH_TIMEOUT(done.count() + failed.count(), 2, 5000);
+    QCOMPARE(failed.count(), 0);
+    QCOMPARE(done.at(0).at(0).value<quint32>(), writeTag);
+    QCOMPARE(done.at(1).at(0).value<quint32>(), readTag);
+
+    MicontBusPacket p;
+    QVERIFY(p.parse(done.at(1).at(1).toByteArray()));
+    QCOMPARE((int)p.cmd(), MicontBusPacket::CMD_GETBUF_B | (int)MicontBusPacket::CMD_RESULT_OK);
+    QCOMPARE(p.data(), QByteArray::fromHex("0102030405060708"));
+    QCOMPARE(master.backend(), MicontBusTransport::BackendPosix);
+}
+
+QTEST_GUILESS_MAIN(TestPosixTransport)
+
+#include "tst_posixtransport.moc"
@@ -0,0 +1,15 @@
+# MicontBusProcessImageReader, standard library only
+
+CONFIG   -= qt
+CONFIG   += console testcase c++2a
+CONFIG   -= app_bundle
+
+TARGET = tst_processimage
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_processimage.cpp
+
+HEADERS += ../check.h \
+    ../../micontbusprocessimage.h
@@ -0,0 +1,41 @@
+#include "micontbusprocessimage.h"
+#include "../check.h"
+
+static void testRead()
+{
+    MicontBusImageBlock block;
+    memset(static_cast<void *>(&block), 0, sizeof(block));
+    block.seq.store(4);
+    block.id = 3;
+    block.addr = 0x40;
+    block.generation = 2;
+    block.count = 2;
+    block.timestamp = 1234;
+    block.vars[0] = 7;
+    block.vars[1] = 8;
+
+    MicontBusImageSnapshot snapshot;
+    CHECK(MicontBusProcessImageReader::read(&block, &snapshot));
+    CHECK(snapshot.id == 3 && snapshot.addr == 0x40 && snapshot.generation == 2);
+    CHECK(snapshot.count == 2 && snapshot.timestamp == 1234);
+    CHECK(snapshot.vars[0] == 7 && snapshot.vars[1] == 8);
+}
+
+// a writer that died inside the block doesn't hang the reader
+static void testDeadWriter()
+{
+    MicontBusImageBlock block;
+    memset(static_cast<void *>(&block), 0, sizeof(block));
+    block.seq.store(5);
+
+    MicontBusImageSnapshot snapshot;
+    CHECK(!MicontBusProcessImageReader::read(&block, &snapshot, 1000));
+    CHECK(!MicontBusProcessImageReader::read(&block, &snapshot));
+}
+
+int main()
+{
+    testRead();
+    testDeadWriter();
+    return checkFailures("tst_processimage");
+}
@@ -0,0 +1,17 @@
+# MicontBusRegisterMap layouts and accessors
+
+QT       += testlib
+QT       -= gui
+CONFIG   += console testcase c++2a
+CONFIG   -= app_bundle
+
+TARGET = tst_registermap
+TEMPLATE = app
+
+INCLUDEPATH += ../.. ../../core
+
+SOURCES += tst_registermap.cpp \
+    ../../micontbuspacket.cpp \
+    ../../core/micontbuscodec.cpp
+
+HEADERS += ../../micontbusregistermap.h
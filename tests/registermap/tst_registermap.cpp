@@ -0,0 +1,112 @@
+#include <QtTest>
+
+#include "micontbusregistermap.h"
+
+MICONTBUS_FIELD(Status, quint32, 0x0010, 1);
+MICONTBUS_FIELD(Setpoint, qint32, 0x0012, 1);
+MICONTBUS_FIELD(Currents, float, 0x0013, 3);
+typedef MicontBusRegisterMap<Currents, Status, Setpoint> DriveMap;
+
+static_assert(DriveMap::addr == 0x0010, "map starts at its lowest field");
+static_assert(DriveMap::count == 6, "map spans its fields, gaps included");
+static_assert(DriveMap::size == 24, "four bytes a variable");
+static_assert(DriveMap::Offset<Currents>::value == 12, "offset from the map start");
+
+class TestRegisterMap : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void readRequest();
+    void parse();
+    void getChecksData();
+    void indexRange();
+    void writeRequest();
+};
+
+// GETBUF_B response frame (without CRC) carrying data at the map's address.
+static QByteArray response(quint16 addr, const QByteArray &data)
+{
+    MicontBusPacket packet;
+    packet.setId(3);
+    packet.setCmd(MicontBusPacket::CMD_GETBUF_B | (int)MicontBusPacket::CMD_RESULT_OK);
+    packet.setAddr(addr);
+    packet.setSize(data.size());
+    packet.setData(data);
+    return packet.serialize();
+}
+
+void TestRegisterMap::readRequest()
+{
+    QCOMPARE(DriveMap::readRequest(3), QByteArray::fromHex("030210001800"));
+}
+
+void TestRegisterMap::parse()
+{
+    DriveMap::Block block;
+    block.set<Status>(0x01020304);
+    block.set<Setpoint>(-2);
+    block.set<Currents>(1.5f, 2);
+
+    DriveMap::Block copy;
+    QVERIFY(copy.parse(response(DriveMap::addr, block.data())));
+    QCOMPARE(copy.get<Status>(), 0x01020304u);
+    QCOMPARE(copy.get<Setpoint>(), -2);
+    QCOMPARE(copy.get<Currents>(0), 0.0f);
+    QCOMPARE(copy.get<Currents>(2), 1.5f);
+
+    // another address, too little data
+    QVERIFY(!copy.parse(response(DriveMap::addr + 1, block.data())));
+    QVERIFY(!copy.parse(response(DriveMap::addr, block.data().left(DriveMap::size - 4))));
+}
+
+void TestRegisterMap::getChecksData()
+{
+    DriveMap::Block block;
+    block.set<Currents>(4.0f, 2);
+    QByteArray data = block.data();
+
+    bool ok;
+    QCOMPARE(DriveMap::get<Currents>(data, 2, &ok), 4.0f);
+    QVERIFY(ok);
+
+    // a short response doesn't reach the last current
+    QCOMPARE(DriveMap::get<Currents>(data.left(DriveMap::size - 1), 2, &ok), 0.0f);
+    QVERIFY(!ok);
+    DriveMap::get<Status>(QByteArray(), 0, &ok);
+    QVERIFY(!ok);
+}
+
+void TestRegisterMap::indexRange()
+{
+    DriveMap::Block block;
+    QVERIFY(block.set<Currents>(1.0f, 2));
+    QVERIFY(!block.set<Currents>(1.0f, 3));
+    QVERIFY(!block.set<Status>(1, -1));
+    QVERIFY(!block.set<Status>(1, 1));
+
+    // the setpoint after Status is untouched by a write past it
+    QCOMPARE(block.get<Setpoint>(), 0);
+    QCOMPARE(block.get<Status>(1), 0u);
+
+    bool ok;
+    DriveMap::get<Status>(block.data(), 1, &ok);
+    QVERIFY(!ok);
+}
+
+void TestRegisterMap::writeRequest()
+{
+    QCOMPARE(DriveMap::writeRequest<Setpoint>(3, -1), QByteArray::fromHex("030412000400" "ffffffff"));
+    QCOMPARE(DriveMap::writeRequest<Currents>(3, 0.0f, 1), QByteArray::fromHex("030414000400" "00000000"));
+    QVERIFY(DriveMap::writeRequest<Currents>(3, 0.0f, 3).isEmpty());
+
+    DriveMap::Block block;
+    block.set<Status>(7);
+    QByteArray request = block.writeRequest(3);
+    QCOMPARE(request.left(6), QByteArray::fromHex("030410001800"));
+    QCOMPARE(request.mid(6), block.data());
+}
+
+QTEST_GUILESS_MAIN(TestRegisterMap)
+
+#include "tst_registermap.moc"
@@ -0,0 +1,24 @@
+# MicontBusScheduler over a fake port, standard library only
+
+CONFIG   -= qt
+CONFIG   += console testcase c++2a thread
+CONFIG   -= app_bundle
+
+TARGET = tst_scheduler
+TEMPLATE = app
+
+INCLUDEPATH += ../../core
+
+SOURCES += tst_scheduler.cpp \
+    ../../core/micontbuscodec.cpp \
+    ../../core/micontbusframepool.cpp \
+    ../../core/micontbushealth.cpp \
+    ../../core/micontbuslatencyhistogram.cpp \
+    ../../core/micontbuslinestats.cpp \
+    ../../core/micontbusretrypolicy.cpp \
+    ../../core/micontbusrttestimator.cpp \
+    ../../core/micontbusscheduler.cpp
+
+unix: SOURCES += ../../core/micontbusposixport.cpp
+
+HEADERS += ../check.h
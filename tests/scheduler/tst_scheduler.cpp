@@ -0,0 +1,332 @@
+#include "micontbusscheduler.h"
+#include "micontbuscodec.h"
+#include "../check.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+
+static const char *PORT = "fake0";
+
+// The bus as seen by the slaves: requests in the order they were sent
+// and the ids that don't answer.
+struct FakeBus
+{
+    std::mutex mutex;
+    std::vector<MicontBusMessage> requests;
+    std::set<uint8_t> silent;
+};
+
+/* A port whose slaves answer every request at once, all variables zero,
+ * unless they are silent. */
+class FakePort : public MicontBusPort
+{
+public:
+    explicit FakePort(FakeBus *bus) : m_bus(bus), m_open(false) {}
+
+    bool open(const std::string &portName, int32_t, const MicontBusSerialOptions &)
+    {
+        m_open = portName == PORT;
+        return m_open;
+    }
+    void close() { m_open = false; }
+    bool isOpen() const { return m_open; }
+    std::string errorString() const { return "no such port"; }
+
+    int64_t write(const char *data, int64_t size)
+    {
+        MicontBusMessage request;
+        if (size < 2 || !MicontBusCodec::checkCrc(data, size) || !MicontBusCodec::decode(data, size - 2, &request))
+            return size;
+
+        std::lock_guard<std::mutex> locker(m_bus->mutex);
+        m_bus->requests.push_back(request);
+        if (m_bus->silent.count(request.id))
+            return size;
+
+        MicontBusMessage response = request;
+        response.cmd |= MicontBusCodec::CMD_RESULT_OK;
+        if ((request.cmd & 0x0f) == MicontBusCodec::CMD_GETBUF_B)
+            response.data.assign(request.size, 0);
+        else if (request.cmd == MicontBusCodec::CMD_GETSIZE)
+            response.data.assign(4, 0);
+        m_rx = MicontBusCodec::encode(response);
+        MicontBusCodec::appendCrc(m_rx);
+        return size;
+    }
+    bool waitForBytesWritten(int) { return true; }
+    bool waitForReadyRead(int) { return !m_rx.empty(); }
+    int64_t bytesAvailable() const { return m_rx.size(); }
+    int64_t read(char *data, int64_t maxSize)
+    {
+        int64_t n = std::min<int64_t>(maxSize, m_rx.size());
+        std::copy(m_rx.begin(), m_rx.begin() + n, data);
+        m_rx.erase(m_rx.begin(), m_rx.begin() + n);
+        return n;
+    }
+    void discardInput() { m_rx.clear(); }
+
+private:
+    FakeBus *m_bus;
+    bool m_open;
+    std::vector<uint8_t> m_rx;
+};
+
+// Collects the outcome of every transaction.
+class Outcomes : public MicontBusScheduler::Listener
+{
+public:
+    struct Failed {
+        uint32_t tag;
+        std::string s;
+        MicontBusScheduler::Failure failure;
+    };
+
+    void response(uint32_t tag, const MicontBusFrame &frame)
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        responses.push_back(std::make_pair(tag, frame.size()));
+        m_cond.notify_all();
+    }
+    void failure(uint8_t, uint32_t tag, const std::string &s, MicontBusScheduler::Failure failure)
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        Failed f = { tag, s, failure };
+        failures.push_back(f);
+        m_cond.notify_all();
+    }
+    void portError(const std::string &) {}
+    void slaveStateChanged(const std::string &, uint8_t id, bool up)
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        stateChanges.push_back(std::make_pair(id, up));
+    }
+
+    // false if fewer than count arrived within two seconds
+    bool wait(size_t count)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_cond.wait_for(lock, std::chrono::seconds(2),
+                               [this, count]() { return responses.size() + failures.size() >= count; });
+    }
+
+    std::vector<std::pair<uint32_t, int> > responses;
+    std::vector<Failed> failures;
+    std::vector<std::pair<uint8_t, bool> > stateChanges;
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+static std::string getbuf(uint8_t id, uint16_t addr, uint16_t size)
+{
+    MicontBusMessage message;
+    message.id = id;
+    message.cmd = MicontBusCodec::CMD_GETBUF_B;
+    message.addr = addr;
+    message.size = size;
+    std::vector<uint8_t> frame = MicontBusCodec::encode(message);
+    return std::string(frame.begin(), frame.end());
+}
+
+static uint32_t post(MicontBusScheduler &scheduler, const std::string &packet,
+                     MicontBusScheduler::Priority priority = MicontBusScheduler::PriorityInteractive,
+                     int32_t deadline = 0, const MicontBusCancelToken &token = MicontBusCancelToken())
+{
+    return scheduler.transaction(PORT, 115200, 50, packet.data(), packet.size(), priority, deadline, token);
+}
+
+static void setUp(MicontBusScheduler &scheduler, FakeBus *bus)
+{
+    scheduler.setPortFactory([bus]() { return new FakePort(bus); });
+    MicontBusRetryPolicy policy;
+    policy.setBackoff(1, 2);
+    scheduler.setRetryPolicy(policy);
+}
+
+static void testResponse()
+{
+    FakeBus bus;
+    MicontBusScheduler scheduler;
+    setUp(scheduler, &bus);
+    Outcomes outcomes;
+
+    uint32_t tag = post(scheduler, getbuf(2, 0x10, 8));
+    std::thread thread([&]() { scheduler.run(&outcomes); });
+    CHECK(outcomes.wait(1));
+    scheduler.stop();
+    thread.join();
+
+    CHECK(outcomes.failures.empty());
+    CHECK(outcomes.responses.size() == 1);
+    if (outcomes.responses.size() == 1) {
+        CHECK(outcomes.responses[0].first == tag);
+        // header, size and data, without CRC
+        CHECK(outcomes.responses[0].second == 6 + 8);
+    }
+    CHECK(scheduler.slaveCounters(PORT, 2).transactions.load() == 1);
+    CHECK(scheduler.slaveCounters(PORT, 2).responses.load() == 1);
+    CHECK(scheduler.slaveCounters("fake1", 2).transactions.load() == 0);
+    CHECK(scheduler.counterPorts() == std::vector<std::string>(1, PORT));
+    CHECK(scheduler.statRetries() == 0);
+    CHECK(scheduler.rttEstimates().size() == 1);
+    CHECK(scheduler.clear().empty());
+}
+
+// a silent slave is retried up to the policy's limit, then held down
+static void testTimeout()
+{
+    FakeBus bus;
+    bus.silent.insert(9);
+    MicontBusScheduler scheduler;
+    setUp(scheduler, &bus);
+    MicontBusRetryPolicy policy = scheduler.retryPolicy();
+    policy.setLimit(MicontBusRetryPolicy::RetryTimeout, 2);
+    scheduler.setRetryPolicy(policy);
+    scheduler.setHealthThresholds(3, 0.5);
+    Outcomes outcomes;
+
+    uint32_t tag = post(scheduler, getbuf(9, 0, 4));
+    std::thread thread([&]() { scheduler.run(&outcomes); });
+    CHECK(outcomes.wait(1));
+    scheduler.stop();
+    thread.join();
+
+    CHECK(outcomes.responses.empty());
+    CHECK(outcomes.failures.size() == 1);
+    if (outcomes.failures.size() == 1) {
+        CHECK(outcomes.failures[0].tag == tag);
+        CHECK(outcomes.failures[0].s == "read timeout");
+        CHECK(outcomes.failures[0].failure == MicontBusScheduler::FailureTimeout);
+    }
+    CHECK(scheduler.slaveCounters(PORT, 9).timeouts.load() == 3);
+    CHECK(scheduler.statRetries() == 2);
+    CHECK(scheduler.isSlaveDown(PORT, 9));
+    CHECK(scheduler.slaveCounters(PORT, 9).down.load());
+    CHECK(outcomes.stateChanges.size() == 1);
+}
+
+// queued before the bus loop runs: control first, bulk last
+static void testPriorities()
+{
+    FakeBus bus;
+    MicontBusScheduler scheduler;
+    setUp(scheduler, &bus);
+    Outcomes outcomes;
+
+    post(scheduler, getbuf(1, 0, 1), MicontBusScheduler::PriorityBulk);
+    post(scheduler, getbuf(2, 0, 1), MicontBusScheduler::PriorityPolling);
+    post(scheduler, getbuf(3, 0, 1), MicontBusScheduler::PriorityControl);
+    post(scheduler, getbuf(4, 0, 1), MicontBusScheduler::PriorityInteractive);
+    CHECK(scheduler.queueSize() == 4);
+    CHECK(scheduler.queueSize(MicontBusScheduler::PriorityBulk) == 1);
+
+    std::thread thread([&]() { scheduler.run(&outcomes); });
+    CHECK(outcomes.wait(4));
+    scheduler.stop();
+    thread.join();
+
+    CHECK(bus.requests.size() == 4);
+    if (bus.requests.size() == 4) {
+        CHECK(bus.requests[0].id == 3);
+        CHECK(bus.requests[1].id == 4);
+        CHECK(bus.requests[2].id == 2);
+        CHECK(bus.requests[3].id == 1);
+    }
+    CHECK(scheduler.queueSize() == 0);
+}
+
+// dropped before they reach the wire
+static void testCancelAndDeadline()
+{
+    FakeBus bus;
+    MicontBusScheduler scheduler;
+    setUp(scheduler, &bus);
+    Outcomes outcomes;
+
+    uint32_t removed = post(scheduler, getbuf(2, 0, 1));
+    MicontBusCancelToken token = MicontBusCancelToken::create();
+    uint32_t cancelled = post(scheduler, getbuf(2, 0, 2), MicontBusScheduler::PriorityInteractive, 0, token);
+    uint32_t expired = post(scheduler, getbuf(2, 0, 3), MicontBusScheduler::PriorityInteractive, 1);
+    CHECK(scheduler.cancel(removed));
+    CHECK(!scheduler.cancel(removed));
+    token.cancel();
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    std::thread thread([&]() { scheduler.run(&outcomes); });
+    CHECK(outcomes.wait(2));
+    scheduler.stop();
+    thread.join();
+
+    CHECK(bus.requests.empty());
+    CHECK(outcomes.responses.empty());
+    CHECK(outcomes.failures.size() == 2);
+    for (size_t i = 0; i < outcomes.failures.size(); i++) {
+        const Outcomes::Failed &f = outcomes.failures[i];
+        CHECK(f.failure == MicontBusScheduler::FailureSilent);
+        CHECK((f.tag == cancelled && f.s == "cancelled") || (f.tag == expired && f.s == "deadline expired"));
+    }
+    CHECK(scheduler.droppedCancelled() == 2);
+    CHECK(scheduler.droppedExpired() == 1);
+}
+
+// what is still queued after stop() is handed back by clear()
+static void testStopAndClear()
+{
+    FakeBus bus;
+    MicontBusScheduler scheduler;
+    setUp(scheduler, &bus);
+    Outcomes outcomes;
+
+    scheduler.stop();
+    uint32_t tag = post(scheduler, getbuf(2, 0, 1));
+    scheduler.run(&outcomes);
+
+    CHECK(bus.requests.empty());
+    std::vector<uint32_t> tags = scheduler.clear();
+    CHECK(tags.size() == 1 && tags[0] == tag);
+    CHECK(scheduler.queueSize() == 0);
+
+    // and the scheduler runs again
+    post(scheduler, getbuf(2, 0, 1));
+    std::thread thread([&]() { scheduler.run(&outcomes); });
+    CHECK(outcomes.wait(1));
+    scheduler.stop();
+    thread.join();
+    CHECK(outcomes.responses.size() == 1);
+}
+
+// a port the factory can't open fails its whole queue
+static void testOpenFailure()
+{
+    FakeBus bus;
+    MicontBusScheduler scheduler;
+    setUp(scheduler, &bus);
+    Outcomes outcomes;
+
+    std::string packet = getbuf(2, 0, 1);
+    scheduler.transaction("fake1", 115200, 50, packet.data(), packet.size());
+    scheduler.transaction("fake1", 115200, 50, packet.data(), packet.size());
+
+    std::thread thread([&]() { scheduler.run(&outcomes); });
+    CHECK(outcomes.wait(2));
+    scheduler.stop();
+    thread.join();
+
+    CHECK(outcomes.failures.size() == 2);
+    for (size_t i = 0; i < outcomes.failures.size(); i++)
+        CHECK(outcomes.failures[i].s == "can't open fake1, no such port");
+}
+
+int main()
+{
+    testResponse();
+    testTimeout();
+    testPriorities();
+    testCancelAndDeadline();
+    testStopAndClear();
+    testOpenFailure();
+    return checkFailures("tst_scheduler");
+}
@@ -0,0 +1,13 @@
+# A short fixed-seed load run against simulated slaves with faults
+
+QT       += testlib
+QT       -= gui
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_stress
+TEMPLATE = app
+
+include(../../micontbus.pri)
+
+SOURCES += tst_stress.cpp
@@ -0,0 +1,11 @@
+#-------------------------------------------------
+#
+# Tests, run with make check
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS = codec historian metricsserver registermap scheduler
+
+unix: SUBDIRS += async posixport posixtransport processimage gateway stress
@@ -1,5 +1,7 @@
 #include "window.h"
 #include "micontbuspacket.h"
+#include "scandialog.h"
+#include "capturedialog.h"
 
 #include <QLabel>
 #include <QLineEdit>
@@ -16,6 +18,7 @@
 #include <QVector>
 #include <QItemDelegate>
 #include <QMessageBox>
+#include <QFileDialog>
 
 #include <QtSerialPort/QSerialPortInfo>
 
@@ -44,6 +47,10 @@ public:
 Window::Window(QWidget *parent) : QMainWindow(parent)
   , comboPort(new QComboBox())
   , comboSpeed(new QComboBox())
+  , comboDataBits(new QComboBox())
+  , comboParity(new QComboBox())
+  , comboStopBits(new QComboBox())
+  , comboBackend(new QComboBox())
   , spinTimeout(new QSpinBox())
   , spinId(new QSpinBox())
   , comboCmd(new QComboBox())
@@ -52,11 +59,14 @@ Window::Window(QWidget *parent) : QMainWindow(parent)
   , spinSize(new QSpinBox())
   , comboType(new QComboBox)
   , pushQuery(new QPushButton(QIcon("icons/transaction.svg"), tr("Query")))
+  , pushScan(new QPushButton(QIcon("icons/network.svg"), tr("Scan...")))
+  , pushFrameSize(new QPushButton(tr("Frame Size")))
   , tableVariables(new QTableWidget())
   , tableTags(new QTableWidget())
   , textRaw(new QTextEdit())
   , treeMonitor(new QTreeWidget())
   , labelStatus(new QLabel(tr("Ready")))
+  , frameSizeBus(0)
 {
     // fill port combo with available serial ports
     foreach (const QSerialPortInfo &info, QSerialPortInfo::availablePorts())
@@ -71,9 +81,33 @@ Window::Window(QWidget *parent) : QMainWindow(parent)
     }
     comboSpeed->setCurrentIndex(comboSpeed->findText("115200"));
 
+    // character format, 8N1 by default
+    for (int bits = 8; bits >= 5; bits--)
+        comboDataBits->addItem(QString::number(bits), bits);
+    comboParity->addItem(tr("None"), MicontBusSerialOptions::ParityNone);
+    comboParity->addItem(tr("Even"), MicontBusSerialOptions::ParityEven);
+    comboParity->addItem(tr("Odd"), MicontBusSerialOptions::ParityOdd);
+    comboStopBits->addItem("1", 1);
+    comboStopBits->addItem("2", 2);
+    connect(comboDataBits, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(serialOptionsChanged()));
+    connect(comboParity, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(serialOptionsChanged()));
+    connect(comboStopBits, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(serialOptionsChanged()));
+
+    // serial backends this platform has
+    comboBackend->addItem(tr("Qt"), MicontBusTransport::BackendQt);
+    if (MicontBusTransport::isAvailable(MicontBusTransport::BackendPosix))
+        comboBackend->addItem(tr("POSIX"), MicontBusTransport::BackendPosix);
+    comboBackend->setToolTip(tr("POSIX: raw termios port of the core library, Unix only"));
+    connect(comboBackend, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(backendChanged()));
+
     // timeout range & default value
     spinTimeout->setRange(0, 10000);
     spinTimeout->setValue(1000);
+    spinTimeout->setToolTip(tr("Upper bound for the adaptive response timeout"));
 
     // id range & default value
     spinId->setRange(0, 255);
@@ -129,10 +163,9 @@ Window::Window(QWidget *parent) : QMainWindow(parent)
     tableTags->verticalHeader()->setVisible(false);
     tableTags->setColumnCount(4);
     tableTags->setHorizontalHeaderLabels(QStringList() << tr("Tag") << tr("Channel") << tr("Value1") << tr("Value2"));
-//    tableTags->setItemDelegateForColumn(1, new Delegate);
-//    tableTags->setContextMenuPolicy(Qt::CustomContextMenu);
-//    connect(tableTags, SIGNAL(customContextMenuRequested(QPoint)),
-//            this, SLOT(editorContextMenu(QPoint)));
+    tableTags->setContextMenuPolicy(Qt::CustomContextMenu);
+    connect(tableTags, SIGNAL(customContextMenuRequested(QPoint)),
+            this, SLOT(tagsContextMenu(QPoint)));
 
     // raw bytes editor
     textRaw->hide();
@@ -154,6 +187,12 @@ Window::Window(QWidget *parent) : QMainWindow(parent)
     grid_settings->addWidget(comboSpeed, 1, 1);
     grid_settings->addWidget(new QLabel(tr("Timeout, ms:")), 1, 2);
     grid_settings->addWidget(spinTimeout, 1, 3);
+    grid_settings->addWidget(new QLabel(tr("Data/Parity/Stop:")), 2, 0);
+    grid_settings->addWidget(comboDataBits, 2, 1);
+    grid_settings->addWidget(comboParity, 2, 2);
+    grid_settings->addWidget(comboStopBits, 2, 3);
+    grid_settings->addWidget(new QLabel(tr("Backend:")), 3, 0);
+    grid_settings->addWidget(comboBackend, 3, 1);
     group_settings->setLayout(grid_settings);
 
     // query group
@@ -184,7 +223,9 @@ Window::Window(QWidget *parent) : QMainWindow(parent)
     QGroupBox *group_transaction = new QGroupBox(tr("Transaction:"));
     QGridLayout *grid_transaction = new QGridLayout;
     grid_transaction->addWidget(pushQuery, 0, 0);
-    grid_transaction->setColumnStretch(1, 1);
+    grid_transaction->addWidget(pushScan, 0, 1);
+    grid_transaction->addWidget(pushFrameSize, 0, 2);
+    grid_transaction->setColumnStretch(3, 1);
     group_transaction->setLayout(grid_transaction);
 
     // data editor group
@@ -201,6 +242,8 @@ Window::Window(QWidget *parent) : QMainWindow(parent)
     labelStatRxPackets = new QLabel;
     labelStatCrcErrors = new QLabel;
     labelStatTimeouts = new QLabel;
+    labelStatRetries = new QLabel;
+    labelStatLine = new QLabel;
 
     // monitor group
     QGroupBox *group_monitor = new QGroupBox(tr("Monitor:"));
@@ -228,6 +271,12 @@ Window::Window(QWidget *parent) : QMainWindow(parent)
     grid_monitor->addWidget(new QLabel(tr("Timeouts:")), 2, 4);
     grid_monitor->addWidget(labelStatTimeouts, 2, 5);
 
+    grid_monitor->addWidget(new QLabel(tr("Line (10 s):")), 3, 0);
+    grid_monitor->addWidget(labelStatLine, 3, 1, 1, 3);
+
+    grid_monitor->addWidget(new QLabel(tr("Retries:")), 3, 4);
+    grid_monitor->addWidget(labelStatRetries, 3, 5);
+
     group_monitor->setLayout(grid_monitor);
 
     // main layout
@@ -248,12 +297,33 @@ Window::Window(QWidget *parent) : QMainWindow(parent)
 
     connect(pushQuery, SIGNAL(clicked()),
             this, SLOT(doTransaction()));
-    connect(&master, SIGNAL(response(QByteArray)),
-            this, SLOT(processResponse(QByteArray)));
+    connect(pushScan, SIGNAL(clicked()),
+            this, SLOT(doScan()));
+    connect(pushFrameSize, SIGNAL(clicked()),
+            this, SLOT(doFrameSize()));
+    connect(&master, SIGNAL(decoded(MicontBusResponse)),
+            this, SLOT(processResponse(MicontBusResponse)));
     connect(&master, SIGNAL(error(QString)),
             this, SLOT(processError(QString)));
     connect(&master, SIGNAL(timeout(QString)),
             this, SLOT(processTimeout(QString)));
+    connect(&master, SIGNAL(slaveStateChanged(QString,int,bool)),
+            this, SLOT(processSlaveState(QString,int,bool)));
+    connect(&master, SIGNAL(decoded(MicontBusResponse)),
+            this, SLOT(processTagResponse(MicontBusResponse)));
+    connect(&master, SIGNAL(transactionFailed(quint32,QString)),
+            this, SLOT(processTagFailure(quint32,QString)));
+
+    frameSizes.load();
+    tags.setFrameSizes(&frameSizes);
+    connect(&frameSizes, SIGNAL(discovered(QString,quint8,int,int)),
+            this, SLOT(processFrameSize(QString,quint8,int,int)));
+    connect(&frameSizes, SIGNAL(discoveryFailed(QString,quint8,QString)),
+            this, SLOT(processFrameSizeFailure(QString,quint8,QString)));
+    connect(comboPort, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(updateSizeLimit()));
+    connect(spinId, SIGNAL(valueChanged(int)),
+            this, SLOT(updateSizeLimit()));
 
     cmdChanged();
 
@@ -261,8 +331,21 @@ Window::Window(QWidget *parent) : QMainWindow(parent)
     updateStatistics();
 }
 
+// A discovery still running ends with "bus closed" while the frame sizes
+// are still there to take it.
+Window::~Window()
+{
+    frameSizes.disconnect(this);
+    delete frameSizeBus;
+}
+
 void Window::doTransaction()
 {
+    if (comboType->currentData().toInt() == DataTags) {
+        doTagsTransaction();
+        return;
+    }
+
     setControlsEnabled(false);
     labelStatus->setText(tr("Opening port %1...").arg(comboPort->currentData().toString()));
 
@@ -304,20 +387,125 @@ void Window::doTransaction()
 
     master.transaction(comboPort->currentData().toString(),
                        comboSpeed->currentData().toInt(),
-                       spinTimeout->value(), packet.serialize());
+                       spinTimeout->value(), packet.serialize(),
+                       (packet.cmd() == MicontBusPacket::CMD_PUTBUF_B) ? MicontBusMaster::PriorityControl
+                                                                       : MicontBusMaster::PriorityInteractive);
 
     logPacket(packet);
 }
 
-void Window::processResponse(const QByteArray &rawPacket)
+void Window::doScan()
+{
+    QStringList ports;
+    for (int i = 0; i < comboPort->count(); i++)
+        ports << comboPort->itemData(i).toString();
+
+    // release the port, the scanner opens its own; the dialog is modal so
+    // that nothing takes the port back while it scans
+    master.stop();
+
+    ScanDialog *dialog = new ScanDialog(ports, comboSpeed->currentData().toInt(), master.serialOptions(),
+                                        master.backend(), this);
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+    connect(dialog, SIGNAL(slaveSelected(QString,int)),
+            this, SLOT(scanSlaveSelected(QString,int)));
+    dialog->open();
+}
+
+// Finds the largest read the selected slave takes, with the block at the
+// query address. Runs through the master like any other request.
+void Window::doFrameSize()
 {
-    setControlsEnabled(true);
+    QString portName = comboPort->currentData().toString();
+
+    frameSizeBus = new MicontBusAsync(&master, portName, comboSpeed->currentData().toInt(), spinTimeout->value());
+    frameSizeBus->setPriority(MicontBusMaster::PriorityBulk);
+
+    pushFrameSize->setEnabled(false);
+    setControlsEnabled(false);
+    labelStatus->setText(tr("Looking for the frame size of slave %1...").arg(spinId->value()));
+
+    frameSizes.discover(frameSizeBus, spinId->value(), spinAddr->value());
+}
+
+void Window::processFrameSize(const QString &portName, quint8 id, int read, int write)
+{
+    frameSizeBus->deleteLater();
+    frameSizeBus = 0;
+    pushFrameSize->setEnabled(true);
+    setControlsEnabled(tagRequests.isEmpty());
+
+    labelStatus->setText(tr("Slave %1 on %2 takes %3 bytes per read, %4 per write")
+                         .arg((int)id).arg(portName).arg(read).arg(write));
+    updateSizeLimit();
+}
+
+void Window::processFrameSizeFailure(const QString &portName, quint8 id, const QString &s)
+{
+    frameSizeBus->deleteLater();
+    frameSizeBus = 0;
+    pushFrameSize->setEnabled(true);
+    setControlsEnabled(tagRequests.isEmpty());
+
+    labelStatus->setText(tr("Frame size of slave %1 on %2: %3").arg((int)id).arg(portName).arg(s));
+}
 
-    MicontBusPacket p;
-    if (!p.parse(rawPacket)) {
+// Keeps the count within the selected slave's known frame size.
+void Window::updateSizeLimit()
+{
+    QString portName = comboPort->currentData().toString();
+    quint8 id = spinId->value();
+    int limit = (comboCmd->currentData().toInt() == MicontBusPacket::CMD_PUTBUF_B)
+            ? frameSizes.maxWrite(portName, id, 0) : frameSizes.maxRead(portName, id, 0);
+
+    if (limit == 0)
+        spinSize->setMaximum(0xffff);
+    else if (comboType->currentData().toInt() == DataRawBytes)
+        spinSize->setMaximum(limit);
+    else
+        spinSize->setMaximum(limit / sizeof(quint32));
+}
+
+// The port is reopened with the new format by the next transaction.
+void Window::serialOptionsChanged()
+{
+    MicontBusSerialOptions options = master.serialOptions();
+    options.dataBits = comboDataBits->currentData().toInt();
+    options.parity = (MicontBusSerialOptions::Parity)comboParity->currentData().toInt();
+    options.stopBits = comboStopBits->currentData().toInt();
+    master.setSerialOptions(options);
+}
+
+// Like the format, used from the next transaction on.
+void Window::backendChanged()
+{
+    master.setBackend((MicontBusTransport::Backend)comboBackend->currentData().toInt());
+}
+
+void Window::scanSlaveSelected(const QString &portName, int id)
+{
+    comboPort->setCurrentIndex(comboPort->findData(portName));
+    spinId->setValue(id);
+}
+
+// Parsed by the master's decode workers.
+void Window::processResponse(const MicontBusResponse &response)
+{
+    // frame size probes are only logged; this connection is older than the
+    // bus's, so a probe is still pending here
+    if (frameSizeBus && frameSizeBus->isPending(response.tag)) {
+        if (response.valid)
+            logPacket(response.packet);
+        return;
+    }
+
+    setControlsEnabled(tagRequests.isEmpty());
+
+    if (!response.valid) {
         processError(tr("packet parse error"));
         return;
     }
+    const MicontBusPacket &p = response.packet;
 
     logPacket(p);
 
@@ -333,7 +521,7 @@ void Window::processResponse(const QByteArray &rawPacket)
             tableVariables->setItem(0, 0, new QTableWidgetItem(QString("0x%1").arg(p.addr(), 4, 16, QLatin1Char('0'))));
             tableVariables->setItem(0, 1, new QTableWidgetItem(bufferToString(p.data())));
         } else if (comboType->currentData().toInt() == DataVariables) {
-            QVector<tMicontVar> vars = p.variables();
+            const QVector<tMicontVar> &vars = response.variables;
             tableVariables->setRowCount(vars.count());
             for (int i = 0; i < vars.count(); i++) {
                 QTableWidgetItem *item = new QTableWidgetItem;
@@ -350,18 +538,50 @@ void Window::processResponse(const QByteArray &rawPacket)
 
 void Window::processError(const QString &s)
 {
-    setControlsEnabled(true);
+    setControlsEnabled(tagRequests.isEmpty());
     labelStatus->setText(tr("Error (%1)").arg(s));
     updateStatistics();
 }
 
 void Window::processTimeout(const QString &s)
 {
-    setControlsEnabled(true);
+    setControlsEnabled(tagRequests.isEmpty());
     labelStatus->setText(tr("Error (%1)").arg(s));
     updateStatistics();
 }
 
+void Window::processTagResponse(const MicontBusResponse &response)
+{
+    QHash<quint32, int>::iterator it = tagRequests.find(response.tag);
+    if (it == tagRequests.end())
+        return;
+
+    int plan = it.value();
+    tagRequests.erase(it);
+
+    const MicontBusPacket &p = response.packet;
+    if (response.valid && p.cmd() == (MicontBusPacket::CMD_GETBUF_B | (int)MicontBusPacket::CMD_RESULT_OK)
+            && tags.decode(plan, p.data()))
+        updateTagRows(plan);
+
+    if (tagRequests.isEmpty())
+        setControlsEnabled(true);
+}
+
+void Window::processTagFailure(quint32 tag, const QString &s)
+{
+    Q_UNUSED(s)
+
+    if (tagRequests.remove(tag) && tagRequests.isEmpty())
+        setControlsEnabled(true);
+}
+
+void Window::processSlaveState(const QString &portName, int id, bool up)
+{
+    labelStatus->setText(up ? tr("Slave %1 on %2 is back").arg(id).arg(portName)
+                            : tr("Slave %1 on %2 is down, probing").arg(id).arg(portName));
+}
+
 void Window::addrChanged(int newAddr)
 {
     lineAddr->setText(QString("0x%1").arg(newAddr, 4, 16, QLatin1Char('0')));
@@ -398,12 +618,14 @@ void Window::cmdChanged()
         case MicontBusPacket::CMD_PUTBUF_B:
             spinSize->setValue(1);
             toggleWidgets(dataWidgets, true);
-            if (comboCmd->currentData().toInt() == MicontBusPacket::CMD_PUTBUF_B) {
+            if (comboCmd->currentData().toInt() == MicontBusPacket::CMD_PUTBUF_B)
                 fillDataEditor();
-                comboType->insertItem(1, "Tags", DataTags);
-            }
+            else
+                comboType->insertItem(1, tr("Tags"), DataTags);
             break;
     }
+
+    updateSizeLimit();
 }
 
 void Window::typeChanged()
@@ -425,6 +647,8 @@ void Window::typeChanged()
         tableTags->show();
         break;
     }
+
+    updateSizeLimit();
 }
 
 void Window::fillDataEditor()
@@ -461,6 +685,7 @@ void Window::monitorContextMenu(const QPoint &)
 {
     QMenu *menu = new QMenu;
     menu->addAction(QIcon("icons/trash.svg"), tr("Clear"), this, SLOT(monitorClear()));
+    menu->addAction(tr("Open Capture..."), this, SLOT(openCapture()));
     menu->exec(QCursor::pos());
 }
 
@@ -482,6 +707,51 @@ void Window::editorContextMenu(const QPoint &p)
     menu->exec(QCursor::pos());
 }
 
+void Window::tagsContextMenu(const QPoint &)
+{
+    QMenu *menu = new QMenu;
+    menu->addAction(tr("Load tags..."), this, SLOT(loadTags()));
+    menu->exec(QCursor::pos());
+}
+
+void Window::loadTags()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Load tags"), QString(),
+                                                    tr("Tag files (*.csv *.txt);;All files (*)"));
+    if (fileName.isEmpty())
+        return;
+
+    // plan indices of reads still on their way belong to the old tags;
+    // their responses are ignored from now on
+    foreach (quint32 tag, tagRequests.keys())
+        master.cancel(tag);
+    if (!tagRequests.isEmpty()) {
+        tagRequests.clear();
+        setControlsEnabled(true);
+    }
+
+    if (!tags.load(fileName)) {
+        QMessageBox::warning(this, tr("Load tags"), tags.errorString());
+        return;
+    }
+
+    tableTags->clearContents();
+    tableTags->setRowCount(tags.count());
+    for (int i = 0; i < tags.count(); i++) {
+        const MicontBusTag &t = tags.tag(i);
+        tableTags->setItem(i, 0, new QTableWidgetItem(t.name));
+        tableTags->setItem(i, 1, new QTableWidgetItem(QString("%1 %2:0x%3 %4")
+                                                     .arg(t.portName.isEmpty() ? "*" : t.portName)
+                                                     .arg(t.id)
+                                                     .arg(t.addr, 4, 16, QLatin1Char('0'))
+                                                     .arg(MicontBusTagDatabase::typeToString(t.type))));
+        tableTags->setItem(i, 2, new QTableWidgetItem);
+        tableTags->setItem(i, 3, new QTableWidgetItem);
+    }
+
+    labelStatus->setText(tr("%1 tags loaded").arg(tags.count()));
+}
+
 void Window::monitorClear()
 {
     master.statClear();
@@ -494,6 +764,19 @@ void Window::monitorClear()
     }
 }
 
+// Sniffer captures, searched in a dialog of their own.
+void Window::openCapture()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Open capture"), QString(),
+                                                    tr("Captures (*.mbc);;All files (*)"));
+    if (fileName.isEmpty())
+        return;
+
+    CaptureDialog *dialog = new CaptureDialog(fileName, this);
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+    dialog->show();
+}
+
 void Window::itemSwitchViewToUInt()
 {
     QTableWidgetItem *item = tableVariables->currentItem();
@@ -545,7 +828,7 @@ void Window::toggleWidgets(const QList<QWidget *> &widgets, bool show)
 
 void Window::setControlsEnabled(bool enable)
 {
-    pushQuery->setEnabled(enable);
+    pushQuery->setEnabled(enable && !frameSizeBus);
 }
 
 QString Window::bufferToString(const QByteArray &data, int start, int length)
@@ -644,6 +927,36 @@ void Window::logPacket(const MicontBusPacket &packet)
     updateStatistics();
 }
 
+void Window::doTagsTransaction()
+{
+    QString portName = comboPort->currentData().toString();
+    int plans = tags.compile(QStringList(), portName);
+    if (plans == 0) {
+        labelStatus->setText(tr("No tags for %1").arg(portName));
+        return;
+    }
+
+    setControlsEnabled(false);
+    labelStatus->setText(tr("Reading %1 tags in %2 frames...").arg(tags.count()).arg(plans));
+
+    for (int i = 0; i < plans; i++) {
+        quint32 tag = master.transaction(portName, comboSpeed->currentData().toInt(),
+                                         spinTimeout->value(), tags.planRequest(i));
+        tagRequests.insert(tag, i);
+    }
+}
+
+void Window::updateTagRows(int plan)
+{
+    const MicontBusTagDatabase::ReadPlan &p = tags.plan(plan);
+
+    foreach (const MicontBusTagDatabase::ReadPlan::Decode &d, p.decodes) {
+        const MicontBusTag &t = tags.tag(d.tag);
+        tableTags->item(d.tag, 2)->setText(QString::number(t.value));
+        tableTags->item(d.tag, 3)->setText(QString("0x%1").arg(t.raw, 8, 16, QLatin1Char('0')));
+    }
+}
+
 void Window::updateStatistics()
 {
     labelStatRxBytes->setText(QString::number(master.statRxBytes()));
@@ -653,4 +966,12 @@ void Window::updateStatistics()
     QString color = (master.statCrcErrors() != 0) ? "red" : "black";
     labelStatCrcErrors->setText("<font color=" + color + ">" + QString::number(master.statCrcErrors()) + "</font>");
     labelStatTimeouts->setText(QString::number(master.statTimeouts()));
+    labelStatRetries->setText(QString::number(master.statRetries()));
+
+    MicontBusLineReport line = master.lineReport(comboPort->currentData().toString(), 10);
+    labelStatLine->setText(tr("%1% wire, %2% turnaround, %3% timeouts, %4% idle")
+                           .arg(line.utilization * 100, 0, 'f', 1)
+                           .arg(line.turnaround * 100, 0, 'f', 1)
+                           .arg(line.timeouts * 100, 0, 'f', 1)
+                           .arg(line.idle * 100, 0, 'f', 1));
 }
@@ -5,6 +5,8 @@
 #include <QList>
 
 #include "micontbusmaster.h"
+#include "micontbustagdatabase.h"
+#include "micontbusframesizes.h"
 
 QT_BEGIN_NAMESPACE
 class QLabel;
@@ -32,12 +34,24 @@ class Window : public QMainWindow
     Q_OBJECT
 public:
     explicit Window(QWidget *parent = 0);
+    ~Window();
 
 private slots:
     void doTransaction();
-    void processResponse(const QByteArray &rawPacket);
+    void doScan();
+    void doFrameSize();
+    void processFrameSize(const QString &portName, quint8 id, int read, int write);
+    void processFrameSizeFailure(const QString &portName, quint8 id, const QString &s);
+    void updateSizeLimit();
+    void serialOptionsChanged();
+    void backendChanged();
+    void scanSlaveSelected(const QString &portName, int id);
+    void processResponse(const MicontBusResponse &response);
     void processError(const QString &s);
     void processTimeout(const QString &s);
+    void processSlaveState(const QString &portName, int id, bool up);
+    void processTagResponse(const MicontBusResponse &response);
+    void processTagFailure(quint32 tag, const QString &s);
     void addrChanged(int newAddr);
     void countChanged();
     void hexAddrChanged();
@@ -47,7 +61,10 @@ private slots:
     void monitorItemChanged(QTreeWidgetItem *current, QTreeWidgetItem *previous);
     void monitorContextMenu(const QPoint &);
     void editorContextMenu(const QPoint &p);
+    void tagsContextMenu(const QPoint &);
+    void loadTags();
     void monitorClear();
+    void openCapture();
     void itemSwitchViewToUInt();
     void itemSwitchViewToInt();
     void itemSwitchViewToFloat();
@@ -61,11 +78,17 @@ private:
     QString cmdToString(quint8 cmd);
     void logPacket(const MicontBusPacket &packet);
     void updateStatistics(void);
+    void doTagsTransaction();
+    void updateTagRows(int plan);
 
 private:
     // settings group
     QComboBox *comboPort;
     QComboBox *comboSpeed;
+    QComboBox *comboDataBits;
+    QComboBox *comboParity;
+    QComboBox *comboStopBits;
+    QComboBox *comboBackend;
     QSpinBox *spinTimeout;
 
     // micontbus query group
@@ -76,6 +99,8 @@ private:
     QSpinBox *spinSize;
     QComboBox *comboType;
     QPushButton *pushQuery;
+    QPushButton *pushScan;
+    QPushButton *pushFrameSize;
     QList<QWidget *> dataWidgets;
 
     // Variables editor
@@ -98,8 +123,18 @@ private:
     QLabel *labelStatTxPackets;
     QLabel *labelStatCrcErrors;
     QLabel *labelStatTimeouts;
+    QLabel *labelStatRetries;
+    QLabel *labelStatLine;
 
     MicontBusMaster master;
+
+    // tags editor backend, pending plan reads by transaction tag
+    MicontBusTagDatabase tags;
+    QHash<quint32, int> tagRequests;
+
+    // discovered frame size limits, the bus of a running discovery
+    MicontBusFrameSizes frameSizes;
+    MicontBusAsync *frameSizeBus;
 };
 
 #endif // WINDOW_H